@@ -0,0 +1,67 @@
+/* Compares the memory and evaluation speed of a tree with the arena it's stored in, on a sum of
+ * 5000 terms of the form c * x + y * c. The tree's memory is what glibc's heap grows by. Also
+ * times evaluating each of the 5000 terms, added to one arena as trees of their own, which takes
+ * as long as the single tree if evaluating a root only passes over its own nodes.
+ *
+ * Usage: bench_arena [repetitions] */
+
+#include "bench.h"
+
+#include "../mathop/algeblah.h"
+#include "../mathop/arena.h"
+
+#include <malloc.h>
+
+using namespace MathOps;
+
+/* Bytes allocated from the heap, as far as glibc knows */
+static size_t heap_in_use() { return mallinfo2().uordblks; }
+
+int main(int argc, char** argv)
+{
+    int repetitions = argc > 1 ? atoi(argv[1]) : 200;
+
+    auto x = Variable<number>::create("x", 1);
+    auto y = Variable<number>::create("y", 2);
+
+    size_t before = heap_in_use();
+    std::shared_ptr<MathOp<number>> tree = ConstantValue<number>::create(0);
+    for (int i = 0; i < 5000; i++)
+    {
+        auto c = ConstantValue<number>::create(i % 7 + 1);
+        tree = tree + (c * x + y * c);
+    }
+    size_t tree_memory = heap_in_use() - before;
+
+    Arena<number> arena;
+    uint32_t root = arena.add(tree);
+
+    std::cout << "memory:   " << tree_memory / 1e6 << " MB tree, " << arena.memory_usage() / 1e6 << " MB arena ("
+              << arena.size() << " nodes)\n";
+
+    /* Setting x invalidates the tree's cached results */
+    number value = 0;
+    double tree_ns = time_ns([&] { x->set(value += 1e-3); keep(tree->result()); }, repetitions);
+    double arena_ns = time_ns([&] { x->set(value += 1e-3); keep(arena.result(root)); }, repetitions);
+
+    std::cout << "evaluate: " << tree_ns / 1000 << " us tree, " << arena_ns / 1000 << " us arena ("
+              << tree_ns / arena_ns << "x)\n";
+
+    std::vector<std::shared_ptr<MathOp<number>>> terms;
+    std::vector<uint32_t> roots;
+    Arena<number> many;
+    for (int i = 0; i < 5000; i++)
+    {
+        auto c = ConstantValue<number>::create(i % 7 + 1);
+        terms.push_back(c * x + y * c);
+        roots.push_back(many.add(terms.back()));
+    }
+
+    tree_ns = time_ns([&] { x->set(value += 1e-3); for (auto& term: terms) keep(term->result()); }, repetitions);
+    arena_ns = time_ns([&] { x->set(value += 1e-3); for (auto root: roots) keep(many.result(root)); }, repetitions);
+
+    std::cout << "roots:    " << tree_ns / 1000 << " us trees, " << arena_ns / 1000 << " us arena ("
+              << tree_ns / arena_ns << "x)\n";
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,73 @@
+/* Times evaluating a program row by row against evaluating it in one batch, on a 50-term
+ * expression in x and y over 100k rows, with and without a sin() in every term, in double and
+ * in long double (or in MPFR, in the arbitrary precision build).
+ *
+ * Usage: bench_batch [rows] */
+
+#include "bench.h"
+
+#include "../mathop/algeblah.h"
+#include "../mathop/program.h"
+
+#include <string>
+#include <vector>
+
+using namespace MathOps;
+
+template<typename T>
+void run(const std::string& type, size_t rows)
+{
+    auto x = Variable<T>::create("x", 1);
+    auto y = Variable<T>::create("y", 2);
+
+    std::vector<T> xs(rows), ys(rows), out(rows);
+    for (size_t k = 0; k < rows; k++)
+    {
+        xs[k] = T(k) / rows;
+        ys[k] = 1 - T(k) / rows;
+    }
+
+    for (bool with_sin: { false, true })
+    {
+        std::shared_ptr<MathOp<T>> tree = ConstantValue<T>::create(0);
+        for (int i = 0; i < 50; i++)
+        {
+            auto c = ConstantValue<T>::create(i + 1);
+            std::shared_ptr<MathOp<T>> term = c * x * y + x / c;
+            tree = tree + (with_sin ? sin(term) : term);
+        }
+
+        Program<T> program(tree);
+
+        double row_ns = time_ns([&]
+        {
+            for (size_t k = 0; k < rows; k++)
+            {
+                x->set(xs[k]);
+                y->set(ys[k]);
+                out[k] = program.result();
+            }
+        }, 1) / rows;
+        keep(out[rows / 2]);
+
+        double batch_ns = time_ns([&] { program.results({ x, y }, { xs.data(), ys.data() }, out.data(), rows); }, 1) / rows;
+        keep(out[rows / 2]);
+
+        std::cout << type << (with_sin ? " + sin: " : ":       ") << row_ns << " -> " << batch_ns << " ns/row ("
+                  << row_ns / batch_ns << "x)\n";
+    }
+}
+
+int main(int argc, char** argv)
+{
+    size_t rows = argc > 1 ? atol(argv[1]) : 100000;
+
+#ifdef ARBIT_PREC
+    run<number>("mpfr       ", rows);
+#else
+    run<double>("double     ", rows);
+    run<long double>("long double", rows);
+#endif
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,36 @@
+#ifndef BENCH_H
+#define BENCH_H
+
+#include "../config.h"
+#include "../defaulthelper.h"
+
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+
+/* Average time of one call to f, in nanoseconds, over the given number of calls */
+template<typename F>
+double time_ns(F f, int repetitions)
+{
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < repetitions; i++)
+    {
+        f();
+    }
+    auto end = std::chrono::steady_clock::now();
+
+    return std::chrono::duration<double, std::nano>(end - start).count() / repetitions;
+}
+
+/* Stops the compiler from optimising away a result that's never used */
+template<typename T>
+void keep(const T& value)
+{
+    static volatile bool never = false;
+    if (never)
+    {
+        std::cout << value;
+    }
+}
+
+#endif /* BENCH_H */
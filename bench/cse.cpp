@@ -0,0 +1,58 @@
+/* Times two trees that each hold three copies of sin(x) * log(y + 3) - cos(x), compiled into a
+ * program each and into one program together, batched over 100k rows. Each program computes
+ * the copies in it once; only the joint one shares them between the trees.
+ *
+ * Usage: bench_cse [rows] */
+
+#include "bench.h"
+
+#include "../mathop/algeblah.h"
+#include "../mathop/program.h"
+
+#include <vector>
+
+using namespace MathOps;
+
+typedef std::shared_ptr<MathOp<number>> Op;
+
+int main(int argc, char** argv)
+{
+    size_t rows = argc > 1 ? atol(argv[1]) : 100000;
+
+    Op x = Variable<number>::create("x", 0.5);
+    Op y = Variable<number>::create("y", 2);
+    auto copy = [&]() -> Op { return sin(x) * log(y + ConstantValue<number>::create(3)) - cos(x); };
+
+    std::vector<Op> trees { copy() + copy() * x + copy() * y, copy() * copy() - copy() };
+
+    std::vector<number> xs(rows), ys(rows);
+    for (size_t k = 0; k < rows; k++)
+    {
+        xs[k] = number(k) / rows;
+        ys[k] = 1 - number(k) / rows;
+    }
+
+    std::vector<std::vector<number>> outs(trees.size(), std::vector<number>(rows));
+    std::vector<std::shared_ptr<Value<number>>> values {
+        std::dynamic_pointer_cast<Value<number>>(x), std::dynamic_pointer_cast<Value<number>>(y) };
+
+    Program<number> first(trees[0]), second(trees[1]);
+    double separate_ns = time_ns([&]
+    {
+        first.results(values, { xs.data(), ys.data() }, outs[0].data(), rows);
+        second.results(values, { xs.data(), ys.data() }, outs[1].data(), rows);
+    }, 1) / rows;
+
+    Program<number> together(trees);
+    double together_ns = time_ns([&]
+    {
+        together.results(values, { xs.data(), ys.data() }, { outs[0].data(), outs[1].data() }, rows);
+    }, 1) / rows;
+    keep(outs[1][rows / 2]);
+
+    std::cout << "separate: " << first.get_code().size() + second.get_code().size() << " instructions, "
+              << separate_ns << " ns/row\n"
+              << "together: " << together.get_code().size() << " instructions, " << together_ns << " ns/row\n";
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,69 @@
+/* Times evaluating, finding x in, counting the variables of, constant folding and freeing trees of
+ * two shapes: deep chains that alternate x * x and + 1, which are walked from loops below a depth
+ * of 256, and balanced (wide) sums of x, which are shallow enough to be walked recursively.
+ *
+ * Usage: bench_deep [repetitions] */
+
+#include "bench.h"
+
+#include "../mathop/algeblah.h"
+#include "../mathop/constantfoldtransformer.h"
+#include "../mathop/finder.h"
+#include "../mathop/namedvaluecounter.h"
+
+#include <functional>
+#include <string>
+
+using namespace MathOps;
+
+typedef std::shared_ptr<MathOp<number>> Op;
+
+static Op deep(const std::shared_ptr<Variable<number>>& x, size_t n)
+{
+    Op tree = x;
+    for (size_t i = 1; i < n; i++)
+    {
+        tree = i % 2 ? tree * x : tree + ConstantValue<number>::create(1);
+    }
+
+    return tree;
+}
+
+static Op wide(const std::shared_ptr<Variable<number>>& x, int depth)
+{
+    return depth ? wide(x, depth - 1) + wide(x, depth - 1) : Op(x);
+}
+
+static void run(const std::string& name, std::function<Op()> build, std::shared_ptr<Variable<number>> x, int repetitions)
+{
+    Op tree = build();
+
+    number value = 0;
+    double eval_ns = time_ns([&] { x->set(value += 1e-3); keep(tree->result()); }, repetitions);
+    double find_ns = time_ns([&] { keep(tree->count(Finder<number>(x))); }, repetitions);
+    double count_ns = time_ns([&] { keep(tree->count(NamedValueCounter<number>("x"))); }, repetitions);
+    double fold_ns = time_ns([&] { keep(tree->transform(ConstantFoldTransformer<number>())); }, repetitions);
+    double free_ns = time_ns([&] { tree.reset(); }, 1);
+
+    std::cout << name << ": eval " << eval_ns / 1000 << " us, find " << find_ns / 1000 << " us, count "
+              << count_ns / 1000 << " us, fold " << fold_ns / 1000 << " us, free " << free_ns / 1000 << " us\n";
+}
+
+int main(int argc, char** argv)
+{
+    int repetitions = argc > 1 ? atoi(argv[1]) : 10;
+
+    auto x = Variable<number>::create("x", 1);
+
+    for (size_t n: { 10000, 100000, 1000000 })
+    {
+        run("deep " + std::to_string(n), [&] { return deep(x, n); }, x, repetitions);
+    }
+
+    for (int depth: { 13, 19 })
+    {
+        run("wide 2^" + std::to_string(depth), [&] { return wide(x, depth); }, x, repetitions);
+    }
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,38 @@
+/* Times a chain of 10k additions and subtractions against the Sum it's flattened into, after a
+ * change of x every time, and how long flattening takes.
+ *
+ * Usage: bench_flatten [repetitions] */
+
+#include "bench.h"
+
+#include "../mathop/algeblah.h"
+#include "../mathop/flattentransformer.h"
+
+using namespace MathOps;
+
+int main(int argc, char** argv)
+{
+    int repetitions = argc > 1 ? atoi(argv[1]) : 200;
+
+    auto x = Variable<number>::create("x", 1);
+    auto y = Variable<number>::create("y", 2);
+    auto z = Variable<number>::create("z", 3);
+
+    std::shared_ptr<MathOp<number>> chain = x;
+    for (int i = 0; i < 10000; i++)
+    {
+        chain = i % 2 ? chain + y : chain - z;
+    }
+
+    std::shared_ptr<MathOp<number>> flat;
+    double flatten_ns = time_ns([&] { flat = FlattenTransformer<number>().flatten(chain); }, 1);
+
+    number value = 0;
+    double chain_ns = time_ns([&] { x->set(value += 1); keep(chain->result()); }, repetitions);
+    double flat_ns = time_ns([&] { x->set(value += 1); keep(flat->result()); }, repetitions);
+
+    std::cout << "chain " << chain_ns / 1000 << " us, sum " << flat_ns / 1000 << " us, flattening "
+              << flatten_ns / 1e6 << " ms once\n";
+
+    return EXIT_SUCCESS;
+}
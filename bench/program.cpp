@@ -0,0 +1,75 @@
+/* Times a tree against the program it compiles to, on a sum of 2000 lambdas of the form
+ * c * x + y / c - x * y, with and without an extra sin() in each, and on the same lambdas
+ * compiled together as 2000 trees, each of which is read after every change.
+ *
+ * Usage: bench_program [repetitions] */
+
+#include "bench.h"
+
+#include "../mathop/algeblah.h"
+#include "../mathop/program.h"
+
+#include <string>
+#include <vector>
+
+using namespace MathOps;
+
+int main(int argc, char** argv)
+{
+    int repetitions = argc > 1 ? atoi(argv[1]) : 200;
+
+    auto x = Variable<number>::create("x", 1);
+    auto y = Variable<number>::create("y", 2);
+
+    for (bool with_sin: { false, true })
+    {
+        std::shared_ptr<MathOp<number>> tree = ConstantValue<number>::create(0);
+        std::vector<std::shared_ptr<MathOp<number>>> lambdas;
+        for (int i = 0; i < 2000; i++)
+        {
+            auto c = ConstantValue<number>::create(i + 1);
+            std::shared_ptr<MathOp<number>> lambda = c * x + y / c - x * y;
+            if (with_sin)
+            {
+                lambda = lambda + sin(c * x);
+            }
+
+            lambdas.push_back(Container<number>::create(lambda, "f" + std::to_string(i)));
+            tree = tree + lambdas.back();
+        }
+
+        Program<number> program(tree);
+
+        /* Setting x invalidates the tree's cached results */
+        number value = 0;
+        double tree_ns = time_ns([&] { x->set(value += 1e-3); keep(tree->result()); }, repetitions);
+        double program_ns = time_ns([&] { x->set(value += 1e-3); keep(program.result()); }, repetitions);
+
+        std::cout << (with_sin ? "with sin(): " : "without:    ") << "tree " << tree_ns / 1e6 << " ms, program "
+                  << program_ns / 1e6 << " ms (" << tree_ns / program_ns << "x)\n";
+
+        /* One evaluation of the program, after which every result is read */
+        Program<number> all(lambdas);
+        double trees_ns = time_ns([&]
+        {
+            x->set(value += 1e-3);
+            for (auto& lambda: lambdas)
+            {
+                keep(lambda->result());
+            }
+        }, repetitions);
+        double all_ns = time_ns([&]
+        {
+            x->set(value += 1e-3);
+            for (size_t i = 0; i < lambdas.size(); i++)
+            {
+                keep(all.result(i));
+            }
+        }, repetitions);
+
+        std::cout << "  every tree: tree " << trees_ns / 1e6 << " ms, program " << all_ns / 1e6 << " ms ("
+                  << trees_ns / all_ns << "x)\n";
+    }
+
+    return EXIT_SUCCESS;
+}
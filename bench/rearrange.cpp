@@ -0,0 +1,56 @@
+/* Times how long it takes to find every solution of an equation with many branches (each square,
+ * sine and cosine has more than one reverse), with thread pools of increasing size. The solutions
+ * are found in the same order every time, so the count is printed to check they're all found.
+ *
+ * Once a thread has been started, reference counts are updated atomically for the rest of the
+ * process, which makes everything slower, whether branches are forked or not. So the pool without
+ * workers is timed both first and last.
+ *
+ * Usage: bench_rearrange [repetitions] */
+
+#include "../config.h"
+#include "../defaulthelper.h"
+
+#include "../mathop/algeblah.h"
+#include "../mathop/rearrangemultitransformer.h"
+
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+
+using namespace MathOps;
+
+int main(int argc, char** argv)
+{
+    int repetitions = argc > 1 ? atoi(argv[1]) : 20;
+
+    auto x = Variable<number>::create("x", 0.5);
+    auto c = [](number value) { return ConstantValue<number>::create(value); };
+
+    /* Every level doubles the number of branches */
+    std::shared_ptr<MathOp<number>> equation = x;
+    for (int i = 0; i < 4; i++)
+    {
+        equation = sin(cos(equation * equation + c(i)) * c(3)) * c(5) - c(1) / (equation * equation + c(2));
+    }
+
+    auto from = c(0.25);
+
+    for (unsigned workers: { 0, 1, 2, 4, 8, 0 })
+    {
+        ThreadPool pool(workers);
+
+        size_t solutions = 0;
+        auto start = std::chrono::steady_clock::now();
+        for (int i = 0; i < repetitions; i++)
+        {
+            solutions = equation->multi_transform(RearrangeMultiTransformer<number>(x, from, &pool)).size();
+        }
+        auto end = std::chrono::steady_clock::now();
+
+        std::cout << workers << " workers: " << solutions << " solutions, "
+                  << std::chrono::duration_cast<std::chrono::microseconds>(end - start).count() / repetitions << " us\n";
+    }
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,41 @@
+/* Times a tree made of shapes the simplifier rewrites, such as sqrt(a) ^ 2, log(%e ^ a),
+ * (a / b) * b and a ^ 2, against its simplified form, after a change of x every time.
+ *
+ * Usage: bench_simplifier [repetitions] */
+
+#include "bench.h"
+
+#include "../mathop/algeblah.h"
+#include "../mathop/constants.h"
+#include "../mathop/defaultformatter.h"
+#include "../mathop/simplifier.h"
+
+using namespace MathOps;
+
+typedef std::shared_ptr<MathOp<number>> Op;
+
+int main(int argc, char** argv)
+{
+    int repetitions = argc > 1 ? atoi(argv[1]) : 200000;
+
+    auto variable = Variable<number>::create("x", 1);
+    Op x = variable;
+    Op two = ConstantValue<number>::create(2);
+    Op three = ConstantValue<number>::create(3);
+
+    Op square = x * x + two;
+    Op s = sin(x);
+    Op tree = pow(sqrt(square), two) + log(pow(Constants::e<number>(), s)) + s / three * three
+            + pow(cos(x) + three, two) - asinh(sinh(s)) * tanh(atanh(s / three));
+    Op simple = Simplifier<number>().simplify(tree);
+
+    std::cout << tree->format(DefaultFormatter<number>(5)) << "\n -> " << simple->format(DefaultFormatter<number>(5)) << "\n";
+
+    number value = 0;
+    double tree_ns = time_ns([&] { variable->set(value += 1e-3); keep(tree->result()); }, repetitions);
+    double simple_ns = time_ns([&] { variable->set(value += 1e-3); keep(simple->result()); }, repetitions);
+
+    std::cout << "tree " << tree_ns << " ns, simplified " << simple_ns << " ns (" << tree_ns / simple_ns << "x)\n";
+
+    return EXIT_SUCCESS;
+}
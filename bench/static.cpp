@@ -0,0 +1,49 @@
+/* Times x ^ 2 + sin(y) * x / 3 as a tree, as a program and as an expression template, after a
+ * change of x every time, in double and in long double (or in MPFR, in the arbitrary precision
+ * build).
+ *
+ * Usage: bench_static [repetitions] */
+
+#include "bench.h"
+
+#include "../mathop/algeblah.h"
+#include "../mathop/program.h"
+#include "../mathop/staticop.h"
+
+#include <string>
+
+using namespace MathOps;
+
+template<typename T>
+void run(const std::string& type, int repetitions)
+{
+    auto x = Variable<T>::create("x", 1);
+    auto y = Variable<T>::create("y", 2);
+
+    auto expression = pow(static_arg<0>, 2) + sin(static_arg<1>) * static_arg<0> / 3;
+    auto tree = to_math_op<T>(expression, { x, y });
+    Program<T> program(tree);
+
+    T value = 0;
+    T total = 0;
+    double tree_ns = time_ns([&] { x->set(value += 1e-3); total += tree->result(); }, repetitions);
+    double program_ns = time_ns([&] { x->set(value += 1e-3); total += program.result(); }, repetitions);
+    double static_ns = time_ns([&] { value += 1e-3; total += expression(value, T(2)); }, repetitions);
+    keep(total);
+
+    std::cout << type << ": tree " << tree_ns << ", program " << program_ns << ", static " << static_ns << " ns\n";
+}
+
+int main(int argc, char** argv)
+{
+    int repetitions = argc > 1 ? atoi(argv[1]) : 1000000;
+
+#ifdef ARBIT_PREC
+    run<number>("mpfr       ", repetitions);
+#else
+    run<double>("double     ", repetitions);
+    run<long double>("long double", repetitions);
+#endif
+
+    return EXIT_SUCCESS;
+}
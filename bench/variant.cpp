@@ -0,0 +1,70 @@
+/* Times the traversals that were ported to the std::variant representation against the MathOp
+ * visitors they replace, on a sum of 50 random subtrees that are up to 8 operations deep, which
+ * don't share operations. Evaluation is also timed on x doubled 32 times over, with each sum
+ * using the one before it twice, which only stays fast if shared operations are walked once.
+ *
+ * Usage: bench_variant [repetitions] */
+
+#include "bench.h"
+#include "../tests/randomtree.h"
+
+#include "../mathop/defaultformatter.h"
+#include "../mathop/finder.h"
+#include "../mathop/namedvaluecounter.h"
+#include "../mathop/variantop.h"
+
+using namespace MathOps;
+
+int main(int argc, char** argv)
+{
+    int repetitions = argc > 1 ? atoi(argv[1]) : 2000;
+
+    RandomTree<number> random(1, false);
+    std::shared_ptr<MathOp<number>> tree = random(8);
+    for (int i = 1; i < 50; i++)
+    {
+        tree = tree + random(8);
+    }
+
+    auto variant = to_variant(tree);
+    number x = 0;
+
+    std::cout << tree->format(DefaultFormatter<number>(5)).size() << " characters formatted\n";
+
+    /* Setting the variables invalidates the tree's cached results, other than those of constant
+     * subtrees, which the variant tree has the values of as well */
+    auto set = [&] { x += 1e-3; random.x->set(x); random.y->set(x); random.z->set(x); };
+    double tree_ns = time_ns([&] { set(); keep(tree->result()); }, repetitions);
+    double variant_ns = time_ns([&] { set(); keep(evaluate(*variant)); }, repetitions);
+    std::cout << "evaluate " << tree_ns / 1000 << " -> " << variant_ns / 1000 << " us\n";
+
+    tree_ns = time_ns([&] { keep(tree->count(Finder<number>(random.x))); }, repetitions);
+    variant_ns = time_ns([&] { keep(find<number>(*variant, random.x)); }, repetitions);
+    std::cout << "find     " << tree_ns / 1000 << " -> " << variant_ns / 1000 << " us\n";
+
+    tree_ns = time_ns([&] { NamedValueCounter<number> counter("y"); keep(tree->count(counter)); }, repetitions);
+    variant_ns = time_ns([&]
+    {
+        std::vector<std::shared_ptr<Value<number>>> found;
+        named_values(*variant, "y", found);
+        keep(found.size());
+    }, repetitions);
+    std::cout << "named    " << tree_ns / 1000 << " -> " << variant_ns / 1000 << " us\n";
+
+    tree_ns = time_ns([&] { keep(tree->format(DefaultFormatter<number>(5)).size()); }, repetitions);
+    variant_ns = time_ns([&] { keep(VariantFormatter<number>(5).format(*variant).size()); }, repetitions);
+    std::cout << "format   " << tree_ns / 1000 << " -> " << variant_ns / 1000 << " us\n";
+
+    std::shared_ptr<MathOp<number>> doubled = random.x;
+    for (int i = 0; i < 32; i++)
+    {
+        doubled = doubled + doubled;
+    }
+
+    auto doubled_variant = to_variant(doubled);
+    tree_ns = time_ns([&] { set(); keep(doubled->result()); }, repetitions);
+    variant_ns = time_ns([&] { set(); keep(evaluate(*doubled_variant)); }, repetitions);
+    std::cout << "shared   " << tree_ns / 1000 << " -> " << variant_ns / 1000 << " us\n";
+
+    return EXIT_SUCCESS;
+}
@@ -6,19 +6,33 @@
 #include <sys/wait.h>
 #include <functional>
 #include <limits>
+#include <future>
 
 #include "driver.h"
 #include "parser.h"
 #include "mathop/containercounter.h"
 #include "mathop/rearrangemultitransformer.h"
 #include "mathop/expandtransformer.h"
+#include "mathop/constantfoldtransformer.h"
+#include "mathop/interner.h"
+#include "mathop/transformpipeline.h"
+#include "mathop/simplifier.h"
+#include "mathop/flattentransformer.h"
+#include "mathop/polynomialtransformer.h"
 #include "mathop/namedvaluecounter.h"
 #include "mathop/defaultformatter.h"
 #include "mathop/finder.h"
 #include "mathop/texformatter.h"
 #include "mathop/constants.h"
+#include "mathop/newtonsolver.h"
 #include "usefulfraction.h"
 
+/* The thread that solves takes part as well */
+static unsigned solver_workers(int threads)
+{
+    return threads > 1 ? threads - 1 : 0;
+}
+
 driver::driver(options opt)
     : trace_parsing(false), trace_scanning(false),
       opt(opt),
@@ -26,10 +40,28 @@ driver::driver(options opt)
       ans(MathOps::Variable<number>::create("ans", 0)),
 #ifdef ARBIT_PREC
       precision(MathOps::Variable<number>::create("precision", opt.precision)),
-      variables({precision, digits, ans})
+      variables({precision, digits, ans}),
 #else
-      variables({digits, ans})
+      variables({digits, ans}),
 #endif
+      pool(solver_workers(opt.threads), [this] { set_thread_precision(); })
+{
+    set_thread_precision();
+}
+
+/* Whether numbers are precise enough for each operation to cost more than handing it to another
+ * thread. Below that, solving only forks large subtrees, and doesn't evaluate on the pool. */
+bool driver::high_precision()
+{
+#ifdef ARBIT_PREC
+    return precision->result() >= 500;
+#else
+    return false;
+#endif
+}
+
+/* Also run before every solving task, so tasks run at the current precision */
+void driver::set_thread_precision()
 {
 #ifdef ARBIT_PREC
     boost::multiprecision::mpfr_float::default_precision((int) precision->result());
@@ -98,6 +130,8 @@ void driver::clear_variables()
 {
     variables.clear();
     lambdas.clear();
+    lambda_interner.collect();
+    clear_solve_plans();
     plot_equations.clear();
 #ifdef ARBIT_PREC
     variables.insert(variables.end(), { precision, digits, ans });
@@ -117,6 +151,8 @@ void driver::help()
                  "                                  Example: c => expand(c)\n"
                  "  Solve for a variable         : solve <variable name>: <expression> = <expession>\n"
                  "                                  Example: solve a: a^2 + b^2 = c^2\n"
+                 "                                  If the variable can't be isolated, it is solved for\n"
+                 "                                  numerically, starting at its current value\n"
                  "  Convert expression to value  : value(<expression>)\n"
                  "                                  Example: some_lambda => 2 * value(anoter_lambda)\n"
 #ifdef GNUPLOT
@@ -172,50 +208,239 @@ void driver::warranty()
                  "\n";
 }
 
-std::vector<std::shared_ptr<MathOps::MathOp<number>>> driver::find_solutions(
+/* Pass the solutions of the plan's equation to found, in order, along with their simplified forms,
+ * whether they're viable at the current values or not, until found returns false. Returns whether
+ * every solution was found. */
+bool driver::find_solutions(const SolvePlan& plan,
+    const std::function<bool(const std::shared_ptr<MathOps::MathOp<number>>&,
+                             const std::shared_ptr<MathOps::MathOp<number>>&)>& found)
+{
+    /* Intern both sides and all solutions, so identical subtrees are only stored once */
+    MathOps::Interner<number> interner;
+
+    // XXX: Should we always expand the entire tree before solving?
+    MathOps::TransformPipeline<number> expand(true);
+    expand.then("intern", interner);
+
+    auto solve_side  = expand.run(plan.solve_side);
+    auto result_side = expand.run(plan.result_side);
+
+    /* Simplified in strict mode, as the plan is used for other values as well. Polynomials aren't
+     * put in Horner form, as that can hide an overflow that makes a solution NaN. */
+    MathOps::Simplifier<number> simplifier;
+    MathOps::FlattenTransformer<number> flatten;
+
+    bool complete = true;
+    solve_side->multi_transform(MathOps::RearrangeMultiTransformer<number>(plan.solve_for, result_side,
+        [&](auto& solution)
+        {
+            auto interned = interner.intern(solution);
+            auto flattened = flatten.flatten(simplifier.simplify(interned));
+            return complete = found(interned, interner.intern(flattened));
+        }, &pool, true, high_precision() ? 8 : MathOps::RearrangeMultiTransformer<number>::default_fork_size));
+
+    return complete;
+}
+
+/* The first count viable solutions (or all of them, if count is 0). Solutions are only looked for
+ * until enough of them are viable, and the plan keeps those that were looked at. */
+std::vector<std::shared_ptr<MathOps::MathOp<number>>> driver::viable_solutions(SolvePlan& plan, size_t count)
+{
+    if (!count)
+    {
+        if (!plan.complete)
+        {
+            plan.solutions.clear();
+            plan.evaluation_forms.clear();
+            plan.complete = find_solutions(plan, [&](auto& solution, auto& form)
+            {
+                plan.solutions.push_back(solution);
+                plan.evaluation_forms.push_back(form);
+                return true;
+            });
+        }
+
+        return viable_solutions(plan.solutions, plan.evaluation_forms);
+    }
+
+    std::vector<std::shared_ptr<MathOps::MathOp<number>>> viable;
+    for (size_t i = 0; i < plan.solutions.size() && viable.size() < count; i++)
+    {
+        if (!MathOps::isnan(plan.evaluation_forms[i]->result()))
+        {
+            viable.push_back(plan.solutions[i]);
+        }
+    }
+
+    if (plan.complete || viable.size() == count)
+    {
+        return viable;
+    }
+
+    /* Look again, from the start, until enough of them are viable */
+    plan.solutions.clear();
+    plan.evaluation_forms.clear();
+    viable.clear();
+    plan.complete = find_solutions(plan, [&](auto& solution, auto& form)
+    {
+        plan.solutions.push_back(solution);
+        plan.evaluation_forms.push_back(form);
+        if (!MathOps::isnan(form->result()))
+        {
+            viable.push_back(solution);
+        }
+
+        return viable.size() < count;
+    });
+
+    return viable;
+}
+
+/* Evaluate the solutions through their evaluation forms (on the pool, if there's more than one,
+ * and they're costly enough to evaluate), and keep the viable ones */
+std::vector<std::shared_ptr<MathOps::MathOp<number>>> driver::viable_solutions(
+    const std::vector<std::shared_ptr<MathOps::MathOp<number>>>& solutions,
+    const std::vector<std::shared_ptr<MathOps::MathOp<number>>>& evaluation_forms)
+{
+    std::vector<number> results;
+    if (pool.size() && solutions.size() > 1 && high_precision())
+    {
+        MathOps::MathOp<number>::Concurrent concurrent;
+
+        std::vector<std::future<number>> evaluated;
+        for (auto& form: evaluation_forms)
+        {
+            evaluated.push_back(pool.submit([form] { return form->result(); }));
+        }
+
+        for (auto& result: evaluated)
+        {
+            results.push_back(pool.wait(result));
+        }
+    }
+    else
+    {
+        for (auto& form: evaluation_forms)
+        {
+            results.push_back(form->result());
+        }
+    }
+
+    std::vector<std::shared_ptr<MathOps::MathOp<number>>> viable;
+    for (size_t i = 0; i < solutions.size(); i++)
+    {
+        if (!MathOps::isnan(results[i]))
+        {
+            viable.push_back(solutions[i]);
+        }
+    }
+
+    return viable;
+}
+
+std::vector<std::shared_ptr<MathOps::MathOp<number>>> driver::find_numeric_solutions(
     std::shared_ptr<MathOps::MathOp<number>> lhs,
     std::shared_ptr<MathOps::MathOp<number>> rhs,
-    const std::shared_ptr<MathOps::Value<number>> &solve_for,
-    bool solve_from_left)
+    const std::shared_ptr<MathOps::Value<number>> &solve_for)
 {
-    // XXX: Should we always expand the entire tree before solving?
-    auto solve_side  = (solve_from_left ? lhs : rhs)->transform(MathOps::ExpandTransformer<number>());
-    auto result_side = (solve_from_left ? rhs : lhs)->transform(MathOps::ExpandTransformer<number>());
-    auto solutions = solve_side->multi_transform(MathOps::RearrangeMultiTransformer<number>(solve_for, result_side));
+    MathOps::NewtonSolver<number> solver(lhs - rhs, solve_for);
+
+    /* Start at the variable's current value first, so it can be used to pick a root */
+    auto roots = solver.solve({ solve_for->result(), 0, 1, -1, 10, -10, 100, -100 });
 
-    /* Remove non-viable solutions */
-    solutions.erase(std::remove_if(solutions.begin(), solutions.end(), [](auto& x) { 
-        return isnan(x->result());
-    }), solutions.end());
+    std::vector<std::shared_ptr<MathOps::MathOp<number>>> solutions;
+    for (auto& root: roots)
+    {
+        solutions.push_back(MathOps::ConstantValue<number>::create(root));
+    }
 
     return solutions;
 }
 
-std::shared_ptr<MathOps::MathOp<number>> driver::solve(std::shared_ptr<MathOps::MathOp<number>> lhs,
-                                              std::shared_ptr<MathOps::MathOp<number>> rhs,
-                                              const std::string& variable, number index)
+/* Solving the same equation for the same variable again (e.g. for other values of the variables
+ * in it) reuses the solutions that were found the first time. Equations are compared by their
+ * interned sides, so equations that are parsed again are found as well. */
+driver::SolvePlan& driver::solve_plan(std::shared_ptr<MathOps::MathOp<number>> lhs,
+                                            std::shared_ptr<MathOps::MathOp<number>> rhs,
+                                            const std::string& variable)
 {
+    lhs = plan_interner.intern(lhs);
+    rhs = plan_interner.intern(rhs);
+
+    auto key = std::make_tuple(lhs.get(), rhs.get(), variable);
+    auto it = solve_plans.find(key);
+    if (it != solve_plans.end())
+    {
+        return it->second;
+    }
+
     MathOps::NamedValueCounter<number> counter(variable);
     int left_count = lhs->count(counter);
     rhs->count(counter);
     auto& variables = counter.get_results();
 
-    if ((int) index != index)
+    if (variables.size() == 0)
     {
-        throw yy::parser::syntax_error(location, "Index should be an integer value");        
+        throw yy::parser::syntax_error(location, "variable " + variable + " appears on neither left or right side");        
     }
 
-    if (variables.size() == 0)
+    if (std::any_of(variables.begin(), variables.end(), [&](auto& x) { return x != variables[0]; }))
     {
-        throw yy::parser::syntax_error(location, "variable " + variable + " appears on neither left or right side");        
+        throw yy::parser::syntax_error(location, "variable " + variable + " refers to more than one value");
     }
 
+    /* Solutions are looked for when they're needed. If the variable appears more than once, the
+     * equation can still be rearranged if it's a polynomial in which the variable only appears
+     * once in Horner form (e.g. 3 * x - x / 2 = 5, or x * y = x + y). Otherwise, it's found
+     * numerically, and there's nothing to look for. */
+    SolvePlan plan { lhs, rhs, variables[0], left_count > 0 ? lhs : rhs, left_count > 0 ? rhs : lhs, { }, { }, false };
     if (variables.size() > 1)
     {
-        throw yy::parser::syntax_error(location, "variable " + variable + " appears more than once");        
+        auto sides = MathOps::PolynomialTransformer<number>().separated(lhs->transform(MathOps::ExpandTransformer<number>()),
+            rhs->transform(MathOps::ExpandTransformer<number>()), variables[0]);
+
+        plan.complete = !sides.first || sides.first->count(MathOps::Finder<number>(variables[0])) != 1 ||
+            sides.second->count(MathOps::Finder<number>(variables[0])) != 0;
+        if (!plan.complete)
+        {
+            plan.solve_side = sides.first;
+            plan.result_side = sides.second;
+        }
+    }
+
+    if (solve_plans.size() >= max_solve_plans)
+    {
+        clear_solve_plans();
+    }
+
+    return solve_plans.emplace(key, plan).first->second;
+}
+
+void driver::clear_solve_plans()
+{
+    solve_plans.clear();
+    plan_interner.collect();
+}
+
+std::shared_ptr<MathOps::MathOp<number>> driver::solve(std::shared_ptr<MathOps::MathOp<number>> lhs,
+                                              std::shared_ptr<MathOps::MathOp<number>> rhs,
+                                              const std::string& variable, number index)
+{
+    if ((int) index != index)
+    {
+        throw yy::parser::syntax_error(location, "Index should be an integer value");        
+    }
+
+    auto& plan = solve_plan(lhs, rhs, variable);
+
+    /* Given an index, solutions are only looked for up to that one. If the variable can't be
+     * isolated, or none of the solutions are viable, roots are found numerically. */
+    auto solutions = viable_solutions(plan, index >= 0 ? (size_t) index + 1 : 0);
+    if (solutions.size() == 0)
+    {
+        solutions = find_numeric_solutions(lhs, rhs, plan.solve_for);
     }
 
-    auto solutions = find_solutions(lhs, rhs, variables[0], left_count > 0);
     if (solutions.size() == 0)
     {
         throw yy::parser::syntax_error(location, "No solutions found");
@@ -242,7 +467,7 @@ std::shared_ptr<MathOps::MathOp<number>> driver::solve(std::shared_ptr<MathOps::
         std::cout << "         Selecting solution 0. (Use \"solve " << variable << ", <index>: ...\" to override)\n";
     }
 
-    variables[0]->set(solutions[idx]->result());
+    plan.solve_for->set(solutions[idx]->result());
 
     return solutions[idx];
 }
@@ -291,7 +516,7 @@ void driver::plot(const std::string& variable,
 
     auto v = get_var(variable);
 
-    gp.plot(equations, v, from, to, step, (int) digits->result());
+    gp.plot(equations, v, from, to, step, (int) digits->result(), opt.use_jit);
     plot_variable = variable;
     plot_equations = equations;
     plot_args = args;
@@ -369,6 +594,15 @@ std::shared_ptr<MathOps::MathOp<number>> driver::assign(const std::string& varia
 
         boost::multiprecision::mpfr_float::default_precision((int) result);
         precision->set((int) result);
+        MathOps::MathOp<number>::invalidate_all();
+
+        /* Re-fold the lambdas at the new precision */
+        for (auto lambda: lambdas)
+        {
+            lambda->set_inner(lambda->get_inner(), evaluation_form(lambda->get_inner()));
+        }
+        lambda_interner.collect();
+        clear_solve_plans();
 
         return precision;
     }
@@ -386,6 +620,7 @@ std::shared_ptr<MathOps::MathOp<number>> driver::assign(const std::string& varia
         }
 
         remove(lambdas, l);
+        clear_solve_plans();
     }
 
     auto v = get_var(variable);
@@ -431,19 +666,40 @@ std::shared_ptr<MathOps::MathOp<number>> driver::assign_lambda(const std::string
         remove(variables, v);
     }
     
+    auto evaluated = evaluation_form(op);
+
     if (!l)
     {
-        l = MathOps::Container<number>::create(op, variable);
+        l = MathOps::Container<number>::create(op, variable, evaluated);
         lambdas.push_back(l);
 
         return l;
     }
 
-    l->set_inner(op);
+    l->set_inner(op, evaluated);
+    lambda_interner.collect();
+    clear_solve_plans();
 
     return l;
 }
 
+/* Lambdas are evaluated through a constant folded and (strictly) simplified copy of their
+ * expression, with long sums and products flattened, interned together with those of all other
+ * lambdas, so subexpressions they have in common are evaluated only once. Polynomials are put in
+ * Horner form only where no term can overflow (see PolynomialTransformer), so a lambda is NaN
+ * where the expression as written is. */
+std::shared_ptr<MathOps::MathOp<number>> driver::evaluation_form(std::shared_ptr<MathOps::MathOp<number>> op)
+{
+    auto simplified = MathOps::TransformPipeline<number>()
+        .then("constant fold", std::make_shared<MathOps::ConstantFoldTransformer<number>>())
+        .then("simplify", std::make_shared<MathOps::Simplifier<number>>())
+        .run(op);
+
+    auto polynomial = MathOps::PolynomialTransformer<number>().canonicalize(simplified);
+
+    return lambda_interner.intern(MathOps::FlattenTransformer<number>().flatten(polynomial));
+}
+
 void driver::unassign(const std::string& name)
 {
     check_reserved(name);
@@ -461,6 +717,8 @@ void driver::unassign(const std::string& name)
 
     variables.erase(std::remove(variables.begin(), variables.end(), op), variables.end());
     lambdas.erase(std::remove(lambdas.begin(), lambdas.end(), op), lambdas.end());
+    lambda_interner.collect();
+    clear_solve_plans();
 
 #ifdef GNUPLOT
     delete_plot_using(op);
@@ -555,7 +813,7 @@ static std::map<std::string, FunctionOptions> function_map = {
     { "asinh",  FunctionOptions { 1, [](auto ops) { return MathOps::asinh(ops[0]); } } },
     { "acosh",  FunctionOptions { 1, [](auto ops) { return MathOps::acosh(ops[0]); } } },
     { "atanh",  FunctionOptions { 1, [](auto ops) { return MathOps::atanh(ops[0]); } } },
-    { "expand", FunctionOptions { 1, [](auto ops) { return ops[0]->transform(MathOps::ExpandTransformer<number>()); } } },
+    { "expand", FunctionOptions { 1, [](auto ops) { return MathOps::TransformPipeline<number>(true).then("intern", std::make_shared<MathOps::Interner<number>>()).run(ops[0]); } } },
     { "value",  FunctionOptions { 1, [](auto ops) { return MathOps::ConstantValue<number>::create(ops[0]->result()); } } },
 };
 
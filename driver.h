@@ -7,12 +7,16 @@
 #include "gnuplot.h"
 #endif
 #include "config.h"
+#include "mathop/interner.h"
+#include "mathop/threadpool.h"
 
 #include <string>
 #include <iostream>
 #include <memory>
 #include <vector>
 #include <map>
+#include <tuple>
+#include <functional>
 #include <algorithm>
 
 // Tell Flex the lexer's prototype ...
@@ -71,16 +75,46 @@ private:
 	void clear_variables();
 	void help();
 	void warranty();
+	void set_thread_precision();
 
-	std::vector<std::shared_ptr<MathOps::MathOp<number>>> find_solutions(
+	struct SolvePlan
+	{
+		// The interned sides of the equation, which the plan is found by.
+		std::shared_ptr<MathOps::MathOp<number>> lhs;
+		std::shared_ptr<MathOps::MathOp<number>> rhs;
+		std::shared_ptr<MathOps::Value<number>> solve_for;
+		// The sides the variable is isolated from and moved to.
+		std::shared_ptr<MathOps::MathOp<number>> solve_side;
+		std::shared_ptr<MathOps::MathOp<number>> result_side;
+		// The solutions found so far, whether they're viable at the current values or not.
+		std::vector<std::shared_ptr<MathOps::MathOp<number>>> solutions;
+		// Their simplified forms, which are evaluated in their place.
+		std::vector<std::shared_ptr<MathOps::MathOp<number>>> evaluation_forms;
+		// Whether those are all of them.
+		bool complete;
+	};
+
+	SolvePlan& solve_plan(std::shared_ptr<MathOps::MathOp<number>> lhs,
+		std::shared_ptr<MathOps::MathOp<number>> rhs, const std::string& variable);
+	// Forget the plans after something they depend on (e.g. a lambda) has changed.
+	void clear_solve_plans();
+	bool find_solutions(const SolvePlan& plan,
+		const std::function<bool(const std::shared_ptr<MathOps::MathOp<number>>&,
+		                         const std::shared_ptr<MathOps::MathOp<number>>&)>& found);
+	std::vector<std::shared_ptr<MathOps::MathOp<number>>> viable_solutions(SolvePlan& plan, size_t count);
+	std::vector<std::shared_ptr<MathOps::MathOp<number>>> viable_solutions(
+		const std::vector<std::shared_ptr<MathOps::MathOp<number>>>& solutions,
+		const std::vector<std::shared_ptr<MathOps::MathOp<number>>>& evaluation_forms);
+	std::vector<std::shared_ptr<MathOps::MathOp<number>>> find_numeric_solutions(
 		std::shared_ptr<MathOps::MathOp<number>> lhs,
 		std::shared_ptr<MathOps::MathOp<number>> rhs,
-		const std::shared_ptr<MathOps::Value<number>> &solve_for,
-		bool solve_from_left);
+		const std::shared_ptr<MathOps::Value<number>> &solve_for);
 	void check_reserved(const std::string& variable);
 	std::string format(std::shared_ptr<MathOps::MathOp<number>> op);
 	std::string result_string(std::shared_ptr<MathOps::MathOp<number>> op, number result);
 	number print_result(std::shared_ptr<MathOps::MathOp<number>> op);
+	std::shared_ptr<MathOps::MathOp<number>> evaluation_form(std::shared_ptr<MathOps::MathOp<number>> op);
+	bool high_precision();
 
 	template <typename U>
 	static std::shared_ptr<U> get(std::vector<std::shared_ptr<U>>& from, const std::string& name)
@@ -127,5 +161,13 @@ private:
 #endif
 	std::vector<std::shared_ptr<MathOps::Variable<number>>> variables;
 	std::vector<std::shared_ptr<MathOps::Container<number>>> lambdas;
+	MathOps::Interner<number> lambda_interner;
+
+	static constexpr size_t max_solve_plans = 1024;
+	std::map<std::tuple<const MathOps::MathOp<number>*, const MathOps::MathOp<number>*, std::string>, SolvePlan> solve_plans;
+	MathOps::Interner<number> plan_interner;
+
+	// Declared last, so its threads are stopped first.
+	MathOps::ThreadPool pool;
 };
 #endif // ! DRIVER_HH
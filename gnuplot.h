@@ -3,8 +3,15 @@
 
 #include "mathop/defaultformatter.h"
 #include "mathop/expandtransformer.h"
+#include "mathop/constantfoldtransformer.h"
+#include "mathop/program.h"
+#ifndef ARBIT_PREC
+#include "mathop/jit.h"
+#endif
 
 #include <iostream>
+#include <vector>
+#include <algorithm>
 #include <cstring>
 #include <cstdlib>
 #include <cstdio>
@@ -27,7 +34,7 @@ public:
     inline bool is_open() { return pipe != nullptr; }
 
     void plot(std::vector<std::shared_ptr<MathOps::MathOp<T>>> equations,
-        std::shared_ptr<MathOps::Variable<T>> x, T from, T to, T step, int digits)
+        std::shared_ptr<MathOps::Variable<T>> x, T from, T to, T step, int digits, bool jit = false)
     {
         std::stringstream ss;
 
@@ -55,15 +62,21 @@ public:
             }
         }
 
+        std::vector<T> xs;
+        for (T i = from; i < to; i += step)
+        {
+            xs.push_back(i);
+        }
+
+        std::vector<std::vector<T>> ys(equations.size(), std::vector<T>(xs.size()));
+        evaluate(equations, x, xs, ys, jit);
+
         ss << std::setprecision(digits);
         for (size_t i = 0; i < equations.size(); i++)
         {
-            auto equation = equations[i];
-
-            for (T i = from; i < to; i += step)
+            for (size_t j = 0; j < xs.size(); j++)
             {
-                x->set(i);
-                ss << i << ' ' << equation->result() << '\n';
+                ss << xs[j] << ' ' << ys[i][j] << '\n';
             }
 
             ss << "EOF\n";
@@ -77,6 +90,46 @@ public:
 private:
     FILE* pipe = nullptr;
 
+    void evaluate(std::vector<std::shared_ptr<MathOps::MathOp<T>>> equations, std::shared_ptr<MathOps::Variable<T>> x,
+        const std::vector<T>& xs, std::vector<std::vector<T>>& ys, bool jit)
+    {
+        /* Lambdas are expanded, as their definition can't change while plotting */
+        for (auto& equation: equations)
+        {
+            equation = equation->transform(MathOps::ConstantFoldTransformer<T>(true));
+        }
+
+#ifndef ARBIT_PREC
+        if (jit)
+        {
+            std::vector<MathOps::Jit<T>> compiled(equations.begin(), equations.end());
+            if (std::all_of(compiled.begin(), compiled.end(), [](auto& c) { return c.is_compiled(); }))
+            {
+                for (size_t i = 0; i < compiled.size(); i++)
+                {
+                    compiled[i].results({ x }, { xs.data() }, ys[i].data(), xs.size());
+                }
+
+                return;
+            }
+
+            std::cerr << "Native code compilation failed, falling back to the interpreter\n";
+        }
+#else
+        (void) jit;
+#endif
+
+        /* Compiled into one program, so subexpressions shared between equations run only once */
+        std::vector<T*> outs;
+        for (auto& y: ys)
+        {
+            outs.push_back(y.data());
+        }
+
+        MathOps::Program<T> program(equations);
+        program.results({ x }, { xs.data() }, outs, xs.size());
+    }
+
     inline std::string escape(std::string s)
     {
         size_t pos = 0;
@@ -8,6 +8,14 @@
 #include <sstream>
 #include <memory>
 #include <cassert>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#include <algorithm>
+#include <type_traits>
+#include <atomic>
+#include <mutex>
 
 namespace MathOps
 {
@@ -21,6 +29,41 @@ enum class Bodmas
     AdditionSubtraction
 };
 
+/* Node kinds, used by the flattened representations of a tree */
+enum class OpKind : uint8_t
+{
+    ConstantSymbol,
+    Variable,
+    ValueVariable,
+    NamedConstant,
+    MutableValue,
+    ConstantValue,
+    Container,
+    Negate,
+    Sqrt,
+    Log,
+    Log10,
+    Sin,
+    ASin,
+    Cos,
+    ACos,
+    Tan,
+    ATan,
+    Sinh,
+    ASinh,
+    Cosh,
+    ACosh,
+    Tanh,
+    ATanh,
+    Pow,
+    Mul,
+    Div,
+    Add,
+    Sub,
+    Sum,
+    Product
+};
+
 /* Math operation class base class */
 template<typename T>
 struct MathOp : public std::enable_shared_from_this<MathOp<T>>
@@ -32,17 +75,28 @@ struct MathOp : public std::enable_shared_from_this<MathOp<T>>
     virtual bool is_single() const = 0;
     virtual bool right_associative() const { return false; }
 
-    std::shared_ptr<MathOp<T>> transform(Visitor<T>& visitor) { return std::get<std::shared_ptr<MathOp<T>>>(accept(visitor)); }
-    std::shared_ptr<MathOp<T>> transform(Visitor<T>&& visitor) { return transform(visitor); }
+    /* Generic access to the operands, for walking a tree without recursion. A container's only
+     * operand is its inner expression. */
+    virtual size_t arity() const { return 0; }
+    virtual MathOp<T>* operand(size_t) const { return nullptr; }
+
+    std::shared_ptr<MathOp<T>> transform(TransformVisitor<T>& visitor) { accept(visitor); return visitor.take(); }
+    std::shared_ptr<MathOp<T>> transform(TransformVisitor<T>&& visitor) { return transform(visitor); }
 
-    std::vector<std::shared_ptr<MathOp<T>>> multi_transform(Visitor<T>& visitor) { return std::get<std::vector<std::shared_ptr<MathOp<T>>>>(accept(visitor)); }
-    std::vector<std::shared_ptr<MathOp<T>>> multi_transform(Visitor<T>&& visitor) { return multi_transform(visitor); }
+    std::vector<std::shared_ptr<MathOp<T>>> multi_transform(MultiTransformVisitor<T>& visitor) { accept(visitor); return visitor.take(); }
+    std::vector<std::shared_ptr<MathOp<T>>> multi_transform(MultiTransformVisitor<T>&& visitor) { return multi_transform(visitor); }
 
-    std::string format(Visitor<T>& visitor) { return std::get<std::string>(accept(visitor)); }
-    std::string format(Visitor<T>&& visitor) { return format(visitor); }
+    std::string format(FormatVisitor<T>& visitor)
+    {
+        visitor.out.clear();
+        accept(visitor);
+        return std::move(visitor.out);
+    }
 
-    int count(Visitor<T>& visitor) { return std::get<int>(accept(visitor)); }
-    int count(Visitor<T>&& visitor) { return count(visitor); }
+    std::string format(FormatVisitor<T>&& visitor) { return format(visitor); }
+
+    int count(CountVisitor<T>& visitor) { accept(visitor); return visitor.take(); }
+    int count(CountVisitor<T>&& visitor) { return count(visitor); }
 
     friend std::shared_ptr<MathOp<T>> operator+(std::shared_ptr<MathOp<T>> lhs, std::shared_ptr<MathOp<T>> rhs)
     {
@@ -69,15 +123,362 @@ struct MathOp : public std::enable_shared_from_this<MathOp<T>>
         return Div<T>::create(lhs, rhs);
     }
 
+    /* Mark every operation that depends on this one as dirty, so its cached result is recomputed
+     * on the next call to result(). Propagation stops at operations that are already dirty, as
+     * everything above those is dirty as well. */
+    void invalidate()
+    {
+        /* Walk up single-parent chains iteratively, only recursing where a node has more parents */
+        for (MathOp<T>* op = this; ; op = op->parent)
+        {
+            for (auto& p: op->more_parents)
+            {
+                p.op->mark_dirty();
+            }
+
+            if (!op->parent || op->parent->dirty)
+            {
+                break;
+            }
+
+            op->parent->dirty = true;
+        }
+    }
+
+    /* Invalidate every cached result (e.g. after changing the precision) */
+    static void invalidate_all() { generation()++; }
+
+    /* While one of these exists, trees may be used (and operations created and destroyed) by more
+     * than one thread at a time, so cached results and parents are only accessed under a lock.
+     * Values can't be set, and containers can't be re-assigned, in the meantime. */
+    struct Concurrent
+    {
+        Concurrent() { sharing()++; }
+        ~Concurrent() { sharing()--; }
+
+        Concurrent(const Concurrent&) = delete;
+        Concurrent& operator=(const Concurrent&) = delete;
+    };
+
+    /* Operations register themselves with their operands, so they can be invalidated. The parent's
+     * slot is stored in 'slot', to pass to remove_parent(). The slot belongs to the parent, but
+     * it's moved when other parents are removed, so it's only ever read or written under this
+     * operation's lock. */
+    void add_parent(MathOp<T>* p, size_t& slot)
+    {
+        auto guard = locked();
+        if (!parent)
+        {
+            parent = p;
+            slot = inline_slot;
+            return;
+        }
+
+        more_parents.push_back(Parent { p, &slot });
+        slot = more_parents.size() - 1;
+    }
+
+    /* The last parent takes the place of the removed one, and its slot is updated (without
+     * calling into the parent, which may be under construction or being destroyed), so removing a
+     * parent doesn't depend on how many there are */
+    void remove_parent(const size_t& slot)
+    {
+        auto guard = locked();
+        if (more_parents.empty())
+        {
+            parent = nullptr;
+            return;
+        }
+
+        size_t last = more_parents.size() - 1;
+        Parent moved = more_parents[last];
+        more_parents.pop_back();
+
+        if (slot == inline_slot)
+        {
+            parent = moved.op;
+            *moved.slot = inline_slot;
+        }
+        else if (slot != last)
+        {
+            more_parents[slot] = moved;
+            *moved.slot = slot;
+        }
+    }
+
     virtual ~MathOp() { }
 
 protected:
-    virtual VisitorResult<T> accept(Visitor<T>& visitor) = 0;
+    template<typename, typename> friend struct Visitor;
+
+    virtual void accept(VisitorBase<T>& visitor) = 0;
+
+    static unsigned long& generation()
+    {
+        static unsigned long current = 0;
+        return current;
+    }
+
+    /* Nesting depth of result() and is_constant() calls. Past max_depth, the operations below are
+     * brought up to date bottom up, from a loop, instead. */
+    static constexpr unsigned max_depth = 256;
+
+    static unsigned& depth()
+    {
+        static thread_local unsigned current = 0;
+        return current;
+    }
+
+    static std::atomic<unsigned>& sharing()
+    {
+        static std::atomic<unsigned> current { 0 };
+        return current;
+    }
+
+    static bool shared() { return sharing().load(std::memory_order_relaxed); }
+
+    /* The lock of this operation, if trees are shared between threads. Operations share a fixed
+     * number of locks, so no operation may be locked while another one is. */
+    std::unique_lock<std::mutex> locked() const
+    {
+        static std::mutex locks[64];
+
+        return shared()
+            ? std::unique_lock<std::mutex>(locks[(std::uintptr_t) this / alignof(std::max_align_t) % 64])
+            : std::unique_lock<std::mutex>();
+    }
+
+    /* The operands result() is computed from. The same as operand(), except for a container that
+     * is evaluated through a different form of its inner expression. */
+    virtual const MathOp<T>* dependency(size_t i) const { return operand(i); }
+
+    /* Whether result() or is_constant() would have to (re)compute */
+    virtual bool is_stale() const { return false; }
+    virtual bool is_constant_stale() const { return false; }
+
+    /* Iterative post-order walk over the stale operations below root, computing result() (or
+     * is_constant()) of each one after those of its operands. Evaluating root itself then only
+     * goes one level deep. */
+    static void update_below(const MathOp<T>* root, bool evaluate)
+    {
+        unsigned saved_depth = depth();
+        depth() = 0;
+
+        std::vector<std::pair<const MathOp<T>*, size_t>> stack { { root, 0 } };
+        while (!stack.empty())
+        {
+            const MathOp<T>* op = stack.back().first;
+            size_t i = stack.back().second++;
+
+            if (i < op->arity())
+            {
+                const MathOp<T>* next = evaluate ? op->dependency(i) : op->operand(i);
+                if (evaluate ? next->is_stale() : next->is_constant_stale())
+                {
+                    stack.emplace_back(next, 0);
+                }
+
+                continue;
+            }
+
+            stack.pop_back();
+            if (op != root)
+            {
+                evaluate ? (void) op->result() : (void) op->is_constant();
+            }
+        }
+
+        depth() = saved_depth;
+    }
+
+    /* Drop a reference to an operand. Destroying the last reference to a tree would recurse once
+     * per level, so the outermost destructor destroys the operands below it from a loop instead. */
+    static void release(std::shared_ptr<MathOp<T>>& op)
+    {
+        static thread_local std::vector<std::shared_ptr<MathOp<T>>> pending;
+        static thread_local bool releasing = false;
+
+        if (op.use_count() != 1)
+        {
+            op.reset();
+            return;
+        }
+
+        pending.push_back(std::move(op));
+        if (releasing)
+        {
+            return;
+        }
+
+        releasing = true;
+        while (!pending.empty())
+        {
+            auto next = std::move(pending.back());
+            pending.pop_back();
+        }
+        releasing = false;
+    }
+
+    /* Changed whenever the inner expression of a container is replaced */
+    static unsigned long& structure_generation()
+    {
+        static unsigned long current = 0;
+        return current;
+    }
+
+    mutable bool dirty = true;
+
+    static constexpr size_t inline_slot = ~(size_t) 0;
+
+private:
+    /* A parent, and where it keeps its slot */
+    struct Parent
+    {
+        MathOp<T>* op;
+        size_t* slot;
+    };
+
+    /* Most operations have a single parent, which is kept inline */
+    MathOp<T>* parent = nullptr;
+    std::vector<Parent> more_parents;
+
+    void mark_dirty()
+    {
+        if (!dirty)
+        {
+            dirty = true;
+            invalidate();
+        }
+    }
 };
 
-#define ADD_VISITOR(to_type) VisitorResult<T> accept(Visitor<T>& visitor) override      \
+/* Base class of operations that cache their result. The cached result is valid until one of the
+ * values it depends on is set (which marks it dirty), or until invalidate_all() is called. */
+template<typename T>
+struct MathCachedOp : public MathOp<T>
+{
+protected:
+    /* Called from each operation's own result(), rather than from a shared virtual one, so the
+     * calls into the operands stay well predicted */
+    template<typename F>
+    T cached(F evaluate) const
+    {
+        if (MathOp<T>::shared())
+        {
+            return cached_shared(evaluate);
+        }
+
+        if (stale())
+        {
+            if (++MathOp<T>::depth() > MathOp<T>::max_depth)
+            {
+                MathOp<T>::update_below(this, true);
+            }
+
+            cache = evaluate();
+            cached_generation = MathOp<T>::generation();
+            this->dirty = false;
+            MathOp<T>::depth()--;
+        }
+
+        return cache;
+    }
+
+    /* Whether an operation is constant can only change when a container below it is re-assigned */
+    template<typename F>
+    bool cached_constant(F evaluate) const
+    {
+        if (MathOp<T>::shared())
+        {
+            return cached_constant_shared(evaluate);
+        }
+
+        if (constant_stale())
+        {
+            if (++MathOp<T>::depth() > MathOp<T>::max_depth)
+            {
+                MathOp<T>::update_below(this, false);
+            }
+
+            constant = evaluate();
+            constant_generation = MathOp<T>::structure_generation();
+            MathOp<T>::depth()--;
+        }
+
+        return constant;
+    }
+
+    /* When trees are shared between threads, the cache is only accessed under the operation's lock.
+     * No lock is held while evaluating, so the same result may be computed (and stored) by more
+     * than one thread. */
+    template<typename F>
+    T cached_shared(F evaluate) const
+    {
+        {
+            auto guard = this->locked();
+            if (!stale())
+            {
+                return cache;
+            }
+        }
+
+        if (++MathOp<T>::depth() > MathOp<T>::max_depth)
+        {
+            MathOp<T>::update_below(this, true);
+        }
+
+        T value = evaluate();
+        MathOp<T>::depth()--;
+
+        auto guard = this->locked();
+        cache = std::move(value);
+        cached_generation = MathOp<T>::generation();
+        this->dirty = false;
+
+        return cache;
+    }
+
+    template<typename F>
+    bool cached_constant_shared(F evaluate) const
+    {
+        {
+            auto guard = this->locked();
+            if (!constant_stale())
+            {
+                return constant;
+            }
+        }
+
+        if (++MathOp<T>::depth() > MathOp<T>::max_depth)
+        {
+            MathOp<T>::update_below(this, false);
+        }
+
+        bool value = evaluate();
+        MathOp<T>::depth()--;
+
+        auto guard = this->locked();
+        constant = value;
+        constant_generation = MathOp<T>::structure_generation();
+
+        return constant;
+    }
+
+    bool is_stale() const override { auto guard = this->locked(); return stale(); }
+    bool is_constant_stale() const override { auto guard = this->locked(); return constant_stale(); }
+
+    bool stale() const { return this->dirty || cached_generation != MathOp<T>::generation(); }
+    bool constant_stale() const { return constant_generation != MathOp<T>::structure_generation(); }
+
+    mutable T cache;
+    mutable unsigned long cached_generation = 0;
+    mutable bool constant = false;
+    mutable unsigned long constant_generation = ~0ul;
+};
+
+#define ADD_VISITOR(to_type) void accept(VisitorBase<T>& visitor) override              \
 {                                                                                       \
-    return visitor.visit(std::static_pointer_cast<to_type>(this->shared_from_this()));  \
+    visitor.dispatch(std::static_pointer_cast<to_type>(this->shared_from_this()));      \
 }
 
 template <typename T>
@@ -98,9 +499,9 @@ struct EnableCreator
 };
 
 template <typename T>
-struct Container : public MathOp<T>, public EnableCreator<Container<T>>
+struct Container : public MathCachedOp<T>, public EnableCreator<Container<T>>
 {
-    T result() const override { return op->result(); };
+    T result() const override { return this->cached([this] { return evaluated->result(); }); };
     Bodmas precedence() const override { return op->precedence(); };
     bool is_commutative() const override { return op->is_commutative(); };
     bool is_constant() const override { return op->is_constant(); };
@@ -109,15 +510,49 @@ struct Container : public MathOp<T>, public EnableCreator<Container<T>>
 
     std::string get_name() const { return name; }
     std::shared_ptr<MathOp<T>> get_inner() const { return op; }
-    void set_inner(std::shared_ptr<MathOp<T>> op) { this->op = op; }
+
+    size_t arity() const override { return 1; }
+    MathOp<T>* operand(size_t) const override { return op.get(); }
+
+    /* The container is evaluated through 'evaluated' if given; an equivalent (e.g. constant folded)
+     * form of the inner expression. Visitors only see the inner expression itself. */
+    void set_inner(std::shared_ptr<MathOp<T>> op, std::shared_ptr<MathOp<T>> evaluated = nullptr)
+    {
+        this->evaluated->remove_parent(slot);
+        this->op = op;
+        this->evaluated = evaluated ? evaluated : op;
+        this->evaluated->add_parent(this, slot);
+
+        MathOp<T>::structure_generation()++;
+        this->dirty = true;
+        this->invalidate();
+    }
+
+    ~Container()
+    {
+        evaluated->remove_parent(slot);
+        MathOp<T>::release(evaluated);
+        MathOp<T>::release(op);
+    }
 
 protected:
-    Container(std::shared_ptr<MathOp<T>> op, std::string name) : op(op), name(name) { }
+    Container(std::shared_ptr<MathOp<T>> op, std::string name, std::shared_ptr<MathOp<T>> evaluated = nullptr)
+        : op(op), evaluated(evaluated ? evaluated : op), name(name)
+    {
+        this->evaluated->add_parent(this, slot);
+    }
+
+    const MathOp<T>* dependency(size_t) const override { return evaluated.get(); }
+
+    /* is_constant() isn't cached, but only asks the inner expression */
+    bool is_constant_stale() const override { return true; }
 
     ADD_VISITOR(Container<T>)
 
 private:
     std::shared_ptr<MathOp<T>> op;
+    std::shared_ptr<MathOp<T>> evaluated;
+    size_t slot;
     std::string name;
 };
 
@@ -126,6 +561,7 @@ template<typename T>
 struct Value : public MathOp<T>
 {
     T result() const override { return value; }
+    const T& get_value() const { return value; }
     bool is_single() const override { return true; }
     virtual void set(T) { std::cerr << "Attempt to set a read-only value\n"; abort(); }
     virtual std::string get_name() const { std::cerr << "Attempt to get name from an unnamed value\n"; abort(); }
@@ -158,7 +594,7 @@ private:
 template<typename T>
 struct Variable : public Value<T>, public EnableCreator<Variable<T>>
 {
-    void set(T x) override { this->value = x; };
+    void set(T x) override { this->value = x; this->invalidate(); };
     bool is_constant() const override { return false; }
     std::string get_name() const override { return name; }
 
@@ -174,7 +610,7 @@ private:
 template<typename T>
 struct ValueVariable : public Value<T>, public EnableCreator<ValueVariable<T>>
 {
-    void set(T x) override { this->value = x; };
+    void set(T x) override { this->value = x; this->invalidate(); };
     bool is_constant() const override { return false; }
     std::string get_name() const override { return name; }
 
@@ -205,7 +641,7 @@ private:
 template<typename T>
 struct MutableValue : public Value<T>, public EnableCreator<MutableValue<T>>
 {
-    void set(T x) override { this->value = x; };
+    void set(T x) override { this->value = x; this->invalidate(); };
     bool is_constant() const override { return false; }
 
 protected:
@@ -227,39 +663,129 @@ protected:
 
 /* Unary math operation base class */
 template<typename T>
-struct MathUnaryOp : public MathOp<T>
+struct MathUnaryOp : public MathCachedOp<T>
 {
     Bodmas precedence() const override { return prec; }
     bool is_single() const override { return true; }
-    bool is_constant() const override { return false; }
+    bool is_constant() const override { return this->cached_constant([this] { return x->is_constant(); }); }
 
     std::shared_ptr<MathOp<T>> get_x() const { return x; }
 
+    size_t arity() const override { return 1; }
+    MathOp<T>* operand(size_t) const override { return x.get(); }
+
 protected:
-    MathUnaryOp(std::shared_ptr<MathOp<T>> x, Bodmas precedence) : x(x), prec(precedence) { }
+    MathUnaryOp(std::shared_ptr<MathOp<T>> x, Bodmas precedence) : x(x), prec(precedence) { x->add_parent(this, x_slot); }
+
+    ~MathUnaryOp()
+    {
+        x->remove_parent(x_slot);
+        MathOp<T>::release(x);
+    }
 
     std::shared_ptr<MathOp<T>>x;
+    size_t x_slot;
     Bodmas prec;
 };
 
 /* Binary math operation base class */
 template<typename T>
-struct MathBinaryOp : public MathOp<T>
+struct MathBinaryOp : public MathCachedOp<T>
 {
     Bodmas precedence() const override { return prec; }
-    bool is_constant() const override { return false; }
+    bool is_constant() const override
+    {
+        return this->cached_constant([this] { return lhs->is_constant() && rhs->is_constant(); });
+    }
+
     bool is_single() const override { return false; }
 
     std::shared_ptr<MathOp<T>> get_lhs() const { return lhs; }
     std::shared_ptr<MathOp<T>> get_rhs() const { return rhs; }
 
+    size_t arity() const override { return 2; }
+    MathOp<T>* operand(size_t i) const override { return i ? rhs.get() : lhs.get(); }
+
 protected:
     MathBinaryOp(std::shared_ptr<MathOp<T>> lhs, std::shared_ptr<MathOp<T>> rhs, Bodmas precedence)
         : lhs(lhs), rhs(rhs), prec(precedence)
-    { }
+    {
+        lhs->add_parent(this, lhs_slot);
+        rhs->add_parent(this, rhs_slot);
+    }
+
+    ~MathBinaryOp()
+    {
+        lhs->remove_parent(lhs_slot);
+        rhs->remove_parent(rhs_slot);
+        MathOp<T>::release(lhs);
+        MathOp<T>::release(rhs);
+    }
 
     std::shared_ptr<MathOp<T>>lhs;
     std::shared_ptr<MathOp<T>>rhs;
+    size_t lhs_slot;
+    size_t rhs_slot;
+    Bodmas prec;
+};
+
+/* N-ary math operation base class. The operands are kept in a single array, each with a flag that
+ * inverts it (i.e. it's subtracted from a sum, or divided by in a product), so a long chain of
+ * additions or multiplications is evaluated from a loop instead of one binary operation (and one
+ * level of recursion) per operand. There are always at least two operands. */
+template<typename T>
+struct MathNaryOp : public MathCachedOp<T>
+{
+    struct Term
+    {
+        std::shared_ptr<MathOp<T>> op;
+        bool inverted;
+    };
+
+    Bodmas precedence() const override { return prec; }
+    bool is_constant() const override
+    {
+        return this->cached_constant([this]
+        {
+            return std::all_of(terms.begin(), terms.end(), [](const Term& term) { return term.op->is_constant(); });
+        });
+    }
+
+    bool is_single() const override { return false; }
+
+    const std::vector<Term>& get_terms() const { return terms; }
+
+    size_t arity() const override { return terms.size(); }
+    MathOp<T>* operand(size_t i) const override { return terms[i].op.get(); }
+
+    /* The same operation, as the chain of binary operations it stands for (left to right) */
+    virtual std::shared_ptr<MathOp<T>> to_binary() const = 0;
+
+protected:
+    MathNaryOp(std::vector<Term> terms, Bodmas precedence)
+        : terms(std::move(terms)), prec(precedence)
+    {
+        assert(this->terms.size() >= 2);
+
+        /* The slots are in place before any is registered, as operands keep pointers to them */
+        slots.resize(this->terms.size());
+        for (size_t i = 0; i < this->terms.size(); i++)
+        {
+            this->terms[i].op->add_parent(this, slots[i]);
+        }
+    }
+
+    ~MathNaryOp()
+    {
+        for (size_t i = 0; i < terms.size(); i++)
+        {
+            terms[i].op->remove_parent(slots[i]);
+            MathOp<T>::release(terms[i].op);
+        }
+    }
+
+    std::vector<Term> terms;
+    std::vector<size_t> slots;
     Bodmas prec;
 };
 
@@ -268,7 +794,7 @@ protected:
 template<typename T>                                                     \
 struct op_name : public MathUnaryOp<T>, public EnableCreator<op_name<T>> \
 {                                                                        \
-    T result() const override { return (operation); }                    \
+    T result() const override { return this->cached([this] { return (operation); }); } \
     bool is_commutative() const override { return commutative; }         \
                                                                          \
 protected:                                                               \
@@ -321,7 +847,7 @@ template<typename T> std::shared_ptr<MathOp<T>> atanh(std::shared_ptr<MathOp<T>>
 template<typename T>                                                           \
 struct op_name : public MathBinaryOp<T>, public EnableCreator<op_name<T>>      \
 {                                                                              \
-    T result() const override { return (operation); }                          \
+    T result() const override { return this->cached([this] { return (operation); }); }   \
                                                                                \
     bool is_commutative() const override { return commutative; }               \
     bool right_associative() const override { return right_assoc; }            \
@@ -342,6 +868,208 @@ DEFINE_BINARY_OP(Sub,    (this->lhs->result() - this->rhs->result()), false, fal
 
 #undef DEFINE_BINARY_OP
 
+/* A sum of values added one at a time. Hardware floating point sums are compensated (Neumaier's
+ * variant of Kahan summation), so their rounding error doesn't grow with the number of values.
+ * Other types are added as they are. Every backend sums with this, so they agree on the result. */
+template<typename T>
+struct CompensatedSum
+{
+    CompensatedSum(T first) : total(first) { }
+
+    void add(const T& x)
+    {
+        if constexpr (std::is_floating_point<T>::value)
+        {
+            T t = total + x;
+            compensation += std::abs(total) >= std::abs(x) ? (total - t) + x : (x - t) + total;
+            total = t;
+        }
+        else
+        {
+            total = total + x;
+        }
+    }
+
+    T result() const
+    {
+        if constexpr (std::is_floating_point<T>::value)
+        {
+            /* The compensation is meaningless once the sum isn't finite */
+            return std::isfinite(total) && compensation != 0 ? total + compensation : total;
+        }
+        else
+        {
+            return total;
+        }
+    }
+
+private:
+    T total;
+
+    /* Only kept for hardware floats */
+    typename std::conditional<std::is_floating_point<T>::value, T, char>::type compensation = 0;
+};
+
+/* N-ary math operations. Sums are compensated (see CompensatedSum), so their rounding error
+ * doesn't grow with the number of operands. Products are evaluated in order, like the chain of
+ * multiplications and divisions they replace. */
+template<typename T>
+struct Sum : public MathNaryOp<T>, public EnableCreator<Sum<T>>
+{
+    typedef typename MathNaryOp<T>::Term Term;
+
+    T result() const override { return this->cached([this] { return sum(); }); }
+    bool is_commutative() const override { return true; }
+
+    std::shared_ptr<MathOp<T>> to_binary() const override
+    {
+        auto& terms = this->terms;
+        auto result = terms[0].inverted ? Negate<T>::create(terms[0].op) : terms[0].op;
+        for (size_t i = 1; i < terms.size(); i++)
+        {
+            result = terms[i].inverted ? result - terms[i].op : result + terms[i].op;
+        }
+
+        return result;
+    }
+
+protected:
+    Sum(std::vector<Term> terms)
+        : MathNaryOp<T>(std::move(terms), Bodmas::AdditionSubtraction)
+    { }
+
+    ADD_VISITOR(Sum<T>)
+
+private:
+    static T term(const Term& term) { return term.inverted ? -term.op->result() : term.op->result(); }
+
+    T sum() const
+    {
+        CompensatedSum<T> total(term(this->terms[0]));
+        for (size_t i = 1; i < this->terms.size(); i++)
+        {
+            total.add(term(this->terms[i]));
+        }
+
+        return total.result();
+    }
+};
+
+template<typename T>
+struct Product : public MathNaryOp<T>, public EnableCreator<Product<T>>
+{
+    typedef typename MathNaryOp<T>::Term Term;
+
+    T result() const override { return this->cached([this] { return product(); }); }
+    bool is_commutative() const override { return true; }
+
+    std::shared_ptr<MathOp<T>> to_binary() const override
+    {
+        auto& terms = this->terms;
+        auto result = terms[0].inverted ? ConstantValue<T>::create(1) / terms[0].op : terms[0].op;
+        for (size_t i = 1; i < terms.size(); i++)
+        {
+            result = terms[i].inverted ? result / terms[i].op : result * terms[i].op;
+        }
+
+        return result;
+    }
+
+protected:
+    Product(std::vector<Term> terms)
+        : MathNaryOp<T>(std::move(terms), Bodmas::MultiplicationDivision)
+    { }
+
+    ADD_VISITOR(Product<T>)
+
+private:
+    T product() const
+    {
+        auto& terms = this->terms;
+        T total = terms[0].inverted ? T(1) / terms[0].op->result() : terms[0].op->result();
+        for (size_t i = 1; i < terms.size(); i++)
+        {
+            total = terms[i].inverted ? total / terms[i].op->result() : total * terms[i].op->result();
+        }
+
+        return total;
+    }
+};
+
+/* Create a unary (y is ignored) or binary operation by kind */
+template<typename T>
+std::shared_ptr<MathOp<T>> create_op(OpKind kind, std::shared_ptr<MathOp<T>> x, std::shared_ptr<MathOp<T>> y = nullptr)
+{
+    switch (kind)
+    {
+        case OpKind::Negate: return Negate<T>::create(x);
+        case OpKind::Sqrt:   return Sqrt<T>::create(x);
+        case OpKind::Log:    return Log<T>::create(x);
+        case OpKind::Log10:  return Log10<T>::create(x);
+        case OpKind::Sin:    return Sin<T>::create(x);
+        case OpKind::ASin:   return ASin<T>::create(x);
+        case OpKind::Cos:    return Cos<T>::create(x);
+        case OpKind::ACos:   return ACos<T>::create(x);
+        case OpKind::Tan:    return Tan<T>::create(x);
+        case OpKind::ATan:   return ATan<T>::create(x);
+        case OpKind::Sinh:   return Sinh<T>::create(x);
+        case OpKind::ASinh:  return ASinh<T>::create(x);
+        case OpKind::Cosh:   return Cosh<T>::create(x);
+        case OpKind::ACosh:  return ACosh<T>::create(x);
+        case OpKind::Tanh:   return Tanh<T>::create(x);
+        case OpKind::ATanh:  return ATanh<T>::create(x);
+        case OpKind::Pow:    return Pow<T>::create(x, y);
+        case OpKind::Mul:    return Mul<T>::create(x, y);
+        case OpKind::Div:    return Div<T>::create(x, y);
+        case OpKind::Add:    return Add<T>::create(x, y);
+        case OpKind::Sub:    return Sub<T>::create(x, y);
+        default:
+            std::cerr << "Attempt to create a value, container or n-ary operation by kind\n";
+            abort();
+    }
+}
+
+/* Create an n-ary operation by kind */
+template<typename T>
+std::shared_ptr<MathOp<T>> create_nary_op(OpKind kind, std::vector<typename MathNaryOp<T>::Term> terms)
+{
+    switch (kind)
+    {
+        case OpKind::Sum:     return Sum<T>::create(std::move(terms));
+        case OpKind::Product: return Product<T>::create(std::move(terms));
+        default:
+            std::cerr << "Attempt to create a value, container, unary or binary operation as an n-ary operation\n";
+            abort();
+    }
+}
+
+/* Apply the operation of kind K, resolved at compile time */
+template<OpKind K, typename T>
+constexpr T apply_op(const T& a, const T& b = T())
+{
+    if constexpr (K == OpKind::Negate) return -a;
+    else if constexpr (K == OpKind::Sqrt)  return sqrt(a);
+    else if constexpr (K == OpKind::Log)   return log(a);
+    else if constexpr (K == OpKind::Log10) return log10(a);
+    else if constexpr (K == OpKind::Sin)   return sin(a);
+    else if constexpr (K == OpKind::ASin)  return asin(a);
+    else if constexpr (K == OpKind::Cos)   return cos(a);
+    else if constexpr (K == OpKind::ACos)  return acos(a);
+    else if constexpr (K == OpKind::Tan)   return tan(a);
+    else if constexpr (K == OpKind::ATan)  return atan(a);
+    else if constexpr (K == OpKind::Sinh)  return sinh(a);
+    else if constexpr (K == OpKind::ASinh) return asinh(a);
+    else if constexpr (K == OpKind::Cosh)  return cosh(a);
+    else if constexpr (K == OpKind::ACosh) return acosh(a);
+    else if constexpr (K == OpKind::Tanh)  return tanh(a);
+    else if constexpr (K == OpKind::ATanh) return atanh(a);
+    else if constexpr (K == OpKind::Pow)   return pow(a, b);
+    else if constexpr (K == OpKind::Mul)   return a * b;
+    else if constexpr (K == OpKind::Div)   return a / b;
+    else if constexpr (K == OpKind::Add)   return a + b;
+    else                                   return a - b;
+}
+
 #undef ADD_VISITOR
 
 } /* namespace MathOps */
@@ -0,0 +1,459 @@
+#ifndef ARENA_H
+#define ARENA_H
+
+#include "algeblah.h"
+
+#include <algorithm>
+#include <vector>
+#include <unordered_map>
+
+namespace MathOps
+{
+
+/* A compact, index based node. Children are referenced by their index in the arena.
+ * For leaves, 'a' indexes either the constant table (ConstantValue) or the leaf table. A Sum's
+ * operands are the 'b' terms in the term table that start at 'a'. */
+struct ArenaNode
+{
+    OpKind kind;
+    uint32_t a;
+    uint32_t b;
+};
+
+/* An operand of a Sum, and whether it's subtracted */
+struct ArenaTerm
+{
+    uint32_t node;
+    bool inverted;
+};
+
+/* A contiguous store of expression nodes, as an alternative to a tree of individually allocated
+ * MathOp objects. Nodes are appended in post-order, so children always precede their parents,
+ * and a single forward pass over the node array evaluates every node in it. Evaluating a root only
+ * passes over the nodes added along with it, and the leaves it shares with trees added before.
+ *
+ * Named values (variables, named constants, etc) are referenced, not copied, so Variable::set()
+ * is picked up by the next evaluation. Containers are referenced as well, but their inner
+ * expression is copied into the arena when it is added; re-assigning a lambda is not seen by
+ * an arena that was built before.
+ *
+ * Sums are compensated, just like Sum::result() (see CompensatedSum). Products are stored as the
+ * chain of binary operations they stand for.
+ *
+ * result(root) keeps the results of the nodes in the arena itself, so only one thread at a time
+ * may call it. Threads that evaluate the same arena each pass a buffer of their own instead. */
+template<typename T>
+struct Arena
+{
+    uint32_t add(std::shared_ptr<MathOp<T>> op)
+    {
+        Builder builder(*this);
+        Reach reach { (uint32_t) nodes.size(), { } };
+        uint32_t root = builder.add(op);
+
+        /* Only leaves are shared with the trees added before */
+        for (auto& appended: builder.appended_nodes())
+        {
+            if (appended.second < reach.first)
+            {
+                reach.earlier.push_back(appended.second);
+            }
+        }
+
+        std::sort(reach.earlier.begin(), reach.earlier.end());
+        roots[root] = std::move(reach);
+
+        return root;
+    }
+
+    /* The value of a node that add() returned. Any other node is evaluated along with every node
+     * before it. */
+    T result(uint32_t root) const { return result(root, buffer); }
+
+    T result(uint32_t root, std::vector<T>& results) const
+    {
+        assert(root < nodes.size());
+
+        results.resize(nodes.size());
+
+        auto it = roots.find(root);
+        if (it == roots.end())
+        {
+            for (uint32_t i = 0; i <= root; i++)
+            {
+                results[i] = evaluate(nodes[i], results);
+            }
+
+            return results[root];
+        }
+
+        for (uint32_t i: it->second.earlier)
+        {
+            results[i] = evaluate(nodes[i], results);
+        }
+
+        for (uint32_t i = it->second.first; i <= root; i++)
+        {
+            results[i] = evaluate(nodes[i], results);
+        }
+
+        return results[root];
+    }
+
+    /* Rebuild a MathOp tree from the arena, so existing visitors can be used on it. Nodes that are
+     * shared in the arena are shared in the tree as well. */
+    std::shared_ptr<MathOp<T>> to_math_op(uint32_t index) const
+    {
+        Rebuilt built;
+        return to_math_op(index, built);
+    }
+
+    size_t size() const { return nodes.size(); }
+
+    size_t memory_usage() const
+    {
+        return nodes.capacity() * sizeof(ArenaNode) +
+               terms.capacity() * sizeof(ArenaTerm) +
+               constants.capacity() * sizeof(T) +
+               leaves.capacity() * sizeof(std::shared_ptr<Value<T>>) +
+               containers.capacity() * sizeof(std::shared_ptr<Container<T>>);
+    }
+
+private:
+    std::vector<ArenaNode> nodes;
+    std::vector<ArenaTerm> terms;
+    std::vector<T> constants;
+    std::vector<std::shared_ptr<Value<T>>> leaves;
+    std::vector<std::shared_ptr<Container<T>>> containers;
+    std::unordered_map<const MathOp<T>*, uint32_t> leaf_index;
+    mutable std::vector<T> buffer;
+
+    /* The nodes a root reaches: those from first up to the root, which were added with it, and
+     * the earlier ones (leaves of trees added before), in order */
+    struct Reach
+    {
+        uint32_t first;
+        std::vector<uint32_t> earlier;
+    };
+
+    std::unordered_map<uint32_t, Reach> roots;
+
+    /* The trees rebuilt from each node, so shared nodes are only rebuilt once */
+    typedef std::unordered_map<uint32_t, std::shared_ptr<MathOp<T>>> Rebuilt;
+
+    T evaluate(const ArenaNode& node, const std::vector<T>& results) const
+    {
+        switch (node.kind)
+        {
+            case OpKind::ConstantValue: return constants[node.a];
+            case OpKind::ConstantSymbol:
+            case OpKind::Variable:
+            case OpKind::ValueVariable:
+            case OpKind::NamedConstant:
+            case OpKind::MutableValue:  return leaves[node.a]->result();
+            case OpKind::Container:     return results[node.a];
+            case OpKind::Negate:        return -results[node.a];
+            case OpKind::Sqrt:          return sqrt (results[node.a]);
+            case OpKind::Log:           return log  (results[node.a]);
+            case OpKind::Log10:         return log10(results[node.a]);
+            case OpKind::Sin:           return sin  (results[node.a]);
+            case OpKind::ASin:          return asin (results[node.a]);
+            case OpKind::Cos:           return cos  (results[node.a]);
+            case OpKind::ACos:          return acos (results[node.a]);
+            case OpKind::Tan:           return tan  (results[node.a]);
+            case OpKind::ATan:          return atan (results[node.a]);
+            case OpKind::Sinh:          return sinh (results[node.a]);
+            case OpKind::ASinh:         return asinh(results[node.a]);
+            case OpKind::Cosh:          return cosh (results[node.a]);
+            case OpKind::ACosh:         return acosh(results[node.a]);
+            case OpKind::Tanh:          return tanh (results[node.a]);
+            case OpKind::ATanh:         return atanh(results[node.a]);
+            case OpKind::Pow:           return pow(results[node.a], results[node.b]);
+            case OpKind::Mul:           return results[node.a] * results[node.b];
+            case OpKind::Div:           return results[node.a] / results[node.b];
+            case OpKind::Add:           return results[node.a] + results[node.b];
+            case OpKind::Sub:           return results[node.a] - results[node.b];
+            case OpKind::Sum:           return sum(node, results);
+            case OpKind::Product:       break; /* Lowered to binary operations by the builder */
+        }
+
+        assert(false);
+        return 0;
+    }
+
+    /* Nodes are rebuilt in post-order, from a loop, so the stack usage doesn't depend on the depth
+     * of the tree. Each one is rebuilt once its operands have been. */
+    std::shared_ptr<MathOp<T>> to_math_op(uint32_t index, Rebuilt& built) const
+    {
+        std::vector<std::pair<uint32_t, bool>> stack { { index, false } };
+        while (!stack.empty())
+        {
+            auto [i, ready] = stack.back();
+
+            if (built.count(i))
+            {
+                stack.pop_back();
+                continue;
+            }
+
+            if (!ready)
+            {
+                stack.back().second = true;
+                push_operands(nodes[i], stack);
+                continue;
+            }
+
+            stack.pop_back();
+            built[i] = rebuild(nodes[i], built);
+        }
+
+        return built[index];
+    }
+
+    /* Pushes the operands a node is rebuilt from, last one first */
+    void push_operands(const ArenaNode& node, std::vector<std::pair<uint32_t, bool>>& stack) const
+    {
+        switch (node.kind)
+        {
+            case OpKind::ConstantValue:
+            case OpKind::ConstantSymbol:
+            case OpKind::Variable:
+            case OpKind::ValueVariable:
+            case OpKind::NamedConstant:
+            case OpKind::MutableValue:
+            case OpKind::Container:     return;
+            case OpKind::Pow:
+            case OpKind::Mul:
+            case OpKind::Div:
+            case OpKind::Add:
+            case OpKind::Sub:           stack.push_back({ node.b, false }); stack.push_back({ node.a, false }); return;
+            case OpKind::Sum:
+                for (uint32_t i = node.a + node.b; i-- > node.a; )
+                {
+                    stack.push_back({ terms[i].node, false });
+                }
+                return;
+            default:                    stack.push_back({ node.a, false }); return;
+        }
+    }
+
+    /* Rebuilds a node whose operands have been rebuilt */
+    std::shared_ptr<MathOp<T>> rebuild(const ArenaNode& node, const Rebuilt& built) const
+    {
+        switch (node.kind)
+        {
+            case OpKind::ConstantValue: return ConstantValue<T>::create(constants[node.a]);
+            case OpKind::ConstantSymbol:
+            case OpKind::Variable:
+            case OpKind::ValueVariable:
+            case OpKind::NamedConstant:
+            case OpKind::MutableValue:  return leaves[node.a];
+            case OpKind::Container:     return containers[node.b];
+            case OpKind::Pow:
+            case OpKind::Mul:
+            case OpKind::Div:
+            case OpKind::Add:
+            case OpKind::Sub:           return create_op<T>(node.kind, built.at(node.a), built.at(node.b));
+            case OpKind::Sum:
+            {
+                std::vector<typename MathNaryOp<T>::Term> sum;
+                for (uint32_t i = node.a; i < node.a + node.b; i++)
+                {
+                    sum.push_back({ built.at(terms[i].node), terms[i].inverted });
+                }
+
+                return Sum<T>::create(std::move(sum));
+            }
+            default:                    return create_op<T>(node.kind, built.at(node.a));
+        }
+    }
+
+    static T term(const ArenaTerm& term, const std::vector<T>& results) { return term.inverted ? -results[term.node] : results[term.node]; }
+
+    T sum(const ArenaNode& node, const std::vector<T>& results) const
+    {
+        CompensatedSum<T> total(term(terms[node.a], results));
+        for (uint32_t i = node.a + 1; i < node.a + node.b; i++)
+        {
+            total.add(term(terms[i], results));
+        }
+
+        return total.result();
+    }
+
+    uint32_t append(OpKind kind, uint32_t a, uint32_t b = 0)
+    {
+        nodes.push_back(ArenaNode { kind, a, b });
+        return (uint32_t) nodes.size() - 1;
+    }
+
+    uint32_t append_leaf(OpKind kind, std::shared_ptr<Value<T>> op)
+    {
+        auto it = leaf_index.find(op.get());
+        if (it != leaf_index.end())
+        {
+            return it->second;
+        }
+
+        leaves.push_back(op);
+        uint32_t index = append(kind, (uint32_t) leaves.size() - 1);
+        leaf_index[op.get()] = index;
+
+        return index;
+    }
+
+    /* Visits the tree and returns the index of each appended node. Shared subtrees are appended
+     * once and referenced by every parent, so a tree with a lot of sharing stays small. */
+    struct Builder : public Visitor<T, uint32_t>
+    {
+        Builder(Arena<T>& arena) : arena(arena) { }
+
+        /* Operations are appended in post-order, from a loop, so the stack usage doesn't depend on
+         * the depth of the tree. Each one is visited once its operands have been appended. */
+        uint32_t add(std::shared_ptr<MathOp<T>> root)
+        {
+            std::vector<std::pair<MathOp<T>*, bool>> stack { { root.get(), false } };
+            while (!stack.empty())
+            {
+                auto [op, ready] = stack.back();
+
+                if (appended.count(op))
+                {
+                    stack.pop_back();
+                    continue;
+                }
+
+                if (!ready)
+                {
+                    stack.back().second = true;
+                    for (size_t i = op->arity(); i-- > 0; )
+                    {
+                        stack.push_back({ op->operand(i), false });
+                    }
+
+                    continue;
+                }
+
+                stack.pop_back();
+                appended[op] = this->apply(*op);
+            }
+
+            return appended[root.get()];
+        }
+
+        const std::unordered_map<const MathOp<T>*, uint32_t>& appended_nodes() const { return appended; }
+
+        uint32_t visit(std::shared_ptr<ConstantSymbol<T>> op) override { return leaf(OpKind::ConstantSymbol, op); }
+        uint32_t visit(std::shared_ptr<Variable<T>> op) override { return leaf(OpKind::Variable, op); }
+        uint32_t visit(std::shared_ptr<ValueVariable<T>> op) override { return leaf(OpKind::ValueVariable, op); }
+        uint32_t visit(std::shared_ptr<NamedConstant<T>> op) override { return leaf(OpKind::NamedConstant, op); }
+        uint32_t visit(std::shared_ptr<MutableValue<T>> op) override { return leaf(OpKind::MutableValue, op); }
+
+        uint32_t visit(std::shared_ptr<ConstantValue<T>> op) override
+        {
+            arena.constants.push_back(op->result());
+            return arena.append(OpKind::ConstantValue, (uint32_t) arena.constants.size() - 1);
+        }
+
+        uint32_t visit(std::shared_ptr<Container<T>> op) override
+        {
+            uint32_t inner = added(op->get_inner());
+            arena.containers.push_back(op);
+            return arena.append(OpKind::Container, inner, (uint32_t) arena.containers.size() - 1);
+        }
+
+        uint32_t visit(std::shared_ptr<Negate<T>> op) override { return unary(OpKind::Negate, op); }
+        uint32_t visit(std::shared_ptr<Sqrt<T>> op) override { return unary(OpKind::Sqrt, op); }
+        uint32_t visit(std::shared_ptr<Log<T>> op) override { return unary(OpKind::Log, op); }
+        uint32_t visit(std::shared_ptr<Log10<T>> op) override { return unary(OpKind::Log10, op); }
+        uint32_t visit(std::shared_ptr<Sin<T>> op) override { return unary(OpKind::Sin, op); }
+        uint32_t visit(std::shared_ptr<ASin<T>> op) override { return unary(OpKind::ASin, op); }
+        uint32_t visit(std::shared_ptr<Cos<T>> op) override { return unary(OpKind::Cos, op); }
+        uint32_t visit(std::shared_ptr<ACos<T>> op) override { return unary(OpKind::ACos, op); }
+        uint32_t visit(std::shared_ptr<Tan<T>> op) override { return unary(OpKind::Tan, op); }
+        uint32_t visit(std::shared_ptr<ATan<T>> op) override { return unary(OpKind::ATan, op); }
+        uint32_t visit(std::shared_ptr<Sinh<T>> op) override { return unary(OpKind::Sinh, op); }
+        uint32_t visit(std::shared_ptr<ASinh<T>> op) override { return unary(OpKind::ASinh, op); }
+        uint32_t visit(std::shared_ptr<Cosh<T>> op) override { return unary(OpKind::Cosh, op); }
+        uint32_t visit(std::shared_ptr<ACosh<T>> op) override { return unary(OpKind::ACosh, op); }
+        uint32_t visit(std::shared_ptr<Tanh<T>> op) override { return unary(OpKind::Tanh, op); }
+        uint32_t visit(std::shared_ptr<ATanh<T>> op) override { return unary(OpKind::ATanh, op); }
+
+        uint32_t visit(std::shared_ptr<Pow<T>> op) override { return binary(OpKind::Pow, op); }
+        uint32_t visit(std::shared_ptr<Mul<T>> op) override { return binary(OpKind::Mul, op); }
+        uint32_t visit(std::shared_ptr<Div<T>> op) override { return binary(OpKind::Div, op); }
+        uint32_t visit(std::shared_ptr<Add<T>> op) override { return binary(OpKind::Add, op); }
+        uint32_t visit(std::shared_ptr<Sub<T>> op) override { return binary(OpKind::Sub, op); }
+
+        uint32_t visit(std::shared_ptr<Sum<T>> op) override
+        {
+            std::vector<ArenaTerm> sum;
+            for (auto& term: op->get_terms())
+            {
+                sum.push_back(ArenaTerm { added(term.op), term.inverted });
+            }
+
+            uint32_t first = (uint32_t) arena.terms.size();
+            arena.terms.insert(arena.terms.end(), sum.begin(), sum.end());
+
+            return arena.append(OpKind::Sum, first, (uint32_t) sum.size());
+        }
+
+        uint32_t visit(std::shared_ptr<Product<T>> op) override { return nary(OpKind::Mul, OpKind::Div, op); }
+
+    private:
+        Arena<T>& arena;
+        std::unordered_map<const MathOp<T>*, uint32_t> appended;
+
+        /* The index of an operand, which add() appends before its users */
+        uint32_t added(const std::shared_ptr<MathOp<T>>& op) const { return appended.at(op.get()); }
+
+        uint32_t leaf(OpKind kind, std::shared_ptr<Value<T>> op)
+        {
+            return arena.append_leaf(kind, op);
+        }
+
+        uint32_t unary(OpKind kind, std::shared_ptr<MathUnaryOp<T>> op)
+        {
+            uint32_t x = added(op->get_x());
+            return arena.append(kind, x);
+        }
+
+        uint32_t binary(OpKind kind, std::shared_ptr<MathBinaryOp<T>> op)
+        {
+            uint32_t lhs = added(op->get_lhs());
+            uint32_t rhs = added(op->get_rhs());
+            return arena.append(kind, lhs, rhs);
+        }
+
+        /* Products are stored as the chain of binary operations they stand for */
+        uint32_t nary(OpKind kind, OpKind inverted_kind, std::shared_ptr<MathNaryOp<T>> op)
+        {
+            auto& terms = op->get_terms();
+
+            uint32_t result = added(terms[0].op);
+            if (terms[0].inverted)
+            {
+                result = arena.append(OpKind::Div, one(), result);
+            }
+
+            for (size_t i = 1; i < terms.size(); i++)
+            {
+                uint32_t rhs = added(terms[i].op);
+                result = arena.append(terms[i].inverted ? inverted_kind : kind, result, rhs);
+            }
+
+            return result;
+        }
+
+        uint32_t one()
+        {
+            arena.constants.push_back(1);
+            return arena.append(OpKind::ConstantValue, (uint32_t) arena.constants.size() - 1);
+        }
+    };
+};
+
+} /* namespace MathOps */
+
+#endif /* ARENA_H */
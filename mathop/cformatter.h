@@ -0,0 +1,283 @@
+#ifndef CFORMATTER_H
+#define CFORMATTER_H
+
+#include "algeblah.h"
+
+#include <sstream>
+#include <iomanip>
+#include <cmath>
+#include <unordered_map>
+#include <vector>
+
+namespace MathOps
+{
+
+/* C type name, math function suffix and literal suffix of a hardware floating point type */
+template<typename T> struct CType;
+template<> struct CType<float>
+{
+    static const char* name() { return "float"; }
+    static const char* suffix() { return "f"; }
+    static const char* literal_suffix() { return "F"; }
+};
+
+template<> struct CType<double>
+{
+    static const char* name() { return "double"; }
+    static const char* suffix() { return ""; }
+    static const char* literal_suffix() { return ""; }
+};
+
+template<> struct CType<long double>
+{
+    static const char* name() { return "long double"; }
+    static const char* suffix() { return "l"; }
+    static const char* literal_suffix() { return "L"; }
+};
+
+/* Formats a tree as a C expression. Containers are inlined, every value that can change is read
+ * from the input array 'v' (in the order returned by get_inputs()), and constants are written as
+ * exact hexadecimal literals. Every operation is parenthesized.
+ *
+ * Operations that are used more than once below the root are formatted once, as a temporary
+ * (t0, t1, ...) that the expression refers to. Otherwise, a tree that shares its subtrees would
+ * be written out in full along every path, which takes exponential space. The declarations of the
+ * temporaries are returned by get_temporaries(), which go in the function body before the
+ * expression.
+ *
+ * Sums are passed to a function that compensates them like Sum::result() does, as an array of
+ * their operands. Its definition is returned by get_preamble(), which goes before the
+ * expression. */
+template<typename T>
+struct CFormatter : FormatVisitor<T>
+{
+    /* root is the tree that will be formatted, to find the operations it shares */
+    explicit CFormatter(const std::shared_ptr<MathOp<T>>& root)
+    {
+        count_uses(root.get());
+    }
+
+    void visit(std::shared_ptr<ConstantSymbol<T>> op) override { this->out += literal(op->result()); }
+    void visit(std::shared_ptr<Variable<T>> op) override { this->out += input(op); }
+    void visit(std::shared_ptr<ValueVariable<T>> op) override { this->out += input(op); }
+    void visit(std::shared_ptr<NamedConstant<T>> op) override { this->out += literal(op->result()); }
+    void visit(std::shared_ptr<MutableValue<T>> op) override { this->out += input(op); }
+    void visit(std::shared_ptr<ConstantValue<T>> op) override { this->out += literal(op->result()); }
+
+    void visit(std::shared_ptr<Container<T>> op) override { operand(op->get_inner()); }
+
+    void visit(std::shared_ptr<Negate<T>> op) override
+    {
+        this->out += "(-";
+        operand(op->get_x());
+        this->out += ')';
+    }
+
+    void visit(std::shared_ptr<Sqrt<T>> op) override { function(op->get_x(), "sqrt"); }
+    void visit(std::shared_ptr<Log<T>> op) override { function(op->get_x(), "log"); }
+    void visit(std::shared_ptr<Log10<T>> op) override { function(op->get_x(), "log10"); }
+    void visit(std::shared_ptr<Sin<T>> op) override { function(op->get_x(), "sin"); }
+    void visit(std::shared_ptr<ASin<T>> op) override { function(op->get_x(), "asin"); }
+    void visit(std::shared_ptr<Cos<T>> op) override { function(op->get_x(), "cos"); }
+    void visit(std::shared_ptr<ACos<T>> op) override { function(op->get_x(), "acos"); }
+    void visit(std::shared_ptr<Tan<T>> op) override { function(op->get_x(), "tan"); }
+    void visit(std::shared_ptr<ATan<T>> op) override { function(op->get_x(), "atan"); }
+    void visit(std::shared_ptr<Sinh<T>> op) override { function(op->get_x(), "sinh"); }
+    void visit(std::shared_ptr<ASinh<T>> op) override { function(op->get_x(), "asinh"); }
+    void visit(std::shared_ptr<Cosh<T>> op) override { function(op->get_x(), "cosh"); }
+    void visit(std::shared_ptr<ACosh<T>> op) override { function(op->get_x(), "acosh"); }
+    void visit(std::shared_ptr<Tanh<T>> op) override { function(op->get_x(), "tanh"); }
+    void visit(std::shared_ptr<ATanh<T>> op) override { function(op->get_x(), "atanh"); }
+
+    void visit(std::shared_ptr<Pow<T>> op) override
+    {
+        this->out += "pow";
+        this->out += CType<T>::suffix();
+        this->out += '(';
+        operand(op->get_lhs());
+        this->out += ", ";
+        operand(op->get_rhs());
+        this->out += ')';
+    }
+
+    void visit(std::shared_ptr<Mul<T>> op) override { infix(op, " * "); }
+    void visit(std::shared_ptr<Div<T>> op) override { infix(op, " / "); }
+    void visit(std::shared_ptr<Add<T>> op) override { infix(op, " + "); }
+    void visit(std::shared_ptr<Sub<T>> op) override { infix(op, " - "); }
+
+    void visit(std::shared_ptr<Sum<T>> op) override { sum(op); }
+    void visit(std::shared_ptr<Product<T>> op) override { nary(op, " * ", " / ", "1 / "); }
+
+    const std::vector<std::shared_ptr<Value<T>>>& get_inputs() const { return inputs; }
+
+    /* Declarations of the temporaries the expression refers to, in the order they're needed */
+    const std::string& get_temporaries() const { return temporaries; }
+
+    /* Definitions of the functions the expression calls, if any */
+    std::string get_preamble() const
+    {
+        if (!has_sum)
+        {
+            return "";
+        }
+
+        std::string type = CType<T>::name();
+        std::string fabs = std::string("fabs") + CType<T>::suffix();
+
+        /* The same as CompensatedSum */
+        return "static " + type + " algeblah_sum(const " + type + "* x, unsigned long n)\n"
+               "{\n"
+               "    " + type + " total = x[0];\n"
+               "    " + type + " compensation = 0;\n"
+               "    for (unsigned long i = 1; i < n; i++)\n"
+               "    {\n"
+               "        " + type + " t = total + x[i];\n"
+               "        compensation += " + fabs + "(total) >= " + fabs + "(x[i]) ? (total - t) + x[i] : (x[i] - t) + total;\n"
+               "        total = t;\n"
+               "    }\n"
+               "    return isfinite(total) && compensation != 0 ? total + compensation : total;\n"
+               "}\n";
+    }
+
+private:
+    std::vector<std::shared_ptr<Value<T>>> inputs;
+    bool has_sum = false;
+    std::unordered_map<const MathOp<T>*, size_t> input_index;
+
+    /* How many times each operation is used, and the index of the temporary of each shared one */
+    std::unordered_map<const MathOp<T>*, size_t> uses;
+    std::unordered_map<const MathOp<T>*, size_t> temporary_index;
+    std::string temporaries;
+
+    void count_uses(const MathOp<T>* root)
+    {
+        std::vector<const MathOp<T>*> stack { root };
+        while (!stack.empty())
+        {
+            const MathOp<T>* op = stack.back();
+            stack.pop_back();
+
+            for (size_t i = 0; i < op->arity(); i++)
+            {
+                if (uses[op->operand(i)]++ == 0)
+                {
+                    stack.push_back(op->operand(i));
+                }
+            }
+        }
+    }
+
+    /* Formats an operand, or refers to its temporary if it's shared */
+    void operand(const std::shared_ptr<MathOp<T>>& op)
+    {
+        if (op->arity() == 0 || uses[op.get()] < 2)
+        {
+            this->apply(op);
+            return;
+        }
+
+        auto it = temporary_index.find(op.get());
+        if (it == temporary_index.end())
+        {
+            std::string expression = std::move(this->out);
+            this->out.clear();
+            this->apply(op);
+            std::swap(expression, this->out);
+
+            /* Temporaries that op uses are declared while formatting it, so before op's */
+            it = temporary_index.emplace(op.get(), temporary_index.size()).first;
+            temporaries += std::string("    const ") + CType<T>::name() + " t" + std::to_string(it->second) +
+                " = " + expression + ";\n";
+        }
+
+        this->out += "t" + std::to_string(it->second);
+    }
+
+    std::string input(std::shared_ptr<Value<T>> op)
+    {
+        auto it = input_index.find(op.get());
+        size_t index = it != input_index.end() ? it->second : inputs.size();
+        if (index == inputs.size())
+        {
+            inputs.push_back(op);
+            input_index[op.get()] = index;
+        }
+
+        return "v[" + std::to_string(index) + "]";
+    }
+
+    std::string literal(T x) const
+    {
+        if (std::isnan(x))
+        {
+            return "NAN";
+        }
+
+        if (std::isinf(x))
+        {
+            return x < 0 ? "(-INFINITY)" : "INFINITY";
+        }
+
+        std::stringstream ss;
+        ss << '(' << std::hexfloat << x << CType<T>::literal_suffix() << ')';
+        return ss.str();
+    }
+
+    void function(std::shared_ptr<MathOp<T>> x, const char* name)
+    {
+        this->out += name;
+        this->out += CType<T>::suffix();
+        this->out += '(';
+        operand(x);
+        this->out += ')';
+    }
+
+    void infix(std::shared_ptr<MathBinaryOp<T>> op, const char* symbol)
+    {
+        this->out += '(';
+        operand(op->get_lhs());
+        this->out += symbol;
+        operand(op->get_rhs());
+        this->out += ')';
+    }
+
+    /* An array of the operands, as a compound literal */
+    void sum(std::shared_ptr<Sum<T>> op)
+    {
+        has_sum = true;
+
+        auto& terms = op->get_terms();
+
+        this->out += "algeblah_sum((const ";
+        this->out += CType<T>::name();
+        this->out += "[]) { ";
+        for (size_t i = 0; i < terms.size(); i++)
+        {
+            this->out += i ? ", " : "";
+            this->out += terms[i].inverted ? "(-" : "";
+            operand(terms[i].op);
+            this->out += terms[i].inverted ? ")" : "";
+        }
+
+        this->out += " }, " + std::to_string(terms.size()) + ")";
+    }
+
+    /* Evaluated left to right, like the chain of binary operations it stands for */
+    void nary(std::shared_ptr<MathNaryOp<T>> op, const char* symbol, const char* inverted_symbol, const char* inverted_first)
+    {
+        this->out += '(';
+
+        auto& terms = op->get_terms();
+        for (size_t i = 0; i < terms.size(); i++)
+        {
+            this->out += terms[i].inverted ? (i ? inverted_symbol : inverted_first) : (i ? symbol : "");
+            operand(terms[i].op);
+        }
+
+        this->out += ')';
+    }
+};
+
+} /* namespace MathOps */
+
+#endif /* CFORMATTER_H */
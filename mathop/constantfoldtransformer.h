@@ -0,0 +1,107 @@
+#ifndef CONSTANTFOLDTRANSFORMER_H
+#define CONSTANTFOLDTRANSFORMER_H
+
+#include "dummytransformer.h"
+
+namespace MathOps
+{
+
+/* Collapses every operation whose operands are all constant values (after folding) into a single
+ * ConstantValue, evaluated at the current precision.
+ *
+ * Containers are left alone, as the lambda they refer to can be re-assigned, unless
+ * expand_containers is set, in which case they are expanded and folded into the result. */
+template <typename T>
+struct ConstantFoldTransformer : public DummyTransformer<T>
+{
+    ConstantFoldTransformer(bool expand_containers = false)
+        : expand_containers(expand_containers)
+    { }
+
+    std::shared_ptr<MathOp<T>> visit(std::shared_ptr<Container<T>> op) override
+    {
+        return expand_containers ? this->transformed(op->get_inner()) : op;
+    }
+
+    std::shared_ptr<MathOp<T>> visit(std::shared_ptr<Negate<T>> op) override { return unary(DummyTransformer<T>::visit(op)); }
+    std::shared_ptr<MathOp<T>> visit(std::shared_ptr<Sqrt<T>> op) override { return unary(DummyTransformer<T>::visit(op)); }
+    std::shared_ptr<MathOp<T>> visit(std::shared_ptr<Log<T>> op) override { return unary(DummyTransformer<T>::visit(op)); }
+    std::shared_ptr<MathOp<T>> visit(std::shared_ptr<Log10<T>> op) override { return unary(DummyTransformer<T>::visit(op)); }
+    std::shared_ptr<MathOp<T>> visit(std::shared_ptr<Sin<T>> op) override { return unary(DummyTransformer<T>::visit(op)); }
+    std::shared_ptr<MathOp<T>> visit(std::shared_ptr<ASin<T>> op) override { return unary(DummyTransformer<T>::visit(op)); }
+    std::shared_ptr<MathOp<T>> visit(std::shared_ptr<Cos<T>> op) override { return unary(DummyTransformer<T>::visit(op)); }
+    std::shared_ptr<MathOp<T>> visit(std::shared_ptr<ACos<T>> op) override { return unary(DummyTransformer<T>::visit(op)); }
+    std::shared_ptr<MathOp<T>> visit(std::shared_ptr<Tan<T>> op) override { return unary(DummyTransformer<T>::visit(op)); }
+    std::shared_ptr<MathOp<T>> visit(std::shared_ptr<ATan<T>> op) override { return unary(DummyTransformer<T>::visit(op)); }
+    std::shared_ptr<MathOp<T>> visit(std::shared_ptr<Sinh<T>> op) override { return unary(DummyTransformer<T>::visit(op)); }
+    std::shared_ptr<MathOp<T>> visit(std::shared_ptr<ASinh<T>> op) override { return unary(DummyTransformer<T>::visit(op)); }
+    std::shared_ptr<MathOp<T>> visit(std::shared_ptr<Cosh<T>> op) override { return unary(DummyTransformer<T>::visit(op)); }
+    std::shared_ptr<MathOp<T>> visit(std::shared_ptr<ACosh<T>> op) override { return unary(DummyTransformer<T>::visit(op)); }
+    std::shared_ptr<MathOp<T>> visit(std::shared_ptr<Tanh<T>> op) override { return unary(DummyTransformer<T>::visit(op)); }
+    std::shared_ptr<MathOp<T>> visit(std::shared_ptr<ATanh<T>> op) override { return unary(DummyTransformer<T>::visit(op)); }
+
+    std::shared_ptr<MathOp<T>> visit(std::shared_ptr<Pow<T>> op) override { return binary(DummyTransformer<T>::visit(op)); }
+    std::shared_ptr<MathOp<T>> visit(std::shared_ptr<Mul<T>> op) override { return binary(DummyTransformer<T>::visit(op)); }
+    std::shared_ptr<MathOp<T>> visit(std::shared_ptr<Div<T>> op) override { return binary(DummyTransformer<T>::visit(op)); }
+    std::shared_ptr<MathOp<T>> visit(std::shared_ptr<Add<T>> op) override { return binary(DummyTransformer<T>::visit(op)); }
+    std::shared_ptr<MathOp<T>> visit(std::shared_ptr<Sub<T>> op) override { return binary(DummyTransformer<T>::visit(op)); }
+
+    std::shared_ptr<MathOp<T>> visit(std::shared_ptr<Sum<T>> op) override { return nary(DummyTransformer<T>::visit(op)); }
+    std::shared_ptr<MathOp<T>> visit(std::shared_ptr<Product<T>> op) override { return nary(DummyTransformer<T>::visit(op)); }
+
+protected:
+    bool walks_into_containers() const override { return expand_containers; }
+
+private:
+    bool expand_containers;
+
+    /* Constant values, constant symbols and named constants. Containers are never literal, even
+     * if their inner expression is constant. */
+    static bool is_literal(std::shared_ptr<MathOp<T>> op)
+    {
+        return op->is_constant() && std::dynamic_pointer_cast<Value<T>>(op);
+    }
+
+    std::shared_ptr<MathOp<T>> unary(std::shared_ptr<MathOp<T>> op)
+    {
+        auto unary_op = std::static_pointer_cast<MathUnaryOp<T>>(op);
+
+        if (is_literal(unary_op->get_x()))
+        {
+            return ConstantValue<T>::create(op->result());
+        }
+
+        return op;
+    }
+
+    std::shared_ptr<MathOp<T>> binary(std::shared_ptr<MathOp<T>> op)
+    {
+        auto binary_op = std::static_pointer_cast<MathBinaryOp<T>>(op);
+
+        if (is_literal(binary_op->get_lhs()) && is_literal(binary_op->get_rhs()))
+        {
+            return ConstantValue<T>::create(op->result());
+        }
+
+        return op;
+    }
+
+    std::shared_ptr<MathOp<T>> nary(std::shared_ptr<MathOp<T>> op)
+    {
+        auto nary_op = std::static_pointer_cast<MathNaryOp<T>>(op);
+
+        for (auto& term: nary_op->get_terms())
+        {
+            if (!is_literal(term.op))
+            {
+                return op;
+            }
+        }
+
+        return ConstantValue<T>::create(op->result());
+    }
+};
+
+} /* namespace MathOps */
+
+#endif /* CONSTANTFOLDTRANSFORMER_H */
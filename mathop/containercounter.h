@@ -21,9 +21,9 @@ struct ContainerCounter : public Counter<T, Container<T>>
         return op->count(counter) ? counter.get_results()[0] : nullptr;
     }
 
-    VisitorResult<T> visit(std::shared_ptr<Container<T>> op) override
+    int visit(std::shared_ptr<Container<T>> op) override
     {
-        return count(op) + std::get<int>(Counter<T, Container<T>>::visit(op));
+        return count(op) + Counter<T, Container<T>>::visit(op);
     }
 
 private:
@@ -5,123 +5,180 @@
 
 #include <sstream>
 #include <iomanip>
+#include <initializer_list>
+#include <iterator>
+#include <vector>
 
 namespace MathOps
 {
 
 template<typename T>
-struct DefaultFormatter : Visitor<T>
+struct DefaultFormatter : FormatVisitor<T>
 {
     DefaultFormatter(int precision)
-     : DefaultFormatter(precision, false)
+     : precision(precision)
     { }
 
-    VisitorResult<T> visit(std::shared_ptr<ConstantSymbol<T>> op) override { return op->get_name(); }
-    VisitorResult<T> visit(std::shared_ptr<Variable<T>> op) override { return op->get_name(); }
-    VisitorResult<T> visit(std::shared_ptr<ValueVariable<T>> op) override { return value_to_string(op->result()); }
-    VisitorResult<T> visit(std::shared_ptr<NamedConstant<T>> op) override { return op->get_name(); }
-    VisitorResult<T> visit(std::shared_ptr<MutableValue<T>> op) override { return value_to_string(op->result()); }
-    VisitorResult<T> visit(std::shared_ptr<ConstantValue<T>> op) override { return value_to_string(op->result()); }
-
-    VisitorResult<T> visit(std::shared_ptr<Container<T>> op) override { return op->get_name(); }
-
-    VisitorResult<T> visit(std::shared_ptr<Negate<T>> op) override { return str_unary_sign(op, op->get_x(), "-"); }
-    VisitorResult<T> visit(std::shared_ptr<Sqrt<T>> op) override { return str_unary(op->get_x(), "sqrt"); }
-    VisitorResult<T> visit(std::shared_ptr<Log<T>> op) override { return str_unary(op->get_x(), "log"); }
-    VisitorResult<T> visit(std::shared_ptr<Log10<T>> op) override { return str_unary(op->get_x(), "log10"); }
-    VisitorResult<T> visit(std::shared_ptr<Sin<T>> op) override { return str_unary(op->get_x(), "sin"); }
-    VisitorResult<T> visit(std::shared_ptr<ASin<T>> op) override { return str_unary(op->get_x(), "asin"); }
-    VisitorResult<T> visit(std::shared_ptr<Cos<T>> op) override { return str_unary(op->get_x(), "cos"); }
-    VisitorResult<T> visit(std::shared_ptr<ACos<T>> op) override { return str_unary(op->get_x(), "acos"); }
-    VisitorResult<T> visit(std::shared_ptr<Tan<T>> op) override { return str_unary(op->get_x(), "tan"); }
-    VisitorResult<T> visit(std::shared_ptr<ATan<T>> op) override { return str_unary(op->get_x(), "atan"); }
-    VisitorResult<T> visit(std::shared_ptr<Sinh<T>> op) override { return str_unary(op->get_x(), "sinh"); }
-    VisitorResult<T> visit(std::shared_ptr<ASinh<T>> op) override { return str_unary(op->get_x(), "asinh"); }
-    VisitorResult<T> visit(std::shared_ptr<Cosh<T>> op) override { return str_unary(op->get_x(), "cosh"); }
-    VisitorResult<T> visit(std::shared_ptr<ACosh<T>> op) override { return str_unary(op->get_x(), "acosh"); }
-    VisitorResult<T> visit(std::shared_ptr<Tanh<T>> op) override { return str_unary(op->get_x(), "tanh"); }
-    VisitorResult<T> visit(std::shared_ptr<ATanh<T>> op) override { return str_unary(op->get_x(), "atanh"); }
-
-    VisitorResult<T> visit(std::shared_ptr<Pow<T>> op) override { return str_binary(op, op->get_lhs(), op->get_rhs(), " ^ "); }
-    VisitorResult<T> visit(std::shared_ptr<Mul<T>> op) override { return str_binary(op, op->get_lhs(), op->get_rhs(), " * "); }
-    VisitorResult<T> visit(std::shared_ptr<Div<T>> op) override { return str_binary(op, op->get_lhs(), op->get_rhs(), " / "); }
-    VisitorResult<T> visit(std::shared_ptr<Add<T>> op) override { return str_binary(op, op->get_lhs(), op->get_rhs(), " + "); }
-    VisitorResult<T> visit(std::shared_ptr<Sub<T>> op) override { return str_binary(op, op->get_lhs(), op->get_rhs(), " - "); }
+    void visit(std::shared_ptr<ConstantSymbol<T>> op) override { this->out += op->get_name(); }
+    void visit(std::shared_ptr<Variable<T>> op) override { this->out += op->get_name(); }
+    void visit(std::shared_ptr<ValueVariable<T>> op) override { this->out += value_to_string(op->result()); }
+    void visit(std::shared_ptr<NamedConstant<T>> op) override { this->out += op->get_name(); }
+    void visit(std::shared_ptr<MutableValue<T>> op) override { this->out += value_to_string(op->result()); }
+    void visit(std::shared_ptr<ConstantValue<T>> op) override { this->out += value_to_string(op->result()); }
+
+    void visit(std::shared_ptr<Container<T>> op) override { this->out += op->get_name(); }
+
+    void visit(std::shared_ptr<Negate<T>> op) override { str_unary_sign(op, op->get_x(), "-"); }
+    void visit(std::shared_ptr<Sqrt<T>> op) override { str_unary(op->get_x(), "sqrt"); }
+    void visit(std::shared_ptr<Log<T>> op) override { str_unary(op->get_x(), "log"); }
+    void visit(std::shared_ptr<Log10<T>> op) override { str_unary(op->get_x(), "log10"); }
+    void visit(std::shared_ptr<Sin<T>> op) override { str_unary(op->get_x(), "sin"); }
+    void visit(std::shared_ptr<ASin<T>> op) override { str_unary(op->get_x(), "asin"); }
+    void visit(std::shared_ptr<Cos<T>> op) override { str_unary(op->get_x(), "cos"); }
+    void visit(std::shared_ptr<ACos<T>> op) override { str_unary(op->get_x(), "acos"); }
+    void visit(std::shared_ptr<Tan<T>> op) override { str_unary(op->get_x(), "tan"); }
+    void visit(std::shared_ptr<ATan<T>> op) override { str_unary(op->get_x(), "atan"); }
+    void visit(std::shared_ptr<Sinh<T>> op) override { str_unary(op->get_x(), "sinh"); }
+    void visit(std::shared_ptr<ASinh<T>> op) override { str_unary(op->get_x(), "asinh"); }
+    void visit(std::shared_ptr<Cosh<T>> op) override { str_unary(op->get_x(), "cosh"); }
+    void visit(std::shared_ptr<ACosh<T>> op) override { str_unary(op->get_x(), "acosh"); }
+    void visit(std::shared_ptr<Tanh<T>> op) override { str_unary(op->get_x(), "tanh"); }
+    void visit(std::shared_ptr<ATanh<T>> op) override { str_unary(op->get_x(), "atanh"); }
+
+    void visit(std::shared_ptr<Pow<T>> op) override { str_binary(op, op->get_lhs(), op->get_rhs(), " ^ "); }
+    void visit(std::shared_ptr<Mul<T>> op) override { str_binary(op, op->get_lhs(), op->get_rhs(), " * "); }
+    void visit(std::shared_ptr<Div<T>> op) override { str_binary(op, op->get_lhs(), op->get_rhs(), " / "); }
+    void visit(std::shared_ptr<Add<T>> op) override { str_binary(op, op->get_lhs(), op->get_rhs(), " + "); }
+    void visit(std::shared_ptr<Sub<T>> op) override { str_binary(op, op->get_lhs(), op->get_rhs(), " - "); }
+
+    void visit(std::shared_ptr<Sum<T>> op) override { str_nary(op, " + ", " - ", "-"); }
+    void visit(std::shared_ptr<Product<T>> op) override { str_nary(op, " * ", " / ", "1 / "); }
 
 private:
-    DefaultFormatter(int precision, bool parenthesize)
-     : precision(precision), parenthesize(parenthesize)
-    { }
-
     const int precision;
-    const bool parenthesize;
 
-    std::string value_to_string(T x) const
-    {
-        std::stringstream ss;
-        ss << std::setprecision(precision) << x;
-        return ss.str();        
-    }
+    /* Whether the operation being formatted needs parentheses. Set before each one is formatted. */
+    bool parenthesize = false;
 
-    std::string str_binary(std::shared_ptr<MathOp<T>> op,
-        std::shared_ptr<MathOp<T>> lhs, std::shared_ptr<MathOp<T>> rhs, std::string symbol)
+    /* A piece of the output that's yet to be written: either an operation to format, or text */
+    struct Piece
     {
-        bool right_associative = op->right_associative();
-        std::stringstream ss;
+        MathOp<T>* op;
+        const char* text;
+        bool parenthesize;
+    };
 
-        if (parenthesize)
+    /* Operations queue the pieces they're made of, rather than formatting their operands
+     * recursively, and the outermost call writes them out from a loop. This way, the stack usage
+     * doesn't depend on the depth of the tree. */
+    std::vector<Piece> pending;
+    bool writing = false;
+
+    static Piece text(const char* text) { return Piece { nullptr, text, false }; }
+
+    template<typename It>
+    void write(It begin, It end)
+    {
+        pending.insert(pending.end(), std::make_reverse_iterator(end), std::make_reverse_iterator(begin));
+        if (writing)
         {
-            ss << '(';
+            return;
         }
 
-        side_to_stream(ss, op, lhs, right_associative);
-        ss << symbol;
-        side_to_stream(ss, op, rhs, !right_associative);
+        writing = true;
 
-        if (parenthesize)
+        while (!pending.empty())
         {
-            ss << ')';
+            Piece next = pending.back();
+            pending.pop_back();
+
+            if (!next.op)
+            {
+                this->out += next.text;
+                continue;
+            }
+
+            parenthesize = next.parenthesize;
+            this->apply(*next.op);
         }
 
-        return ss.str();
+        writing = false;
     }
 
-    void side_to_stream(std::stringstream& ss, std::shared_ptr<MathOp<T>> op, std::shared_ptr<MathOp<T>> side,
-        bool use_commutation)
+    void write(std::initializer_list<Piece> pieces) { write(pieces.begin(), pieces.end()); }
+
+    std::string value_to_string(T x) const
+    {
+        std::stringstream ss;
+        ss << std::setprecision(precision) << x;
+        return ss.str();        
+    }
+
+    void str_binary(std::shared_ptr<MathOp<T>> op,
+        std::shared_ptr<MathOp<T>> lhs, std::shared_ptr<MathOp<T>> rhs, const char* symbol)
+    {
+        bool right_associative = op->right_associative();
+
+        write({ text(parenthesize ? "(" : ""),
+                side_piece(op, lhs, right_associative),
+                text(symbol),
+                side_piece(op, rhs, !right_associative),
+                text(parenthesize ? ")" : "") });
+    }
+
+    Piece side_piece(std::shared_ptr<MathOp<T>> op, std::shared_ptr<MathOp<T>> side, bool use_commutation)
     {
         Bodmas parent_precedence = op->precedence();
         bool use_parens = !use_commutation || op->is_commutative()
             ? parent_precedence < side->precedence()
             : parent_precedence <= side->precedence();
 
-        ss << side->format(DefaultFormatter(precision, use_parens));
+        return Piece { side.get(), nullptr, use_parens };
     }
 
-    std::string str_unary_sign(std::shared_ptr<MathOp<T>> op,
-        std::shared_ptr<MathOp<T>> x, std::string symbol)
+    /* Formatted like the chain of binary operations it stands for. An inverted operand is
+     * parenthesized like the right hand side of a subtraction or division. */
+    void str_nary(std::shared_ptr<MathNaryOp<T>> op, const char* symbol, const char* inverted_symbol, const char* inverted_first)
     {
-        std::stringstream ss;
+        auto& terms = op->get_terms();
+
+        std::vector<Piece> pieces;
+        pieces.reserve(terms.size() * 2 + 2);
+        pieces.push_back(text(parenthesize ? "(" : ""));
 
-        if (parenthesize)
+        for (size_t i = 0; i < terms.size(); i++)
         {
-            ss << '(';
+            pieces.push_back(text(terms[i].inverted ? (i ? inverted_symbol : inverted_first) : (i ? symbol : "")));
+            pieces.push_back(term_piece(op, terms[i]));
         }
 
-        ss << symbol;
+        pieces.push_back(text(parenthesize ? ")" : ""));
+        write(pieces.begin(), pieces.end());
+    }
 
-        side_to_stream(ss, op, x, true);
+    Piece term_piece(std::shared_ptr<MathNaryOp<T>> op, const typename MathNaryOp<T>::Term& term)
+    {
+        Bodmas parent_precedence = op->precedence();
+        bool use_parens = term.inverted
+            ? parent_precedence <= term.op->precedence()
+            : parent_precedence < term.op->precedence();
 
-        if (parenthesize)
-        {
-            ss << ')';
-        }
+        return Piece { term.op.get(), nullptr, use_parens };
+    }
 
-        return ss.str();
+    void str_unary_sign(std::shared_ptr<MathOp<T>> op,
+        std::shared_ptr<MathOp<T>> x, const char* symbol)
+    {
+        write({ text(parenthesize ? "(" : ""),
+                text(symbol),
+                side_piece(op, x, true),
+                text(parenthesize ? ")" : "") });
     }
 
-    std::string str_unary(std::shared_ptr<MathOp<T>> x, std::string symbol)
+    /* The operand inherits whether to parenthesize */
+    void str_unary(std::shared_ptr<MathOp<T>> x, const char* symbol)
     {
-        return symbol + "(" + x->format(*this) + ")";            
+        write({ text(symbol), text("("), Piece { x.get(), nullptr, parenthesize }, text(")") });
     }
 };
 
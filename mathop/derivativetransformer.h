@@ -0,0 +1,289 @@
+#ifndef DERIVATIVETRANSFORMER_H
+#define DERIVATIVETRANSFORMER_H
+
+#include "dummytransformer.h"
+
+#include <unordered_map>
+
+namespace MathOps
+{
+
+/* Transforms a tree into its derivative with respect to the given value. Containers are expanded,
+ * as their inner expression may depend on the value. Every other value is treated as constant.
+ *
+ * Terms that are known to be zero or one are left out as the derivative is built, so the result
+ * of differentiating a subtree that doesn't depend on the value is a single constant. */
+template <typename T>
+struct DerivativeTransformer : public DummyTransformer<T>
+{
+    DerivativeTransformer(std::shared_ptr<MathOp<T>> with_respect_to)
+        : with_respect_to(with_respect_to),
+          zero(ConstantValue<T>::create(0)),
+          one(ConstantValue<T>::create(1))
+    { }
+
+    std::shared_ptr<MathOp<T>> visit(std::shared_ptr<ConstantSymbol<T>> op) override { return value(op); }
+    std::shared_ptr<MathOp<T>> visit(std::shared_ptr<Variable<T>> op) override { return value(op); }
+    std::shared_ptr<MathOp<T>> visit(std::shared_ptr<ValueVariable<T>> op) override { return value(op); }
+    std::shared_ptr<MathOp<T>> visit(std::shared_ptr<NamedConstant<T>> op) override { return value(op); }
+    std::shared_ptr<MathOp<T>> visit(std::shared_ptr<MutableValue<T>> op) override { return value(op); }
+    std::shared_ptr<MathOp<T>> visit(std::shared_ptr<ConstantValue<T>> op) override { return value(op); }
+
+    std::shared_ptr<MathOp<T>> visit(std::shared_ptr<Container<T>> op) override { return derivative(op->get_inner()); }
+
+    std::shared_ptr<MathOp<T>> visit(std::shared_ptr<Negate<T>> op) override
+    {
+        return neg(derivative(op->get_x()));
+    }
+
+    /* d sqrt(x) = dx / (2 * sqrt(x)) */
+    std::shared_ptr<MathOp<T>> visit(std::shared_ptr<Sqrt<T>> op) override
+    {
+        return div(derivative(op->get_x()), constant(2) * op);
+    }
+
+    /* d log(x) = dx / x */
+    std::shared_ptr<MathOp<T>> visit(std::shared_ptr<Log<T>> op) override
+    {
+        return div(derivative(op->get_x()), op->get_x());
+    }
+
+    /* d log10(x) = dx / (x * log(10)) */
+    std::shared_ptr<MathOp<T>> visit(std::shared_ptr<Log10<T>> op) override
+    {
+        return div(derivative(op->get_x()), op->get_x() * log(constant(10)));
+    }
+
+    /* d sin(x) = cos(x) * dx */
+    std::shared_ptr<MathOp<T>> visit(std::shared_ptr<Sin<T>> op) override
+    {
+        return mul(derivative(op->get_x()), cos(op->get_x()));
+    }
+
+    /* d asin(x) = dx / sqrt(1 - x^2) */
+    std::shared_ptr<MathOp<T>> visit(std::shared_ptr<ASin<T>> op) override
+    {
+        return div(derivative(op->get_x()), sqrt(one - square(op->get_x())));
+    }
+
+    /* d cos(x) = -sin(x) * dx */
+    std::shared_ptr<MathOp<T>> visit(std::shared_ptr<Cos<T>> op) override
+    {
+        return neg(mul(derivative(op->get_x()), sin(op->get_x())));
+    }
+
+    /* d acos(x) = -dx / sqrt(1 - x^2) */
+    std::shared_ptr<MathOp<T>> visit(std::shared_ptr<ACos<T>> op) override
+    {
+        return neg(div(derivative(op->get_x()), sqrt(one - square(op->get_x()))));
+    }
+
+    /* d tan(x) = dx / cos(x)^2 */
+    std::shared_ptr<MathOp<T>> visit(std::shared_ptr<Tan<T>> op) override
+    {
+        return div(derivative(op->get_x()), square(cos(op->get_x())));
+    }
+
+    /* d atan(x) = dx / (1 + x^2) */
+    std::shared_ptr<MathOp<T>> visit(std::shared_ptr<ATan<T>> op) override
+    {
+        return div(derivative(op->get_x()), one + square(op->get_x()));
+    }
+
+    /* d sinh(x) = cosh(x) * dx */
+    std::shared_ptr<MathOp<T>> visit(std::shared_ptr<Sinh<T>> op) override
+    {
+        return mul(derivative(op->get_x()), cosh(op->get_x()));
+    }
+
+    /* d asinh(x) = dx / sqrt(x^2 + 1) */
+    std::shared_ptr<MathOp<T>> visit(std::shared_ptr<ASinh<T>> op) override
+    {
+        return div(derivative(op->get_x()), sqrt(square(op->get_x()) + one));
+    }
+
+    /* d cosh(x) = sinh(x) * dx */
+    std::shared_ptr<MathOp<T>> visit(std::shared_ptr<Cosh<T>> op) override
+    {
+        return mul(derivative(op->get_x()), sinh(op->get_x()));
+    }
+
+    /* d acosh(x) = dx / sqrt(x^2 - 1) */
+    std::shared_ptr<MathOp<T>> visit(std::shared_ptr<ACosh<T>> op) override
+    {
+        return div(derivative(op->get_x()), sqrt(square(op->get_x()) - one));
+    }
+
+    /* d tanh(x) = dx / cosh(x)^2 */
+    std::shared_ptr<MathOp<T>> visit(std::shared_ptr<Tanh<T>> op) override
+    {
+        return div(derivative(op->get_x()), square(cosh(op->get_x())));
+    }
+
+    /* d atanh(x) = dx / (1 - x^2) */
+    std::shared_ptr<MathOp<T>> visit(std::shared_ptr<ATanh<T>> op) override
+    {
+        return div(derivative(op->get_x()), one - square(op->get_x()));
+    }
+
+    /* d a^b = b * a^(b - 1) * da + a^b * log(a) * db */
+    std::shared_ptr<MathOp<T>> visit(std::shared_ptr<Pow<T>> op) override
+    {
+        auto a = op->get_lhs();
+        auto b = op->get_rhs();
+        auto da = derivative(a);
+        auto db = derivative(b);
+
+        auto d_base = da == zero ? zero : mul(mul(b, Pow<T>::create(a, b - one)), da);
+        auto d_exponent = db == zero ? zero : mul(mul(op, log(a)), db);
+
+        return add(d_base, d_exponent);
+    }
+
+    /* d (a * b) = da * b + a * db */
+    std::shared_ptr<MathOp<T>> visit(std::shared_ptr<Mul<T>> op) override
+    {
+        return add(mul(derivative(op->get_lhs()), op->get_rhs()), mul(op->get_lhs(), derivative(op->get_rhs())));
+    }
+
+    /* d (a / b) = da / b - a * db / b^2 */
+    std::shared_ptr<MathOp<T>> visit(std::shared_ptr<Div<T>> op) override
+    {
+        auto b = op->get_rhs();
+        auto db = derivative(b);
+
+        return sub(div(derivative(op->get_lhs()), b), db == zero ? zero : div(mul(op->get_lhs(), db), square(b)));
+    }
+
+    std::shared_ptr<MathOp<T>> visit(std::shared_ptr<Add<T>> op) override
+    {
+        return add(derivative(op->get_lhs()), derivative(op->get_rhs()));
+    }
+
+    std::shared_ptr<MathOp<T>> visit(std::shared_ptr<Sub<T>> op) override
+    {
+        return sub(derivative(op->get_lhs()), derivative(op->get_rhs()));
+    }
+
+    /* d (a + b - c) = da + db - dc */
+    std::shared_ptr<MathOp<T>> visit(std::shared_ptr<Sum<T>> op) override
+    {
+        std::vector<Term> terms;
+        for (auto& term: op->get_terms())
+        {
+            auto d = derivative(term.op);
+            if (d != zero)
+            {
+                terms.push_back(Term { d, term.inverted });
+            }
+        }
+
+        return sum(std::move(terms));
+    }
+
+    /* d (a * b / c) = da * b / c + a * db / c - a * b * dc / c^2 */
+    std::shared_ptr<MathOp<T>> visit(std::shared_ptr<Product<T>> op) override
+    {
+        auto& factors = op->get_terms();
+
+        std::vector<Term> terms;
+        for (size_t i = 0; i < factors.size(); i++)
+        {
+            auto d = derivative(factors[i].op);
+            if (d == zero)
+            {
+                continue;
+            }
+
+            auto product = factors;
+            product[i] = Term { d, false };
+            if (factors[i].inverted)
+            {
+                product.push_back(Term { square(factors[i].op), true });
+            }
+
+            if (d == one)
+            {
+                product.erase(product.begin() + i);
+            }
+
+            if (product.size() == 1)
+            {
+                terms.push_back(Term { product[0].inverted ? one / product[0].op : product[0].op, factors[i].inverted });
+                continue;
+            }
+
+            terms.push_back(Term { Product<T>::create(std::move(product)), factors[i].inverted });
+        }
+
+        return sum(std::move(terms));
+    }
+
+protected:
+    bool walks_into_containers() const override { return true; }
+
+private:
+    typedef typename MathNaryOp<T>::Term Term;
+
+    const std::shared_ptr<MathOp<T>> with_respect_to;
+    const std::shared_ptr<MathOp<T>> zero;
+    const std::shared_ptr<MathOp<T>> one;
+
+    /* Subtrees that are shared are only differentiated once */
+    std::unordered_map<const MathOp<T>*, std::shared_ptr<MathOp<T>>> derivatives;
+
+    std::shared_ptr<MathOp<T>> derivative(const std::shared_ptr<MathOp<T>>& op)
+    {
+        auto it = derivatives.find(op.get());
+        if (it != derivatives.end())
+        {
+            return it->second;
+        }
+
+        auto result = this->transformed(op);
+        derivatives.emplace(op.get(), result);
+
+        return result;
+    }
+
+    std::shared_ptr<MathOp<T>> value(std::shared_ptr<MathOp<T>> op) { return op == with_respect_to ? one : zero; }
+
+    static std::shared_ptr<MathOp<T>> constant(T x) { return ConstantValue<T>::create(x); }
+    static std::shared_ptr<MathOp<T>> square(std::shared_ptr<MathOp<T>> x) { return Pow<T>::create(x, constant(2)); }
+
+    std::shared_ptr<MathOp<T>> neg(std::shared_ptr<MathOp<T>> x) { return x == zero ? zero : -x; }
+
+    std::shared_ptr<MathOp<T>> add(std::shared_ptr<MathOp<T>> lhs, std::shared_ptr<MathOp<T>> rhs)
+    {
+        return lhs == zero ? rhs : rhs == zero ? lhs : lhs + rhs;
+    }
+
+    std::shared_ptr<MathOp<T>> sub(std::shared_ptr<MathOp<T>> lhs, std::shared_ptr<MathOp<T>> rhs)
+    {
+        return rhs == zero ? lhs : lhs == zero ? -rhs : lhs - rhs;
+    }
+
+    std::shared_ptr<MathOp<T>> mul(std::shared_ptr<MathOp<T>> lhs, std::shared_ptr<MathOp<T>> rhs)
+    {
+        return lhs == zero || rhs == zero ? zero : lhs == one ? rhs : rhs == one ? lhs : lhs * rhs;
+    }
+
+    std::shared_ptr<MathOp<T>> div(std::shared_ptr<MathOp<T>> lhs, std::shared_ptr<MathOp<T>> rhs)
+    {
+        return lhs == zero ? zero : lhs / rhs;
+    }
+
+    std::shared_ptr<MathOp<T>> sum(std::vector<Term> terms)
+    {
+        if (terms.size() < 2)
+        {
+            return terms.empty() ? zero : terms[0].inverted ? neg(terms[0].op) : terms[0].op;
+        }
+
+        return Sum<T>::create(std::move(terms));
+    }
+};
+
+} /* namespace MathOps */
+
+#endif /* DERIVATIVETRANSFORMER_H */
@@ -1,7 +1,7 @@
 #ifndef DUMMYTRANSFORMER_H
 #define DUMMYTRANSFORMER_H
 
-#include "algeblah.h"
+#include "walker.h"
 
 namespace MathOps
 {
@@ -15,123 +15,177 @@ namespace MathOps
  *       - to set a new internal MathOp in the existing Container, but we should not alter the original tree
  */
 template <typename T>
-struct DummyTransformer : public Visitor<T>
+struct DummyTransformer : public TransformWalker<T>
 {
-    virtual VisitorResult<T> visit(std::shared_ptr<ConstantSymbol<T>> op) override { return op; }
-    virtual VisitorResult<T> visit(std::shared_ptr<Variable<T>> op) override { return op; }
-    virtual VisitorResult<T> visit(std::shared_ptr<ValueVariable<T>> op) override { return op; }
-    virtual VisitorResult<T> visit(std::shared_ptr<NamedConstant<T>> op) override { return op; }
-    virtual VisitorResult<T> visit(std::shared_ptr<MutableValue<T>> op) override { return op; }
-    virtual VisitorResult<T> visit(std::shared_ptr<ConstantValue<T>> op) override { return op; }
-
-    virtual VisitorResult<T> visit(std::shared_ptr<Container<T>> op) override { return op; }
+    virtual std::shared_ptr<MathOp<T>> visit(std::shared_ptr<ConstantSymbol<T>> op) override { return op; }
+    virtual std::shared_ptr<MathOp<T>> visit(std::shared_ptr<Variable<T>> op) override { return op; }
+    virtual std::shared_ptr<MathOp<T>> visit(std::shared_ptr<ValueVariable<T>> op) override { return op; }
+    virtual std::shared_ptr<MathOp<T>> visit(std::shared_ptr<NamedConstant<T>> op) override { return op; }
+    virtual std::shared_ptr<MathOp<T>> visit(std::shared_ptr<MutableValue<T>> op) override { return op; }
+    virtual std::shared_ptr<MathOp<T>> visit(std::shared_ptr<ConstantValue<T>> op) override { return op; }
+
+    virtual std::shared_ptr<MathOp<T>> visit(std::shared_ptr<Container<T>> op) override { return op; }
     // {
-    //     return op->get_inner()->transform(*this);
+    //     return this->transformed(op->get_inner());
     // }
 
-    virtual VisitorResult<T> visit(std::shared_ptr<Negate<T>> op) override
+    virtual std::shared_ptr<MathOp<T>> visit(std::shared_ptr<Negate<T>> op) override
     {
-        return -(op->get_x()->transform(*this));
+        return rebuilt(op, this->transformed(op->get_x()));
     }
 
-    virtual VisitorResult<T> visit(std::shared_ptr<Sqrt<T>> op) override
+    virtual std::shared_ptr<MathOp<T>> visit(std::shared_ptr<Sqrt<T>> op) override
     {
-        return sqrt(op->get_x()->transform(*this));
+        return rebuilt(op, this->transformed(op->get_x()));
     }
 
-    virtual VisitorResult<T> visit(std::shared_ptr<Log<T>> op) override
+    virtual std::shared_ptr<MathOp<T>> visit(std::shared_ptr<Log<T>> op) override
     {
-        return log(op->get_x()->transform(*this));
+        return rebuilt(op, this->transformed(op->get_x()));
     }
 
-    virtual VisitorResult<T> visit(std::shared_ptr<Log10<T>> op) override
+    virtual std::shared_ptr<MathOp<T>> visit(std::shared_ptr<Log10<T>> op) override
     {
-        return log10(op->get_x()->transform(*this));
+        return rebuilt(op, this->transformed(op->get_x()));
     }
 
-    virtual VisitorResult<T> visit(std::shared_ptr<Sin<T>> op) override
+    virtual std::shared_ptr<MathOp<T>> visit(std::shared_ptr<Sin<T>> op) override
     {
-        return sin(op->get_x()->transform(*this));
+        return rebuilt(op, this->transformed(op->get_x()));
     }
 
-    virtual VisitorResult<T> visit(std::shared_ptr<ASin<T>> op) override
+    virtual std::shared_ptr<MathOp<T>> visit(std::shared_ptr<ASin<T>> op) override
     {
-        return asin(op->get_x()->transform(*this));
+        return rebuilt(op, this->transformed(op->get_x()));
     }
 
-    virtual VisitorResult<T> visit(std::shared_ptr<Cos<T>> op) override
+    virtual std::shared_ptr<MathOp<T>> visit(std::shared_ptr<Cos<T>> op) override
     {
-        return cos(op->get_x()->transform(*this));
+        return rebuilt(op, this->transformed(op->get_x()));
     }
 
-    virtual VisitorResult<T> visit(std::shared_ptr<ACos<T>> op) override
+    virtual std::shared_ptr<MathOp<T>> visit(std::shared_ptr<ACos<T>> op) override
     {
-        return acos(op->get_x()->transform(*this));
+        return rebuilt(op, this->transformed(op->get_x()));
     }
 
-    virtual VisitorResult<T> visit(std::shared_ptr<Tan<T>> op) override
+    virtual std::shared_ptr<MathOp<T>> visit(std::shared_ptr<Tan<T>> op) override
     {
-        return tan(op->get_x()->transform(*this));
+        return rebuilt(op, this->transformed(op->get_x()));
     }
 
-    virtual VisitorResult<T> visit(std::shared_ptr<ATan<T>> op) override
+    virtual std::shared_ptr<MathOp<T>> visit(std::shared_ptr<ATan<T>> op) override
     {
-        return atan(op->get_x()->transform(*this));
+        return rebuilt(op, this->transformed(op->get_x()));
     }
 
-    virtual VisitorResult<T> visit(std::shared_ptr<Sinh<T>> op) override
+    virtual std::shared_ptr<MathOp<T>> visit(std::shared_ptr<Sinh<T>> op) override
     {
-        return sinh(op->get_x()->transform(*this));
+        return rebuilt(op, this->transformed(op->get_x()));
     }
 
-    virtual VisitorResult<T> visit(std::shared_ptr<ASinh<T>> op) override
+    virtual std::shared_ptr<MathOp<T>> visit(std::shared_ptr<ASinh<T>> op) override
     {
-        return asinh(op->get_x()->transform(*this));
+        return rebuilt(op, this->transformed(op->get_x()));
     }
 
-    virtual VisitorResult<T> visit(std::shared_ptr<Cosh<T>> op) override
+    virtual std::shared_ptr<MathOp<T>> visit(std::shared_ptr<Cosh<T>> op) override
     {
-        return cosh(op->get_x()->transform(*this));
+        return rebuilt(op, this->transformed(op->get_x()));
     }
 
-    virtual VisitorResult<T> visit(std::shared_ptr<ACosh<T>> op) override
+    virtual std::shared_ptr<MathOp<T>> visit(std::shared_ptr<ACosh<T>> op) override
     {
-        return acosh(op->get_x()->transform(*this));
+        return rebuilt(op, this->transformed(op->get_x()));
     }
 
-    virtual VisitorResult<T> visit(std::shared_ptr<Tanh<T>> op) override
+    virtual std::shared_ptr<MathOp<T>> visit(std::shared_ptr<Tanh<T>> op) override
     {
-        return tanh(op->get_x()->transform(*this));
+        return rebuilt(op, this->transformed(op->get_x()));
     }
 
-    virtual VisitorResult<T> visit(std::shared_ptr<ATanh<T>> op) override
+    virtual std::shared_ptr<MathOp<T>> visit(std::shared_ptr<ATanh<T>> op) override
     {
-        return atanh(op->get_x()->transform(*this));
+        return rebuilt(op, this->transformed(op->get_x()));
     }
 
-    virtual VisitorResult<T> visit(std::shared_ptr<Pow<T>> op) override
+    virtual std::shared_ptr<MathOp<T>> visit(std::shared_ptr<Pow<T>> op) override
     {
-        return Pow<T>::create(op->get_lhs()->transform(*this), op->get_rhs()->transform(*this));
+        return rebuilt(op, this->transformed(op->get_lhs()), this->transformed(op->get_rhs()));
     }
 
-    virtual VisitorResult<T> visit(std::shared_ptr<Mul<T>> op) override
+    virtual std::shared_ptr<MathOp<T>> visit(std::shared_ptr<Mul<T>> op) override
     {
-        return op->get_lhs()->transform(*this) * op->get_rhs()->transform(*this);
+        return rebuilt(op, this->transformed(op->get_lhs()), this->transformed(op->get_rhs()));
     }
 
-    virtual VisitorResult<T> visit(std::shared_ptr<Div<T>> op) override
+    virtual std::shared_ptr<MathOp<T>> visit(std::shared_ptr<Div<T>> op) override
     {
-        return op->get_lhs()->transform(*this) / op->get_rhs()->transform(*this);
+        return rebuilt(op, this->transformed(op->get_lhs()), this->transformed(op->get_rhs()));
     }
 
-    virtual VisitorResult<T> visit(std::shared_ptr<Add<T>> op) override
+    virtual std::shared_ptr<MathOp<T>> visit(std::shared_ptr<Add<T>> op) override
     {
-        return op->get_lhs()->transform(*this) + op->get_rhs()->transform(*this);
+        return rebuilt(op, this->transformed(op->get_lhs()), this->transformed(op->get_rhs()));
     }
 
-    virtual VisitorResult<T> visit(std::shared_ptr<Sub<T>> op) override
+    virtual std::shared_ptr<MathOp<T>> visit(std::shared_ptr<Sub<T>> op) override
     {
-        return op->get_lhs()->transform(*this) - op->get_rhs()->transform(*this);
+        return rebuilt(op, this->transformed(op->get_lhs()), this->transformed(op->get_rhs()));
+    }
+
+    virtual std::shared_ptr<MathOp<T>> visit(std::shared_ptr<Sum<T>> op) override
+    {
+        return rebuilt(op, transformed_terms(op));
+    }
+
+    virtual std::shared_ptr<MathOp<T>> visit(std::shared_ptr<Product<T>> op) override
+    {
+        return rebuilt(op, transformed_terms(op));
+    }
+
+protected:
+    typedef typename MathNaryOp<T>::Term Term;
+
+    /* The terms of an n-ary operation, with their operands transformed */
+    std::vector<Term> transformed_terms(const std::shared_ptr<MathNaryOp<T>>& op)
+    {
+        auto terms = op->get_terms();
+        for (size_t i = 0; i < terms.size(); i++)
+        {
+            terms[i].op = this->transformed_operand(*op, i);
+        }
+
+        return terms;
+    }
+
+    /* The operation itself if its operands came back unchanged, so subtrees that a transform leaves
+     * alone are shared with the original tree instead of being copied */
+    template<typename Op>
+    static std::shared_ptr<MathOp<T>> rebuilt(std::shared_ptr<Op> op, std::shared_ptr<MathOp<T>> x)
+    {
+        return x == op->get_x() ? op : Op::create(x);
+    }
+
+    template<typename Op>
+    static std::shared_ptr<MathOp<T>> rebuilt(std::shared_ptr<Op> op, std::shared_ptr<MathOp<T>> lhs, std::shared_ptr<MathOp<T>> rhs)
+    {
+        return lhs == op->get_lhs() && rhs == op->get_rhs() ? op : Op::create(lhs, rhs);
+    }
+
+    template<typename Op>
+    static std::shared_ptr<MathOp<T>> rebuilt(std::shared_ptr<Op> op, std::vector<Term> terms)
+    {
+        auto& original = op->get_terms();
+        for (size_t i = 0; i < terms.size(); i++)
+        {
+            if (terms[i].op != original[i].op || terms[i].inverted != original[i].inverted)
+            {
+                return Op::create(std::move(terms));
+            }
+        }
+
+        return op;
     }
 };
 
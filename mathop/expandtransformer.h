@@ -9,10 +9,13 @@ namespace MathOps
 template <typename T>
 struct ExpandTransformer : public DummyTransformer<T>
 {
-    virtual VisitorResult<T> visit(std::shared_ptr<Container<T>> op) override
+    virtual std::shared_ptr<MathOp<T>> visit(std::shared_ptr<Container<T>> op) override
     {
-        return op->get_inner()->transform(*this);
+        return this->transformed(op->get_inner());
     }
+
+protected:
+    bool walks_into_containers() const override { return true; }
 };
 
 } /* namespace MathOps */
@@ -0,0 +1,181 @@
+#ifndef FLATTENTRANSFORMER_H
+#define FLATTENTRANSFORMER_H
+
+#include "dummytransformer.h"
+
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+namespace MathOps
+{
+
+/* Flattens chains of additions and subtractions into a single Sum, and chains of multiplications
+ * and divisions into a single Product, so they're evaluated from a loop rather than through a
+ * deep tree of binary operations. Sums of hardware floats are compensated while they're
+ * evaluated (see Sum), which makes long sums more accurate as well.
+ *
+ * Only the left hand side of an addition, subtraction, multiplication or division is part of the
+ * chain, so the terms and factors are still applied in the same order, and the chain overflows (or
+ * turns into NaN) just like the original would. A right hand side that's a chain of its own is
+ * flattened into a term of its own. Sums are also flattened through negations.
+ *
+ * Chains of fewer than min_terms terms are left alone. A chain that's used more than once in the
+ * same chain is flattened once, and then used as a term of its own. Containers are left alone. */
+template <typename T>
+struct FlattenTransformer : public DummyTransformer<T>
+{
+    FlattenTransformer(size_t min_terms = 3)
+        : min_terms(min_terms)
+    { }
+
+    std::shared_ptr<MathOp<T>> flatten(std::shared_ptr<MathOp<T>> op)
+    {
+        terms.clear();
+
+        return op->transform(*this);
+    }
+
+    std::shared_ptr<MathOp<T>> visit(std::shared_ptr<Add<T>> op) override { return flattened(op, OpKind::Sum); }
+    std::shared_ptr<MathOp<T>> visit(std::shared_ptr<Sub<T>> op) override { return flattened(op, OpKind::Sum); }
+    std::shared_ptr<MathOp<T>> visit(std::shared_ptr<Sum<T>> op) override { return flattened(op, OpKind::Sum); }
+
+    std::shared_ptr<MathOp<T>> visit(std::shared_ptr<Mul<T>> op) override { return flattened(op, OpKind::Product); }
+    std::shared_ptr<MathOp<T>> visit(std::shared_ptr<Div<T>> op) override { return flattened(op, OpKind::Product); }
+    std::shared_ptr<MathOp<T>> visit(std::shared_ptr<Product<T>> op) override { return flattened(op, OpKind::Product); }
+
+private:
+    typedef typename MathNaryOp<T>::Term Term;
+
+    size_t min_terms;
+
+    /* Terms that are shared are only flattened once */
+    std::unordered_map<const MathOp<T>*, std::shared_ptr<MathOp<T>>> terms;
+
+    std::shared_ptr<MathOp<T>> term(const std::shared_ptr<MathOp<T>>& op)
+    {
+        auto it = terms.find(op.get());
+        if (it != terms.end())
+        {
+            return it->second;
+        }
+
+        auto result = this->transformed(op);
+        terms.emplace(op.get(), result);
+
+        return result;
+    }
+
+    /* An operation in the chain that's yet to be looked at. Terms are never expanded further. */
+    struct Pending
+    {
+        MathOp<T>* op;
+        bool inverted;
+        bool is_term;
+    };
+
+    /* The chain below op is walked from a loop, left to right, and only its terms are transformed */
+    template<typename Op>
+    std::shared_ptr<MathOp<T>> flattened(std::shared_ptr<Op> op, OpKind kind)
+    {
+        std::vector<Term> result;
+        std::unordered_set<const MathOp<T>*> expanded;
+
+        std::vector<Pending> stack { { op.get(), false, false } };
+        while (!stack.empty())
+        {
+            Pending next = stack.back();
+            stack.pop_back();
+
+            if (next.is_term || expanded.count(next.op) || !expand(next, kind, stack))
+            {
+                result.push_back(Term { term(next.op->shared_from_this()), next.inverted });
+                continue;
+            }
+
+            expanded.insert(next.op);
+        }
+
+        if (result.size() < min_terms)
+        {
+            return DummyTransformer<T>::visit(op);
+        }
+
+        return create_nary_op<T>(kind, std::move(result));
+    }
+
+    /* Pushes the operands of next, right to left, if it's part of the chain */
+    static bool expand(const Pending& next, OpKind kind, std::vector<Pending>& stack)
+    {
+        bool inverted = next.inverted;
+
+        /* Only the left hand side of a sum or product is part of the chain */
+        if (kind == OpKind::Sum)
+        {
+            if (auto add = dynamic_cast<Add<T>*>(next.op))
+            {
+                stack.push_back({ add->get_rhs().get(), inverted, true });
+                stack.push_back({ add->get_lhs().get(), inverted, false });
+                return true;
+            }
+
+            if (auto sub = dynamic_cast<Sub<T>*>(next.op))
+            {
+                stack.push_back({ sub->get_rhs().get(), !inverted, true });
+                stack.push_back({ sub->get_lhs().get(), inverted, false });
+                return true;
+            }
+
+            if (auto negate = dynamic_cast<Negate<T>*>(next.op))
+            {
+                stack.push_back({ negate->get_x().get(), !inverted, false });
+                return true;
+            }
+
+            if (auto sum = dynamic_cast<Sum<T>*>(next.op))
+            {
+                auto& terms = sum->get_terms();
+                for (size_t i = terms.size(); i-- > 0; )
+                {
+                    stack.push_back({ terms[i].op.get(), terms[i].inverted != inverted, i > 0 });
+                }
+
+                return true;
+            }
+
+            return false;
+        }
+
+        /* Factors are never inverted while they're expanded */
+        if (auto mul = dynamic_cast<Mul<T>*>(next.op))
+        {
+            stack.push_back({ mul->get_rhs().get(), false, true });
+            stack.push_back({ mul->get_lhs().get(), false, false });
+            return true;
+        }
+
+        if (auto div = dynamic_cast<Div<T>*>(next.op))
+        {
+            stack.push_back({ div->get_rhs().get(), true, true });
+            stack.push_back({ div->get_lhs().get(), false, false });
+            return true;
+        }
+
+        if (auto product = dynamic_cast<Product<T>*>(next.op))
+        {
+            auto& terms = product->get_terms();
+            for (size_t i = terms.size(); i-- > 0; )
+            {
+                stack.push_back({ terms[i].op.get(), terms[i].inverted, i > 0 || terms[i].inverted });
+            }
+
+            return true;
+        }
+
+        return false;
+    }
+};
+
+} /* namespace MathOps */
+
+#endif /* FLATTENTRANSFORMER_H */
@@ -0,0 +1,311 @@
+#ifndef INTERNER_H
+#define INTERNER_H
+
+#include "walker.h"
+
+#include <algorithm>
+#include <string>
+#include <unordered_map>
+
+namespace MathOps
+{
+
+/* Hash-consing node factory. Every operation is keyed by its kind and the identity of its
+ * (already interned) operands, constant values are keyed by sign and value (so -0 and 0 are
+ * different constants, and every NaN is the same one) and constant symbols by name and value (so
+ * a symbol made at a different precision is a different constant).
+ * Asking for a node that already exists returns the existing one, so two interned subtrees are
+ * structurally identical if, and only if, they are the same object.
+ *
+ * Variables, named constants, mutable values and containers are kept by identity, as their value
+ * (or, for a container, their inner expression) can change after interning.
+ *
+ * Interned nodes are kept alive for as long as the interner lives, or until collect() finds they
+ * are no longer used outside of it.
+ *
+ * A canonical interner also folds operations on constant values into a single constant, and puts
+ * the operands of commutative operations in a fixed order, so equivalent trees such as a + 2 * 3
+ * and 6 + a intern to the same node. That order is only fixed for the lifetime of the interner,
+ * so canonical trees are meant for comparing, not for display. */
+template <typename T>
+struct Interner : public TransformWalker<T>
+{
+    Interner(bool canonical = false)
+        : canonical(canonical)
+    { }
+
+    std::shared_ptr<MathOp<T>> intern(std::shared_ptr<MathOp<T>> op) { return op->transform(*this); }
+
+    /* If given, reuse is kept as the node, rather than creating a new one, if it's the same operation
+     * on the same operands */
+    std::shared_ptr<MathOp<T>> make(OpKind kind, std::shared_ptr<MathOp<T>> x, std::shared_ptr<MathOp<T>> y = nullptr,
+                                    std::shared_ptr<MathOp<T>> reuse = nullptr)
+    {
+        if (canonical)
+        {
+            if (is_literal(x) && (!y || is_literal(y)))
+            {
+                /* -0 is kept as 0, as it hashes differently at arbitrary precision */
+                T folded = create_op<T>(kind, x, y)->result();
+                return constant(folded == 0 ? T(0) : folded);
+            }
+
+            if ((kind == OpKind::Add || kind == OpKind::Mul) && std::less<const MathOp<T>*>()(y.get(), x.get()))
+            {
+                std::swap(x, y);
+            }
+        }
+
+        Key key { kind, x.get(), y.get() };
+        auto it = nodes.find(key);
+        if (it != nodes.end())
+        {
+            return it->second;
+        }
+
+        bool same = reuse && reuse->operand(0) == x.get() && (!y || reuse->operand(1) == y.get());
+        auto op = same ? reuse : create_op<T>(kind, x, y);
+        nodes.emplace(key, op);
+
+        return op;
+    }
+
+    /* The same, for an n-ary operation on the given terms */
+    std::shared_ptr<MathOp<T>> make(OpKind kind, std::vector<typename MathNaryOp<T>::Term> terms,
+                                    std::shared_ptr<MathNaryOp<T>> reuse = nullptr)
+    {
+        if (canonical)
+        {
+            if (std::all_of(terms.begin(), terms.end(), [](const Term& term) { return is_literal(term.op); }))
+            {
+                T folded = create_nary_op<T>(kind, terms)->result();
+                return constant(folded == 0 ? T(0) : folded);
+            }
+
+            std::sort(terms.begin(), terms.end(), [](const Term& a, const Term& b)
+            {
+                return std::less<const MathOp<T>*>()(a.op.get(), b.op.get()) || (a.op == b.op && a.inverted < b.inverted);
+            });
+        }
+
+        NaryKey key { kind, { } };
+        key.terms.reserve(terms.size());
+        for (auto& term: terms)
+        {
+            key.terms.emplace_back(term.op.get(), term.inverted);
+        }
+
+        auto it = nary_nodes.find(key);
+        if (it != nary_nodes.end())
+        {
+            return it->second;
+        }
+
+        bool same = reuse && reuse->get_terms().size() == terms.size() &&
+            std::equal(terms.begin(), terms.end(), reuse->get_terms().begin(), [](const Term& a, const Term& b)
+            {
+                return a.op == b.op && a.inverted == b.inverted;
+            });
+
+        auto op = same ? reuse : create_nary_op<T>(kind, std::move(terms));
+        nary_nodes.emplace(std::move(key), op);
+
+        return op;
+    }
+
+    std::shared_ptr<MathOp<T>> constant(T value)
+    {
+        auto it = constants.find(value);
+        if (it != constants.end())
+        {
+            return it->second;
+        }
+
+        std::shared_ptr<MathOp<T>> op = ConstantValue<T>::create(value);
+        constants.emplace(value, op);
+
+        return op;
+    }
+
+    size_t size() const { return nodes.size() + nary_nodes.size() + constants.size() + symbols.size(); }
+
+    /* Forget every node that is only referenced by the interner itself */
+    void collect()
+    {
+        /* Forgetting a node can leave its operands unreferenced, so repeat until nothing changes */
+        while (collect(nodes) | collect(nary_nodes) | collect(constants) | collect(symbols))
+        { }
+    }
+
+    std::shared_ptr<MathOp<T>> visit(std::shared_ptr<ConstantSymbol<T>> op) override
+    {
+        Symbol key { op->get_name(), op->result() };
+        auto it = symbols.find(key);
+        if (it != symbols.end())
+        {
+            return it->second;
+        }
+
+        symbols.emplace(std::move(key), op);
+
+        return op;
+    }
+
+    std::shared_ptr<MathOp<T>> visit(std::shared_ptr<Variable<T>> op) override { return op; }
+    std::shared_ptr<MathOp<T>> visit(std::shared_ptr<ValueVariable<T>> op) override { return op; }
+    std::shared_ptr<MathOp<T>> visit(std::shared_ptr<NamedConstant<T>> op) override { return op; }
+    std::shared_ptr<MathOp<T>> visit(std::shared_ptr<MutableValue<T>> op) override { return op; }
+    std::shared_ptr<MathOp<T>> visit(std::shared_ptr<ConstantValue<T>> op) override { return constant(op->result()); }
+
+    std::shared_ptr<MathOp<T>> visit(std::shared_ptr<Container<T>> op) override { return op; }
+
+    std::shared_ptr<MathOp<T>> visit(std::shared_ptr<Negate<T>> op) override { return unary(OpKind::Negate, op); }
+    std::shared_ptr<MathOp<T>> visit(std::shared_ptr<Sqrt<T>> op) override { return unary(OpKind::Sqrt, op); }
+    std::shared_ptr<MathOp<T>> visit(std::shared_ptr<Log<T>> op) override { return unary(OpKind::Log, op); }
+    std::shared_ptr<MathOp<T>> visit(std::shared_ptr<Log10<T>> op) override { return unary(OpKind::Log10, op); }
+    std::shared_ptr<MathOp<T>> visit(std::shared_ptr<Sin<T>> op) override { return unary(OpKind::Sin, op); }
+    std::shared_ptr<MathOp<T>> visit(std::shared_ptr<ASin<T>> op) override { return unary(OpKind::ASin, op); }
+    std::shared_ptr<MathOp<T>> visit(std::shared_ptr<Cos<T>> op) override { return unary(OpKind::Cos, op); }
+    std::shared_ptr<MathOp<T>> visit(std::shared_ptr<ACos<T>> op) override { return unary(OpKind::ACos, op); }
+    std::shared_ptr<MathOp<T>> visit(std::shared_ptr<Tan<T>> op) override { return unary(OpKind::Tan, op); }
+    std::shared_ptr<MathOp<T>> visit(std::shared_ptr<ATan<T>> op) override { return unary(OpKind::ATan, op); }
+    std::shared_ptr<MathOp<T>> visit(std::shared_ptr<Sinh<T>> op) override { return unary(OpKind::Sinh, op); }
+    std::shared_ptr<MathOp<T>> visit(std::shared_ptr<ASinh<T>> op) override { return unary(OpKind::ASinh, op); }
+    std::shared_ptr<MathOp<T>> visit(std::shared_ptr<Cosh<T>> op) override { return unary(OpKind::Cosh, op); }
+    std::shared_ptr<MathOp<T>> visit(std::shared_ptr<ACosh<T>> op) override { return unary(OpKind::ACosh, op); }
+    std::shared_ptr<MathOp<T>> visit(std::shared_ptr<Tanh<T>> op) override { return unary(OpKind::Tanh, op); }
+    std::shared_ptr<MathOp<T>> visit(std::shared_ptr<ATanh<T>> op) override { return unary(OpKind::ATanh, op); }
+
+    std::shared_ptr<MathOp<T>> visit(std::shared_ptr<Pow<T>> op) override { return binary(OpKind::Pow, op); }
+    std::shared_ptr<MathOp<T>> visit(std::shared_ptr<Mul<T>> op) override { return binary(OpKind::Mul, op); }
+    std::shared_ptr<MathOp<T>> visit(std::shared_ptr<Div<T>> op) override { return binary(OpKind::Div, op); }
+    std::shared_ptr<MathOp<T>> visit(std::shared_ptr<Add<T>> op) override { return binary(OpKind::Add, op); }
+    std::shared_ptr<MathOp<T>> visit(std::shared_ptr<Sub<T>> op) override { return binary(OpKind::Sub, op); }
+
+    std::shared_ptr<MathOp<T>> visit(std::shared_ptr<Sum<T>> op) override { return nary(OpKind::Sum, op); }
+    std::shared_ptr<MathOp<T>> visit(std::shared_ptr<Product<T>> op) override { return nary(OpKind::Product, op); }
+
+private:
+    typedef typename MathNaryOp<T>::Term Term;
+
+    struct Key
+    {
+        OpKind kind;
+        const MathOp<T>* x;
+        const MathOp<T>* y;
+
+        bool operator==(const Key& other) const { return kind == other.kind && x == other.x && y == other.y; }
+    };
+
+    struct KeyHash
+    {
+        size_t operator()(const Key& key) const
+        {
+            size_t h = std::hash<const MathOp<T>*>()(key.x);
+            h ^= std::hash<const MathOp<T>*>()(key.y) + 0x9e3779b9 + (h << 6) + (h >> 2);
+            return h ^ ((size_t) key.kind << 1);
+        }
+    };
+
+    struct NaryKey
+    {
+        OpKind kind;
+        std::vector<std::pair<const MathOp<T>*, bool>> terms;
+
+        bool operator==(const NaryKey& other) const { return kind == other.kind && terms == other.terms; }
+    };
+
+    struct NaryKeyHash
+    {
+        size_t operator()(const NaryKey& key) const
+        {
+            size_t h = (size_t) key.kind;
+            for (auto& term: key.terms)
+            {
+                h ^= (std::hash<const MathOp<T>*>()(term.first) ^ term.second) + 0x9e3779b9 + (h << 6) + (h >> 2);
+            }
+
+            return h;
+        }
+    };
+
+    struct ValueHash
+    {
+        size_t operator()(const T& value) const { return value_hash(value); }
+    };
+
+    struct SameValue
+    {
+        bool operator()(const T& a, const T& b) const { return same_value(a, b); }
+    };
+
+    struct Symbol
+    {
+        std::string name;
+        T value;
+
+        bool operator==(const Symbol& other) const { return name == other.name && same_value(value, other.value); }
+    };
+
+    struct SymbolHash
+    {
+        size_t operator()(const Symbol& symbol) const { return std::hash<std::string>()(symbol.name) ^ value_hash(symbol.value); }
+    };
+
+    bool canonical;
+
+    std::unordered_map<Key, std::shared_ptr<MathOp<T>>, KeyHash> nodes;
+    std::unordered_map<NaryKey, std::shared_ptr<MathOp<T>>, NaryKeyHash> nary_nodes;
+    std::unordered_map<T, std::shared_ptr<MathOp<T>>, ValueHash, SameValue> constants;
+    std::unordered_map<Symbol, std::shared_ptr<MathOp<T>>, SymbolHash> symbols;
+
+    template<typename Map>
+    static bool collect(Map& map)
+    {
+        bool collected = false;
+        for (auto it = map.begin(); it != map.end(); )
+        {
+            if (it->second.use_count() == 1)
+            {
+                it = map.erase(it);
+                collected = true;
+            }
+            else
+            {
+                ++it;
+            }
+        }
+
+        return collected;
+    }
+
+    static bool is_literal(const std::shared_ptr<MathOp<T>>& op) { return dynamic_cast<ConstantValue<T>*>(op.get()); }
+
+    std::shared_ptr<MathOp<T>> unary(OpKind kind, std::shared_ptr<MathUnaryOp<T>> op)
+    {
+        return make(kind, this->transformed(op->get_x()), nullptr, op);
+    }
+
+    std::shared_ptr<MathOp<T>> binary(OpKind kind, std::shared_ptr<MathBinaryOp<T>> op)
+    {
+        auto lhs = this->transformed(op->get_lhs());
+        auto rhs = this->transformed(op->get_rhs());
+
+        return make(kind, lhs, rhs, op);
+    }
+
+    std::shared_ptr<MathOp<T>> nary(OpKind kind, std::shared_ptr<MathNaryOp<T>> op)
+    {
+        auto terms = op->get_terms();
+        for (size_t i = 0; i < terms.size(); i++)
+        {
+            terms[i].op = this->transformed_operand(*op, i);
+        }
+
+        return make(kind, std::move(terms), op);
+    }
+};
+
+} /* namespace MathOps */
+
+#endif /* INTERNER_H */
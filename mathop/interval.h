@@ -0,0 +1,341 @@
+#ifndef INTERVAL_H
+#define INTERVAL_H
+
+#include <cmath>
+#include <limits>
+#include <algorithm>
+
+namespace MathOps
+{
+
+/* A closed interval of floating point numbers, that contains every value (other than NaN) an
+ * expression could have. Bounds are rounded outward, so the true result is never left out, and
+ * an interval is empty if the result can only be NaN (e.g. sqrt() of a negative number).
+ * maybe_nan is set if the result could be NaN as well (e.g. sqrt() of a number that could be
+ * negative), and is only ever unset where it can't.
+ *
+ * Basic arithmetic is correctly rounded, so one unit in the last place is added to its bounds.
+ * The math library's functions are allowed a few. */
+template<typename U>
+struct Interval
+{
+    U lower;
+    U upper;
+    bool maybe_nan;
+
+    Interval() : lower(-infinity()), upper(infinity()), maybe_nan(false) { }
+    Interval(U lower, U upper, bool maybe_nan = false) : lower(lower), upper(upper), maybe_nan(maybe_nan) { }
+
+    /* The interval around a value that was rounded to U */
+    static Interval<U> point(U x) { return std::isnan(x) ? empty() : Interval<U>(down(x, 1), up(x, 1)); }
+
+    static Interval<U> empty() { return Interval<U>(std::numeric_limits<U>::quiet_NaN(), std::numeric_limits<U>::quiet_NaN(), true); }
+    static Interval<U> entire(bool maybe_nan = false) { return Interval<U>(-infinity(), infinity(), maybe_nan); }
+
+    /* Round bounds outward by the given number of units in the last place. A bound that came
+     * out as NaN (e.g. inf - inf) can be anything, and so can the result. */
+    static Interval<U> rounded(U lower, U upper, int ulps, bool maybe_nan = false)
+    {
+        return Interval<U>(std::isnan(lower) ? -infinity() : down(lower, ulps),
+                           std::isnan(upper) ?  infinity() : up(upper, ulps),
+                           maybe_nan || std::isnan(lower) || std::isnan(upper));
+    }
+
+    bool is_empty() const { return std::isnan(lower) || std::isnan(upper); }
+    bool contains(U x) const { return lower <= x && x <= upper; }
+    bool is_point_infinity() const { return lower == upper && std::isinf(lower); }
+    bool is_finite() const { return std::isfinite(lower) && std::isfinite(upper); }
+
+    /* Whether offset + k * period lies within the interval for some integer k. May return true
+     * when it doesn't, but never the other way around. */
+    bool contains_periodic(U offset, U period) const
+    {
+        const U margin = 1e-9;
+        return std::ceil((lower - offset) / period - margin) <= std::floor((upper - offset) / period + margin);
+    }
+
+    static U infinity() { return std::numeric_limits<U>::infinity(); }
+
+    static U down(U x, int ulps)
+    {
+        while (ulps--) x = std::nextafter(x, -infinity());
+        return x;
+    }
+
+    static U up(U x, int ulps)
+    {
+        while (ulps--) x = std::nextafter(x, infinity());
+        return x;
+    }
+};
+
+/* Number of units in the last place the bounds of a transcendental function are widened by */
+constexpr int interval_function_ulps = 4;
+
+template<typename U>
+Interval<U> operator-(const Interval<U>& a)
+{
+    return a.is_empty() ? a : Interval<U>(-a.upper, -a.lower, a.maybe_nan);
+}
+
+template<typename U>
+Interval<U> operator+(const Interval<U>& a, const Interval<U>& b)
+{
+    if (a.is_empty() || b.is_empty())
+    {
+        return Interval<U>::empty();
+    }
+
+    /* inf - inf */
+    bool maybe_nan = a.maybe_nan || b.maybe_nan ||
+                     (a.upper == Interval<U>::infinity() && b.lower == -Interval<U>::infinity()) ||
+                     (a.lower == -Interval<U>::infinity() && b.upper == Interval<U>::infinity());
+
+    return Interval<U>::rounded(a.lower + b.lower, a.upper + b.upper, 1, maybe_nan);
+}
+
+template<typename U>
+Interval<U> operator-(const Interval<U>& a, const Interval<U>& b)
+{
+    return a + -b;
+}
+
+/* The bounds of an operation that is monotonic in both operands are found at the corners */
+template<typename U, typename F>
+Interval<U> interval_corners(const Interval<U>& a, const Interval<U>& b, F f, int ulps, bool maybe_nan)
+{
+    U c[] = { f(a.lower, b.lower), f(a.lower, b.upper), f(a.upper, b.lower), f(a.upper, b.upper) };
+    if (std::any_of(std::begin(c), std::end(c), [](U x) { return std::isnan(x); }))
+    {
+        return Interval<U>::entire(true);
+    }
+
+    return Interval<U>::rounded(*std::min_element(std::begin(c), std::end(c)),
+                                *std::max_element(std::begin(c), std::end(c)), ulps, maybe_nan);
+}
+
+template<typename U>
+Interval<U> operator*(const Interval<U>& a, const Interval<U>& b)
+{
+    if (a.is_empty() || b.is_empty())
+    {
+        return Interval<U>::empty();
+    }
+
+    /* 0 * inf */
+    bool maybe_nan = a.maybe_nan || b.maybe_nan || (a.contains(0) && !b.is_finite()) || (b.contains(0) && !a.is_finite());
+
+    return interval_corners(a, b, [](U x, U y) { return x * y; }, 1, maybe_nan);
+}
+
+/* a * a, which unlike the product of two intervals can't be negative */
+template<typename U>
+Interval<U> sqr(const Interval<U>& a)
+{
+    if (a.is_empty() || a.lower > 0 || a.upper < 0)
+    {
+        return a * a;
+    }
+
+    return Interval<U>(0, Interval<U>::up(std::max(a.lower * a.lower, a.upper * a.upper), 1), a.maybe_nan);
+}
+
+template<typename U>
+Interval<U> operator/(const Interval<U>& a, const Interval<U>& b)
+{
+    if (a.is_empty() || b.is_empty())
+    {
+        return Interval<U>::empty();
+    }
+
+    /* 0 / 0 and inf / inf */
+    bool maybe_nan = a.maybe_nan || b.maybe_nan || (a.contains(0) && b.contains(0)) || (!a.is_finite() && !b.is_finite());
+
+    if (b.lower <= 0 && b.upper >= 0)
+    {
+        return Interval<U>::entire(maybe_nan);
+    }
+
+    return interval_corners(a, b, [](U x, U y) { return x / y; }, 1, maybe_nan);
+}
+
+template<typename U>
+Interval<U> pow(const Interval<U>& a, const Interval<U>& b)
+{
+    /* pow(NaN, 0) and pow(1, NaN) are 1 */
+    if (a.is_empty() || b.is_empty())
+    {
+        return (a.is_empty() && b.contains(0)) || (b.is_empty() && a.contains(1))
+            ? Interval<U>(1, 1, true)
+            : Interval<U>::empty();
+    }
+
+    if (a.lower >= 0)
+    {
+        return interval_corners(a, b, [](U x, U y) { return std::pow(x, y); }, interval_function_ulps, a.maybe_nan || b.maybe_nan);
+    }
+
+    /* A finite negative number to a power that can't be an integer */
+    if (a.upper < 0 && std::isfinite(a.lower) && std::ceil(b.lower) > b.upper)
+    {
+        return Interval<U>::empty();
+    }
+
+    return Interval<U>::entire(true);
+}
+
+/* Functions that are increasing over [from, to], and NaN outside of it */
+template<typename U, typename F>
+Interval<U> interval_increasing(const Interval<U>& a, F f, U from, U to)
+{
+    if (a.is_empty() || a.upper < from || a.lower > to)
+    {
+        return Interval<U>::empty();
+    }
+
+    return Interval<U>::rounded(f(std::max(a.lower, from)), f(std::min(a.upper, to)), interval_function_ulps,
+                                a.maybe_nan || a.lower < from || a.upper > to);
+}
+
+template<typename U>
+Interval<U> sqrt(const Interval<U>& a)
+{
+    return interval_increasing(a, [](U x) { return std::sqrt(x); }, U(0), Interval<U>::infinity());
+}
+
+template<typename U>
+Interval<U> log(const Interval<U>& a)
+{
+    return interval_increasing(a, [](U x) { return std::log(x); }, U(0), Interval<U>::infinity());
+}
+
+template<typename U>
+Interval<U> log10(const Interval<U>& a)
+{
+    return interval_increasing(a, [](U x) { return std::log10(x); }, U(0), Interval<U>::infinity());
+}
+
+/* sin() and cos() have their maximum at max_at + 2 * k * pi, and their minimum half a period on */
+template<typename U, typename F>
+Interval<U> interval_periodic(const Interval<U>& a, F f, U max_at)
+{
+    const U pi = M_PI;
+
+    if (a.is_empty() || a.is_point_infinity())
+    {
+        return Interval<U>::empty();
+    }
+
+    /* Of +-inf */
+    bool maybe_nan = a.maybe_nan || !a.is_finite();
+
+    if (!a.is_finite() || a.upper - a.lower >= 2 * pi || std::max(-a.lower, a.upper) > 1e6)
+    {
+        return Interval<U>(-1, 1, maybe_nan);
+    }
+
+    auto r = Interval<U>::rounded(std::min(f(a.lower), f(a.upper)), std::max(f(a.lower), f(a.upper)), interval_function_ulps);
+
+    return Interval<U>(a.contains_periodic(max_at + pi, 2 * pi) ? U(-1) : std::max(r.lower, U(-1)),
+                       a.contains_periodic(max_at, 2 * pi)      ? U( 1) : std::min(r.upper, U( 1)),
+                       maybe_nan);
+}
+
+template<typename U>
+Interval<U> sin(const Interval<U>& a)
+{
+    return interval_periodic(a, [](U x) { return std::sin(x); }, U(M_PI / 2));
+}
+
+template<typename U>
+Interval<U> cos(const Interval<U>& a)
+{
+    return interval_periodic(a, [](U x) { return std::cos(x); }, U(0));
+}
+
+template<typename U>
+Interval<U> tan(const Interval<U>& a)
+{
+    if (a.is_empty() || a.is_point_infinity())
+    {
+        return Interval<U>::empty();
+    }
+
+    if (!a.is_finite() || a.upper - a.lower >= M_PI || std::max(-a.lower, a.upper) > 1e6 ||
+        a.contains_periodic(M_PI / 2, M_PI))
+    {
+        /* Of +-inf */
+        return Interval<U>::entire(a.maybe_nan || !a.is_finite());
+    }
+
+    return Interval<U>::rounded(std::tan(a.lower), std::tan(a.upper), interval_function_ulps, a.maybe_nan);
+}
+
+template<typename U>
+Interval<U> asin(const Interval<U>& a)
+{
+    return interval_increasing(a, [](U x) { return std::asin(x); }, U(-1), U(1));
+}
+
+template<typename U>
+Interval<U> acos(const Interval<U>& a)
+{
+    /* Decreasing, so -acos(x) is increasing */
+    return -interval_increasing(a, [](U x) { return -std::acos(x); }, U(-1), U(1));
+}
+
+template<typename U>
+Interval<U> atan(const Interval<U>& a)
+{
+    return interval_increasing(a, [](U x) { return std::atan(x); }, -Interval<U>::infinity(), Interval<U>::infinity());
+}
+
+template<typename U>
+Interval<U> sinh(const Interval<U>& a)
+{
+    return interval_increasing(a, [](U x) { return std::sinh(x); }, -Interval<U>::infinity(), Interval<U>::infinity());
+}
+
+template<typename U>
+Interval<U> asinh(const Interval<U>& a)
+{
+    return interval_increasing(a, [](U x) { return std::asinh(x); }, -Interval<U>::infinity(), Interval<U>::infinity());
+}
+
+template<typename U>
+Interval<U> cosh(const Interval<U>& a)
+{
+    if (a.is_empty())
+    {
+        return a;
+    }
+
+    /* Even, and increasing from 0 */
+    auto abs_a = a.lower >= 0 ? a
+               : a.upper <= 0 ? -a
+               : Interval<U>(0, std::max(-a.lower, a.upper), a.maybe_nan);
+
+    return interval_increasing(abs_a, [](U x) { return std::cosh(x); }, U(0), Interval<U>::infinity());
+}
+
+template<typename U>
+Interval<U> acosh(const Interval<U>& a)
+{
+    return interval_increasing(a, [](U x) { return std::acosh(x); }, U(1), Interval<U>::infinity());
+}
+
+template<typename U>
+Interval<U> tanh(const Interval<U>& a)
+{
+    return interval_increasing(a, [](U x) { return std::tanh(x); }, -Interval<U>::infinity(), Interval<U>::infinity());
+}
+
+template<typename U>
+Interval<U> atanh(const Interval<U>& a)
+{
+    return interval_increasing(a, [](U x) { return std::atanh(x); }, U(-1), U(1));
+}
+
+} /* namespace MathOps */
+
+#endif /* INTERVAL_H */
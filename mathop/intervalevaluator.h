@@ -0,0 +1,147 @@
+#ifndef INTERVALEVALUATOR_H
+#define INTERVALEVALUATOR_H
+
+#include "algeblah.h"
+#include "interval.h"
+
+#include <unordered_map>
+#include <vector>
+
+namespace MathOps
+{
+
+/* Bounds the result of a tree, in double precision interval arithmetic, at the current values of
+ * its variables. This is cheap compared to evaluating the tree at a high precision, and is used
+ * to prove that a tree can only evaluate to NaN (i.e. it's out of domain somewhere).
+ *
+ * The bounds of every operation are remembered, so trees that share subtrees can be bounded one
+ * after another without walking the shared parts again. The values in the trees shouldn't change
+ * in the meantime.
+ *
+ * If any_value is set, the values that can be set (e.g. variables, and the inner expressions of
+ * containers) are taken to be anything, so the bounds hold no matter what they're set to later. */
+template <typename T>
+struct IntervalEvaluator : public Visitor<T, Interval<double>>
+{
+    IntervalEvaluator(bool any_value = false)
+        : any_value(any_value)
+    { }
+
+    /* Operations below op are bounded bottom up, from a loop */
+    Interval<double> bounds(const std::shared_ptr<MathOp<T>>& op)
+    {
+        auto it = known.find(op.get());
+        if (it != known.end())
+        {
+            return it->second.bounds;
+        }
+
+        std::vector<std::pair<MathOp<T>*, size_t>> stack { { op.get(), 0 } };
+        while (!stack.empty())
+        {
+            MathOp<T>* next = stack.back().first;
+            size_t i = stack.back().second++;
+
+            if (i < next->arity())
+            {
+                if (!known.count(next->operand(i)))
+                {
+                    stack.emplace_back(next->operand(i), 0);
+                }
+
+                continue;
+            }
+
+            stack.pop_back();
+            known.emplace(next, Known { next->shared_from_this(), this->apply(*next) });
+        }
+
+        return known.at(op.get()).bounds;
+    }
+
+    bool is_nan(const std::shared_ptr<MathOp<T>>& op) { return bounds(op).is_empty(); }
+
+    /* Remember the bounds found by another evaluator as well (of the same values, and with the same
+     * any_value) */
+    void merge(const IntervalEvaluator<T>& other) { known.insert(other.known.begin(), other.known.end()); }
+
+    Interval<double> visit(std::shared_ptr<ConstantSymbol<T>> op) override { return value(op); }
+    Interval<double> visit(std::shared_ptr<Variable<T>> op) override { return settable_value(op); }
+    Interval<double> visit(std::shared_ptr<ValueVariable<T>> op) override { return settable_value(op); }
+    Interval<double> visit(std::shared_ptr<NamedConstant<T>> op) override { return value(op); }
+    Interval<double> visit(std::shared_ptr<MutableValue<T>> op) override { return settable_value(op); }
+    Interval<double> visit(std::shared_ptr<ConstantValue<T>> op) override { return value(op); }
+
+    Interval<double> visit(std::shared_ptr<Container<T>> op) override { return any_value ? Interval<double>::entire() : operand(op->get_inner()); }
+
+    Interval<double> visit(std::shared_ptr<Negate<T>> op) override { return -operand(op->get_x()); }
+    Interval<double> visit(std::shared_ptr<Sqrt<T>> op) override { return sqrt(operand(op->get_x())); }
+    Interval<double> visit(std::shared_ptr<Log<T>> op) override { return log(operand(op->get_x())); }
+    Interval<double> visit(std::shared_ptr<Log10<T>> op) override { return log10(operand(op->get_x())); }
+    Interval<double> visit(std::shared_ptr<Sin<T>> op) override { return sin(operand(op->get_x())); }
+    Interval<double> visit(std::shared_ptr<ASin<T>> op) override { return asin(operand(op->get_x())); }
+    Interval<double> visit(std::shared_ptr<Cos<T>> op) override { return cos(operand(op->get_x())); }
+    Interval<double> visit(std::shared_ptr<ACos<T>> op) override { return acos(operand(op->get_x())); }
+    Interval<double> visit(std::shared_ptr<Tan<T>> op) override { return tan(operand(op->get_x())); }
+    Interval<double> visit(std::shared_ptr<ATan<T>> op) override { return atan(operand(op->get_x())); }
+    Interval<double> visit(std::shared_ptr<Sinh<T>> op) override { return sinh(operand(op->get_x())); }
+    Interval<double> visit(std::shared_ptr<ASinh<T>> op) override { return asinh(operand(op->get_x())); }
+    Interval<double> visit(std::shared_ptr<Cosh<T>> op) override { return cosh(operand(op->get_x())); }
+    Interval<double> visit(std::shared_ptr<ACosh<T>> op) override { return acosh(operand(op->get_x())); }
+    Interval<double> visit(std::shared_ptr<Tanh<T>> op) override { return tanh(operand(op->get_x())); }
+    Interval<double> visit(std::shared_ptr<ATanh<T>> op) override { return atanh(operand(op->get_x())); }
+
+    Interval<double> visit(std::shared_ptr<Pow<T>> op) override { return pow(operand(op->get_lhs()), operand(op->get_rhs())); }
+    Interval<double> visit(std::shared_ptr<Mul<T>> op) override
+    {
+        return op->get_lhs() == op->get_rhs() ? sqr(operand(op->get_lhs())) : operand(op->get_lhs()) * operand(op->get_rhs());
+    }
+    Interval<double> visit(std::shared_ptr<Div<T>> op) override { return operand(op->get_lhs()) / operand(op->get_rhs()); }
+    Interval<double> visit(std::shared_ptr<Add<T>> op) override { return operand(op->get_lhs()) + operand(op->get_rhs()); }
+    Interval<double> visit(std::shared_ptr<Sub<T>> op) override { return operand(op->get_lhs()) - operand(op->get_rhs()); }
+
+    Interval<double> visit(std::shared_ptr<Sum<T>> op) override
+    {
+        return nary(op, Interval<double>::point(0), [](auto& a, auto& b, bool inverted) { return inverted ? a - b : a + b; });
+    }
+
+    Interval<double> visit(std::shared_ptr<Product<T>> op) override
+    {
+        return nary(op, Interval<double>::point(1), [](auto& a, auto& b, bool inverted) { return inverted ? a / b : a * b; });
+    }
+
+private:
+    /* Operations are kept alive while their bounds are known, so their addresses aren't reused */
+    struct Known
+    {
+        std::shared_ptr<MathOp<T>> op;
+        Interval<double> bounds;
+    };
+
+    bool any_value;
+    std::unordered_map<const MathOp<T>*, Known> known;
+
+    /* Operands are always bounded before the operations that use them */
+    const Interval<double>& operand(const std::shared_ptr<MathOp<T>>& op) const { return known.at(op.get()).bounds; }
+
+    /* Operands are applied in order. An inverted first operand is applied to the identity (0 or 1). */
+    template<typename F>
+    Interval<double> nary(std::shared_ptr<MathNaryOp<T>> op, Interval<double> identity, F apply) const
+    {
+        auto& terms = op->get_terms();
+        auto result = terms[0].inverted ? apply(identity, operand(terms[0].op), true) : operand(terms[0].op);
+        for (size_t i = 1; i < terms.size(); i++)
+        {
+            result = apply(result, operand(terms[i].op), terms[i].inverted);
+        }
+
+        return result;
+    }
+
+    static Interval<double> value(std::shared_ptr<Value<T>> op) { return Interval<double>::point(static_cast<double>(op->result())); }
+    Interval<double> settable_value(std::shared_ptr<Value<T>> op) const { return any_value ? Interval<double>::entire() : value(op); }
+};
+
+} /* namespace MathOps */
+
+#endif /* INTERVALEVALUATOR_H */
@@ -0,0 +1,279 @@
+#ifndef JIT_H
+#define JIT_H
+
+#include "algeblah.h"
+#include "cformatter.h"
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <fstream>
+#include <sstream>
+#include <iomanip>
+#include <cstdlib>
+#include <cstdio>
+#include <unistd.h>
+#include <dlfcn.h>
+#include <sys/stat.h>
+
+namespace MathOps
+{
+
+/* Compiles a tree to native code, by emitting it as C, building it as a shared object with the
+ * system's C compiler (or $CC) and loading it with dlopen(). Shared objects are cached on disk,
+ * in $XDG_CACHE_HOME/algeblah (or ~/.cache/algeblah, or /tmp/algeblah-<uid>), named by a hash of
+ * the compiler command and the generated source. The command and the source are kept next to each
+ * object, and compared before it's loaded, so neither a hash collision nor a change of compiler
+ * loads the wrong code. The cache directory must belong to the user and is kept private (0700);
+ * if it isn't ours, nothing is loaded from it.
+ *
+ * If there's no working compiler, or loading fails, is_compiled() returns false and evaluation
+ * falls back to the tree.
+ *
+ * Only hardware floating point types are supported. Like Program, the result is a snapshot. */
+template<typename T>
+struct Jit
+{
+    typedef T (*Function)(const T*);
+
+    Jit(std::shared_ptr<MathOp<T>> op)
+        : op(op)
+    {
+        CFormatter<T> formatter(op);
+        std::string expression = op->format(formatter);
+        inputs = formatter.get_inputs();
+
+        std::stringstream source;
+        source << "#include <math.h>\n"
+               << formatter.get_preamble()
+               << CType<T>::name() << " algeblah_eval(const " << CType<T>::name() << "* v)\n"
+               << "{\n"
+               << formatter.get_temporaries()
+               << "    return " << expression << ";\n"
+               << "}\n";
+
+        load(source.str());
+    }
+
+    bool is_compiled() const { return function != nullptr; }
+
+    T result() const
+    {
+        if (!function)
+        {
+            return op->result();
+        }
+
+        std::vector<T> v(inputs.size());
+        for (size_t i = 0; i < inputs.size(); i++)
+        {
+            v[i] = inputs[i]->result();
+        }
+
+        return function(v.data());
+    }
+
+    /* Evaluate for n sets of inputs, reading each of the given values from its column */
+    void results(const std::vector<std::shared_ptr<Value<T>>>& values, const std::vector<const T*>& columns,
+        T* out, size_t n) const
+    {
+        std::vector<T> v(inputs.size());
+        std::vector<std::pair<size_t, const T*>> column_inputs;
+        for (size_t i = 0; i < inputs.size(); i++)
+        {
+            v[i] = inputs[i]->result();
+            for (size_t j = 0; j < values.size(); j++)
+            {
+                if (inputs[i] == values[j])
+                {
+                    column_inputs.emplace_back(i, columns[j]);
+                }
+            }
+        }
+
+        const std::vector<T> v_initial = v;
+
+        for (size_t k = 0; k < n; k++)
+        {
+            for (auto& column: column_inputs)
+            {
+                v[column.first] = column.second[k];
+            }
+
+            out[k] = function ? function(v.data()) : evaluate_tree(v);
+        }
+
+        if (!function)
+        {
+            for (auto& column: column_inputs)
+            {
+                inputs[column.first]->set(v_initial[column.first]);
+            }
+        }
+    }
+
+private:
+    std::shared_ptr<MathOp<T>> op;
+    std::vector<std::shared_ptr<Value<T>>> inputs;
+    std::shared_ptr<void> handle;
+    Function function = nullptr;
+
+    T evaluate_tree(const std::vector<T>& v) const
+    {
+        for (size_t i = 0; i < inputs.size(); i++)
+        {
+            inputs[i]->set(v[i]);
+        }
+
+        return op->result();
+    }
+
+    /* Returns an empty string if there's no private cache directory */
+    static std::string cache_directory()
+    {
+        const char* xdg_cache = getenv("XDG_CACHE_HOME");
+        const char* home = getenv("HOME");
+
+        std::string dir = xdg_cache && *xdg_cache ? std::string(xdg_cache) + "/algeblah"
+                        : home && *home           ? std::string(home) + "/.cache/algeblah"
+                        :                           "/tmp/algeblah-" + std::to_string(geteuid());
+
+        std::string parent = dir.substr(0, dir.rfind('/'));
+        if (!parent.empty())
+        {
+            mkdir(parent.c_str(), 0700);
+        }
+
+        mkdir(dir.c_str(), 0700);
+
+        /* Someone else's directory (or a link to one) could hand us their code */
+        struct stat status;
+        if (lstat(dir.c_str(), &status) != 0 || !S_ISDIR(status.st_mode) || status.st_uid != geteuid())
+        {
+            return std::string();
+        }
+
+        if ((status.st_mode & 077) != 0 && chmod(dir.c_str(), 0700) != 0)
+        {
+            return std::string();
+        }
+
+        return dir;
+    }
+
+    /* Quotes a path for the shell */
+    static std::string quoted(const std::string& path)
+    {
+        std::string result = "'";
+        for (char c: path)
+        {
+            result += c == '\'' ? std::string("'\\''") : std::string(1, c);
+        }
+
+        return result + "'";
+    }
+
+    static std::string compiler()
+    {
+        const char* cc = getenv("CC");
+
+        return std::string(cc && *cc ? cc : "cc") + " -O2 -shared -fPIC";
+    }
+
+    static std::string read_file(const std::string& file)
+    {
+        std::ifstream in(file, std::ios::binary);
+        std::stringstream contents;
+        contents << in.rdbuf();
+
+        return in ? contents.str() : std::string();
+    }
+
+    /* Builds the object for a slot that's still free, and claims the slot by linking its key into
+     * place, which fails if someone else got there first. Returns whether the slot is ours (or was
+     * claimed for the same key). */
+    static bool compile(const std::string& source, const std::string& key, const std::string& slot)
+    {
+        std::string base = slot + "." + std::to_string(getpid());
+        std::string source_file = base + ".c";
+        std::string temp_object = base + ".so";
+        std::string temp_key = base + ".key";
+
+        std::ofstream(source_file) << source;
+        std::ofstream(temp_key, std::ios::binary) << key;
+
+        std::string command = compiler() + " -o " + quoted(temp_object) + " " + quoted(source_file) +
+            " -lm >/dev/null 2>&1";
+
+        bool ok = system(command.c_str()) == 0 && read_file(temp_key) == key &&
+            (link(temp_key.c_str(), (slot + ".key").c_str()) == 0 || read_file(slot + ".key") == key) &&
+            rename(temp_object.c_str(), (slot + ".so").c_str()) == 0;
+
+        remove(source_file.c_str());
+        remove(temp_object.c_str());
+        remove(temp_key.c_str());
+
+        return ok;
+    }
+
+    /* Sources whose names collide are put in the next free slot, so an object's name only ever
+     * holds one source, and dlopen() can't hand back another source's object that's still loaded */
+    void load(const std::string& source)
+    {
+        std::string directory = cache_directory();
+        if (directory.empty())
+        {
+            return;
+        }
+
+        std::string key = compiler() + "\n" + source;
+
+        std::stringstream name;
+        name << directory << "/jit-" << std::hex << std::setw(16) << std::setfill('0')
+             << std::hash<std::string>()(key);
+
+        for (int i = 0; i < 16; i++)
+        {
+            std::string slot = name.str() + (i ? "-" + std::to_string(i) : std::string());
+
+            std::string cached = read_file(slot + ".key");
+            if (cached.empty() && !compile(source, key, slot))
+            {
+                /* Without a compiler there's no point trying the other slots */
+                if (read_file(slot + ".key").empty())
+                {
+                    return;
+                }
+
+                continue;
+            }
+
+            if (!cached.empty() && cached != key)
+            {
+                continue;
+            }
+
+            /* A slot whose key is ours but whose object doesn't load was claimed by a build that
+             * didn't finish (say, the process died before it put the object in place), so it's
+             * built again rather than left broken for good */
+            void* h = dlopen((slot + ".so").c_str(), RTLD_NOW | RTLD_LOCAL);
+            if (!h && !cached.empty() && compile(source, key, slot))
+            {
+                h = dlopen((slot + ".so").c_str(), RTLD_NOW | RTLD_LOCAL);
+            }
+
+            if (!h)
+            {
+                return;
+            }
+
+            handle = std::shared_ptr<void>(h, dlclose);
+            function = reinterpret_cast<Function>(dlsym(h, "algeblah_eval"));
+            return;
+        }
+    }
+};
+
+} /* namespace MathOps */
+
+#endif /* JIT_H */
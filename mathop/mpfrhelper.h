@@ -2,6 +2,7 @@
 #define MPFRHELPER_H
 
 #include <boost/multiprecision/mpfr.hpp>
+#include <functional>
 
 namespace MathOps
 {
@@ -15,6 +16,32 @@ T get_constant_e() { return boost::math::constants::e<T>(); }
 inline boost::multiprecision::mpfr_float modf(boost::multiprecision::mpfr_float x, boost::multiprecision::mpfr_float &integral) { return boost::multiprecision::modf(x, &integral); }
 inline boost::multiprecision::mpfr_float isnan(boost::multiprecision::mpfr_float x) { return boost::multiprecision::isnan(x); }
 inline boost::multiprecision::mpfr_float abs(boost::multiprecision::mpfr_float x) { return boost::multiprecision::abs(x); }
+inline bool same_value(const boost::multiprecision::mpfr_float& a, const boost::multiprecision::mpfr_float& b)
+{
+    return boost::multiprecision::isnan(a) ? boost::multiprecision::isnan(b)
+         : a == b && mpfr_signbit(a.backend().data()) == mpfr_signbit(b.backend().data());
+}
+
+/* Hashes the sign, the exponent and the most significant limb, which equal values share whatever
+ * their precision */
+inline std::size_t value_hash(const boost::multiprecision::mpfr_float& x)
+{
+    mpfr_srcptr v = x.backend().data();
+    if (mpfr_nan_p(v))
+    {
+        return 0;
+    }
+
+    std::size_t h = mpfr_signbit(v) ? 1 : 2;
+    if (!mpfr_regular_p(v))
+    {
+        return h + (mpfr_inf_p(v) ? 4 : 0);
+    }
+
+    mp_limb_t top = v->_mpfr_d[(mpfr_get_prec(v) - 1) / mp_bits_per_limb];
+
+    return h ^ std::hash<long>()(mpfr_get_exp(v)) * 31 ^ std::hash<mp_limb_t>()(top);
+}
 
 inline boost::multiprecision::mpfr_float log(boost::multiprecision::mpfr_float x) { return boost::multiprecision::log(x); }
 inline boost::multiprecision::mpfr_float log10(boost::multiprecision::mpfr_float x) { return boost::multiprecision::log10(x); }
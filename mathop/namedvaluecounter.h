@@ -21,9 +21,9 @@ struct NamedValueCounter : public Counter<T, Value<T>>
         return op->count(counter) ? counter.get_results()[0] : nullptr;
     }
 
-    VisitorResult<T> visit(std::shared_ptr<Variable<T>> op) override { return count(op); }
-    VisitorResult<T> visit(std::shared_ptr<NamedConstant<T>> op) override { return count(op); }
-    VisitorResult<T> visit(std::shared_ptr<ValueVariable<T>> op) override { return count(op); }
+    int visit(std::shared_ptr<Variable<T>> op) override { return count(op); }
+    int visit(std::shared_ptr<NamedConstant<T>> op) override { return count(op); }
+    int visit(std::shared_ptr<ValueVariable<T>> op) override { return count(op); }
 
 private:
     const std::string symbol;
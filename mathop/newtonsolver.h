@@ -0,0 +1,118 @@
+#ifndef NEWTONSOLVER_H
+#define NEWTONSOLVER_H
+
+#include "derivativetransformer.h"
+
+#include <limits>
+#include <vector>
+
+namespace MathOps
+{
+
+/* Finds roots of f(x) numerically, using Halley's method with symbolic first and second
+ * derivatives. Convergence is cubic near a simple root, so a root is found to the full precision
+ * of T in a handful of iterations. Where Halley's step is undefined, Newton's step is taken.
+ *
+ * x is set to each iterate while solving; it's left at its original value afterwards. */
+template <typename T>
+struct NewtonSolver
+{
+    NewtonSolver(std::shared_ptr<MathOp<T>> f, std::shared_ptr<Value<T>> x, int max_iterations = 200)
+        : f(f), x(x), max_iterations(max_iterations)
+    {
+        df = f->transform(DerivativeTransformer<T>(x));
+        d2f = df->transform(DerivativeTransformer<T>(x));
+    }
+
+    /* Returns the root that iterating from guess converges to, or NaN if it does not converge */
+    T solve(T guess)
+    {
+        T original = x->result();
+        T root = iterate(guess);
+        x->set(original);
+
+        return root;
+    }
+
+    /* Returns the distinct roots found from each of the guesses, in the order they were found */
+    std::vector<T> solve(const std::vector<T>& guesses)
+    {
+        const T tolerance = sqrt(std::numeric_limits<T>::epsilon());
+
+        std::vector<T> roots;
+        for (auto& guess: guesses)
+        {
+            T root = solve(guess);
+            if (isnan(root))
+            {
+                continue;
+            }
+
+            if (std::none_of(roots.begin(), roots.end(), [&](const T& r) {
+                    return abs(r - root) <= tolerance * std::max(T(1), abs(r)); }))
+            {
+                roots.push_back(root);
+            }
+        }
+
+        return roots;
+    }
+
+private:
+    std::shared_ptr<MathOp<T>> f;
+    std::shared_ptr<MathOp<T>> df;
+    std::shared_ptr<MathOp<T>> d2f;
+    std::shared_ptr<Value<T>> x;
+    int max_iterations;
+
+    T iterate(T xn)
+    {
+        const T epsilon = std::numeric_limits<T>::epsilon();
+        const T nan = std::numeric_limits<T>::quiet_NaN();
+
+        for (int i = 0; i < max_iterations; i++)
+        {
+            x->set(xn);
+
+            T fx = f->result();
+            if (fx == 0)
+            {
+                return xn;
+            }
+
+            T dfx = df->result();
+            if (isnan(fx) || isnan(dfx) || dfx == 0)
+            {
+                return nan;
+            }
+
+            T d2fx = d2f->result();
+            T denominator = 2 * dfx * dfx - fx * d2fx;
+
+            T step = fx / dfx;
+            if (!isnan(d2fx) && denominator != 0)
+            {
+                step = 2 * fx * dfx / denominator;
+            }
+
+            T next = xn - step;
+            if (isnan(next))
+            {
+                return nan;
+            }
+
+            if (abs(step) <= epsilon * abs(next))
+            {
+                return next;
+            }
+
+            xn = next;
+        }
+
+        return nan;
+    }
+};
+
+} /* namespace MathOps */
+
+#endif /* NEWTONSOLVER_H */
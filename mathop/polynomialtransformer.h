@@ -0,0 +1,689 @@
+#ifndef POLYNOMIALTRANSFORMER_H
+#define POLYNOMIALTRANSFORMER_H
+
+#include "dummytransformer.h"
+#include "finder.h"
+#include "intervalevaluator.h"
+#include "simplifier.h"
+
+#include <algorithm>
+#include <functional>
+#include <iterator>
+#include <map>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+namespace MathOps
+{
+
+/* Rewrites polynomial subtrees into Horner form. A subtree made of additions, subtractions,
+ * negations, multiplications, divisions by a constant and powers to a constant natural exponent is
+ * converted to a sparse polynomial, i.e. a map from the exponents of its terms to their
+ * coefficients. Its indeterminates ("atoms") are whatever else it's made of, such as variables or
+ * sin(x), by identity. Like terms are collected, and the polynomial is written back as e.g.
+ *
+ *     ((3 * x + 2) * x - 1) * x + 5
+ *
+ * which takes one multiplication per degree, rather than a power per term. A large gap in the
+ * exponents (as in x ^ 10 + 1) takes a single power. A polynomial in more than one atom is written
+ * in Horner form in the atom of the highest degree, and its coefficients are polynomials in the
+ * other atoms, which are written in Horner form in turn.
+ *
+ * A subtree is only rewritten if its Horner form costs less to evaluate (see Simplifier::cost()),
+ * so e.g. (x - 1) ^ 10 is left alone rather than expanded, and if every atom in it is still in its
+ * Horner form, so the result is NaN where an atom is (x - x is left alone, as x may be NaN).
+ * Otherwise, the result is that of the original up to rounding, as long as no atom is infinite and
+ * no term overflows. Where one does, the two can differ: x * x - x * x + x is NaN where x * x
+ * overflows, but its Horner form is just x.
+ *
+ * In strict mode, a subtree is therefore only rewritten where neither it nor its Horner form has an
+ * operation that can be infinite, whatever the values that can be set are later (see
+ * IntervalEvaluator), so the result is NaN where, and only where, the original is. As variables
+ * can be anything, that leaves mostly polynomials in bounded atoms, such as sin(x).
+ *
+ * Polynomials of more than max_terms terms or max_atoms atoms, or with a power over max_degree,
+ * are taken to be atoms themselves. Containers are left alone. */
+template <typename T>
+struct PolynomialTransformer : public DummyTransformer<T>
+{
+    PolynomialTransformer(bool strict = true, size_t max_terms = 32, size_t max_atoms = 8, unsigned max_degree = 64)
+        : strict(strict), max_terms(max_terms), max_atoms(max_atoms), max_degree(max_degree), intervals(true)
+    { }
+
+    std::shared_ptr<MathOp<T>> canonicalize(std::shared_ptr<MathOp<T>> op)
+    {
+        clear();
+
+        return op->transform(*this);
+    }
+
+    /* The equation lhs = rhs, with the terms that have x in them in Horner form on the left, and
+     * the others (negated) on the right, or nullptrs if it's too large a polynomial, or if x is
+     * also found inside one of its other atoms (as in x = cos(x)), so it can't be isolated. Unlike
+     * canonicalize(), the whole equation is rewritten, whatever it costs, and its atoms are used as
+     * they are. */
+    std::pair<std::shared_ptr<MathOp<T>>, std::shared_ptr<MathOp<T>>> separated(std::shared_ptr<MathOp<T>> lhs,
+        std::shared_ptr<MathOp<T>> rhs, std::shared_ptr<MathOp<T>> x)
+    {
+        clear();
+
+        auto difference = lhs - rhs;
+        auto& p = polynomial(difference);
+        auto it = atom_index.find(x.get());
+        if (!p.valid || it == atom_index.end())
+        {
+            return { nullptr, nullptr };
+        }
+
+        for (size_t i = 0; i < atom_ops.size(); i++)
+        {
+            if (i != it->second && atom_ops[i]->count(Finder<T>(x)) > 0)
+            {
+                return { nullptr, nullptr };
+            }
+        }
+
+        Terms with, without;
+        for (auto& term: p.terms)
+        {
+            bool has_x = std::any_of(term.first.begin(), term.first.end(), [&](auto& power) { return power.first == it->second; });
+            if (has_x)
+            {
+                with.insert(term);
+            }
+            else
+            {
+                without.emplace(term.first, -term.second);
+            }
+        }
+
+        atom_forms = atom_ops;
+
+        /* Powers are kept as they are, so x only appears once if it's in only one term */
+        unsigned cost = 0;
+        return { written(with, it->second, false, cost), written(without, no_atom, false, cost) };
+    }
+
+    std::shared_ptr<MathOp<T>> visit(std::shared_ptr<Negate<T>> op) override { return canonical(op); }
+    std::shared_ptr<MathOp<T>> visit(std::shared_ptr<Pow<T>> op) override { return canonical(op); }
+    std::shared_ptr<MathOp<T>> visit(std::shared_ptr<Mul<T>> op) override { return canonical(op); }
+    std::shared_ptr<MathOp<T>> visit(std::shared_ptr<Div<T>> op) override { return canonical(op); }
+    std::shared_ptr<MathOp<T>> visit(std::shared_ptr<Add<T>> op) override { return canonical(op); }
+    std::shared_ptr<MathOp<T>> visit(std::shared_ptr<Sub<T>> op) override { return canonical(op); }
+    std::shared_ptr<MathOp<T>> visit(std::shared_ptr<Sum<T>> op) override { return canonical(op); }
+    std::shared_ptr<MathOp<T>> visit(std::shared_ptr<Product<T>> op) override { return canonical(op); }
+
+private:
+    static constexpr size_t no_atom = static_cast<size_t>(-1);
+
+    /* The exponents of the atoms of a term, by atom index, in order of index */
+    typedef std::vector<std::pair<size_t, unsigned>> Monomial;
+    typedef std::map<Monomial, T> Terms;
+
+    struct Polynomial
+    {
+        bool valid;
+        Terms terms;
+
+        /* Every atom the subtree is made of, in order of index, whether it's in a term or not */
+        std::vector<size_t> atoms;
+
+        /* Of the operations the subtree is made of, leaving out its atoms */
+        unsigned cost;
+    };
+
+    bool strict;
+    size_t max_terms;
+    size_t max_atoms;
+    unsigned max_degree;
+
+    /* Whether the operations that were bounded are finite along with everything below them. They
+     * are kept alive by intervals. */
+    IntervalEvaluator<T> intervals;
+    std::unordered_map<const MathOp<T>*, bool> finite_ops;
+
+    /* Polynomials of the operations that were looked at, and the atoms they're made of */
+    std::unordered_map<const MathOp<T>*, Polynomial> polynomials;
+    std::unordered_map<const MathOp<T>*, size_t> atom_index;
+    std::vector<std::shared_ptr<MathOp<T>>> atom_ops;
+    std::vector<std::shared_ptr<MathOp<T>>> atom_forms;
+
+    void clear()
+    {
+        polynomials.clear();
+        atom_index.clear();
+        atom_ops.clear();
+        atom_forms.clear();
+    }
+
+    template<typename Op>
+    std::shared_ptr<MathOp<T>> canonical(std::shared_ptr<Op> op)
+    {
+        auto& p = polynomial(op);
+
+        /* Without atoms, it's folded to what it evaluates to, which keeps the sign of a -0 that
+         * the terms leave out */
+        if (p.valid && p.atoms.empty())
+        {
+            return ConstantValue<T>::create(op->result());
+        }
+
+        if (p.valid && keeps_atoms(p))
+        {
+            unsigned cost = 0;
+            auto result = written(p.terms, no_atom, true, cost);
+            if (cost < p.cost && (!strict || (finite(op) && finite(result))))
+            {
+                return result;
+            }
+        }
+
+        return DummyTransformer<T>::visit(op);
+    }
+
+    /* Whether neither op nor any of the operations and atoms it's made of can be infinite. What's
+     * inside an atom, like the x of sin(x), may be. Operations below op are checked bottom up, from
+     * a loop. */
+    bool finite(const std::shared_ptr<MathOp<T>>& op)
+    {
+        intervals.bounds(op);
+
+        std::vector<std::pair<MathOp<T>*, size_t>> stack { { op.get(), 0 } };
+        while (!stack.empty() && !finite_ops.count(op.get()))
+        {
+            MathOp<T>* next = stack.back().first;
+            size_t i = stack.back().second++;
+
+            if (is_operation(next) && i < next->arity())
+            {
+                if (!finite_ops.count(next->operand(i)))
+                {
+                    stack.emplace_back(next->operand(i), 0);
+                }
+
+                continue;
+            }
+
+            bool is_finite = intervals.bounds(next->shared_from_this()).is_finite();
+            for (size_t j = 0; is_operation(next) && j < next->arity() && is_finite; j++)
+            {
+                is_finite = finite_ops.at(next->operand(j));
+            }
+
+            stack.pop_back();
+            finite_ops.emplace(next, is_finite);
+        }
+
+        return finite_ops.at(op.get());
+    }
+
+    static bool keeps_atoms(const Polynomial& p)
+    {
+        std::vector<size_t> kept;
+        for (auto& term: p.terms)
+        {
+            for (auto& power: term.first)
+            {
+                kept.push_back(power.first);
+            }
+        }
+
+        std::sort(kept.begin(), kept.end());
+        kept.erase(std::unique(kept.begin(), kept.end()), kept.end());
+
+        return kept == p.atoms;
+    }
+
+    static bool is_operation(MathOp<T>* op)
+    {
+        return dynamic_cast<Negate<T>*>(op) || dynamic_cast<MathBinaryOp<T>*>(op) || dynamic_cast<MathNaryOp<T>*>(op);
+    }
+
+    /* Operations below op are converted bottom up, from a loop */
+    const Polynomial& polynomial(const std::shared_ptr<MathOp<T>>& op)
+    {
+        auto it = polynomials.find(op.get());
+        if (it != polynomials.end())
+        {
+            return it->second;
+        }
+
+        if (!is_operation(op.get()))
+        {
+            return polynomials.emplace(op.get(), operand(op.get())).first->second;
+        }
+
+        std::vector<std::pair<MathOp<T>*, size_t>> stack { { op.get(), 0 } };
+        while (!stack.empty())
+        {
+            MathOp<T>* next = stack.back().first;
+            size_t i = stack.back().second++;
+
+            if (i < next->arity())
+            {
+                MathOp<T>* x = next->operand(i);
+                if (is_operation(x) && !polynomials.count(x))
+                {
+                    stack.emplace_back(x, 0);
+                }
+
+                continue;
+            }
+
+            stack.pop_back();
+            polynomials.emplace(next, checked(converted(next)));
+        }
+
+        return polynomials.at(op.get());
+    }
+
+    /* Operands that aren't polynomials are atoms */
+    Polynomial operand(MathOp<T>* op)
+    {
+        if (auto value = dynamic_cast<ConstantValue<T>*>(op))
+        {
+            return constant(value->result());
+        }
+
+        if (is_operation(op))
+        {
+            auto& p = polynomials.at(op);
+            if (p.valid)
+            {
+                return p;
+            }
+        }
+
+        auto it = atom_index.find(op);
+        if (it == atom_index.end())
+        {
+            it = atom_index.emplace(op, atom_ops.size()).first;
+            atom_ops.push_back(op->shared_from_this());
+        }
+
+        return Polynomial { true, { { Monomial { { it->second, 1 } }, T(1) } }, { it->second }, 0 };
+    }
+
+    Polynomial converted(MathOp<T>* op)
+    {
+        if (auto negate = dynamic_cast<Negate<T>*>(op))
+        {
+            return scaled(operand(negate->get_x().get()), T(-1), false, cost(OpKind::Negate));
+        }
+
+        if (auto add = dynamic_cast<Add<T>*>(op))
+        {
+            return sum(operand(add->get_lhs().get()), operand(add->get_rhs().get()), false, cost(OpKind::Add));
+        }
+
+        if (auto sub = dynamic_cast<Sub<T>*>(op))
+        {
+            return sum(operand(sub->get_lhs().get()), operand(sub->get_rhs().get()), true, cost(OpKind::Sub));
+        }
+
+        if (auto mul = dynamic_cast<Mul<T>*>(op))
+        {
+            return product(operand(mul->get_lhs().get()), operand(mul->get_rhs().get()), cost(OpKind::Mul));
+        }
+
+        if (auto div = dynamic_cast<Div<T>*>(op))
+        {
+            auto divisor = dynamic_cast<ConstantValue<T>*>(div->get_rhs().get());
+            if (!divisor || divisor->result() == 0)
+            {
+                return invalid();
+            }
+
+            return scaled(operand(div->get_lhs().get()), divisor->result(), true, cost(OpKind::Div));
+        }
+
+        if (auto pow = dynamic_cast<Pow<T>*>(op))
+        {
+            auto exponent = dynamic_cast<ConstantValue<T>*>(pow->get_rhs().get());
+            T integral;
+            if (!exponent || exponent->result() < 0 || exponent->result() > max_degree ||
+                MathOps::modf(exponent->result(), integral) != 0)
+            {
+                return invalid();
+            }
+
+            return power(operand(pow->get_lhs().get()), static_cast<unsigned>(exponent->result()));
+        }
+
+        /* The same as the chain of binary operations they stand for */
+        if (auto nary = dynamic_cast<MathNaryOp<T>*>(op))
+        {
+            bool is_sum = nary->precedence() == Bodmas::AdditionSubtraction;
+            auto& terms = nary->get_terms();
+
+            Polynomial result = constant(is_sum ? T(0) : T(1));
+            for (size_t i = 0; i < terms.size() && result.valid; i++)
+            {
+                if (is_sum)
+                {
+                    unsigned c = i ? cost(terms[i].inverted ? OpKind::Sub : OpKind::Add) : terms[i].inverted ? cost(OpKind::Negate) : 0;
+                    result = sum(result, operand(terms[i].op.get()), terms[i].inverted, c);
+                }
+                else if (!terms[i].inverted)
+                {
+                    result = product(result, operand(terms[i].op.get()), i ? cost(OpKind::Mul) : 0);
+                }
+                else
+                {
+                    auto divisor = dynamic_cast<ConstantValue<T>*>(terms[i].op.get());
+                    result = divisor && divisor->result() != 0 ? scaled(result, divisor->result(), true, cost(OpKind::Div)) : invalid();
+                }
+            }
+
+            return result;
+        }
+
+        return invalid();
+    }
+
+    /* Coefficients that aren't finite, and polynomials that are too large, aren't converted */
+    Polynomial checked(Polynomial p) const
+    {
+        if (!p.valid || p.terms.size() > max_terms || p.atoms.size() > max_atoms)
+        {
+            return invalid();
+        }
+
+        for (auto& term: p.terms)
+        {
+            /* c - c is NaN if c is infinite or NaN */
+            if (MathOps::isnan(term.second - term.second) ||
+                std::any_of(term.first.begin(), term.first.end(), [this](auto& power) { return power.second > max_degree; }))
+            {
+                return invalid();
+            }
+        }
+
+        return p;
+    }
+
+    static Polynomial invalid() { return Polynomial { false, { }, { }, 0 }; }
+
+    static Polynomial constant(T c)
+    {
+        return Polynomial { true, c == 0 ? Terms { } : Terms { { Monomial { }, c } }, { }, 0 };
+    }
+
+    static std::vector<size_t> atoms(const Polynomial& a, const Polynomial& b)
+    {
+        std::vector<size_t> result;
+        std::set_union(a.atoms.begin(), a.atoms.end(), b.atoms.begin(), b.atoms.end(), std::back_inserter(result));
+
+        return result;
+    }
+
+    static void add_term(Terms& terms, const Monomial& monomial, T coefficient)
+    {
+        auto it = terms.emplace(monomial, T(0)).first;
+        it->second += coefficient;
+        if (it->second == 0)
+        {
+            terms.erase(it);
+        }
+    }
+
+    static unsigned cost(OpKind kind) { return Simplifier<T>::cost(kind); }
+
+    static Polynomial sum(const Polynomial& a, const Polynomial& b, bool subtract, unsigned cost)
+    {
+        if (!a.valid || !b.valid)
+        {
+            return invalid();
+        }
+
+        Polynomial result { true, a.terms, atoms(a, b), a.cost + b.cost + cost };
+        for (auto& term: b.terms)
+        {
+            add_term(result.terms, term.first, subtract ? -term.second : term.second);
+        }
+
+        return result;
+    }
+
+    static Polynomial scaled(const Polynomial& a, T factor, bool divide, unsigned cost)
+    {
+        if (!a.valid)
+        {
+            return invalid();
+        }
+
+        Polynomial result { true, { }, a.atoms, a.cost + cost };
+        for (auto& term: a.terms)
+        {
+            add_term(result.terms, term.first, divide ? T(term.second / factor) : T(term.second * factor));
+        }
+
+        return result;
+    }
+
+    Polynomial product(const Polynomial& a, const Polynomial& b, unsigned cost) const
+    {
+        if (!a.valid || !b.valid || a.terms.size() * b.terms.size() > max_terms * max_terms)
+        {
+            return invalid();
+        }
+
+        Polynomial result { true, { }, atoms(a, b), a.cost + b.cost + cost };
+        for (auto& x: a.terms)
+        {
+            for (auto& y: b.terms)
+            {
+                add_term(result.terms, multiplied(x.first, y.first), x.second * y.second);
+            }
+        }
+
+        return checked(result);
+    }
+
+    static Monomial multiplied(const Monomial& a, const Monomial& b)
+    {
+        Monomial result;
+        auto i = a.begin();
+        auto j = b.begin();
+        while (i != a.end() || j != b.end())
+        {
+            if (j == b.end() || (i != a.end() && i->first < j->first))
+            {
+                result.push_back(*i++);
+            }
+            else if (i == a.end() || j->first < i->first)
+            {
+                result.push_back(*j++);
+            }
+            else
+            {
+                result.emplace_back(i->first, i->second + j->second);
+                i++;
+                j++;
+            }
+        }
+
+        return result;
+    }
+
+    /* By squaring, giving up as soon as the result gets too large */
+    Polynomial power(Polynomial a, unsigned n) const
+    {
+        unsigned total = a.cost + cost(OpKind::Pow);
+
+        Polynomial result = constant(T(1));
+        result.atoms = a.atoms;
+        while (n && result.valid && a.valid)
+        {
+            if (n & 1)
+            {
+                result = product(result, a, 0);
+            }
+
+            n >>= 1;
+            if (n)
+            {
+                a = product(a, a, 0);
+            }
+        }
+
+        if (!result.valid || !a.valid)
+        {
+            return invalid();
+        }
+
+        result.cost = total;
+
+        return result;
+    }
+
+    /* Writes the terms in Horner form, in first if it's in any of them */
+    std::shared_ptr<MathOp<T>> written(const Terms& terms, size_t first, bool multiply_out, unsigned& cost)
+    {
+        if (terms.empty())
+        {
+            return ConstantValue<T>::create(0);
+        }
+
+        /* The highest exponent of every atom */
+        std::map<size_t, unsigned> degrees;
+        for (auto& term: terms)
+        {
+            for (auto& power: term.first)
+            {
+                degrees[power.first] = std::max(degrees[power.first], power.second);
+            }
+        }
+
+        if (degrees.empty())
+        {
+            return ConstantValue<T>::create(terms.begin()->second);
+        }
+
+        size_t outer = degrees.count(first) ? first : std::max_element(degrees.begin(), degrees.end(), [](auto& a, auto& b)
+        {
+            return a.second < b.second;
+        })->first;
+
+        /* The terms by their exponent of the outer atom, highest first, with that atom taken out */
+        std::map<unsigned, Terms, std::greater<unsigned>> coefficients;
+        for (auto& term: terms)
+        {
+            unsigned exponent = 0;
+            Monomial rest;
+            for (auto& power: term.first)
+            {
+                if (power.first == outer)
+                {
+                    exponent = power.second;
+                }
+                else
+                {
+                    rest.push_back(power);
+                }
+            }
+
+            coefficients[exponent].emplace(std::move(rest), term.second);
+        }
+
+        auto x = atom_form(outer);
+
+        std::shared_ptr<MathOp<T>> result;
+        unsigned previous = 0;
+        for (auto& coefficient: coefficients)
+        {
+            auto c = written(coefficient.second, no_atom, multiply_out, cost);
+            result = result ? add(multiply(result, power(x, previous - coefficient.first, multiply_out, cost), cost), c, cost) : c;
+            previous = coefficient.first;
+        }
+
+        return multiply(result, power(x, previous, multiply_out, cost), cost);
+    }
+
+    std::shared_ptr<MathOp<T>> atom_form(size_t index)
+    {
+        if (atom_forms.size() <= index)
+        {
+            atom_forms.resize(index + 1);
+        }
+
+        if (!atom_forms[index])
+        {
+            atom_forms[index] = this->transformed(atom_ops[index]);
+        }
+
+        return atom_forms[index];
+    }
+
+    static const ConstantValue<T>* literal(const std::shared_ptr<MathOp<T>>& op) { return dynamic_cast<ConstantValue<T>*>(op.get()); }
+
+    /* Small powers may be multiplied out, if that's cheaper */
+    static std::shared_ptr<MathOp<T>> power(std::shared_ptr<MathOp<T>> x, unsigned n, bool multiply_out, unsigned& cost)
+    {
+        if (n < 2)
+        {
+            return n ? x : nullptr;
+        }
+
+        if (multiply_out && (n - 1) * PolynomialTransformer<T>::cost(OpKind::Mul) < PolynomialTransformer<T>::cost(OpKind::Pow))
+        {
+            auto result = x;
+            for (unsigned i = 1; i < n; i++)
+            {
+                cost += PolynomialTransformer<T>::cost(OpKind::Mul);
+                result = result * x;
+            }
+
+            return result;
+        }
+
+        cost += PolynomialTransformer<T>::cost(OpKind::Pow);
+
+        return Pow<T>::create(x, ConstantValue<T>::create(n));
+    }
+
+    static std::shared_ptr<MathOp<T>> multiply(std::shared_ptr<MathOp<T>> c, std::shared_ptr<MathOp<T>> x, unsigned& cost)
+    {
+        if (!x)
+        {
+            return c;
+        }
+
+        auto value = literal(c);
+        if (value && (value->result() == 1 || value->result() == -1))
+        {
+            if (value->result() == 1)
+            {
+                return x;
+            }
+
+            cost += PolynomialTransformer<T>::cost(OpKind::Negate);
+
+            return -x;
+        }
+
+        cost += PolynomialTransformer<T>::cost(OpKind::Mul);
+
+        return c * x;
+    }
+
+    static std::shared_ptr<MathOp<T>> add(std::shared_ptr<MathOp<T>> x, std::shared_ptr<MathOp<T>> c, unsigned& cost)
+    {
+        auto value = literal(c);
+        if (value && value->result() < 0)
+        {
+            cost += PolynomialTransformer<T>::cost(OpKind::Sub);
+
+            return x - ConstantValue<T>::create(-value->result());
+        }
+
+        cost += PolynomialTransformer<T>::cost(OpKind::Add);
+
+        return x + c;
+    }
+};
+
+} /* namespace MathOps */
+
+#endif /* POLYNOMIALTRANSFORMER_H */
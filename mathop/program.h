@@ -0,0 +1,696 @@
+#ifndef PROGRAM_H
+#define PROGRAM_H
+
+#include "algeblah.h"
+
+#include <vector>
+#include <algorithm>
+#include <map>
+#include <unordered_map>
+
+namespace MathOps
+{
+
+/* A single register machine instruction: registers[dst] = op(registers[a], registers[b]). A Sum
+ * adds up the operands listed in its entry 'a' of the program's sums instead. */
+struct Instruction
+{
+    OpKind op;
+    uint32_t dst;
+    uint32_t a;
+    uint32_t b;
+};
+
+/* An operand of a Sum, and whether it's subtracted */
+struct SumTerm
+{
+    uint32_t a;
+    bool inverted;
+
+    bool operator<(const SumTerm& other) const { return a != other.a ? a < other.a : inverted < other.inverted; }
+};
+
+/* One or more MathOp trees compiled to a linear, register based instruction stream.
+ *
+ * Containers are inlined and constants are loaded into their registers once, at compile time.
+ * Every named value that can change (variables, etc) gets an input register, which is loaded at
+ * the start of each evaluation. Re-evaluating after Variable::set() therefore runs the
+ * instruction stream only, without walking the tree. Like the tree's cached results, an
+ * instruction that depends only on values that haven't changed since the last evaluation is
+ * skipped, and keeps its result.
+ *
+ * evaluate() runs the stream once for all compiled trees, after which output() reads any of their
+ * results. result() does both, and as long as no value changes, calling it for each tree in turn
+ * runs the stream only once.
+ *
+ * The tree is the better choice for an expression that's evaluated only a few times, as compiling
+ * costs about as much as a few evaluations of the tree, and for reading one of many unrelated
+ * trees compiled together after a change, as evaluate() updates all of them. Evaluating either
+ * from more than one thread at a time needs a copy (or Concurrent, for the tree).
+ *
+ * Common subexpressions are eliminated by value numbering: structurally identical subtrees,
+ * within one tree or across all trees compiled together, are computed once per evaluation.
+ *
+ * Sums are compensated, just like Sum::result() (see CompensatedSum). Products run as the chain of
+ * binary operations they stand for.
+ *
+ * The program is a snapshot: re-assigning a lambda after compilation is not seen by it. */
+template<typename T>
+struct Program
+{
+    Program(std::shared_ptr<MathOp<T>> op)
+        : Program(std::vector<std::shared_ptr<MathOp<T>>> { op })
+    { }
+
+    Program(const std::vector<std::shared_ptr<MathOp<T>>>& ops)
+    {
+        Compiler compiler;
+        std::vector<uint32_t> roots;
+        for (auto& op: ops)
+        {
+            roots.push_back(compiler.compile(op));
+        }
+
+        allocate(compiler, roots);
+    }
+
+    /* Evaluate every compiled tree, skipping the instructions whose values haven't changed */
+    void evaluate() const
+    {
+        /* The first evaluation runs everything, including what depends on constants only */
+        const bool all = !evaluated;
+        uint64_t changed = 0;
+        for (size_t j = 0; j < inputs.size(); j++)
+        {
+            T& reg = registers[inputs[j].reg];
+            if (!same_value(reg, *inputs[j].source))
+            {
+                reg = *inputs[j].source;
+                changed |= input_bit(j);
+            }
+        }
+
+        evaluated = true;
+        if (!all && !changed)
+        {
+            return;
+        }
+
+        T* r = registers.data();
+        for (size_t k = 0; k < code.size(); k++)
+        {
+            if (!all && !(depends[k] & changed))
+            {
+                continue;
+            }
+
+            const Instruction& i = code[k];
+            switch (i.op)
+            {
+                case OpKind::Negate: r[i.dst] = -r[i.a];                break;
+                case OpKind::Sqrt:   r[i.dst] = sqrt (r[i.a]);          break;
+                case OpKind::Log:    r[i.dst] = log  (r[i.a]);          break;
+                case OpKind::Log10:  r[i.dst] = log10(r[i.a]);          break;
+                case OpKind::Sin:    r[i.dst] = sin  (r[i.a]);          break;
+                case OpKind::ASin:   r[i.dst] = asin (r[i.a]);          break;
+                case OpKind::Cos:    r[i.dst] = cos  (r[i.a]);          break;
+                case OpKind::ACos:   r[i.dst] = acos (r[i.a]);          break;
+                case OpKind::Tan:    r[i.dst] = tan  (r[i.a]);          break;
+                case OpKind::ATan:   r[i.dst] = atan (r[i.a]);          break;
+                case OpKind::Sinh:   r[i.dst] = sinh (r[i.a]);          break;
+                case OpKind::ASinh:  r[i.dst] = asinh(r[i.a]);          break;
+                case OpKind::Cosh:   r[i.dst] = cosh (r[i.a]);          break;
+                case OpKind::ACosh:  r[i.dst] = acosh(r[i.a]);          break;
+                case OpKind::Tanh:   r[i.dst] = tanh (r[i.a]);          break;
+                case OpKind::ATanh:  r[i.dst] = atanh(r[i.a]);          break;
+                case OpKind::Pow:    r[i.dst] = pow(r[i.a], r[i.b]);    break;
+                case OpKind::Mul:    r[i.dst] = r[i.a] * r[i.b];        break;
+                case OpKind::Div:    r[i.dst] = r[i.a] / r[i.b];        break;
+                case OpKind::Add:    r[i.dst] = r[i.a] + r[i.b];        break;
+                case OpKind::Sub:    r[i.dst] = r[i.a] - r[i.b];        break;
+                case OpKind::Sum:    r[i.dst] = sum(sums[i.a], r);      break;
+                default:             assert(false);
+            }
+        }
+    }
+
+    /* The result of the given tree (in the order they were compiled) as of the last evaluate() */
+    T output(size_t index = 0) const { return registers[outputs[index]]; }
+
+    /* Evaluate and return the result of the given tree */
+    T result(size_t index = 0) const
+    {
+        evaluate();
+
+        return output(index);
+    }
+
+    /* Evaluate for n sets of inputs at once. Each of the given values is read from its column,
+     * any other value keeps its current value. The instruction stream is walked once per chunk of
+     * inputs, and every instruction runs as a loop over a contiguous lane of its registers. */
+    void results(const std::vector<std::shared_ptr<Value<T>>>& values, const std::vector<const T*>& columns,
+        T* out, size_t n) const
+    {
+        results(values, columns, std::vector<T*> { out }, n);
+    }
+
+    /* As above, writing the results of each compiled tree to its own output */
+    void results(const std::vector<std::shared_ptr<Value<T>>>& values, const std::vector<const T*>& columns,
+        const std::vector<T*>& outs, size_t n) const
+    {
+        assert(values.size() == columns.size());
+
+        const size_t lanes = std::min(n, chunk_size);
+        std::vector<T> lane_registers(registers.size() * lanes);
+
+        /* Broadcast constants and values that are not read from a column. The registers are left
+         * as they are, as evaluate() compares its inputs against them. */
+        for (size_t reg = 0; reg < registers.size(); reg++)
+        {
+            std::fill_n(lane_registers.begin() + reg * lanes, lanes, registers[reg]);
+        }
+
+        for (auto& input: inputs)
+        {
+            std::fill_n(lane_registers.begin() + input.reg * lanes, lanes, *input.source);
+        }
+
+        std::vector<std::pair<uint32_t, const T*>> column_regs;
+        for (size_t i = 0; i < values.size(); i++)
+        {
+            for (auto& input: inputs)
+            {
+                if (input.value == values[i])
+                {
+                    column_regs.emplace_back(input.reg, columns[i]);
+                }
+            }
+        }
+
+        for (size_t offset = 0; offset < n; offset += lanes)
+        {
+            const size_t m = std::min(lanes, n - offset);
+
+            for (auto& column: column_regs)
+            {
+                std::copy_n(column.second + offset, m, lane_registers.begin() + column.first * lanes);
+            }
+
+            T* r = lane_registers.data();
+            for (auto& i: code)
+            {
+                T* d = r + i.dst * lanes;
+                const T* a = r + i.a * lanes;
+                const T* b = r + i.b * lanes;
+
+                switch (i.op)
+                {
+                    case OpKind::Negate: for (size_t k = 0; k < m; k++) d[k] = -a[k];                break;
+                    case OpKind::Sqrt:   for (size_t k = 0; k < m; k++) d[k] = sqrt (a[k]);          break;
+                    case OpKind::Log:    for (size_t k = 0; k < m; k++) d[k] = log  (a[k]);          break;
+                    case OpKind::Log10:  for (size_t k = 0; k < m; k++) d[k] = log10(a[k]);          break;
+                    case OpKind::Sin:    for (size_t k = 0; k < m; k++) d[k] = sin  (a[k]);          break;
+                    case OpKind::ASin:   for (size_t k = 0; k < m; k++) d[k] = asin (a[k]);          break;
+                    case OpKind::Cos:    for (size_t k = 0; k < m; k++) d[k] = cos  (a[k]);          break;
+                    case OpKind::ACos:   for (size_t k = 0; k < m; k++) d[k] = acos (a[k]);          break;
+                    case OpKind::Tan:    for (size_t k = 0; k < m; k++) d[k] = tan  (a[k]);          break;
+                    case OpKind::ATan:   for (size_t k = 0; k < m; k++) d[k] = atan (a[k]);          break;
+                    case OpKind::Sinh:   for (size_t k = 0; k < m; k++) d[k] = sinh (a[k]);          break;
+                    case OpKind::ASinh:  for (size_t k = 0; k < m; k++) d[k] = asinh(a[k]);          break;
+                    case OpKind::Cosh:   for (size_t k = 0; k < m; k++) d[k] = cosh (a[k]);          break;
+                    case OpKind::ACosh:  for (size_t k = 0; k < m; k++) d[k] = acosh(a[k]);          break;
+                    case OpKind::Tanh:   for (size_t k = 0; k < m; k++) d[k] = tanh (a[k]);          break;
+                    case OpKind::ATanh:  for (size_t k = 0; k < m; k++) d[k] = atanh(a[k]);          break;
+                    case OpKind::Pow:    for (size_t k = 0; k < m; k++) d[k] = pow(a[k], b[k]);      break;
+                    case OpKind::Mul:    for (size_t k = 0; k < m; k++) d[k] = a[k] * b[k];          break;
+                    case OpKind::Div:    for (size_t k = 0; k < m; k++) d[k] = a[k] / b[k];          break;
+                    case OpKind::Add:    for (size_t k = 0; k < m; k++) d[k] = a[k] + b[k];          break;
+                    case OpKind::Sub:    for (size_t k = 0; k < m; k++) d[k] = a[k] - b[k];          break;
+                    case OpKind::Sum:    lane_sum(sums[i.a], r, lanes, d, m);                         break;
+                    default:             assert(false);
+                }
+            }
+
+            for (size_t i = 0; i < outs.size(); i++)
+            {
+                std::copy_n(lane_registers.begin() + outputs[i] * lanes, m, outs[i] + offset);
+            }
+        }
+    }
+
+    const std::vector<Instruction>& get_code() const { return code; }
+    size_t num_registers() const { return registers.size(); }
+
+private:
+    static constexpr size_t chunk_size = 256;
+
+    /* Inputs are read through source, which stays valid as long as value lives, rather than
+     * through the virtual result() */
+    struct Input
+    {
+        std::shared_ptr<Value<T>> value;
+        const T* source;
+        uint32_t reg;
+    };
+
+    std::vector<Instruction> code;
+    std::vector<std::vector<SumTerm>> sums;
+    std::vector<Input> inputs;
+    mutable std::vector<T> registers;
+    std::vector<uint32_t> outputs;
+
+    /* The inputs each instruction depends on, one bit per input. Inputs past the 63rd share the
+     * last bit. */
+    std::vector<uint64_t> depends;
+    mutable bool evaluated = false;
+
+    static uint64_t input_bit(size_t input) { return uint64_t(1) << std::min(input, size_t(63)); }
+
+    static T sum(const std::vector<SumTerm>& terms, const T* r)
+    {
+        CompensatedSum<T> total(terms[0].inverted ? -r[terms[0].a] : r[terms[0].a]);
+        for (size_t j = 1; j < terms.size(); j++)
+        {
+            total.add(terms[j].inverted ? -r[terms[j].a] : r[terms[j].a]);
+        }
+
+        return total.result();
+    }
+
+    /* Every lane is summed on its own, one operand at a time */
+    static void lane_sum(const std::vector<SumTerm>& terms, const T* r, size_t lanes, T* d, size_t m)
+    {
+        std::vector<CompensatedSum<T>> totals;
+        totals.reserve(m);
+
+        const T* first = r + terms[0].a * lanes;
+        for (size_t k = 0; k < m; k++)
+        {
+            totals.emplace_back(terms[0].inverted ? -first[k] : first[k]);
+        }
+
+        for (size_t j = 1; j < terms.size(); j++)
+        {
+            const T* x = r + terms[j].a * lanes;
+            for (size_t k = 0; k < m; k++)
+            {
+                totals[k].add(terms[j].inverted ? -x[k] : x[k]);
+            }
+        }
+
+        for (size_t k = 0; k < m; k++)
+        {
+            d[k] = totals[k].result();
+        }
+    }
+
+    /* Numbers every distinct value in the trees. Each one is described by an instruction whose
+     * 'dst' is its own number and whose operands are value numbers, in an order where operands
+     * precede their users. Leaves use OpKind::ConstantValue (with 'a' indexing 'constants') or
+     * OpKind::Variable (with 'a' indexing 'inputs'). Sums use OpKind::Sum, with 'a' indexing
+     * 'sums', whose operands are value numbers. */
+    struct Compiler : public Visitor<T, uint32_t>
+    {
+        std::vector<Instruction> values;
+        std::vector<T> constants;
+        std::vector<std::shared_ptr<Value<T>>> inputs;
+        std::vector<std::vector<SumTerm>> sums;
+
+        /* Operations are numbered in post-order, from a loop, so the stack usage doesn't depend on
+         * the depth of the tree. Each one is visited once its operands have been numbered. */
+        uint32_t compile(std::shared_ptr<MathOp<T>> root)
+        {
+            std::vector<std::pair<MathOp<T>*, bool>> stack { { root.get(), false } };
+            while (!stack.empty())
+            {
+                auto [op, ready] = stack.back();
+
+                /* Trees may be DAGs (e.g. when interned), so every node is numbered only once */
+                if (visited.count(op))
+                {
+                    stack.pop_back();
+                    continue;
+                }
+
+                if (!ready)
+                {
+                    stack.back().second = true;
+                    for (size_t i = op->arity(); i-- > 0; )
+                    {
+                        stack.push_back({ op->operand(i), false });
+                    }
+
+                    continue;
+                }
+
+                stack.pop_back();
+                visited[op] = this->apply(*op);
+            }
+
+            return visited[root.get()];
+        }
+
+        uint32_t visit(std::shared_ptr<ConstantSymbol<T>> op) override { return constant(op->result()); }
+        uint32_t visit(std::shared_ptr<Variable<T>> op) override { return input(op); }
+        uint32_t visit(std::shared_ptr<ValueVariable<T>> op) override { return input(op); }
+        uint32_t visit(std::shared_ptr<NamedConstant<T>> op) override { return constant(op->result()); }
+        uint32_t visit(std::shared_ptr<MutableValue<T>> op) override { return input(op); }
+        uint32_t visit(std::shared_ptr<ConstantValue<T>> op) override { return constant(op->result()); }
+
+        uint32_t visit(std::shared_ptr<Container<T>> op) override { return numbered(op->get_inner()); }
+
+        uint32_t visit(std::shared_ptr<Negate<T>> op) override { return unary(OpKind::Negate, op); }
+        uint32_t visit(std::shared_ptr<Sqrt<T>> op) override { return unary(OpKind::Sqrt, op); }
+        uint32_t visit(std::shared_ptr<Log<T>> op) override { return unary(OpKind::Log, op); }
+        uint32_t visit(std::shared_ptr<Log10<T>> op) override { return unary(OpKind::Log10, op); }
+        uint32_t visit(std::shared_ptr<Sin<T>> op) override { return unary(OpKind::Sin, op); }
+        uint32_t visit(std::shared_ptr<ASin<T>> op) override { return unary(OpKind::ASin, op); }
+        uint32_t visit(std::shared_ptr<Cos<T>> op) override { return unary(OpKind::Cos, op); }
+        uint32_t visit(std::shared_ptr<ACos<T>> op) override { return unary(OpKind::ACos, op); }
+        uint32_t visit(std::shared_ptr<Tan<T>> op) override { return unary(OpKind::Tan, op); }
+        uint32_t visit(std::shared_ptr<ATan<T>> op) override { return unary(OpKind::ATan, op); }
+        uint32_t visit(std::shared_ptr<Sinh<T>> op) override { return unary(OpKind::Sinh, op); }
+        uint32_t visit(std::shared_ptr<ASinh<T>> op) override { return unary(OpKind::ASinh, op); }
+        uint32_t visit(std::shared_ptr<Cosh<T>> op) override { return unary(OpKind::Cosh, op); }
+        uint32_t visit(std::shared_ptr<ACosh<T>> op) override { return unary(OpKind::ACosh, op); }
+        uint32_t visit(std::shared_ptr<Tanh<T>> op) override { return unary(OpKind::Tanh, op); }
+        uint32_t visit(std::shared_ptr<ATanh<T>> op) override { return unary(OpKind::ATanh, op); }
+
+        uint32_t visit(std::shared_ptr<Pow<T>> op) override { return binary(OpKind::Pow, op); }
+        uint32_t visit(std::shared_ptr<Mul<T>> op) override { return binary(OpKind::Mul, op); }
+        uint32_t visit(std::shared_ptr<Div<T>> op) override { return binary(OpKind::Div, op); }
+        uint32_t visit(std::shared_ptr<Add<T>> op) override { return binary(OpKind::Add, op); }
+        uint32_t visit(std::shared_ptr<Sub<T>> op) override { return binary(OpKind::Sub, op); }
+
+        uint32_t visit(std::shared_ptr<Sum<T>> op) override { return sum(op); }
+        uint32_t visit(std::shared_ptr<Product<T>> op) override { return product(op); }
+
+    private:
+        struct Key
+        {
+            OpKind kind;
+            uint32_t a;
+            uint32_t b;
+
+            bool operator==(const Key& other) const { return kind == other.kind && a == other.a && b == other.b; }
+        };
+
+        struct KeyHash
+        {
+            size_t operator()(const Key& key) const
+            {
+                return ((size_t) key.a * 0x9e3779b97f4a7c15ull) ^ ((size_t) key.b << 24) ^ (size_t) key.kind;
+            }
+        };
+
+        struct ValueHash
+        {
+            size_t operator()(const T& value) const { return value_hash(value); }
+        };
+
+        /* A -0 register mustn't be shared with 0, as 1 / -0 is -inf */
+        struct SameValue
+        {
+            bool operator()(const T& a, const T& b) const { return same_value(a, b); }
+        };
+
+        std::unordered_map<const MathOp<T>*, uint32_t> visited;
+        std::unordered_map<Key, uint32_t, KeyHash> numbers;
+        std::unordered_map<T, uint32_t, ValueHash, SameValue> constant_numbers;
+        std::unordered_map<const MathOp<T>*, uint32_t> input_numbers;
+        std::map<std::vector<SumTerm>, uint32_t> sum_numbers;
+
+        uint32_t add(OpKind kind, uint32_t a, uint32_t b = 0)
+        {
+            values.push_back(Instruction { kind, (uint32_t) values.size(), a, b });
+            return values.back().dst;
+        }
+
+        uint32_t constant(T value)
+        {
+            auto it = constant_numbers.find(value);
+            if (it != constant_numbers.end())
+            {
+                return it->second;
+            }
+
+            constants.push_back(value);
+            uint32_t number = add(OpKind::ConstantValue, (uint32_t) constants.size() - 1);
+            constant_numbers.emplace(value, number);
+
+            return number;
+        }
+
+        uint32_t input(std::shared_ptr<Value<T>> op)
+        {
+            auto it = input_numbers.find(op.get());
+            if (it != input_numbers.end())
+            {
+                return it->second;
+            }
+
+            inputs.push_back(op);
+            uint32_t number = add(OpKind::Variable, (uint32_t) inputs.size() - 1);
+            input_numbers[op.get()] = number;
+
+            return number;
+        }
+
+        uint32_t number(OpKind kind, uint32_t a, uint32_t b = 0)
+        {
+            /* Operands of commutative operations are ordered, so a * b and b * a are the same */
+            if ((kind == OpKind::Mul || kind == OpKind::Add) && b < a)
+            {
+                std::swap(a, b);
+            }
+
+            Key key { kind, a, b };
+            auto it = numbers.find(key);
+            if (it != numbers.end())
+            {
+                return it->second;
+            }
+
+            uint32_t n = add(kind, a, b);
+            numbers.emplace(key, n);
+
+            return n;
+        }
+
+        /* The number of an operand, which compile() numbers before its users */
+        uint32_t numbered(const std::shared_ptr<MathOp<T>>& op) const { return visited.at(op.get()); }
+
+        uint32_t unary(OpKind kind, std::shared_ptr<MathUnaryOp<T>> op)
+        {
+            return number(kind, numbered(op->get_x()));
+        }
+
+        uint32_t binary(OpKind kind, std::shared_ptr<MathBinaryOp<T>> op)
+        {
+            uint32_t lhs = numbered(op->get_lhs());
+            uint32_t rhs = numbered(op->get_rhs());
+
+            return number(kind, lhs, rhs);
+        }
+
+        uint32_t sum(std::shared_ptr<Sum<T>> op)
+        {
+            std::vector<SumTerm> terms;
+            terms.reserve(op->get_terms().size());
+            for (auto& term: op->get_terms())
+            {
+                terms.push_back(SumTerm { numbered(term.op), term.inverted });
+            }
+
+            auto it = sum_numbers.find(terms);
+            if (it != sum_numbers.end())
+            {
+                return it->second;
+            }
+
+            sums.push_back(terms);
+            uint32_t n = add(OpKind::Sum, (uint32_t) sums.size() - 1);
+            sum_numbers.emplace(std::move(terms), n);
+
+            return n;
+        }
+
+        /* Products run as the chain of binary operations they stand for */
+        uint32_t product(std::shared_ptr<Product<T>> op)
+        {
+            auto& terms = op->get_terms();
+
+            uint32_t result = numbered(terms[0].op);
+            if (terms[0].inverted)
+            {
+                result = number(OpKind::Div, constant(1), result);
+            }
+
+            for (size_t i = 1; i < terms.size(); i++)
+            {
+                result = number(terms[i].inverted ? OpKind::Div : OpKind::Mul, result, numbered(terms[i].op));
+            }
+
+            return result;
+        }
+    };
+
+    /* Assign registers to the numbered values and emit the code. A value's register is recycled
+     * once its last user has been emitted, by a value that depends on the same inputs: whenever one
+     * of them is skipped, so are the others, and all of their users. Values with a user that
+     * depends on more inputs, leaves and outputs keep their registers. */
+    void allocate(const Compiler& compiler, const std::vector<uint32_t>& roots)
+    {
+        const size_t n = compiler.values.size();
+        std::vector<uint32_t> uses(n, 0);
+        std::vector<uint32_t> reg(n);
+        std::vector<uint64_t> mask(n, 0);
+        std::vector<bool> kept(n, false);
+        std::unordered_map<uint64_t, std::vector<uint32_t>> free_temporaries;
+
+        auto for_operands = [&](const Instruction& value, auto f)
+        {
+            if (value.op == OpKind::ConstantValue || value.op == OpKind::Variable)
+            {
+                return;
+            }
+
+            if (value.op == OpKind::Sum)
+            {
+                for (auto& term: compiler.sums[value.a])
+                {
+                    f(term.a);
+                }
+
+                return;
+            }
+
+            f(value.a);
+            if (is_binary(value.op))
+            {
+                f(value.b);
+            }
+        };
+
+        for (auto& value: compiler.values)
+        {
+            if (value.op == OpKind::ConstantValue || value.op == OpKind::Variable)
+            {
+                kept[value.dst] = true;
+                mask[value.dst] = value.op == OpKind::Variable ? input_bit(value.a) : 0;
+            }
+
+            for_operands(value, [&](uint32_t operand)
+            {
+                uses[operand]++;
+                mask[value.dst] |= mask[operand];
+            });
+        }
+
+        for (auto& value: compiler.values)
+        {
+            for_operands(value, [&](uint32_t operand)
+            {
+                if (mask[operand] != mask[value.dst])
+                {
+                    kept[operand] = true;
+                }
+            });
+        }
+
+        for (auto root: roots)
+        {
+            uses[root]++;
+            kept[root] = true;
+        }
+
+        auto new_register = [&](uint32_t value)
+        {
+            auto& free = free_temporaries[mask[value]];
+            if (!kept[value] && !free.empty())
+            {
+                uint32_t r = free.back();
+                free.pop_back();
+
+                return r;
+            }
+
+            registers.emplace_back();
+
+            return (uint32_t) registers.size() - 1;
+        };
+
+        auto release = [&](uint32_t value)
+        {
+            if (--uses[value] == 0 && !kept[value])
+            {
+                free_temporaries[mask[value]].push_back(reg[value]);
+            }
+        };
+
+        for (auto& value: compiler.values)
+        {
+            switch (value.op)
+            {
+                case OpKind::ConstantValue:
+                    reg[value.dst] = new_register(value.dst);
+                    registers[reg[value.dst]] = compiler.constants[value.a];
+                    break;
+
+                case OpKind::Variable:
+                {
+                    auto& input = compiler.inputs[value.a];
+                    reg[value.dst] = new_register(value.dst);
+                    inputs.push_back(Input { input, &input->get_value(), reg[value.dst] });
+                    break;
+                }
+
+                case OpKind::Sum:
+                {
+                    std::vector<SumTerm> terms = compiler.sums[value.a];
+                    for (auto& term: terms)
+                    {
+                        release(term.a);
+                        term.a = reg[term.a];
+                    }
+
+                    sums.push_back(std::move(terms));
+                    reg[value.dst] = new_register(value.dst);
+                    code.push_back(Instruction { OpKind::Sum, reg[value.dst], (uint32_t) sums.size() - 1, 0 });
+                    depends.push_back(mask[value.dst]);
+                    break;
+                }
+
+                default:
+                {
+                    uint32_t a = reg[value.a];
+                    uint32_t b = is_binary(value.op) ? reg[value.b] : 0;
+                    release(value.a);
+                    if (is_binary(value.op))
+                    {
+                        release(value.b);
+                    }
+
+                    reg[value.dst] = new_register(value.dst);
+                    code.push_back(Instruction { value.op, reg[value.dst], a, b });
+                    depends.push_back(mask[value.dst]);
+                }
+            }
+        }
+
+        for (auto root: roots)
+        {
+            outputs.push_back(reg[root]);
+        }
+    }
+
+    static bool is_binary(OpKind kind)
+    {
+        return kind == OpKind::Pow || kind == OpKind::Mul || kind == OpKind::Div ||
+               kind == OpKind::Add || kind == OpKind::Sub;
+    }
+};
+
+} /* namespace MathOps */
+
+#endif /* PROGRAM_H */
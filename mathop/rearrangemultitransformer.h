@@ -3,68 +3,180 @@
 
 #include "algeblah.h"
 #include "reversemultitransformer.h"
+#include "intervalevaluator.h"
+#include "interner.h"
+#include "threadpool.h"
+
+#include <atomic>
+#include <functional>
+#include <set>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
 
 namespace MathOps
 {
 
+/* Finds every expression for solve_for, given that the visited tree evaluates to from. Given a
+ * pool, a result of an operation with more than one reverse (e.g. the square root of x^2) is
+ * rearranged by the pool, while this thread follows the first. Solutions are always found in the
+ * same order, no matter how the branches are scheduled.
+ *
+ * Forking a branch costs more than rearranging a small subtree (and trees are slower to evaluate
+ * while they're shared between threads), so branches are only forked where the operation has at
+ * least fork_size operations below it. A lower fork_size pays off where every operation is costly,
+ * e.g. at a high precision.
+ *
+ * Branches are dropped if they can only be NaN at the current values of the variables, unless
+ * any_value is set, in which case they're only dropped if they're NaN at any value. Solutions can
+ * then be reused after the variables have changed.
+ *
+ * Given a Found function, solutions are passed to it (in the same order) as soon as they're found,
+ * instead of being returned, and the search stops as soon as it returns false. */
 template <typename T>
-struct RearrangeMultiTransformer : public Visitor<T>
+struct RearrangeMultiTransformer : public MultiTransformVisitor<T>
 {
-    RearrangeMultiTransformer(std::shared_ptr<MathOp<T>> solve_for, std::shared_ptr<MathOp<T>> from)
-        : solve_for(solve_for), from(from)
+    typedef std::function<bool(const std::shared_ptr<MathOp<T>>&)> Found;
+
+    static constexpr size_t default_fork_size = 64;
+
+    RearrangeMultiTransformer(std::shared_ptr<MathOp<T>> solve_for, std::shared_ptr<MathOp<T>> from,
+        ThreadPool* pool = nullptr, bool any_value = false, size_t fork_size = default_fork_size)
+        : RearrangeMultiTransformer(solve_for, from, std::make_shared<Search>(pool, any_value, fork_size), std::make_shared<Branch>(any_value))
     { }
 
-    VisitorResult<T> visit(std::shared_ptr<ConstantSymbol<T>> op) override { return solve_for_single(op); }
-    VisitorResult<T> visit(std::shared_ptr<Variable<T>> op) override { return solve_for_single(op); }
-    VisitorResult<T> visit(std::shared_ptr<ValueVariable<T>> op) override { return solve_for_single(op); }
-    VisitorResult<T> visit(std::shared_ptr<NamedConstant<T>> op) override { return solve_for_single(op); }
-    VisitorResult<T> visit(std::shared_ptr<MutableValue<T>> op) override { return solve_for_single(op); }
-    VisitorResult<T> visit(std::shared_ptr<ConstantValue<T>> op) override { return solve_for_single(op); }
-
-    VisitorResult<T> visit(std::shared_ptr<Container<T>> op) override { return op->get_inner()->multi_transform(*this); }
-
-    VisitorResult<T> visit(std::shared_ptr<Negate<T>> op) override { return solve_for_unary(op, op->get_x()); }
-    VisitorResult<T> visit(std::shared_ptr<Sqrt<T>> op) override { return solve_for_unary(op, op->get_x()); }
-    VisitorResult<T> visit(std::shared_ptr<Log<T>> op) override { return solve_for_unary(op, op->get_x()); }
-    VisitorResult<T> visit(std::shared_ptr<Log10<T>> op) override { return solve_for_unary(op, op->get_x()); }
-    VisitorResult<T> visit(std::shared_ptr<Sin<T>> op) override { return solve_for_unary(op, op->get_x()); }
-    VisitorResult<T> visit(std::shared_ptr<ASin<T>> op) override { return solve_for_unary(op, op->get_x()); }
-    VisitorResult<T> visit(std::shared_ptr<Cos<T>> op) override { return solve_for_unary(op, op->get_x()); }
-    VisitorResult<T> visit(std::shared_ptr<ACos<T>> op) override { return solve_for_unary(op, op->get_x()); }
-    VisitorResult<T> visit(std::shared_ptr<Tan<T>> op) override { return solve_for_unary(op, op->get_x()); }
-    VisitorResult<T> visit(std::shared_ptr<ATan<T>> op) override { return solve_for_unary(op, op->get_x()); }
-    VisitorResult<T> visit(std::shared_ptr<Sinh<T>> op) override { return solve_for_unary(op, op->get_x()); }
-    VisitorResult<T> visit(std::shared_ptr<ASinh<T>> op) override { return solve_for_unary(op, op->get_x()); }
-    VisitorResult<T> visit(std::shared_ptr<Cosh<T>> op) override { return solve_for_unary(op, op->get_x()); }
-    VisitorResult<T> visit(std::shared_ptr<ACosh<T>> op) override { return solve_for_unary(op, op->get_x()); }
-    VisitorResult<T> visit(std::shared_ptr<Tanh<T>> op) override { return solve_for_unary(op, op->get_x()); }
-    VisitorResult<T> visit(std::shared_ptr<ATanh<T>> op) override { return solve_for_unary(op, op->get_x()); }
-
-    VisitorResult<T> visit(std::shared_ptr<Pow<T>> op) override { return solve_for_binary(op, op->get_lhs(), op->get_rhs()); }
-    VisitorResult<T> visit(std::shared_ptr<Mul<T>> op) override { return solve_for_binary(op, op->get_lhs(), op->get_rhs()); }
-    VisitorResult<T> visit(std::shared_ptr<Div<T>> op) override { return solve_for_binary(op, op->get_lhs(), op->get_rhs()); }
-    VisitorResult<T> visit(std::shared_ptr<Add<T>> op) override { return solve_for_binary(op, op->get_lhs(), op->get_rhs()); }
-    VisitorResult<T> visit(std::shared_ptr<Sub<T>> op) override { return solve_for_binary(op, op->get_lhs(), op->get_rhs()); }
+    RearrangeMultiTransformer(std::shared_ptr<MathOp<T>> solve_for, std::shared_ptr<MathOp<T>> from, Found found,
+        ThreadPool* pool = nullptr, bool any_value = false, size_t fork_size = default_fork_size)
+        : RearrangeMultiTransformer(solve_for, from, std::make_shared<Search>(pool, any_value, fork_size), std::make_shared<Branch>(any_value, found))
+    { }
+
+    std::vector<std::shared_ptr<MathOp<T>>> visit(std::shared_ptr<ConstantSymbol<T>> op) override { return solve_for_single(op); }
+    std::vector<std::shared_ptr<MathOp<T>>> visit(std::shared_ptr<Variable<T>> op) override { return solve_for_single(op); }
+    std::vector<std::shared_ptr<MathOp<T>>> visit(std::shared_ptr<ValueVariable<T>> op) override { return solve_for_single(op); }
+    std::vector<std::shared_ptr<MathOp<T>>> visit(std::shared_ptr<NamedConstant<T>> op) override { return solve_for_single(op); }
+    std::vector<std::shared_ptr<MathOp<T>>> visit(std::shared_ptr<MutableValue<T>> op) override { return solve_for_single(op); }
+    std::vector<std::shared_ptr<MathOp<T>>> visit(std::shared_ptr<ConstantValue<T>> op) override { return solve_for_single(op); }
+
+    std::vector<std::shared_ptr<MathOp<T>>> visit(std::shared_ptr<Container<T>> op) override { return op->get_inner()->multi_transform(*this); }
+
+    std::vector<std::shared_ptr<MathOp<T>>> visit(std::shared_ptr<Negate<T>> op) override { return solve_for_unary(op, op->get_x()); }
+    std::vector<std::shared_ptr<MathOp<T>>> visit(std::shared_ptr<Sqrt<T>> op) override { return solve_for_unary(op, op->get_x()); }
+    std::vector<std::shared_ptr<MathOp<T>>> visit(std::shared_ptr<Log<T>> op) override { return solve_for_unary(op, op->get_x()); }
+    std::vector<std::shared_ptr<MathOp<T>>> visit(std::shared_ptr<Log10<T>> op) override { return solve_for_unary(op, op->get_x()); }
+    std::vector<std::shared_ptr<MathOp<T>>> visit(std::shared_ptr<Sin<T>> op) override { return solve_for_unary(op, op->get_x()); }
+    std::vector<std::shared_ptr<MathOp<T>>> visit(std::shared_ptr<ASin<T>> op) override { return solve_for_unary(op, op->get_x()); }
+    std::vector<std::shared_ptr<MathOp<T>>> visit(std::shared_ptr<Cos<T>> op) override { return solve_for_unary(op, op->get_x()); }
+    std::vector<std::shared_ptr<MathOp<T>>> visit(std::shared_ptr<ACos<T>> op) override { return solve_for_unary(op, op->get_x()); }
+    std::vector<std::shared_ptr<MathOp<T>>> visit(std::shared_ptr<Tan<T>> op) override { return solve_for_unary(op, op->get_x()); }
+    std::vector<std::shared_ptr<MathOp<T>>> visit(std::shared_ptr<ATan<T>> op) override { return solve_for_unary(op, op->get_x()); }
+    std::vector<std::shared_ptr<MathOp<T>>> visit(std::shared_ptr<Sinh<T>> op) override { return solve_for_unary(op, op->get_x()); }
+    std::vector<std::shared_ptr<MathOp<T>>> visit(std::shared_ptr<ASinh<T>> op) override { return solve_for_unary(op, op->get_x()); }
+    std::vector<std::shared_ptr<MathOp<T>>> visit(std::shared_ptr<Cosh<T>> op) override { return solve_for_unary(op, op->get_x()); }
+    std::vector<std::shared_ptr<MathOp<T>>> visit(std::shared_ptr<ACosh<T>> op) override { return solve_for_unary(op, op->get_x()); }
+    std::vector<std::shared_ptr<MathOp<T>>> visit(std::shared_ptr<Tanh<T>> op) override { return solve_for_unary(op, op->get_x()); }
+    std::vector<std::shared_ptr<MathOp<T>>> visit(std::shared_ptr<ATanh<T>> op) override { return solve_for_unary(op, op->get_x()); }
+
+    std::vector<std::shared_ptr<MathOp<T>>> visit(std::shared_ptr<Pow<T>> op) override { return solve_for_binary(op, op->get_lhs(), op->get_rhs()); }
+    std::vector<std::shared_ptr<MathOp<T>>> visit(std::shared_ptr<Mul<T>> op) override { return solve_for_binary(op, op->get_lhs(), op->get_rhs()); }
+    std::vector<std::shared_ptr<MathOp<T>>> visit(std::shared_ptr<Div<T>> op) override { return solve_for_binary(op, op->get_lhs(), op->get_rhs()); }
+    std::vector<std::shared_ptr<MathOp<T>>> visit(std::shared_ptr<Add<T>> op) override { return solve_for_binary(op, op->get_lhs(), op->get_rhs()); }
+    std::vector<std::shared_ptr<MathOp<T>>> visit(std::shared_ptr<Sub<T>> op) override { return solve_for_binary(op, op->get_lhs(), op->get_rhs()); }
+
+    std::vector<std::shared_ptr<MathOp<T>>> visit(std::shared_ptr<Sum<T>> op) override { return solve_for_nary(op); }
+    std::vector<std::shared_ptr<MathOp<T>>> visit(std::shared_ptr<Product<T>> op) override { return solve_for_nary(op); }
 
 private:
+    /* State shared by the whole rearrangement, by every thread. Other than 'stopped', none of it
+     * is written to once branches are forked, so it's read without a lock. */
+    struct Search
+    {
+        Search(ThreadPool* pool, bool any_value, size_t fork_size) : pool(pool), any_value(any_value), fork_size(fork_size) { }
+
+        ThreadPool* pool;
+        bool any_value;
+        size_t fork_size;
+
+        /* The operations solve_for is found in (including solve_for itself). Only these lead to a
+         * solution, so the other operand of a binary operation is never rearranged. */
+        std::unordered_set<const MathOp<T>*> on_path;
+        bool path_found = false;
+
+        /* Set once Found returned false */
+        std::atomic<bool> stopped { false };
+    };
+
+    /* State of the branches followed by a single thread. A subtree is rearranged only once for
+     * equivalent results, and equivalent solutions are only found once.
+     *
+     * Branches forked to the pool start out with state of their own, and their solutions are
+     * merged in order when they're joined, dropping those that were found before. Following the
+     * same subtree more than once is wasted work, but doesn't change the outcome.
+     *
+     * Only the branches followed by the thread that started the search pass solutions to Found,
+     * which they do in order, including those of the branches they join.
+     *
+     * Each thread bounds and interns with its own evaluator and interner, so no thread waits for
+     * another. The bounds found by a forked branch are merged when it's joined. Its canonical forms
+     * are only comparable within the branch, so its solutions are interned again when they're
+     * merged. */
+    struct Branch
+    {
+        Branch(bool any_value, Found found = nullptr) : found(found), bounds(any_value) { }
+
+        Found found;
+        std::set<std::pair<const MathOp<T>*, const MathOp<T>*>> rearranged;
+        std::unordered_set<const MathOp<T>*> solutions;
+
+        /* Branches that can only evaluate to NaN (e.g. the asin() of a value above 1) are dropped
+         * before they're rearranged any further */
+        IntervalEvaluator<T> bounds;
+
+        /* Branches and solutions are compared in canonical form. The form of each solution is
+         * remembered, as the same solution may be compared more than once. */
+        Interner<T> canonical { true };
+        std::unordered_map<std::shared_ptr<MathOp<T>>, const MathOp<T>*> solution_forms;
+    };
+
     const std::shared_ptr<MathOp<T>> solve_for;
     const std::shared_ptr<MathOp<T>> from;
+    const std::shared_ptr<Search> search;
+    const std::shared_ptr<Branch> branch;
+
+    RearrangeMultiTransformer(std::shared_ptr<MathOp<T>> solve_for, std::shared_ptr<MathOp<T>> from,
+        std::shared_ptr<Search> search, std::shared_ptr<Branch> branch)
+        : solve_for(solve_for), from(from), search(search), branch(branch)
+    { }
 
     std::vector<std::shared_ptr<MathOp<T>>> solve_for_single(std::shared_ptr<MathOp<T>> op)
     {
-        return op == solve_for
-            ? std::vector<std::shared_ptr<MathOp<T>>> { from }
-            : std::vector<std::shared_ptr<MathOp<T>>> { };
+        std::vector<std::shared_ptr<MathOp<T>>> solutions;
+        if (op == solve_for && branch->solutions.insert(solution_form(from)).second)
+        {
+            found(from, solutions);
+        }
+
+        return solutions;
+    }
+
+    /* Pass a solution on if this branch does so, or else return it */
+    void found(const std::shared_ptr<MathOp<T>>& solution, std::vector<std::shared_ptr<MathOp<T>>>& solutions)
+    {
+        if (!branch->found)
+        {
+            solutions.push_back(solution);
+        }
+        else if (!search->stopped && !branch->found(solution))
+        {
+            search->stopped = true;
+        }
     }
 
     std::vector<std::shared_ptr<MathOp<T>>> solve_for_unary(std::shared_ptr<MathOp<T>> op, std::shared_ptr<MathOp<T>> x)
     {
         std::vector<std::shared_ptr<MathOp<T>>> solutions;
-        auto from_x_results = op->multi_transform(ReverseMultiTransformer<T>(x, from));
-        for(auto& from_x: from_x_results)
+        if (leads_to_solve_for(op, x))
         {
-            auto r = x->multi_transform(RearrangeMultiTransformer<T>(solve_for, from_x));
-            solutions.insert(solutions.end(), r.begin(), r.end());
+            rearrange(x, op->multi_transform(ReverseMultiTransformer<T>(x, from)), solutions);
         }
 
         return solutions;
@@ -74,22 +186,188 @@ private:
         std::shared_ptr<MathOp<T>> lhs, std::shared_ptr<MathOp<T>> rhs)
     {
         std::vector<std::shared_ptr<MathOp<T>>> solutions;
-        auto from_lhs_results = op->multi_transform(ReverseMultiTransformer<T>(lhs, from));
-        for(auto& from_lhs: from_lhs_results)
+        if (leads_to_solve_for(op, lhs))
         {
-            auto r = lhs->multi_transform(RearrangeMultiTransformer<T>(solve_for, from_lhs));
-            solutions.insert(solutions.end(), r.begin(), r.end());
+            rearrange(lhs, op->multi_transform(ReverseMultiTransformer<T>(lhs, from)), solutions);
         }
 
-        auto from_rhs_results = op->multi_transform(ReverseMultiTransformer<T>(rhs, from));
-        for(auto& from_rhs: from_rhs_results)
+        if (leads_to_solve_for(op, rhs))
         {
-            auto r = rhs->multi_transform(RearrangeMultiTransformer<T>(solve_for, from_rhs));
-            solutions.insert(solutions.end(), r.begin(), r.end());
+            rearrange(rhs, op->multi_transform(ReverseMultiTransformer<T>(rhs, from)), solutions);
         }
 
         return solutions;
     }
+
+    /* Each operand is rearranged once, even if it's used more than once */
+    std::vector<std::shared_ptr<MathOp<T>>> solve_for_nary(std::shared_ptr<MathNaryOp<T>> op)
+    {
+        std::vector<std::shared_ptr<MathOp<T>>> solutions;
+        std::unordered_set<const MathOp<T>*> seen;
+        for (auto& term: op->get_terms())
+        {
+            if (seen.insert(term.op.get()).second && leads_to_solve_for(op, term.op))
+            {
+                rearrange(term.op, op->multi_transform(ReverseMultiTransformer<T>(term.op, from)), solutions);
+            }
+        }
+
+        return solutions;
+    }
+
+    /* The first operation that's rearranged is the root of the tree, or the inner operation of its
+     * container, so every operand that's asked about afterwards is below it */
+    bool leads_to_solve_for(const std::shared_ptr<MathOp<T>>& root, const std::shared_ptr<MathOp<T>>& x)
+    {
+        if (!search->path_found)
+        {
+            find_path(root.get());
+            search->path_found = true;
+        }
+
+        return search->on_path.count(x.get());
+    }
+
+    /* Mark every operation below root that solve_for is found in, bottom up, from a loop */
+    void find_path(MathOp<T>* root)
+    {
+        std::unordered_set<const MathOp<T>*> visited { root };
+        std::vector<std::pair<MathOp<T>*, size_t>> stack { { root, 0 } };
+        while (!stack.empty())
+        {
+            MathOp<T>* next = stack.back().first;
+            size_t i = stack.back().second++;
+
+            if (i < next->arity())
+            {
+                if (visited.insert(next->operand(i)).second)
+                {
+                    stack.emplace_back(next->operand(i), 0);
+                }
+
+                continue;
+            }
+
+            stack.pop_back();
+
+            bool found = next == solve_for.get();
+            for (size_t j = 0; !found && j < next->arity(); j++)
+            {
+                found = search->on_path.count(next->operand(j));
+            }
+
+            if (found)
+            {
+                search->on_path.insert(next);
+            }
+        }
+    }
+
+    const MathOp<T>* canonical(const std::shared_ptr<MathOp<T>>& op)
+    {
+        return branch->canonical.intern(op).get();
+    }
+
+    const MathOp<T>* solution_form(const std::shared_ptr<MathOp<T>>& solution)
+    {
+        auto it = branch->solution_forms.find(solution);
+        if (it != branch->solution_forms.end())
+        {
+            return it->second;
+        }
+
+        auto form = branch->canonical.intern(solution).get();
+        branch->solution_forms.emplace(solution, form);
+
+        return form;
+    }
+
+    bool is_nan(const std::shared_ptr<MathOp<T>>& op)
+    {
+        return branch->bounds.is_nan(op);
+    }
+
+    /* Whether op has at least n operations (counting shared ones once per use), without counting
+     * any further */
+    static bool has_operations(const std::shared_ptr<MathOp<T>>& op, size_t n)
+    {
+        std::vector<const MathOp<T>*> pending { op.get() };
+        size_t count = 0;
+        while (!pending.empty() && count < n)
+        {
+            const MathOp<T>* next = pending.back();
+            pending.pop_back();
+            count++;
+
+            for (size_t i = 0; i < next->arity(); i++)
+            {
+                pending.push_back(next->operand(i));
+            }
+        }
+
+        return count >= n;
+    }
+
+    /* Rearrange x for each of the results it should have */
+    void rearrange(std::shared_ptr<MathOp<T>> x, const std::vector<std::shared_ptr<MathOp<T>>>& from_x_results,
+        std::vector<std::shared_ptr<MathOp<T>>>& solutions)
+    {
+        if (search->stopped)
+        {
+            return;
+        }
+
+        std::vector<std::shared_ptr<MathOp<T>>> branches;
+        for(auto& from_x: from_x_results)
+        {
+            if (!is_nan(from_x) && branch->rearranged.emplace(x.get(), canonical(from_x)).second)
+            {
+                branches.push_back(from_x);
+            }
+        }
+
+        if (!search->pool || !search->pool->size() || branches.size() < 2 || !has_operations(x, search->fork_size))
+        {
+            for (size_t i = 0; i < branches.size() && !search->stopped; i++)
+            {
+                auto r = x->multi_transform(RearrangeMultiTransformer<T>(solve_for, branches[i], search, branch));
+                solutions.insert(solutions.end(), r.begin(), r.end());
+            }
+
+            return;
+        }
+
+        typename MathOp<T>::Concurrent concurrent;
+
+        std::vector<std::shared_ptr<Branch>> forked_branches;
+        std::vector<std::future<std::vector<std::shared_ptr<MathOp<T>>>>> forked;
+        for (size_t i = 1; i < branches.size(); i++)
+        {
+            auto forked_branch = std::make_shared<Branch>(search->any_value);
+            forked_branches.push_back(forked_branch);
+            forked.push_back(search->pool->submit([solve_for = solve_for, x, from_x = branches[i], search = search, forked_branch]
+            {
+                return x->multi_transform(RearrangeMultiTransformer<T>(solve_for, from_x, search, forked_branch));
+            }));
+        }
+
+        auto r = x->multi_transform(RearrangeMultiTransformer<T>(solve_for, branches[0], search, branch));
+        solutions.insert(solutions.end(), r.begin(), r.end());
+
+        /* Forked branches are joined even after the search has stopped, as they share its state */
+        for (size_t i = 0; i < forked.size(); i++)
+        {
+            for (auto& solution: search->pool->wait(forked[i]))
+            {
+                if (!search->stopped && branch->solutions.insert(solution_form(solution)).second)
+                {
+                    found(solution, solutions);
+                }
+            }
+
+            branch->bounds.merge(forked_branches[i]->bounds);
+        }
+    }
 };
 
 } /* namespace MathOps */
@@ -9,10 +9,10 @@ namespace MathOps
 template <typename T>
 struct MathOpRemoveNoOpTransformer : public DummyTransformer<T>
 {
-    VisitorResult<T> visit(std::shared_ptr<Pow<T>> op) override
+    std::shared_ptr<MathOp<T>> visit(std::shared_ptr<Pow<T>> op) override
     {
-        auto lhs = op->get_lhs()->transform(*this);
-        auto rhs = op->get_rhs()->transform(*this);
+        auto lhs = this->transformed(op->get_lhs());
+        auto rhs = this->transformed(op->get_rhs());
 
         if (lhs->is_constant() && lhs->result() == 0)
         {
@@ -29,13 +29,13 @@ struct MathOpRemoveNoOpTransformer : public DummyTransformer<T>
             return lhs;
         }
 
-        return Pow<T>::create(lhs, rhs);
+        return this->rebuilt(op, lhs, rhs);
     }
 
-    VisitorResult<T> visit(std::shared_ptr<Mul<T>> op) override
+    std::shared_ptr<MathOp<T>> visit(std::shared_ptr<Mul<T>> op) override
     {
-        auto lhs = op->get_lhs()->transform(*this);
-        auto rhs = op->get_rhs()->transform(*this);
+        auto lhs = this->transformed(op->get_lhs());
+        auto rhs = this->transformed(op->get_rhs());
 
         if (lhs->is_constant() && lhs->result() == 1)
         {
@@ -53,13 +53,13 @@ struct MathOpRemoveNoOpTransformer : public DummyTransformer<T>
             return ConstantValue<T>::create(0.0);
         }
 
-        return lhs  * rhs;
+        return this->rebuilt(op, lhs, rhs);
     }
 
-    VisitorResult<T> visit(std::shared_ptr<Div<T>> op) override
+    std::shared_ptr<MathOp<T>> visit(std::shared_ptr<Div<T>> op) override
     {
-        auto lhs = op->get_lhs()->transform(*this);
-        auto rhs = op->get_rhs()->transform(*this);
+        auto lhs = this->transformed(op->get_lhs());
+        auto rhs = this->transformed(op->get_rhs());
 
         if (lhs->is_constant() && rhs->is_constant() && lhs->result() == rhs->result())
         {
@@ -76,13 +76,13 @@ struct MathOpRemoveNoOpTransformer : public DummyTransformer<T>
             return ConstantValue<T>::create(0.0);
         }
 
-        return lhs / rhs;
+        return this->rebuilt(op, lhs, rhs);
     }
 
-    VisitorResult<T> visit(std::shared_ptr<Add<T>> op) override
+    std::shared_ptr<MathOp<T>> visit(std::shared_ptr<Add<T>> op) override
     {
-        auto lhs = op->get_lhs()->transform(*this);
-        auto rhs = op->get_rhs()->transform(*this);
+        auto lhs = this->transformed(op->get_lhs());
+        auto rhs = this->transformed(op->get_rhs());
 
         if (lhs->is_constant() && lhs->result() == 0)
         {
@@ -94,20 +94,20 @@ struct MathOpRemoveNoOpTransformer : public DummyTransformer<T>
             return lhs;
         }
 
-        return lhs + rhs;
+        return this->rebuilt(op, lhs, rhs);
     }
 
-    VisitorResult<T> visit(std::shared_ptr<Sub<T>> op) override
+    std::shared_ptr<MathOp<T>> visit(std::shared_ptr<Sub<T>> op) override
     {
-        auto lhs = op->get_lhs()->transform(*this);
-        auto rhs = op->get_rhs()->transform(*this);
+        auto lhs = this->transformed(op->get_lhs());
+        auto rhs = this->transformed(op->get_rhs());
 
         if (rhs->is_constant() && rhs->result() == 0)
         {
             return lhs;
         }
 
-        return lhs - rhs;
+        return this->rebuilt(op, lhs, rhs);
     }
 };
 
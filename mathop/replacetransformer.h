@@ -13,37 +13,37 @@ struct ReplaceTransformer : DummyTransformer<T>
         : subject(subject), replacement(replacement)
     { }
 
-    VisitorResult<T> visit(std::shared_ptr<ConstantSymbol<T>> op) override
+    std::shared_ptr<MathOp<T>> visit(std::shared_ptr<ConstantSymbol<T>> op) override
     {
         return op == subject ? replacement : op;
     }
 
-    VisitorResult<T> visit(std::shared_ptr<Variable<T>> op) override
+    std::shared_ptr<MathOp<T>> visit(std::shared_ptr<Variable<T>> op) override
     {
         return op == subject ? replacement : op;
     }
 
-    VisitorResult<T> visit(std::shared_ptr<ValueVariable<T>> op) override
+    std::shared_ptr<MathOp<T>> visit(std::shared_ptr<ValueVariable<T>> op) override
     {
         return op == subject ? replacement : op;
     }
 
-    VisitorResult<T> visit(std::shared_ptr<NamedConstant<T>> op) override
+    std::shared_ptr<MathOp<T>> visit(std::shared_ptr<NamedConstant<T>> op) override
     {
         return op == subject ? replacement : op;
     }
 
-    VisitorResult<T> visit(std::shared_ptr<MutableValue<T>> op) override
+    std::shared_ptr<MathOp<T>> visit(std::shared_ptr<MutableValue<T>> op) override
     {
         return op == subject ? replacement : op;
     }
 
-    VisitorResult<T> visit(std::shared_ptr<ConstantValue<T>> op) override
+    std::shared_ptr<MathOp<T>> visit(std::shared_ptr<ConstantValue<T>> op) override
     {
         return op == subject ? replacement : op;
     }
 
-    VisitorResult<T> visit(std::shared_ptr<Container<T>> op) override
+    std::shared_ptr<MathOp<T>> visit(std::shared_ptr<Container<T>> op) override
     {
         if (op == subject)
         {
@@ -53,7 +53,7 @@ struct ReplaceTransformer : DummyTransformer<T>
         return DummyTransformer<T>::visit(op);
     }
 
-    VisitorResult<T> visit(std::shared_ptr<Negate<T>> op) override
+    std::shared_ptr<MathOp<T>> visit(std::shared_ptr<Negate<T>> op) override
     {
         if (op == subject)
         {
@@ -63,7 +63,7 @@ struct ReplaceTransformer : DummyTransformer<T>
         return DummyTransformer<T>::visit(op);
     }
 
-    VisitorResult<T> visit(std::shared_ptr<Sqrt<T>> op) override
+    std::shared_ptr<MathOp<T>> visit(std::shared_ptr<Sqrt<T>> op) override
     {
         if (op == subject)
         {
@@ -73,7 +73,7 @@ struct ReplaceTransformer : DummyTransformer<T>
         return DummyTransformer<T>::visit(op);
     }
 
-    VisitorResult<T> visit(std::shared_ptr<Log<T>> op) override
+    std::shared_ptr<MathOp<T>> visit(std::shared_ptr<Log<T>> op) override
     {
         if (op == subject)
         {
@@ -83,7 +83,7 @@ struct ReplaceTransformer : DummyTransformer<T>
         return DummyTransformer<T>::visit(op);
     }
 
-    VisitorResult<T> visit(std::shared_ptr<Log10<T>> op) override
+    std::shared_ptr<MathOp<T>> visit(std::shared_ptr<Log10<T>> op) override
     {
         if (op == subject)
         {
@@ -93,7 +93,7 @@ struct ReplaceTransformer : DummyTransformer<T>
         return DummyTransformer<T>::visit(op);
     }
 
-    VisitorResult<T> visit(std::shared_ptr<Sin<T>> op) override
+    std::shared_ptr<MathOp<T>> visit(std::shared_ptr<Sin<T>> op) override
     {
         if (op == subject)
         {
@@ -103,7 +103,7 @@ struct ReplaceTransformer : DummyTransformer<T>
         return DummyTransformer<T>::visit(op);
     }
 
-    VisitorResult<T> visit(std::shared_ptr<ASin<T>> op) override
+    std::shared_ptr<MathOp<T>> visit(std::shared_ptr<ASin<T>> op) override
     {
         if (op == subject)
         {
@@ -113,7 +113,7 @@ struct ReplaceTransformer : DummyTransformer<T>
         return DummyTransformer<T>::visit(op);
     }
 
-    VisitorResult<T> visit(std::shared_ptr<Cos<T>> op) override
+    std::shared_ptr<MathOp<T>> visit(std::shared_ptr<Cos<T>> op) override
     {
         if (op == subject)
         {
@@ -123,7 +123,7 @@ struct ReplaceTransformer : DummyTransformer<T>
         return DummyTransformer<T>::visit(op);
     }
 
-    VisitorResult<T> visit(std::shared_ptr<ACos<T>> op) override
+    std::shared_ptr<MathOp<T>> visit(std::shared_ptr<ACos<T>> op) override
     {
         if (op == subject)
         {
@@ -133,7 +133,7 @@ struct ReplaceTransformer : DummyTransformer<T>
         return DummyTransformer<T>::visit(op);
     }
 
-    VisitorResult<T> visit(std::shared_ptr<Tan<T>> op) override
+    std::shared_ptr<MathOp<T>> visit(std::shared_ptr<Tan<T>> op) override
     {
         if (op == subject)
         {
@@ -143,7 +143,7 @@ struct ReplaceTransformer : DummyTransformer<T>
         return DummyTransformer<T>::visit(op);
     }
 
-    VisitorResult<T> visit(std::shared_ptr<ATan<T>> op) override
+    std::shared_ptr<MathOp<T>> visit(std::shared_ptr<ATan<T>> op) override
     {
         if (op == subject)
         {
@@ -153,7 +153,7 @@ struct ReplaceTransformer : DummyTransformer<T>
         return DummyTransformer<T>::visit(op);
     }
 
-    VisitorResult<T> visit(std::shared_ptr<Sinh<T>> op) override
+    std::shared_ptr<MathOp<T>> visit(std::shared_ptr<Sinh<T>> op) override
     {
         if (op == subject)
         {
@@ -163,7 +163,7 @@ struct ReplaceTransformer : DummyTransformer<T>
         return DummyTransformer<T>::visit(op);
     }
 
-    VisitorResult<T> visit(std::shared_ptr<ASinh<T>> op) override
+    std::shared_ptr<MathOp<T>> visit(std::shared_ptr<ASinh<T>> op) override
     {
         if (op == subject)
         {
@@ -173,7 +173,7 @@ struct ReplaceTransformer : DummyTransformer<T>
         return DummyTransformer<T>::visit(op);
     }
 
-    VisitorResult<T> visit(std::shared_ptr<Cosh<T>> op) override
+    std::shared_ptr<MathOp<T>> visit(std::shared_ptr<Cosh<T>> op) override
     {
         if (op == subject)
         {
@@ -183,7 +183,7 @@ struct ReplaceTransformer : DummyTransformer<T>
         return DummyTransformer<T>::visit(op);
     }
 
-    VisitorResult<T> visit(std::shared_ptr<ACosh<T>> op) override
+    std::shared_ptr<MathOp<T>> visit(std::shared_ptr<ACosh<T>> op) override
     {
         if (op == subject)
         {
@@ -193,7 +193,7 @@ struct ReplaceTransformer : DummyTransformer<T>
         return DummyTransformer<T>::visit(op);
     }
 
-    VisitorResult<T> visit(std::shared_ptr<Tanh<T>> op) override
+    std::shared_ptr<MathOp<T>> visit(std::shared_ptr<Tanh<T>> op) override
     {
         if (op == subject)
         {
@@ -203,7 +203,7 @@ struct ReplaceTransformer : DummyTransformer<T>
         return DummyTransformer<T>::visit(op);
     }
 
-    VisitorResult<T> visit(std::shared_ptr<ATanh<T>> op) override
+    std::shared_ptr<MathOp<T>> visit(std::shared_ptr<ATanh<T>> op) override
     {
         if (op == subject)
         {
@@ -213,7 +213,7 @@ struct ReplaceTransformer : DummyTransformer<T>
         return DummyTransformer<T>::visit(op);
     }
 
-    VisitorResult<T> visit(std::shared_ptr<Pow<T>> op) override
+    std::shared_ptr<MathOp<T>> visit(std::shared_ptr<Pow<T>> op) override
     {
         if (op == subject)
         {
@@ -223,7 +223,7 @@ struct ReplaceTransformer : DummyTransformer<T>
         return DummyTransformer<T>::visit(op);
     }
 
-    VisitorResult<T> visit(std::shared_ptr<Mul<T>> op) override
+    std::shared_ptr<MathOp<T>> visit(std::shared_ptr<Mul<T>> op) override
     {
         if (op == subject)
         {
@@ -233,7 +233,7 @@ struct ReplaceTransformer : DummyTransformer<T>
         return DummyTransformer<T>::visit(op);
     }
 
-    VisitorResult<T> visit(std::shared_ptr<Div<T>> op) override
+    std::shared_ptr<MathOp<T>> visit(std::shared_ptr<Div<T>> op) override
     {
         if (op == subject)
         {
@@ -243,7 +243,7 @@ struct ReplaceTransformer : DummyTransformer<T>
         return DummyTransformer<T>::visit(op);
     }
 
-    VisitorResult<T> visit(std::shared_ptr<Add<T>> op) override
+    std::shared_ptr<MathOp<T>> visit(std::shared_ptr<Add<T>> op) override
     {
         if (op == subject)
         {
@@ -253,7 +253,7 @@ struct ReplaceTransformer : DummyTransformer<T>
         return DummyTransformer<T>::visit(op);
     }
 
-    VisitorResult<T> visit(std::shared_ptr<Sub<T>> op) override
+    std::shared_ptr<MathOp<T>> visit(std::shared_ptr<Sub<T>> op) override
     {
         if (op == subject)
         {
@@ -263,6 +263,26 @@ struct ReplaceTransformer : DummyTransformer<T>
         return DummyTransformer<T>::visit(op);
     }
 
+    std::shared_ptr<MathOp<T>> visit(std::shared_ptr<Sum<T>> op) override
+    {
+        if (op == subject)
+        {
+            return replacement;
+        }
+
+        return DummyTransformer<T>::visit(op);
+    }
+
+    std::shared_ptr<MathOp<T>> visit(std::shared_ptr<Product<T>> op) override
+    {
+        if (op == subject)
+        {
+            return replacement;
+        }
+
+        return DummyTransformer<T>::visit(op);
+    }
+
 private:
     const std::shared_ptr<MathOp<T>> subject;
     const std::shared_ptr<MathOp<T>> replacement;
@@ -8,134 +8,134 @@ namespace MathOps
 {
 
 template <typename T>
-struct ReverseMultiTransformer : public Visitor<T>
+struct ReverseMultiTransformer : public MultiTransformVisitor<T>
 {
     ReverseMultiTransformer(std::shared_ptr<MathOp<T>> for_side, std::shared_ptr<MathOp<T>>from)
         : for_side(for_side), from(from)
     { }
 
-    VisitorResult<T> visit(std::shared_ptr<ConstantSymbol<T>>) override { return std::vector<std::shared_ptr<MathOp<T>>> { }; }
-    VisitorResult<T> visit(std::shared_ptr<Variable<T>>) override { return std::vector<std::shared_ptr<MathOp<T>>> { }; }
-    VisitorResult<T> visit(std::shared_ptr<ValueVariable<T>>) override { return std::vector<std::shared_ptr<MathOp<T>>> { }; }
-    VisitorResult<T> visit(std::shared_ptr<NamedConstant<T>>) override { return std::vector<std::shared_ptr<MathOp<T>>> { }; }
-    VisitorResult<T> visit(std::shared_ptr<MutableValue<T>>) override { return std::vector<std::shared_ptr<MathOp<T>>> { }; }
-    VisitorResult<T> visit(std::shared_ptr<ConstantValue<T>>) override { return std::vector<std::shared_ptr<MathOp<T>>> { }; }
+    std::vector<std::shared_ptr<MathOp<T>>> visit(std::shared_ptr<ConstantSymbol<T>>) override { return std::vector<std::shared_ptr<MathOp<T>>> { }; }
+    std::vector<std::shared_ptr<MathOp<T>>> visit(std::shared_ptr<Variable<T>>) override { return std::vector<std::shared_ptr<MathOp<T>>> { }; }
+    std::vector<std::shared_ptr<MathOp<T>>> visit(std::shared_ptr<ValueVariable<T>>) override { return std::vector<std::shared_ptr<MathOp<T>>> { }; }
+    std::vector<std::shared_ptr<MathOp<T>>> visit(std::shared_ptr<NamedConstant<T>>) override { return std::vector<std::shared_ptr<MathOp<T>>> { }; }
+    std::vector<std::shared_ptr<MathOp<T>>> visit(std::shared_ptr<MutableValue<T>>) override { return std::vector<std::shared_ptr<MathOp<T>>> { }; }
+    std::vector<std::shared_ptr<MathOp<T>>> visit(std::shared_ptr<ConstantValue<T>>) override { return std::vector<std::shared_ptr<MathOp<T>>> { }; }
 
-    VisitorResult<T> visit(std::shared_ptr<Container<T>> op) override { return op->get_inner()->multi_transform(*this); }
+    std::vector<std::shared_ptr<MathOp<T>>> visit(std::shared_ptr<Container<T>> op) override { return op->get_inner()->multi_transform(*this); }
  
-    VisitorResult<T> visit(std::shared_ptr<Negate<T>> op)
+    std::vector<std::shared_ptr<MathOp<T>>> visit(std::shared_ptr<Negate<T>> op)
     {
         return for_side == op->get_x()
             ? std::vector<std::shared_ptr<MathOp<T>>> { -from }
             : std::vector<std::shared_ptr<MathOp<T>>> { };
     }
 
-    VisitorResult<T> visit(std::shared_ptr<Sqrt<T>> op)
+    std::vector<std::shared_ptr<MathOp<T>>> visit(std::shared_ptr<Sqrt<T>> op)
     {
         return for_side == op->get_x()
             ? std::vector<std::shared_ptr<MathOp<T>>> { pow<T>(from, ConstantValue<T>::create(2.0)) }
             : std::vector<std::shared_ptr<MathOp<T>>> { };
     }
 
-    VisitorResult<T> visit(std::shared_ptr<Log<T>> op)
+    std::vector<std::shared_ptr<MathOp<T>>> visit(std::shared_ptr<Log<T>> op)
     {
         return for_side == op->get_x()
             ? std::vector<std::shared_ptr<MathOp<T>>> { pow<T>(Constants::e<T>(), from) }
             : std::vector<std::shared_ptr<MathOp<T>>> { };
     }
 
-    VisitorResult<T> visit(std::shared_ptr<Log10<T>> op)
+    std::vector<std::shared_ptr<MathOp<T>>> visit(std::shared_ptr<Log10<T>> op)
     {
         return for_side == op->get_x()
             ? std::vector<std::shared_ptr<MathOp<T>>> { pow<T>(ConstantValue<T>::create(10.0), from) }
             : std::vector<std::shared_ptr<MathOp<T>>> { };
     }
 
-    VisitorResult<T> visit(std::shared_ptr<Sin<T>> op)
+    std::vector<std::shared_ptr<MathOp<T>>> visit(std::shared_ptr<Sin<T>> op)
     {
         return for_side == op->get_x()
             ? std::vector<std::shared_ptr<MathOp<T>>>{ asin(from) }
             : std::vector<std::shared_ptr<MathOp<T>>>{ };
     }
 
-    VisitorResult<T> visit(std::shared_ptr<ASin<T>> op)
+    std::vector<std::shared_ptr<MathOp<T>>> visit(std::shared_ptr<ASin<T>> op)
     {
         return for_side == op->get_x()
             ? std::vector<std::shared_ptr<MathOp<T>>>{ sin(from) }
             : std::vector<std::shared_ptr<MathOp<T>>>{};
     }
 
-    VisitorResult<T> visit(std::shared_ptr<Cos<T>> op)
+    std::vector<std::shared_ptr<MathOp<T>>> visit(std::shared_ptr<Cos<T>> op)
     {
         return for_side == op->get_x()
             ? std::vector<std::shared_ptr<MathOp<T>>>{ acos(from) }
             : std::vector<std::shared_ptr<MathOp<T>>>{ };
     }
 
-    VisitorResult<T> visit(std::shared_ptr<ACos<T>> op)
+    std::vector<std::shared_ptr<MathOp<T>>> visit(std::shared_ptr<ACos<T>> op)
     {
         return for_side == op->get_x()
             ? std::vector<std::shared_ptr<MathOp<T>>>{ cos(from) }
             : std::vector<std::shared_ptr<MathOp<T>>>{ };
     }
 
-    VisitorResult<T> visit(std::shared_ptr<Tan<T>> op)
+    std::vector<std::shared_ptr<MathOp<T>>> visit(std::shared_ptr<Tan<T>> op)
     {
         return for_side == op->get_x()
             ? std::vector<std::shared_ptr<MathOp<T>>>{ atan(from) }
             : std::vector<std::shared_ptr<MathOp<T>>>{ };
     }
 
-    VisitorResult<T> visit(std::shared_ptr<ATan<T>> op)
+    std::vector<std::shared_ptr<MathOp<T>>> visit(std::shared_ptr<ATan<T>> op)
     {
         return for_side == op->get_x()
             ? std::vector<std::shared_ptr<MathOp<T>>>{ tan(from) }
             : std::vector<std::shared_ptr<MathOp<T>>>{ };
     }
 
-    VisitorResult<T> visit(std::shared_ptr<Sinh<T>> op)
+    std::vector<std::shared_ptr<MathOp<T>>> visit(std::shared_ptr<Sinh<T>> op)
     {
         return for_side == op->get_x()
             ? std::vector<std::shared_ptr<MathOp<T>>>{ asinh(from) }
             : std::vector<std::shared_ptr<MathOp<T>>>{ };
     }
 
-    VisitorResult<T> visit(std::shared_ptr<ASinh<T>> op)
+    std::vector<std::shared_ptr<MathOp<T>>> visit(std::shared_ptr<ASinh<T>> op)
     {
         return for_side == op->get_x()
             ? std::vector<std::shared_ptr<MathOp<T>>>{ sinh(from) }
             : std::vector<std::shared_ptr<MathOp<T>>>{ };
     }
 
-    VisitorResult<T> visit(std::shared_ptr<Cosh<T>> op)
+    std::vector<std::shared_ptr<MathOp<T>>> visit(std::shared_ptr<Cosh<T>> op)
     {
         return for_side == op->get_x()
             ? std::vector<std::shared_ptr<MathOp<T>>>{ acosh(from) }
             : std::vector<std::shared_ptr<MathOp<T>>>{ };
     }
 
-    VisitorResult<T> visit(std::shared_ptr<ACosh<T>> op)
+    std::vector<std::shared_ptr<MathOp<T>>> visit(std::shared_ptr<ACosh<T>> op)
     {
         return for_side == op->get_x()
             ? std::vector<std::shared_ptr<MathOp<T>>>{ cosh(from) }
             : std::vector<std::shared_ptr<MathOp<T>>>{ };
     }
 
-    VisitorResult<T> visit(std::shared_ptr<Tanh<T>> op)
+    std::vector<std::shared_ptr<MathOp<T>>> visit(std::shared_ptr<Tanh<T>> op)
     {
         return for_side == op->get_x()
             ? std::vector<std::shared_ptr<MathOp<T>>>{ atanh(from) }
             : std::vector<std::shared_ptr<MathOp<T>>>{ };
     }
 
-    VisitorResult<T> visit(std::shared_ptr<ATanh<T>> op)
+    std::vector<std::shared_ptr<MathOp<T>>> visit(std::shared_ptr<ATanh<T>> op)
     {
         return for_side == op->get_x()
             ? std::vector<std::shared_ptr<MathOp<T>>>{ tanh(from) }
             : std::vector<std::shared_ptr<MathOp<T>>>{ };
     }
 
-    VisitorResult<T> visit(std::shared_ptr<Pow<T>> op)
+    std::vector<std::shared_ptr<MathOp<T>>> visit(std::shared_ptr<Pow<T>> op)
     {
         auto lhs = op->get_lhs();
         auto rhs = op->get_rhs();
@@ -172,37 +172,80 @@ struct ReverseMultiTransformer : public Visitor<T>
         }
     }
 
-    VisitorResult<T> visit(std::shared_ptr<Mul<T>> op)
+    std::vector<std::shared_ptr<MathOp<T>>> visit(std::shared_ptr<Mul<T>> op)
     {
         if      (for_side == op->get_lhs()) return std::vector<std::shared_ptr<MathOp<T>>> {from / op->get_rhs()};
         else if (for_side == op->get_rhs()) return std::vector<std::shared_ptr<MathOp<T>>> {from / op->get_lhs()};
         else                                return std::vector<std::shared_ptr<MathOp<T>>> { };
     }
 
-    VisitorResult<T> visit(std::shared_ptr<Div<T>> op)
+    std::vector<std::shared_ptr<MathOp<T>>> visit(std::shared_ptr<Div<T>> op)
     {
         if      (for_side == op->get_lhs()) return std::vector<std::shared_ptr<MathOp<T>>> {from * op->get_rhs()};
         else if (for_side == op->get_rhs()) return std::vector<std::shared_ptr<MathOp<T>>> {op->get_lhs() / from};
         else                                return std::vector<std::shared_ptr<MathOp<T>>> { };
     }
 
-    VisitorResult<T> visit(std::shared_ptr<Add<T>> op)
+    std::vector<std::shared_ptr<MathOp<T>>> visit(std::shared_ptr<Add<T>> op)
     {
         if      (for_side == op->get_lhs()) return std::vector<std::shared_ptr<MathOp<T>>> {from - op->get_rhs()};
         else if (for_side == op->get_rhs()) return std::vector<std::shared_ptr<MathOp<T>>> {from - op->get_lhs()};
         else                                return std::vector<std::shared_ptr<MathOp<T>>> { };
     }
 
-    VisitorResult<T> visit(std::shared_ptr<Sub<T>> op)
+    std::vector<std::shared_ptr<MathOp<T>>> visit(std::shared_ptr<Sub<T>> op)
     {
         if      (for_side == op->get_lhs()) return std::vector<std::shared_ptr<MathOp<T>>> {from + op->get_rhs()};
         else if (for_side == op->get_rhs()) return std::vector<std::shared_ptr<MathOp<T>>> {op->get_lhs() - from};
         else                                return std::vector<std::shared_ptr<MathOp<T>>> { };
     }
 
+    std::vector<std::shared_ptr<MathOp<T>>> visit(std::shared_ptr<Sum<T>> op) { return nary<Sum<T>>(op); }
+    std::vector<std::shared_ptr<MathOp<T>>> visit(std::shared_ptr<Product<T>> op) { return nary<Product<T>>(op); }
+
 private:
     const std::shared_ptr<MathOp<T>> for_side;
     const std::shared_ptr<MathOp<T>> from;
+
+    /* Moving the other operands to the other side inverts them, unless for_side is inverted, in
+     * which case from is (e.g. a + b - c = from gives c = a + b - from) */
+    template<typename Op>
+    std::vector<std::shared_ptr<MathOp<T>>> nary(std::shared_ptr<MathNaryOp<T>> op)
+    {
+        auto& terms = op->get_terms();
+        for (size_t i = 0; i < terms.size(); i++)
+        {
+            if (for_side != terms[i].op)
+            {
+                continue;
+            }
+
+            bool inverted = terms[i].inverted;
+
+            std::vector<typename MathNaryOp<T>::Term> moved;
+            if (!inverted)
+            {
+                moved.push_back({ from, false });
+            }
+
+            for (size_t j = 0; j < terms.size(); j++)
+            {
+                if (j != i)
+                {
+                    moved.push_back({ terms[j].op, terms[j].inverted == inverted });
+                }
+            }
+
+            if (inverted)
+            {
+                moved.push_back({ from, true });
+            }
+
+            return std::vector<std::shared_ptr<MathOp<T>>> { Op::create(std::move(moved)) };
+        }
+
+        return std::vector<std::shared_ptr<MathOp<T>>> { };
+    }
 };
 
 } /* namespace MathOps */
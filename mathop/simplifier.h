@@ -0,0 +1,473 @@
+#ifndef SIMPLIFIER_H
+#define SIMPLIFIER_H
+
+#include "dummytransformer.h"
+#include "intervalevaluator.h"
+#include "constants.h"
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <functional>
+#include <limits>
+#include <string>
+#include <vector>
+
+namespace MathOps
+{
+
+/* Rewrites operations into cheaper ones that are equal to them, by a set of rules such as
+ * sqrt(a) ^ 2 = a or log(%e ^ a) = a. A rule is a pattern and its replacement, written as trees in
+ * which variables stand for any subtree (the same one, by identity, wherever the same variable
+ * appears). Rules are indexed by the kind of operation at the root of their pattern.
+ *
+ * Operands are simplified before the operations that use them, and an operation is rewritten until
+ * no rule matches it anymore, or max_rewrites rules have been applied to it. The operations a
+ * replacement is made of are simplified as they're created.
+ *
+ * A rule is only added if its replacement costs less to evaluate than its pattern (see cost()),
+ * so every rewrite makes a tree cheaper, and rewriting always ends.
+ *
+ * Many rules only hold where their pattern can be evaluated: e.g. sqrt(a) ^ 2 is NaN for a < 0,
+ * where a is not. In strict mode, such rules are only applied if their condition holds whatever
+ * the values that can be set are later (see IntervalEvaluator), so a simplified tree is NaN where,
+ * and only where, the original is. Rules that drop a subtree, like a - a = 0, are only applied
+ * where it can't be NaN.
+ *
+ * Strict mode also keeps rules from removing an overflow or a saturation: e.g. asinh(sinh(a)) = a
+ * is only applied where sinh(a) can't overflow, sinh(asinh(a)) = a and %e ^ log(a) = a where a is
+ * far enough from the largest T for them not to overflow either, atanh(tanh(a)) = a where tanh(a)
+ * can't round to +-1, tan(atan(a)) = a where atan(a) is far enough from +-pi / 2 for tan() to keep
+ * the sign and most of the digits of a, and (a * b) / b = a where a * b can't overflow. Nor does it
+ * flip the sign of a zero: -(a - b) = b - a is only applied where a - b can't be 0. Rounding isn't
+ * kept though: a simplified tree can differ from the original in the last digits, and by more where
+ * an intermediate result of the original underflows, e.g. (a * b) / b for an a * b that is
+ * subnormal. */
+template <typename T>
+struct Simplifier : public DummyTransformer<T>
+{
+    /* The subtrees the variables of a pattern are bound to, in order of their first appearance */
+    typedef std::vector<std::shared_ptr<MathOp<T>>> Bindings;
+
+    /* Whether a rule may be applied in strict mode. Rules without a condition always may. */
+    typedef std::function<bool(Simplifier<T>&, const Bindings&)> Condition;
+
+    Simplifier(bool strict = true, size_t max_rewrites = 16)
+        : strict(strict), max_rewrites(max_rewrites), intervals(true)
+    {
+        add_default_rules();
+    }
+
+    std::shared_ptr<MathOp<T>> simplify(std::shared_ptr<MathOp<T>> op) { return op->transform(*this); }
+
+    /* Returns false if the replacement doesn't cost less than the pattern */
+    bool add_rule(std::shared_ptr<MathOp<T>> pattern, std::shared_ptr<MathOp<T>> replacement, Condition condition = nullptr)
+    {
+        std::vector<std::string> variables;
+        Rule rule { compile(pattern, variables, true), compile(replacement, variables, false), condition };
+        if (cost(rule.replacement) >= cost(rule.pattern))
+        {
+            return false;
+        }
+
+        rules[(size_t) rule.pattern.kind].push_back(rule);
+
+        return true;
+    }
+
+    /* The bounds of op for any value of what can be set, e.g. to write conditions with */
+    Interval<double> bounds(const std::shared_ptr<MathOp<T>>& op) { return intervals.bounds(op); }
+
+    size_t rewrites() const { return rewritten; }
+
+    std::shared_ptr<MathOp<T>> visit(std::shared_ptr<Negate<T>> op) override { return simplified(DummyTransformer<T>::visit(op), OpKind::Negate); }
+    std::shared_ptr<MathOp<T>> visit(std::shared_ptr<Sqrt<T>> op) override { return simplified(DummyTransformer<T>::visit(op), OpKind::Sqrt); }
+    std::shared_ptr<MathOp<T>> visit(std::shared_ptr<Log<T>> op) override { return simplified(DummyTransformer<T>::visit(op), OpKind::Log); }
+    std::shared_ptr<MathOp<T>> visit(std::shared_ptr<Log10<T>> op) override { return simplified(DummyTransformer<T>::visit(op), OpKind::Log10); }
+    std::shared_ptr<MathOp<T>> visit(std::shared_ptr<Sin<T>> op) override { return simplified(DummyTransformer<T>::visit(op), OpKind::Sin); }
+    std::shared_ptr<MathOp<T>> visit(std::shared_ptr<ASin<T>> op) override { return simplified(DummyTransformer<T>::visit(op), OpKind::ASin); }
+    std::shared_ptr<MathOp<T>> visit(std::shared_ptr<Cos<T>> op) override { return simplified(DummyTransformer<T>::visit(op), OpKind::Cos); }
+    std::shared_ptr<MathOp<T>> visit(std::shared_ptr<ACos<T>> op) override { return simplified(DummyTransformer<T>::visit(op), OpKind::ACos); }
+    std::shared_ptr<MathOp<T>> visit(std::shared_ptr<Tan<T>> op) override { return simplified(DummyTransformer<T>::visit(op), OpKind::Tan); }
+    std::shared_ptr<MathOp<T>> visit(std::shared_ptr<ATan<T>> op) override { return simplified(DummyTransformer<T>::visit(op), OpKind::ATan); }
+    std::shared_ptr<MathOp<T>> visit(std::shared_ptr<Sinh<T>> op) override { return simplified(DummyTransformer<T>::visit(op), OpKind::Sinh); }
+    std::shared_ptr<MathOp<T>> visit(std::shared_ptr<ASinh<T>> op) override { return simplified(DummyTransformer<T>::visit(op), OpKind::ASinh); }
+    std::shared_ptr<MathOp<T>> visit(std::shared_ptr<Cosh<T>> op) override { return simplified(DummyTransformer<T>::visit(op), OpKind::Cosh); }
+    std::shared_ptr<MathOp<T>> visit(std::shared_ptr<ACosh<T>> op) override { return simplified(DummyTransformer<T>::visit(op), OpKind::ACosh); }
+    std::shared_ptr<MathOp<T>> visit(std::shared_ptr<Tanh<T>> op) override { return simplified(DummyTransformer<T>::visit(op), OpKind::Tanh); }
+    std::shared_ptr<MathOp<T>> visit(std::shared_ptr<ATanh<T>> op) override { return simplified(DummyTransformer<T>::visit(op), OpKind::ATanh); }
+
+    std::shared_ptr<MathOp<T>> visit(std::shared_ptr<Pow<T>> op) override { return simplified(DummyTransformer<T>::visit(op), OpKind::Pow); }
+    std::shared_ptr<MathOp<T>> visit(std::shared_ptr<Mul<T>> op) override { return simplified(DummyTransformer<T>::visit(op), OpKind::Mul); }
+    std::shared_ptr<MathOp<T>> visit(std::shared_ptr<Div<T>> op) override { return simplified(DummyTransformer<T>::visit(op), OpKind::Div); }
+    std::shared_ptr<MathOp<T>> visit(std::shared_ptr<Add<T>> op) override { return simplified(DummyTransformer<T>::visit(op), OpKind::Add); }
+    std::shared_ptr<MathOp<T>> visit(std::shared_ptr<Sub<T>> op) override { return simplified(DummyTransformer<T>::visit(op), OpKind::Sub); }
+
+    /* There are no rules for n-ary operations */
+    std::shared_ptr<MathOp<T>> visit(std::shared_ptr<Sum<T>> op) override { return DummyTransformer<T>::visit(op); }
+    std::shared_ptr<MathOp<T>> visit(std::shared_ptr<Product<T>> op) override { return DummyTransformer<T>::visit(op); }
+
+    /* The rough cost of evaluating an operation, relative to that of an addition */
+    static unsigned cost(OpKind kind)
+    {
+        switch (kind)
+        {
+            case OpKind::Negate:
+            case OpKind::Add:
+            case OpKind::Sub:  return 1;
+            case OpKind::Mul:  return 2;
+            case OpKind::Div:  return 4;
+            case OpKind::Sqrt: return 8;
+            case OpKind::Log:
+            case OpKind::Log10:
+            case OpKind::Sin:
+            case OpKind::ASin:
+            case OpKind::Cos:
+            case OpKind::ACos:
+            case OpKind::Tan:
+            case OpKind::ATan:
+            case OpKind::Sinh:
+            case OpKind::ASinh:
+            case OpKind::Cosh:
+            case OpKind::ACosh:
+            case OpKind::Tanh:
+            case OpKind::ATanh:
+            case OpKind::Pow:  return 16;
+            default:           return 0;
+        }
+    }
+
+private:
+    /* A compiled pattern or replacement. Variables have an index into the bindings, constants keep
+     * the node they were written as. */
+    struct Node
+    {
+        OpKind kind;
+        int variable;
+        std::shared_ptr<MathOp<T>> constant;
+        std::vector<Node> operands;
+    };
+
+    struct Rule
+    {
+        Node pattern;
+        Node replacement;
+        Condition condition;
+    };
+
+    /* Tells the kind of an operation */
+    struct KindOf : public Visitor<T, OpKind>
+    {
+        OpKind visit(std::shared_ptr<ConstantSymbol<T>>) override { return OpKind::ConstantSymbol; }
+        OpKind visit(std::shared_ptr<Variable<T>>) override { return OpKind::Variable; }
+        OpKind visit(std::shared_ptr<ValueVariable<T>>) override { return OpKind::ValueVariable; }
+        OpKind visit(std::shared_ptr<NamedConstant<T>>) override { return OpKind::NamedConstant; }
+        OpKind visit(std::shared_ptr<MutableValue<T>>) override { return OpKind::MutableValue; }
+        OpKind visit(std::shared_ptr<ConstantValue<T>>) override { return OpKind::ConstantValue; }
+
+        OpKind visit(std::shared_ptr<Container<T>>) override { return OpKind::Container; }
+
+        OpKind visit(std::shared_ptr<Negate<T>>) override { return OpKind::Negate; }
+        OpKind visit(std::shared_ptr<Sqrt<T>>) override { return OpKind::Sqrt; }
+        OpKind visit(std::shared_ptr<Log<T>>) override { return OpKind::Log; }
+        OpKind visit(std::shared_ptr<Log10<T>>) override { return OpKind::Log10; }
+        OpKind visit(std::shared_ptr<Sin<T>>) override { return OpKind::Sin; }
+        OpKind visit(std::shared_ptr<ASin<T>>) override { return OpKind::ASin; }
+        OpKind visit(std::shared_ptr<Cos<T>>) override { return OpKind::Cos; }
+        OpKind visit(std::shared_ptr<ACos<T>>) override { return OpKind::ACos; }
+        OpKind visit(std::shared_ptr<Tan<T>>) override { return OpKind::Tan; }
+        OpKind visit(std::shared_ptr<ATan<T>>) override { return OpKind::ATan; }
+        OpKind visit(std::shared_ptr<Sinh<T>>) override { return OpKind::Sinh; }
+        OpKind visit(std::shared_ptr<ASinh<T>>) override { return OpKind::ASinh; }
+        OpKind visit(std::shared_ptr<Cosh<T>>) override { return OpKind::Cosh; }
+        OpKind visit(std::shared_ptr<ACosh<T>>) override { return OpKind::ACosh; }
+        OpKind visit(std::shared_ptr<Tanh<T>>) override { return OpKind::Tanh; }
+        OpKind visit(std::shared_ptr<ATanh<T>>) override { return OpKind::ATanh; }
+
+        OpKind visit(std::shared_ptr<Pow<T>>) override { return OpKind::Pow; }
+        OpKind visit(std::shared_ptr<Mul<T>>) override { return OpKind::Mul; }
+        OpKind visit(std::shared_ptr<Div<T>>) override { return OpKind::Div; }
+        OpKind visit(std::shared_ptr<Add<T>>) override { return OpKind::Add; }
+        OpKind visit(std::shared_ptr<Sub<T>>) override { return OpKind::Sub; }
+
+        OpKind visit(std::shared_ptr<Sum<T>>) override { return OpKind::Sum; }
+        OpKind visit(std::shared_ptr<Product<T>>) override { return OpKind::Product; }
+    };
+
+    bool strict;
+    size_t max_rewrites;
+    size_t rewritten = 0;
+
+    KindOf kind_of;
+    IntervalEvaluator<T> intervals;
+    std::array<std::vector<Rule>, (size_t) OpKind::Product + 1> rules;
+
+    /* Variables of a pattern are numbered as they're found. A replacement can only use those. */
+    Node compile(const std::shared_ptr<MathOp<T>>& op, std::vector<std::string>& variables, bool is_pattern)
+    {
+        OpKind kind = kind_of.apply(op);
+        Node node { kind, -1, nullptr, { } };
+
+        if (kind == OpKind::Variable)
+        {
+            auto it = std::find(variables.begin(), variables.end(), std::static_pointer_cast<Variable<T>>(op)->get_name());
+            if (it == variables.end() && !is_pattern)
+            {
+                std::cerr << "Replacement uses a variable that isn't in its pattern\n";
+                abort();
+            }
+
+            node.variable = it - variables.begin();
+            if (it == variables.end())
+            {
+                variables.push_back(std::static_pointer_cast<Variable<T>>(op)->get_name());
+            }
+
+            return node;
+        }
+
+        if (kind == OpKind::ConstantValue || kind == OpKind::ConstantSymbol)
+        {
+            node.constant = op;
+
+            return node;
+        }
+
+        if (op->arity() == 0 || kind == OpKind::Container || kind == OpKind::Sum || kind == OpKind::Product)
+        {
+            std::cerr << "Rules can only consist of unary and binary operations, constants and variables\n";
+            abort();
+        }
+
+        for (size_t i = 0; i < op->arity(); i++)
+        {
+            node.operands.push_back(compile(op->operand(i)->shared_from_this(), variables, is_pattern));
+        }
+
+        return node;
+    }
+
+    static unsigned cost(const Node& node)
+    {
+        unsigned total = cost(node.kind);
+        for (auto& operand: node.operands)
+        {
+            total += cost(operand);
+        }
+
+        return total;
+    }
+
+    bool match(const Node& pattern, const std::shared_ptr<MathOp<T>>& op, OpKind kind, Bindings& bound)
+    {
+        if (pattern.variable >= 0)
+        {
+            auto& binding = bound[pattern.variable];
+            if (!binding)
+            {
+                binding = op;
+            }
+
+            return binding == op;
+        }
+
+        if (kind != pattern.kind)
+        {
+            return false;
+        }
+
+        if (kind == OpKind::ConstantValue)
+        {
+            return op->result() == pattern.constant->result();
+        }
+
+        if (kind == OpKind::ConstantSymbol)
+        {
+            return std::static_pointer_cast<ConstantSymbol<T>>(op)->get_name() ==
+                   std::static_pointer_cast<ConstantSymbol<T>>(pattern.constant)->get_name();
+        }
+
+        for (size_t i = 0; i < pattern.operands.size(); i++)
+        {
+            auto operand = op->operand(i)->shared_from_this();
+            if (!match(pattern.operands[i], operand, kind_of.apply(operand), bound))
+            {
+                return false;
+            }
+        }
+
+        return true;
+    }
+
+    std::shared_ptr<MathOp<T>> instantiate(const Node& replacement, const Bindings& bound)
+    {
+        if (replacement.variable >= 0)
+        {
+            return bound[replacement.variable];
+        }
+
+        if (replacement.constant)
+        {
+            return replacement.constant;
+        }
+
+        auto x = instantiate(replacement.operands[0], bound);
+        auto y = replacement.operands.size() > 1 ? instantiate(replacement.operands[1], bound) : nullptr;
+
+        return simplified(create_op<T>(replacement.kind, x, y), replacement.kind);
+    }
+
+    /* Apply the first rule that matches, until none do */
+    std::shared_ptr<MathOp<T>> simplified(std::shared_ptr<MathOp<T>> op, OpKind kind)
+    {
+        for (size_t n = 0; n < max_rewrites; n++)
+        {
+            const Rule* applied = nullptr;
+            Bindings bound;
+
+            for (auto& rule: rules[(size_t) kind])
+            {
+                bound.assign(max_variables, nullptr);
+                if (match(rule.pattern, op, kind, bound) && (!strict || !rule.condition || rule.condition(*this, bound)))
+                {
+                    applied = &rule;
+                    break;
+                }
+            }
+
+            if (!applied)
+            {
+                break;
+            }
+
+            op = instantiate(applied->replacement, bound);
+            kind = kind_of.apply(op);
+            rewritten++;
+
+            if (op->arity() == 0 || kind == OpKind::Container)
+            {
+                break;
+            }
+        }
+
+        return op;
+    }
+
+    static constexpr size_t max_variables = 3;
+
+    void add_default_rules()
+    {
+        std::shared_ptr<MathOp<T>> a = Variable<T>::create("a");
+        std::shared_ptr<MathOp<T>> b = Variable<T>::create("b");
+        std::shared_ptr<MathOp<T>> c = Variable<T>::create("c");
+
+        std::shared_ptr<MathOp<T>> zero = ConstantValue<T>::create(0);
+        std::shared_ptr<MathOp<T>> one = ConstantValue<T>::create(1);
+        std::shared_ptr<MathOp<T>> two = ConstantValue<T>::create(2);
+        std::shared_ptr<MathOp<T>> ten = ConstantValue<T>::create(10);
+        auto e = Constants::e<T>();
+
+        /* Conditions on the bounds of the first or second variable. A subtree a replacement drops
+         * has to be finite, and can't be NaN either (e.g. asin(a) - asin(a) is NaN for a > 1). */
+        auto nonnegative = [](auto& s, auto& v) { return s.bounds(v[0]).lower >= 0; };
+        auto positive    = [](auto& s, auto& v) { return s.bounds(v[0]).lower > 0; };
+        auto unit        = [](auto& s, auto& v) { auto r = s.bounds(v[0]); return r.lower >= -1 && r.upper <= 1; };
+        auto finite      = [](auto& s, auto& v) { auto r = s.bounds(v[0]); return r.is_finite() && !r.maybe_nan; };
+        auto divisor     = [](size_t i)
+        {
+            return [i](Simplifier<T>& s, const Bindings& v) { auto r = s.bounds(v[i]); return r.is_finite() && !r.maybe_nan && !r.contains(0); };
+        };
+
+        /* Where T overflows or underflows, where tanh() rounds to +-1, and where atan() is so close
+         * to +-pi / 2 that tan() of it keeps less than half the digits of its argument (or even its
+         * sign). Bounds are doubles, so they're never taken to be wider than double's range. */
+        const double largest = std::min(std::numeric_limits<double>::max(), (double) std::numeric_limits<T>::max());
+        const double smallest = std::max(std::numeric_limits<double>::min(), (double) std::numeric_limits<T>::min());
+        const double log_largest = (double) log(std::numeric_limits<T>::max());
+        const double log_smallest = (double) log(std::numeric_limits<T>::min());
+        const double tanh_limit = std::log(4 / (double) std::numeric_limits<T>::epsilon()) / 2;
+        const double atan_limit = 1 / std::sqrt((double) std::numeric_limits<T>::epsilon());
+
+        auto representable = [=](const Interval<double>& r) { return r.lower >= -largest && r.upper <= largest; };
+        auto within        = [](double lower, double upper)
+        {
+            return [=](Simplifier<T>& s, const Bindings& v) { auto r = s.bounds(v[0]); return r.lower >= lower && r.upper <= upper; };
+        };
+
+        /* Conditions for a * b / b = a and a / b * b = a, with a and b the i-th and j-th variable:
+         * a * b can't overflow if |b| <= 1, nor can a / b if |b| >= 1, and otherwise the bounds of
+         * a and b have to show it can't */
+        auto product = [=](size_t i, size_t j)
+        {
+            return [=](Simplifier<T>& s, const Bindings& v)
+            {
+                auto b = s.bounds(v[j]);
+                return divisor(j)(s, v) && ((b.lower >= -1 && b.upper <= 1) || representable(s.bounds(v[i]) * b));
+            };
+        };
+        auto quotient = [=](size_t i, size_t j)
+        {
+            return [=](Simplifier<T>& s, const Bindings& v)
+            {
+                auto b = s.bounds(v[j]);
+                return divisor(j)(s, v) && (b.lower >= 1 || b.upper <= -1 || representable(s.bounds(v[i]) / b));
+            };
+        };
+
+        /* (a ^ b) ^ c = a ^ (b * c) where a ^ b neither overflows nor underflows, and b * c is
+         * finite and can't be NaN. Even where a ^ b is 1, as (e ^ 0) ^ inf is 1, but e ^ (0 * inf)
+         * is NaN. */
+        auto power = [=](Simplifier<T>& s, const Bindings& v)
+        {
+            auto inner = pow(s.bounds(v[0]), s.bounds(v[1]));
+            auto exponent = s.bounds(v[1]) * s.bounds(v[2]);
+            return positive(s, v) && representable(inner) && inner.lower >= smallest && !inner.maybe_nan &&
+                   representable(exponent) && !exponent.maybe_nan;
+        };
+
+        /* -(a - b) is -0 where a = b, but b - a is 0, which 1 / ... would show */
+        auto nonzero_difference = [](auto& s, auto& v) { return !(s.bounds(v[0]) - s.bounds(v[1])).contains(0); };
+
+        /* Signs */
+        add_rule(-(-a), a);
+        add_rule(-(a - b), b - a, nonzero_difference);
+        add_rule(a + -b, a - b);
+        add_rule(-a + b, b - a);
+        add_rule(a - -b, a + b);
+        add_rule((-a) * (-b), a * b);
+        add_rule((-a) / (-b), a / b);
+
+        /* Cancellation */
+        add_rule(a - a, zero, finite);
+        add_rule(a / a, one, divisor(0));
+        add_rule((a / b) * b, a, quotient(0, 1));
+        add_rule(b * (a / b), a, quotient(1, 0));
+        add_rule((a * b) / b, a, product(0, 1));
+        add_rule((b * a) / b, a, product(1, 0));
+
+        /* Powers */
+        add_rule(pow(a, one), a);
+        add_rule(pow(sqrt(a), two), a, nonnegative);
+        add_rule(pow(pow(a, b), c), pow(a, b * c), power);
+        add_rule(pow(a, two), a * a);
+
+        /* Inverse functions. An inverse function rounds its result, so e.g. %e ^ log(a) can
+         * overflow for an a that's close to the largest T. Half of it leaves room for that. */
+        add_rule(log(pow(e, a)), a, within(log_smallest, log_largest));
+        add_rule(log10(pow(ten, a)), a, within(log_smallest / std::log(10), log_largest / std::log(10)));
+        add_rule(pow(e, log(a)), a, within(smallest, largest / 2));
+        add_rule(pow(ten, log10(a)), a, within(smallest, largest / 2));
+        add_rule(sin(asin(a)), a, unit);
+        add_rule(cos(acos(a)), a, unit);
+        add_rule(tan(atan(a)), a, within(-atan_limit, atan_limit));
+        add_rule(sinh(asinh(a)), a, within(-largest / 2, largest / 2));
+        add_rule(asinh(sinh(a)), a, within(-log_largest, log_largest));
+        add_rule(cosh(acosh(a)), a, within(1, largest / 2));
+        add_rule(tanh(atanh(a)), a, unit);
+        add_rule(atanh(tanh(a)), a, within(-tanh_limit, tanh_limit));
+    }
+};
+
+} /* namespace MathOps */
+
+#endif /* SIMPLIFIER_H */
@@ -0,0 +1,203 @@
+#ifndef STATICOP_H
+#define STATICOP_H
+
+#include "algeblah.h"
+
+#include <array>
+#include <type_traits>
+#include <vector>
+
+namespace MathOps
+{
+
+/* Expression templates: the same operators and functions as MathOp, but the tree is a type that
+ * is built at compile time. Evaluation is inlined into straight-line code, without allocations or
+ * virtual calls, and is constexpr as far as the operations are (+, -, *, / and negation):
+ *
+ *     constexpr auto x = static_arg<0>;
+ *     constexpr auto y = static_arg<1>;
+ *     constexpr auto f = x * x + 2 * y;
+ *     static_assert(f(3.0, 4.0) == 17.0);
+ *
+ *     auto g = sqrt(pow(x, 2) + sin(y));
+ *     double r = g(1.0, 2.0);
+ *
+ * Arguments are referred to by index, and are passed in that order. They're evaluated in their
+ * common type, or in double if that's an integer type (so (x / y)(3, 4) is 0.75, not 0).
+ * to_math_op() converts an expression into a MathOp tree, for formatting, solving, etc. */
+template<typename E>
+struct StaticOp
+{
+    template<typename... A>
+    constexpr auto operator()(const A&... args) const
+    {
+        static_assert(sizeof...(A) >= E::arity, "Too few arguments");
+
+        typedef std::common_type_t<A...> C;
+        typedef std::conditional_t<std::is_integral_v<C>, double, C> T;
+        return static_cast<const E&>(*this).template evaluate<T>(std::array<T, sizeof...(A)> { T(args)... });
+    }
+};
+
+template<size_t I>
+struct StaticArg : StaticOp<StaticArg<I>>
+{
+    static constexpr size_t arity = I + 1;
+
+    template<typename T, typename V>
+    constexpr T evaluate(const V& v) const { return v[I]; }
+
+    template<typename T>
+    std::shared_ptr<MathOp<T>> build(const std::vector<std::shared_ptr<MathOp<T>>>& args) const { return args.at(I); }
+};
+
+template<size_t I> constexpr StaticArg<I> static_arg { };
+
+template<typename C>
+struct StaticLiteral : StaticOp<StaticLiteral<C>>
+{
+    static constexpr size_t arity = 0;
+
+    constexpr StaticLiteral(C value) : value(value) { }
+
+    template<typename T, typename V>
+    constexpr T evaluate(const V&) const { return T(value); }
+
+    template<typename T>
+    std::shared_ptr<MathOp<T>> build(const std::vector<std::shared_ptr<MathOp<T>>>&) const
+    {
+        return ConstantValue<T>::create(T(value));
+    }
+
+    C value;
+};
+
+template<OpKind K, typename X>
+struct StaticUnary : StaticOp<StaticUnary<K, X>>
+{
+    static constexpr size_t arity = X::arity;
+
+    constexpr StaticUnary(X x) : x(x) { }
+
+    template<typename T, typename V>
+    constexpr T evaluate(const V& v) const { return apply_op<K>(x.template evaluate<T>(v)); }
+
+    template<typename T>
+    std::shared_ptr<MathOp<T>> build(const std::vector<std::shared_ptr<MathOp<T>>>& args) const
+    {
+        return create_op<T>(K, x.build(args));
+    }
+
+    X x;
+};
+
+template<OpKind K, typename L, typename R>
+struct StaticBinary : StaticOp<StaticBinary<K, L, R>>
+{
+    static constexpr size_t arity = L::arity > R::arity ? L::arity : R::arity;
+
+    constexpr StaticBinary(L lhs, R rhs) : lhs(lhs), rhs(rhs) { }
+
+    template<typename T, typename V>
+    constexpr T evaluate(const V& v) const
+    {
+        return apply_op<K>(lhs.template evaluate<T>(v), rhs.template evaluate<T>(v));
+    }
+
+    template<typename T>
+    std::shared_ptr<MathOp<T>> build(const std::vector<std::shared_ptr<MathOp<T>>>& args) const
+    {
+        return create_op<T>(K, lhs.build(args), rhs.build(args));
+    }
+
+    L lhs;
+    R rhs;
+};
+
+template<typename E> struct is_static_op : std::false_type { };
+template<size_t I> struct is_static_op<StaticArg<I>> : std::true_type { };
+template<typename C> struct is_static_op<StaticLiteral<C>> : std::true_type { };
+template<OpKind K, typename X> struct is_static_op<StaticUnary<K, X>> : std::true_type { };
+template<OpKind K, typename L, typename R> struct is_static_op<StaticBinary<K, L, R>> : std::true_type { };
+
+/* Operands are either expressions, or arithmetic values which become literals */
+template<typename E>
+constexpr std::enable_if_t<is_static_op<E>::value, E> static_operand(const E& e) { return e; }
+
+template<typename C>
+constexpr std::enable_if_t<std::is_arithmetic_v<C>, StaticLiteral<C>> static_operand(C c) { return StaticLiteral<C>(c); }
+
+template<typename L, typename R>
+using enable_if_static_op = std::enable_if_t<is_static_op<L>::value || is_static_op<R>::value, int>;
+
+template<OpKind K, typename X>
+constexpr auto make_static_unary(const X& x)
+{
+    return StaticUnary<K, X>(x);
+}
+
+template<OpKind K, typename L, typename R>
+constexpr auto make_static_binary(const L& lhs, const R& rhs)
+{
+    auto l = static_operand(lhs);
+    auto r = static_operand(rhs);
+
+    return StaticBinary<K, decltype(l), decltype(r)>(l, r);
+}
+
+template<typename L, typename R, enable_if_static_op<L, R> = 0>
+constexpr auto operator+(const L& lhs, const R& rhs) { return make_static_binary<OpKind::Add>(lhs, rhs); }
+
+template<typename L, typename R, enable_if_static_op<L, R> = 0>
+constexpr auto operator-(const L& lhs, const R& rhs) { return make_static_binary<OpKind::Sub>(lhs, rhs); }
+
+template<typename L, typename R, enable_if_static_op<L, R> = 0>
+constexpr auto operator*(const L& lhs, const R& rhs) { return make_static_binary<OpKind::Mul>(lhs, rhs); }
+
+template<typename L, typename R, enable_if_static_op<L, R> = 0>
+constexpr auto operator/(const L& lhs, const R& rhs) { return make_static_binary<OpKind::Div>(lhs, rhs); }
+
+template<typename L, typename R, enable_if_static_op<L, R> = 0>
+constexpr auto pow(const L& lhs, const R& rhs) { return make_static_binary<OpKind::Pow>(lhs, rhs); }
+
+template<typename X, enable_if_static_op<X, X> = 0>
+constexpr auto operator-(const X& x) { return make_static_unary<OpKind::Negate>(x); }
+
+#define DEFINE_STATIC_FUNCTION(name, kind)                                         \
+template<typename X, enable_if_static_op<X, X> = 0>                                \
+constexpr auto name(const X& x) { return make_static_unary<OpKind::kind>(x); }
+
+DEFINE_STATIC_FUNCTION(sqrt,  Sqrt)
+DEFINE_STATIC_FUNCTION(log,   Log)
+DEFINE_STATIC_FUNCTION(log10, Log10)
+DEFINE_STATIC_FUNCTION(sin,   Sin)
+DEFINE_STATIC_FUNCTION(asin,  ASin)
+DEFINE_STATIC_FUNCTION(cos,   Cos)
+DEFINE_STATIC_FUNCTION(acos,  ACos)
+DEFINE_STATIC_FUNCTION(tan,   Tan)
+DEFINE_STATIC_FUNCTION(atan,  ATan)
+DEFINE_STATIC_FUNCTION(sinh,  Sinh)
+DEFINE_STATIC_FUNCTION(asinh, ASinh)
+DEFINE_STATIC_FUNCTION(cosh,  Cosh)
+DEFINE_STATIC_FUNCTION(acosh, ACosh)
+DEFINE_STATIC_FUNCTION(tanh,  Tanh)
+DEFINE_STATIC_FUNCTION(atanh, ATanh)
+
+#undef DEFINE_STATIC_FUNCTION
+
+/* Build a MathOp tree from an expression, with args[i] in the place of static_arg<i> */
+template<typename T, typename E>
+std::shared_ptr<MathOp<T>> to_math_op(const StaticOp<E>& op, const std::vector<std::shared_ptr<MathOp<T>>>& args)
+{
+    if (args.size() < E::arity)
+    {
+        std::cerr << "Too few arguments to build an expression\n";
+        abort();
+    }
+
+    return static_cast<const E&>(op).build(args);
+}
+
+} /* namespace MathOps */
+
+#endif /* STATICOP_H */
@@ -3,6 +3,7 @@
 
 //#include <numbers>
 #include <cmath>
+#include <functional>
 
 namespace MathOps
 {
@@ -18,6 +19,8 @@ T get_constant_e() { return (T) (M_El); }
 inline float modf(float x, float& integral) { return std::modf(x, &integral); }
 inline float isnan(float x) { return std::isnan(x); }
 inline float abs(float x) { return std::abs(x); }
+inline std::size_t value_hash(float x) { return std::isnan(x) ? 0 : std::hash<float>()(x) ^ std::signbit(x); }
+inline bool same_value(float a, float b) { return std::isnan(a) ? std::isnan(b) : a == b && std::signbit(a) == std::signbit(b); }
 
 inline float log(float x) { return std::log(x); }
 inline float log10(float x) { return std::log10(x); }
@@ -42,6 +45,8 @@ inline float atanh(float x) { return std::atanh(x); }
 inline double modf(double x, double& integral) { return std::modf(x, &integral); }
 inline double isnan(double x) { return std::isnan(x); }
 inline double abs(double x) { return std::abs(x); }
+inline std::size_t value_hash(double x) { return std::isnan(x) ? 0 : std::hash<double>()(x) ^ std::signbit(x); }
+inline bool same_value(double a, double b) { return std::isnan(a) ? std::isnan(b) : a == b && std::signbit(a) == std::signbit(b); }
 
 inline double log(double x) { return std::log(x); }
 inline double log10(double x) { return std::log10(x); }
@@ -66,6 +71,8 @@ inline double atanh(double x) { return std::atanh(x); }
 inline long double modf(long double x, long double& integral) { return std::modf(x, &integral); }
 inline long double isnan(long double x) { return std::isnan(x); }
 inline long double abs(long double x) { return std::abs(x); }
+inline std::size_t value_hash(long double x) { return std::isnan(x) ? 0 : std::hash<long double>()(x) ^ std::signbit(x); }
+inline bool same_value(long double a, long double b) { return std::isnan(a) ? std::isnan(b) : a == b && std::signbit(a) == std::signbit(b); }
 
 inline long double log(long double x) { return std::log(x); }
 inline long double log10(long double x) { return std::log10(x); }
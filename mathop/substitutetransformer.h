@@ -0,0 +1,95 @@
+#ifndef SUBSTITUTETRANSFORMER_H
+#define SUBSTITUTETRANSFORMER_H
+
+#include "removenooptransformer.h"
+
+#include <unordered_map>
+
+namespace MathOps
+{
+
+/* Replaces any number of subtrees in a single walk. Subjects are matched by identity, like with
+ * ReplaceTransformer, and their replacements are used as they are (i.e. they aren't walked into,
+ * so a subject within a replacement stays).
+ *
+ * If remove_no_ops is set, the no-ops that MathOpRemoveNoOpTransformer removes (e.g. x * 1) are
+ * removed in the same walk, after substitution. */
+template <typename T>
+struct SubstituteTransformer : public MathOpRemoveNoOpTransformer<T>
+{
+    typedef std::unordered_map<std::shared_ptr<MathOp<T>>, std::shared_ptr<MathOp<T>>> Substitutions;
+
+    SubstituteTransformer(Substitutions substitutions, bool remove_no_ops = false)
+        : substitutions(std::move(substitutions)), remove_no_ops(remove_no_ops)
+    { }
+
+    std::shared_ptr<MathOp<T>> visit(std::shared_ptr<ConstantSymbol<T>> op) override { return substituted(op); }
+    std::shared_ptr<MathOp<T>> visit(std::shared_ptr<Variable<T>> op) override { return substituted(op); }
+    std::shared_ptr<MathOp<T>> visit(std::shared_ptr<ValueVariable<T>> op) override { return substituted(op); }
+    std::shared_ptr<MathOp<T>> visit(std::shared_ptr<NamedConstant<T>> op) override { return substituted(op); }
+    std::shared_ptr<MathOp<T>> visit(std::shared_ptr<MutableValue<T>> op) override { return substituted(op); }
+    std::shared_ptr<MathOp<T>> visit(std::shared_ptr<ConstantValue<T>> op) override { return substituted(op); }
+
+    std::shared_ptr<MathOp<T>> visit(std::shared_ptr<Container<T>> op) override { return substituted(op); }
+
+    std::shared_ptr<MathOp<T>> visit(std::shared_ptr<Negate<T>> op) override { return substituted(op); }
+    std::shared_ptr<MathOp<T>> visit(std::shared_ptr<Sqrt<T>> op) override { return substituted(op); }
+    std::shared_ptr<MathOp<T>> visit(std::shared_ptr<Log<T>> op) override { return substituted(op); }
+    std::shared_ptr<MathOp<T>> visit(std::shared_ptr<Log10<T>> op) override { return substituted(op); }
+    std::shared_ptr<MathOp<T>> visit(std::shared_ptr<Sin<T>> op) override { return substituted(op); }
+    std::shared_ptr<MathOp<T>> visit(std::shared_ptr<ASin<T>> op) override { return substituted(op); }
+    std::shared_ptr<MathOp<T>> visit(std::shared_ptr<Cos<T>> op) override { return substituted(op); }
+    std::shared_ptr<MathOp<T>> visit(std::shared_ptr<ACos<T>> op) override { return substituted(op); }
+    std::shared_ptr<MathOp<T>> visit(std::shared_ptr<Tan<T>> op) override { return substituted(op); }
+    std::shared_ptr<MathOp<T>> visit(std::shared_ptr<ATan<T>> op) override { return substituted(op); }
+    std::shared_ptr<MathOp<T>> visit(std::shared_ptr<Sinh<T>> op) override { return substituted(op); }
+    std::shared_ptr<MathOp<T>> visit(std::shared_ptr<ASinh<T>> op) override { return substituted(op); }
+    std::shared_ptr<MathOp<T>> visit(std::shared_ptr<Cosh<T>> op) override { return substituted(op); }
+    std::shared_ptr<MathOp<T>> visit(std::shared_ptr<ACosh<T>> op) override { return substituted(op); }
+    std::shared_ptr<MathOp<T>> visit(std::shared_ptr<Tanh<T>> op) override { return substituted(op); }
+    std::shared_ptr<MathOp<T>> visit(std::shared_ptr<ATanh<T>> op) override { return substituted(op); }
+
+    std::shared_ptr<MathOp<T>> visit(std::shared_ptr<Pow<T>> op) override { return binary(op); }
+    std::shared_ptr<MathOp<T>> visit(std::shared_ptr<Mul<T>> op) override { return binary(op); }
+    std::shared_ptr<MathOp<T>> visit(std::shared_ptr<Div<T>> op) override { return binary(op); }
+    std::shared_ptr<MathOp<T>> visit(std::shared_ptr<Add<T>> op) override { return binary(op); }
+    std::shared_ptr<MathOp<T>> visit(std::shared_ptr<Sub<T>> op) override { return binary(op); }
+
+    std::shared_ptr<MathOp<T>> visit(std::shared_ptr<Sum<T>> op) override { return substituted(op); }
+    std::shared_ptr<MathOp<T>> visit(std::shared_ptr<Product<T>> op) override { return substituted(op); }
+
+private:
+    const Substitutions substitutions;
+    bool remove_no_ops;
+
+    std::shared_ptr<MathOp<T>> replacement(std::shared_ptr<MathOp<T>> op) const
+    {
+        auto it = substitutions.find(op);
+
+        return it != substitutions.end() ? it->second : nullptr;
+    }
+
+    template<typename Op>
+    std::shared_ptr<MathOp<T>> substituted(std::shared_ptr<Op> op)
+    {
+        auto found = replacement(op);
+
+        return found ? found : DummyTransformer<T>::visit(op);
+    }
+
+    template<typename Op>
+    std::shared_ptr<MathOp<T>> binary(std::shared_ptr<Op> op)
+    {
+        auto found = replacement(op);
+        if (found)
+        {
+            return found;
+        }
+
+        return remove_no_ops ? MathOpRemoveNoOpTransformer<T>::visit(op) : DummyTransformer<T>::visit(op);
+    }
+};
+
+} /* namespace MathOps */
+
+#endif /* SUBSTITUTETRANSFORMER_H */
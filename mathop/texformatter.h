@@ -5,56 +5,107 @@
 
 #include <sstream>
 #include <iomanip>
+#include <algorithm>
+#include <initializer_list>
+#include <iterator>
+#include <vector>
 
 namespace MathOps
 {
 
 template<typename T>
-struct TexFormatter : Visitor<T>
+struct TexFormatter : FormatVisitor<T>
 {
     TexFormatter(int precision)
-     : TexFormatter(precision, false)
+     : precision(precision)
     { }
 
-    VisitorResult<T> visit(std::shared_ptr<ConstantSymbol<T>> op) override { return constant_sumbol(op->get_name()); }
-    VisitorResult<T> visit(std::shared_ptr<Variable<T>> op) override { return op->get_name(); }
-    VisitorResult<T> visit(std::shared_ptr<ValueVariable<T>> op) override { return value_to_string(op->result()); }
-    VisitorResult<T> visit(std::shared_ptr<NamedConstant<T>> op) override { return op->get_name(); }
-    VisitorResult<T> visit(std::shared_ptr<MutableValue<T>> op) override { return value_to_string(op->result()); }
-    VisitorResult<T> visit(std::shared_ptr<ConstantValue<T>> op) override { return value_to_string(op->result()); }
-
-    VisitorResult<T> visit(std::shared_ptr<Container<T>> op) override { return op->get_name(); }
-
-    VisitorResult<T> visit(std::shared_ptr<Negate<T>> op) override { return str_unary_sign(op, op->get_x(), "-"); }
-    VisitorResult<T> visit(std::shared_ptr<Sqrt<T>> op) override { return str_unary_tex(op->get_x(), "\\sqrt"); }
-    VisitorResult<T> visit(std::shared_ptr<Log<T>> op) override { return str_unary(op->get_x(), "log"); }
-    VisitorResult<T> visit(std::shared_ptr<Log10<T>> op) override { return str_unary(op->get_x(), "log10"); }
-    VisitorResult<T> visit(std::shared_ptr<Sin<T>> op) override { return str_unary(op->get_x(), "sin"); }
-    VisitorResult<T> visit(std::shared_ptr<ASin<T>> op) override { return str_unary(op->get_x(), "asin"); }
-    VisitorResult<T> visit(std::shared_ptr<Cos<T>> op) override { return str_unary(op->get_x(), "cos"); }
-    VisitorResult<T> visit(std::shared_ptr<ACos<T>> op) override { return str_unary(op->get_x(), "acos"); }
-    VisitorResult<T> visit(std::shared_ptr<Tan<T>> op) override { return str_unary(op->get_x(), "tan"); }
-    VisitorResult<T> visit(std::shared_ptr<ATan<T>> op) override { return str_unary(op->get_x(), "atan"); }
-    VisitorResult<T> visit(std::shared_ptr<Sinh<T>> op) override { return str_unary(op->get_x(), "sinh"); }
-    VisitorResult<T> visit(std::shared_ptr<ASinh<T>> op) override { return str_unary(op->get_x(), "asinh"); }
-    VisitorResult<T> visit(std::shared_ptr<Cosh<T>> op) override { return str_unary(op->get_x(), "cosh"); }
-    VisitorResult<T> visit(std::shared_ptr<ACosh<T>> op) override { return str_unary(op->get_x(), "acosh"); }
-    VisitorResult<T> visit(std::shared_ptr<Tanh<T>> op) override { return str_unary(op->get_x(), "tanh"); }
-    VisitorResult<T> visit(std::shared_ptr<ATanh<T>> op) override { return str_unary(op->get_x(), "atanh"); }
-
-    VisitorResult<T> visit(std::shared_ptr<Pow<T>> op) override { return str_binary_tex(op, op->get_lhs(), op->get_rhs(), " ^ "); }
-    VisitorResult<T> visit(std::shared_ptr<Mul<T>> op) override { return str_binary(op, op->get_lhs(), op->get_rhs(), " \\cdot "); }
-    VisitorResult<T> visit(std::shared_ptr<Div<T>> op) override { return str_binary_tex2(op, op->get_lhs(), op->get_rhs(), " \\frac"); }
-    VisitorResult<T> visit(std::shared_ptr<Add<T>> op) override { return str_binary(op, op->get_lhs(), op->get_rhs(), " + "); }
-    VisitorResult<T> visit(std::shared_ptr<Sub<T>> op) override { return str_binary(op, op->get_lhs(), op->get_rhs(), " - "); }
+    void visit(std::shared_ptr<ConstantSymbol<T>> op) override { this->out += constant_sumbol(op->get_name()); }
+    void visit(std::shared_ptr<Variable<T>> op) override { this->out += op->get_name(); }
+    void visit(std::shared_ptr<ValueVariable<T>> op) override { this->out += value_to_string(op->result()); }
+    void visit(std::shared_ptr<NamedConstant<T>> op) override { this->out += op->get_name(); }
+    void visit(std::shared_ptr<MutableValue<T>> op) override { this->out += value_to_string(op->result()); }
+    void visit(std::shared_ptr<ConstantValue<T>> op) override { this->out += value_to_string(op->result()); }
+
+    void visit(std::shared_ptr<Container<T>> op) override { this->out += op->get_name(); }
+
+    void visit(std::shared_ptr<Negate<T>> op) override { str_unary_sign(op, op->get_x(), "-"); }
+    void visit(std::shared_ptr<Sqrt<T>> op) override { str_unary_tex(op->get_x(), "\\sqrt"); }
+    void visit(std::shared_ptr<Log<T>> op) override { str_unary(op->get_x(), "log"); }
+    void visit(std::shared_ptr<Log10<T>> op) override { str_unary(op->get_x(), "log10"); }
+    void visit(std::shared_ptr<Sin<T>> op) override { str_unary(op->get_x(), "sin"); }
+    void visit(std::shared_ptr<ASin<T>> op) override { str_unary(op->get_x(), "asin"); }
+    void visit(std::shared_ptr<Cos<T>> op) override { str_unary(op->get_x(), "cos"); }
+    void visit(std::shared_ptr<ACos<T>> op) override { str_unary(op->get_x(), "acos"); }
+    void visit(std::shared_ptr<Tan<T>> op) override { str_unary(op->get_x(), "tan"); }
+    void visit(std::shared_ptr<ATan<T>> op) override { str_unary(op->get_x(), "atan"); }
+    void visit(std::shared_ptr<Sinh<T>> op) override { str_unary(op->get_x(), "sinh"); }
+    void visit(std::shared_ptr<ASinh<T>> op) override { str_unary(op->get_x(), "asinh"); }
+    void visit(std::shared_ptr<Cosh<T>> op) override { str_unary(op->get_x(), "cosh"); }
+    void visit(std::shared_ptr<ACosh<T>> op) override { str_unary(op->get_x(), "acosh"); }
+    void visit(std::shared_ptr<Tanh<T>> op) override { str_unary(op->get_x(), "tanh"); }
+    void visit(std::shared_ptr<ATanh<T>> op) override { str_unary(op->get_x(), "atanh"); }
+
+    void visit(std::shared_ptr<Pow<T>> op) override { str_binary_tex(op, op->get_lhs(), op->get_rhs(), " ^ "); }
+    void visit(std::shared_ptr<Mul<T>> op) override { str_binary(op, op->get_lhs(), op->get_rhs(), " \\cdot "); }
+    void visit(std::shared_ptr<Div<T>> op) override { str_binary_tex2(op, op->get_lhs(), op->get_rhs(), " \\frac"); }
+    void visit(std::shared_ptr<Add<T>> op) override { str_binary(op, op->get_lhs(), op->get_rhs(), " + "); }
+    void visit(std::shared_ptr<Sub<T>> op) override { str_binary(op, op->get_lhs(), op->get_rhs(), " - "); }
+
+    void visit(std::shared_ptr<Sum<T>> op) override { str_sum(op); }
+    void visit(std::shared_ptr<Product<T>> op) override { str_product_tex(op); }
 
 private:
-    TexFormatter(int precision, bool parenthesize)
-     : precision(precision), parenthesize(parenthesize)
-    { }
-
     const int precision;
-    const bool parenthesize;
+
+    /* Whether the operation being formatted needs parentheses. Set before each one is formatted. */
+    bool parenthesize = false;
+
+    /* A piece of the output that's yet to be written: either an operation to format, or text */
+    struct Piece
+    {
+        MathOp<T>* op;
+        const char* text;
+        bool parenthesize;
+    };
+
+    /* Operations queue the pieces they're made of, and the outermost call writes them out from a
+     * loop, as in DefaultFormatter */
+    std::vector<Piece> pending;
+    bool writing = false;
+
+    static Piece text(const char* text) { return Piece { nullptr, text, false }; }
+
+    template<typename It>
+    void write(It begin, It end)
+    {
+        pending.insert(pending.end(), std::make_reverse_iterator(end), std::make_reverse_iterator(begin));
+        if (writing)
+        {
+            return;
+        }
+
+        writing = true;
+
+        while (!pending.empty())
+        {
+            Piece next = pending.back();
+            pending.pop_back();
+
+            if (!next.op)
+            {
+                this->out += next.text;
+                continue;
+            }
+
+            parenthesize = next.parenthesize;
+            this->apply(*next.op);
+        }
+
+        writing = false;
+    }
+
+    void write(std::initializer_list<Piece> pieces) { write(pieces.begin(), pieces.end()); }
 
     std::string value_to_string(T x) const
     {
@@ -71,108 +122,148 @@ private:
         return symbol;
     }
 
-    std::string str_binary(std::shared_ptr<MathOp<T>> op,
-        std::shared_ptr<MathOp<T>> lhs, std::shared_ptr<MathOp<T>> rhs, std::string symbol)
+    void str_binary(std::shared_ptr<MathOp<T>> op,
+        std::shared_ptr<MathOp<T>> lhs, std::shared_ptr<MathOp<T>> rhs, const char* symbol)
     {
         bool right_associative = op->right_associative();
-        std::stringstream ss;
-
-        if (parenthesize)
-        {
-            ss << '(';
-        }
 
-        side_to_stream(ss, op, lhs, right_associative);
-        ss << symbol;
-        side_to_stream(ss, op, rhs, !right_associative);
-
-        if (parenthesize)
-        {
-            ss << ')';
-        }
-
-        return ss.str();
+        write({ text(parenthesize ? "(" : ""),
+                side_piece(op, lhs, right_associative),
+                text(symbol),
+                side_piece(op, rhs, !right_associative),
+                text(parenthesize ? ")" : "") });
     }
 
-    std::string str_binary_tex(std::shared_ptr<MathOp<T>> op,
-        std::shared_ptr<MathOp<T>> lhs, std::shared_ptr<MathOp<T>> rhs, std::string symbol)
+    void str_binary_tex(std::shared_ptr<MathOp<T>> op,
+        std::shared_ptr<MathOp<T>> lhs, std::shared_ptr<MathOp<T>> rhs, const char* symbol)
     {
         bool right_associative = op->right_associative();
-        std::stringstream ss;
-
-        if (parenthesize)
-        {
-            ss << '(';
-        }
-
-        side_to_stream(ss, op, lhs, right_associative);
-        ss << symbol << '{';
-        side_to_stream(ss, op, rhs, !right_associative);
-        ss << '}';
-
-        if (parenthesize)
-        {
-            ss << ')';
-        }
 
-        return ss.str();
+        write({ text(parenthesize ? "(" : ""),
+                side_piece(op, lhs, right_associative),
+                text(symbol),
+                text("{"),
+                side_piece(op, rhs, !right_associative),
+                text("}"),
+                text(parenthesize ? ")" : "") });
     }
 
-    std::string str_binary_tex2(std::shared_ptr<MathOp<T>> op,
-        std::shared_ptr<MathOp<T>> lhs, std::shared_ptr<MathOp<T>> rhs, std::string symbol)
+    void str_binary_tex2(std::shared_ptr<MathOp<T>> op,
+        std::shared_ptr<MathOp<T>> lhs, std::shared_ptr<MathOp<T>> rhs, const char* symbol)
     {
         bool right_associative = op->right_associative();
-        std::stringstream ss;
 
-        ss << symbol << '{';
-        side_to_stream(ss, op, lhs, right_associative);
-        ss << "}{";
-        side_to_stream(ss, op, rhs, !right_associative);
-        ss << '}';
-
-        return ss.str();
+        write({ text(symbol),
+                text("{"),
+                side_piece(op, lhs, right_associative),
+                text("}{"),
+                side_piece(op, rhs, !right_associative),
+                text("}") });
     }
 
-    void side_to_stream(std::stringstream& ss, std::shared_ptr<MathOp<T>> op, std::shared_ptr<MathOp<T>> side,
-        bool use_commutation)
+    Piece side_piece(std::shared_ptr<MathOp<T>> op, std::shared_ptr<MathOp<T>> side, bool use_commutation)
     {
         Bodmas parent_precedence = op->precedence();
         bool use_parens = !use_commutation || op->is_commutative()
             ? parent_precedence < side->precedence()
             : parent_precedence <= side->precedence();
 
-        ss << side->format(TexFormatter(precision, use_parens));
+        return Piece { side.get(), nullptr, use_parens };
     }
 
-    std::string str_unary_sign(std::shared_ptr<MathOp<T>> op,
-        std::shared_ptr<MathOp<T>> x, std::string symbol)
+    void str_sum(std::shared_ptr<MathNaryOp<T>> op)
     {
-        std::stringstream ss;
+        auto& terms = op->get_terms();
 
-        if (parenthesize)
+        std::vector<Piece> pieces;
+        pieces.reserve(terms.size() * 2 + 2);
+        pieces.push_back(text(parenthesize ? "(" : ""));
+
+        for (size_t i = 0; i < terms.size(); i++)
         {
-            ss << '(';
+            pieces.push_back(text(terms[i].inverted ? (i ? " - " : "-") : (i ? " + " : "")));
+            pieces.push_back(term_piece(op, terms[i].op, terms[i].inverted));
         }
 
-        ss << symbol;
-        side_to_stream(ss, op, x, true);
+        pieces.push_back(text(parenthesize ? ")" : ""));
+        write(pieces.begin(), pieces.end());
+    }
+
+    /* The operands that are divided by go below a single fraction bar */
+    void str_product_tex(std::shared_ptr<MathNaryOp<T>> op)
+    {
+        auto& terms = op->get_terms();
+        bool fraction = std::any_of(terms.begin(), terms.end(), [](auto& term) { return term.inverted; });
+
+        std::vector<Piece> pieces;
+        pieces.reserve(terms.size() * 2 + 5);
 
-        if (parenthesize)
+        if (fraction)
+        {
+            pieces.push_back(text(" \\frac{"));
+            factor_pieces(op, false, pieces);
+            pieces.push_back(text("}{"));
+            factor_pieces(op, true, pieces);
+            pieces.push_back(text("}"));
+        }
+        else
         {
-            ss << ')';
+            pieces.push_back(text(parenthesize ? "(" : ""));
+            factor_pieces(op, false, pieces);
+            pieces.push_back(text(parenthesize ? ")" : ""));
         }
 
-         return ss.str();
+        write(pieces.begin(), pieces.end());
+    }
+
+    void factor_pieces(std::shared_ptr<MathNaryOp<T>> op, bool inverted, std::vector<Piece>& pieces)
+    {
+        bool first = true;
+        for (auto& term: op->get_terms())
+        {
+            if (term.inverted == inverted)
+            {
+                pieces.push_back(text(first ? "" : " \\cdot "));
+                pieces.push_back(term_piece(op, term.op, false));
+                first = false;
+            }
+        }
+
+        if (first)
+        {
+            pieces.push_back(text("1"));
+        }
+    }
+
+    /* An inverted operand is parenthesized like the right hand side of a subtraction */
+    Piece term_piece(std::shared_ptr<MathOp<T>> op, const std::shared_ptr<MathOp<T>>& term, bool inverted)
+    {
+        Bodmas parent_precedence = op->precedence();
+        bool use_parens = inverted
+            ? parent_precedence <= term->precedence()
+            : parent_precedence < term->precedence();
+
+        return Piece { term.get(), nullptr, use_parens };
+    }
+
+    void str_unary_sign(std::shared_ptr<MathOp<T>> op,
+        std::shared_ptr<MathOp<T>> x, const char* symbol)
+    {
+        write({ text(parenthesize ? "(" : ""),
+                text(symbol),
+                side_piece(op, x, true),
+                text(parenthesize ? ")" : "") });
     }
 
-    std::string str_unary(std::shared_ptr<MathOp<T>> x, std::string symbol)
+    /* The operand inherits whether to parenthesize */
+    void str_unary(std::shared_ptr<MathOp<T>> x, const char* symbol)
     {
-        return symbol + "(" + x->format(*this) + ")";
+        write({ text(symbol), text("("), Piece { x.get(), nullptr, parenthesize }, text(")") });
     }
 
-    std::string str_unary_tex(std::shared_ptr<MathOp<T>> x, std::string symbol)
+    void str_unary_tex(std::shared_ptr<MathOp<T>> x, const char* symbol)
     {
-        return symbol + "{" + x->format(*this) + "}";
+        write({ text(symbol), text("{"), Piece { x.get(), nullptr, parenthesize }, text("}") });
     }
 };
 
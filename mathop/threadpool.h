@@ -0,0 +1,254 @@
+#ifndef THREADPOOL_H
+#define THREADPOOL_H
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+namespace MathOps
+{
+
+/* Work-stealing thread pool. Every worker has its own queue; it runs the tasks it submits itself
+ * newest first, and steals the oldest tasks of the others when it runs out. Tasks submitted from
+ * outside the pool go to a queue of their own, that every worker steals from.
+ *
+ * A thread that waits for a task runs other tasks in the meantime, so tasks can submit (and wait
+ * for) tasks of their own, and a pool without workers runs everything from wait(). While there are
+ * none to run, it sleeps until a task finishes or is submitted. */
+class ThreadPool
+{
+public:
+    /* before_task is run before every task, on the thread that runs it (e.g. to set thread-local
+     * state, such as the default precision, to that of the submitting thread) */
+    ThreadPool(unsigned workers, std::function<void()> before_task = nullptr)
+        : before_task(before_task)
+    {
+        for (unsigned i = 0; i <= workers; i++)
+        {
+            queues.emplace_back(new Queue);
+        }
+
+        for (unsigned i = 0; i < workers; i++)
+        {
+            threads.emplace_back([this, i] { work(i); });
+        }
+    }
+
+    ~ThreadPool()
+    {
+        {
+            std::lock_guard<std::mutex> guard(sleep_lock);
+            stopping = true;
+        }
+
+        wake.notify_all();
+        for (auto& thread: threads)
+        {
+            thread.join();
+        }
+    }
+
+    size_t size() const { return threads.size(); }
+
+    /* The task is destroyed (along with anything it captured) before its future becomes ready */
+    template<typename F>
+    std::future<decltype(std::declval<F&>()())> submit(F task)
+    {
+        typedef decltype(std::declval<F&>()()) R;
+
+        auto promise = std::make_shared<std::promise<R>>();
+        auto future = promise->get_future();
+
+        push([promise, task]() mutable
+        {
+            try
+            {
+                F run = std::move(task);
+                set_result<R>(*promise, run);
+            }
+            catch (...)
+            {
+                promise->set_exception(std::current_exception());
+            }
+        });
+
+        return future;
+    }
+
+    /* Wait for a task, running other tasks until it's done */
+    template<typename R>
+    R wait(std::future<R>& future)
+    {
+        size_t self = current_pool == this ? current_queue : queues.size() - 1;
+        auto ready = [&] { return future.wait_for(std::chrono::seconds(0)) == std::future_status::ready; };
+
+        while (!ready())
+        {
+            if (run_one(self))
+            {
+                continue;
+            }
+
+            /* Counted before the task is checked again, so a task that finishes after that sees
+             * that it has to wake this thread */
+            waiting++;
+            {
+                std::unique_lock<std::mutex> guard(sleep_lock);
+                task_done.wait(guard, [&] { return pending > 0 || ready(); });
+            }
+            waiting--;
+        }
+
+        return future.get();
+    }
+
+private:
+    struct Queue
+    {
+        std::mutex lock;
+        std::deque<std::function<void()>> tasks;
+    };
+
+    std::function<void()> before_task;
+
+    /* One queue per worker, followed by the queue of tasks submitted from outside the pool */
+    std::vector<std::unique_ptr<Queue>> queues;
+    std::vector<std::thread> threads;
+
+    std::atomic<size_t> pending { 0 };
+    std::mutex sleep_lock;
+    std::condition_variable wake;
+    bool stopping = false;
+
+    /* Threads in wait() that have nothing to run sleep on task_done */
+    std::atomic<unsigned> waiting { 0 };
+    std::condition_variable task_done;
+
+    /* The pool and queue of the worker running on this thread, if any */
+    static inline thread_local ThreadPool* current_pool = nullptr;
+    static inline thread_local size_t current_queue = 0;
+
+    /* The result is set in its own function, as the task has to be destroyed first */
+    template<typename R, typename F>
+    static typename std::enable_if<!std::is_void<R>::value>::type set_result(std::promise<R>& promise, F& run)
+    {
+        R result = run();
+        {
+            [[maybe_unused]] F finished = std::move(run);
+        }
+        promise.set_value(std::move(result));
+    }
+
+    template<typename R, typename F>
+    static typename std::enable_if<std::is_void<R>::value>::type set_result(std::promise<R>& promise, F& run)
+    {
+        run();
+        {
+            [[maybe_unused]] F finished = std::move(run);
+        }
+        promise.set_value();
+    }
+
+    void push(std::function<void()> task)
+    {
+        /* Counted first, so pending is never less than the number of queued tasks */
+        pending++;
+
+        Queue& queue = *queues[current_pool == this ? current_queue : queues.size() - 1];
+        {
+            std::lock_guard<std::mutex> guard(queue.lock);
+            queue.tasks.push_back(std::move(task));
+        }
+
+        {
+            std::lock_guard<std::mutex> guard(sleep_lock);
+        }
+        wake.notify_one();
+        wake_waiting();
+    }
+
+    void wake_waiting()
+    {
+        if (waiting)
+        {
+            {
+                std::lock_guard<std::mutex> guard(sleep_lock);
+            }
+            task_done.notify_all();
+        }
+    }
+
+    /* Run the newest task of queue self, or else the oldest task of any other queue */
+    bool run_one(size_t self)
+    {
+        std::function<void()> task;
+        for (size_t i = 0; i < queues.size() && !task; i++)
+        {
+            size_t from = (self + i) % queues.size();
+            Queue& queue = *queues[from];
+
+            std::lock_guard<std::mutex> guard(queue.lock);
+            if (!queue.tasks.empty())
+            {
+                if (from == self)
+                {
+                    task = std::move(queue.tasks.back());
+                    queue.tasks.pop_back();
+                }
+                else
+                {
+                    task = std::move(queue.tasks.front());
+                    queue.tasks.pop_front();
+                }
+            }
+        }
+
+        if (!task)
+        {
+            return false;
+        }
+
+        pending--;
+        if (before_task)
+        {
+            before_task();
+        }
+
+        task();
+        wake_waiting();
+
+        return true;
+    }
+
+    void work(size_t self)
+    {
+        current_pool = this;
+        current_queue = self;
+
+        while (true)
+        {
+            if (run_one(self))
+            {
+                continue;
+            }
+
+            std::unique_lock<std::mutex> guard(sleep_lock);
+            wake.wait(guard, [this] { return stopping || pending > 0; });
+            if (stopping && pending == 0)
+            {
+                return;
+            }
+        }
+    }
+};
+
+} /* namespace MathOps */
+
+#endif /* THREADPOOL_H */
@@ -0,0 +1,181 @@
+#ifndef TRANSFORMPIPELINE_H
+#define TRANSFORMPIPELINE_H
+
+#include "dummytransformer.h"
+
+#include <string>
+#include <vector>
+
+namespace MathOps
+{
+
+/* Runs several transformers in a single bottom-up walk, rather than one whole-tree pass each.
+ * Every operation is passed through the stages in order, along with its transformed operands,
+ * and each stage rewrites the result of the one before. An operation is only rebuilt if a stage
+ * rewrites it, or if none does and its operands changed.
+ *
+ * Stages rewrite one operation at a time (see TransformWalker::rewrite()), so the result is the
+ * same as that of running them one after another as long as each of them only looks at an
+ * operation and its operands. That goes for e.g. the constant folding, no-op removing,
+ * substituting and interning transformers.
+ *
+ * Containers are left alone (i.e. passed through the stages as they are), unless expand_containers
+ * is set, in which case they're replaced by their transformed inner expression, like
+ * ExpandTransformer does. Containers never reach the stages in that case.
+ *
+ * The number of operations each stage was given, and how many of those it rewrote, are counted
+ * for as long as the pipeline lives. */
+template <typename T>
+struct TransformPipeline : public DummyTransformer<T>
+{
+    struct Statistics
+    {
+        std::string name;
+        size_t visited;
+        size_t rewritten;
+    };
+
+    TransformPipeline(bool expand_containers = false)
+        : expand_containers(expand_containers)
+    { }
+
+    /* The stage is used by reference, so it has to outlive the pipeline */
+    TransformPipeline<T>& then(std::string name, TransformWalker<T>& stage)
+    {
+        stages.push_back(Stage { &stage, nullptr, Statistics { name, 0, 0 } });
+
+        return *this;
+    }
+
+    TransformPipeline<T>& then(std::string name, std::shared_ptr<TransformWalker<T>> stage)
+    {
+        stages.push_back(Stage { stage.get(), stage, Statistics { name, 0, 0 } });
+
+        return *this;
+    }
+
+    std::shared_ptr<MathOp<T>> run(std::shared_ptr<MathOp<T>> op) { return op->transform(*this); }
+
+    std::vector<Statistics> statistics() const
+    {
+        std::vector<Statistics> result;
+        for (auto& stage: stages)
+        {
+            result.push_back(stage.statistics);
+        }
+
+        return result;
+    }
+
+    std::shared_ptr<MathOp<T>> visit(std::shared_ptr<ConstantSymbol<T>> op) override { return staged(op); }
+    std::shared_ptr<MathOp<T>> visit(std::shared_ptr<Variable<T>> op) override { return staged(op); }
+    std::shared_ptr<MathOp<T>> visit(std::shared_ptr<ValueVariable<T>> op) override { return staged(op); }
+    std::shared_ptr<MathOp<T>> visit(std::shared_ptr<NamedConstant<T>> op) override { return staged(op); }
+    std::shared_ptr<MathOp<T>> visit(std::shared_ptr<MutableValue<T>> op) override { return staged(op); }
+    std::shared_ptr<MathOp<T>> visit(std::shared_ptr<ConstantValue<T>> op) override { return staged(op); }
+
+    std::shared_ptr<MathOp<T>> visit(std::shared_ptr<Container<T>> op) override
+    {
+        return expand_containers ? this->transformed(op->get_inner()) : staged(op);
+    }
+
+    std::shared_ptr<MathOp<T>> visit(std::shared_ptr<Negate<T>> op) override { return unary(op); }
+    std::shared_ptr<MathOp<T>> visit(std::shared_ptr<Sqrt<T>> op) override { return unary(op); }
+    std::shared_ptr<MathOp<T>> visit(std::shared_ptr<Log<T>> op) override { return unary(op); }
+    std::shared_ptr<MathOp<T>> visit(std::shared_ptr<Log10<T>> op) override { return unary(op); }
+    std::shared_ptr<MathOp<T>> visit(std::shared_ptr<Sin<T>> op) override { return unary(op); }
+    std::shared_ptr<MathOp<T>> visit(std::shared_ptr<ASin<T>> op) override { return unary(op); }
+    std::shared_ptr<MathOp<T>> visit(std::shared_ptr<Cos<T>> op) override { return unary(op); }
+    std::shared_ptr<MathOp<T>> visit(std::shared_ptr<ACos<T>> op) override { return unary(op); }
+    std::shared_ptr<MathOp<T>> visit(std::shared_ptr<Tan<T>> op) override { return unary(op); }
+    std::shared_ptr<MathOp<T>> visit(std::shared_ptr<ATan<T>> op) override { return unary(op); }
+    std::shared_ptr<MathOp<T>> visit(std::shared_ptr<Sinh<T>> op) override { return unary(op); }
+    std::shared_ptr<MathOp<T>> visit(std::shared_ptr<ASinh<T>> op) override { return unary(op); }
+    std::shared_ptr<MathOp<T>> visit(std::shared_ptr<Cosh<T>> op) override { return unary(op); }
+    std::shared_ptr<MathOp<T>> visit(std::shared_ptr<ACosh<T>> op) override { return unary(op); }
+    std::shared_ptr<MathOp<T>> visit(std::shared_ptr<Tanh<T>> op) override { return unary(op); }
+    std::shared_ptr<MathOp<T>> visit(std::shared_ptr<ATanh<T>> op) override { return unary(op); }
+
+    std::shared_ptr<MathOp<T>> visit(std::shared_ptr<Pow<T>> op) override { return binary(op); }
+    std::shared_ptr<MathOp<T>> visit(std::shared_ptr<Mul<T>> op) override { return binary(op); }
+    std::shared_ptr<MathOp<T>> visit(std::shared_ptr<Div<T>> op) override { return binary(op); }
+    std::shared_ptr<MathOp<T>> visit(std::shared_ptr<Add<T>> op) override { return binary(op); }
+    std::shared_ptr<MathOp<T>> visit(std::shared_ptr<Sub<T>> op) override { return binary(op); }
+
+    std::shared_ptr<MathOp<T>> visit(std::shared_ptr<Sum<T>> op) override { return nary(op); }
+    std::shared_ptr<MathOp<T>> visit(std::shared_ptr<Product<T>> op) override { return nary(op); }
+
+protected:
+    bool walks_into_containers() const override { return expand_containers; }
+
+private:
+    struct Stage
+    {
+        TransformWalker<T>* walker;
+        std::shared_ptr<TransformWalker<T>> owned;
+        Statistics statistics;
+    };
+
+    bool expand_containers;
+    std::vector<Stage> stages;
+
+    /* Until a stage rewrites it, the operation is given along with its transformed operands */
+    std::shared_ptr<MathOp<T>> staged(const std::shared_ptr<MathOp<T>>& op, const std::shared_ptr<MathOp<T>>* operands = nullptr)
+    {
+        auto result = op;
+        for (auto& stage: stages)
+        {
+            auto rewritten = stage.walker->rewrite(result, result == op ? operands : nullptr);
+
+            stage.statistics.visited++;
+            if (rewritten != result)
+            {
+                stage.statistics.rewritten++;
+                result = std::move(rewritten);
+            }
+        }
+
+        return result;
+    }
+
+    template<typename Op>
+    std::shared_ptr<MathOp<T>> unary(std::shared_ptr<Op> op)
+    {
+        std::shared_ptr<MathOp<T>> operands[] { this->transformed(op->get_x()) };
+
+        auto result = staged(op, operands);
+
+        return result == op ? this->rebuilt(op, operands[0]) : result;
+    }
+
+    template<typename Op>
+    std::shared_ptr<MathOp<T>> binary(std::shared_ptr<Op> op)
+    {
+        std::shared_ptr<MathOp<T>> operands[] { this->transformed(op->get_lhs()), this->transformed(op->get_rhs()) };
+
+        auto result = staged(op, operands);
+
+        return result == op ? this->rebuilt(op, operands[0], operands[1]) : result;
+    }
+
+    template<typename Op>
+    std::shared_ptr<MathOp<T>> nary(std::shared_ptr<Op> op)
+    {
+        auto terms = this->transformed_terms(op);
+
+        std::vector<std::shared_ptr<MathOp<T>>> operands;
+        operands.reserve(terms.size());
+        for (auto& term: terms)
+        {
+            operands.push_back(term.op);
+        }
+
+        auto result = staged(op, operands.data());
+
+        return result == op ? this->rebuilt(op, std::move(terms)) : result;
+    }
+};
+
+} /* namespace MathOps */
+
+#endif /* TRANSFORMPIPELINE_H */
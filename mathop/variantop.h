@@ -0,0 +1,999 @@
+#ifndef VARIANTOP_H
+#define VARIANTOP_H
+
+#include "algeblah.h"
+
+#include <variant>
+#include <type_traits>
+#include <unordered_map>
+#include <sstream>
+#include <iomanip>
+#include <algorithm>
+#include <initializer_list>
+#include <iterator>
+#include <vector>
+
+namespace MathOps
+{
+
+/* An alternate, closed representation of a tree: every node is a std::variant over one struct per
+ * node kind, and traversals dispatch with std::visit, which the compiler turns into a jump table.
+ * There is no accept() and no shared_from_this().
+ *
+ * Named values and containers refer back to the objects of the MathOp tree they were converted
+ * from, so Variable::set() is seen by the next evaluation. The inner expression of a container is
+ * converted along with it; re-assigning a lambda afterwards is not seen.
+ *
+ * The usual visitors are ported below as free functions: evaluate() (MathOp::result()),
+ * format() (DefaultFormatter), find() (Finder) and named_values() (NamedValueCounter).
+ *
+ * A node that is shared by several parents is marked as such, and evaluate(), find() and
+ * named_values() only walk it the first time they get to it. Later visits reuse what they found
+ * then, so sharing doesn't make them exponential.
+ *
+ * The stack usage of converting, walking and destroying a tree doesn't depend on its depth:
+ * trees are converted and formatted from loops, and the other traversals recurse up to a depth of
+ * max_variant_depth, below which the rest of the tree is walked from a loop, as MathOp::result()
+ * does. */
+template<typename T> struct VariantNode;
+template<typename T> using VariantPtr = std::shared_ptr<const VariantNode<T>>;
+
+template<typename T, OpKind K>
+struct VariantLeaf
+{
+    static constexpr OpKind kind = K;
+    std::shared_ptr<Value<T>> value;
+};
+
+template<typename T>
+struct VariantConstant
+{
+    static constexpr OpKind kind = OpKind::ConstantValue;
+    T value;
+};
+
+template<typename T>
+struct VariantContainer
+{
+    static constexpr OpKind kind = OpKind::Container;
+    std::shared_ptr<Container<T>> container;
+    VariantPtr<T> inner;
+};
+
+template<typename T, OpKind K>
+struct VariantUnary
+{
+    static constexpr OpKind kind = K;
+    VariantPtr<T> x;
+};
+
+template<typename T, OpKind K>
+struct VariantBinary
+{
+    static constexpr OpKind kind = K;
+    VariantPtr<T> lhs;
+    VariantPtr<T> rhs;
+};
+
+/* A compensated sum (see CompensatedSum), like Sum. Products are converted to the chain of binary
+ * operations they stand for. */
+template<typename T>
+struct VariantSum
+{
+    static constexpr OpKind kind = OpKind::Sum;
+
+    struct Term
+    {
+        VariantPtr<T> op;
+        bool inverted;
+    };
+
+    std::vector<Term> terms;
+};
+
+template<typename T>
+using VariantOp = std::variant<
+    VariantLeaf<T, OpKind::ConstantSymbol>,
+    VariantLeaf<T, OpKind::Variable>,
+    VariantLeaf<T, OpKind::ValueVariable>,
+    VariantLeaf<T, OpKind::NamedConstant>,
+    VariantLeaf<T, OpKind::MutableValue>,
+    VariantConstant<T>,
+    VariantContainer<T>,
+    VariantUnary<T, OpKind::Negate>,
+    VariantUnary<T, OpKind::Sqrt>,
+    VariantUnary<T, OpKind::Log>,
+    VariantUnary<T, OpKind::Log10>,
+    VariantUnary<T, OpKind::Sin>,
+    VariantUnary<T, OpKind::ASin>,
+    VariantUnary<T, OpKind::Cos>,
+    VariantUnary<T, OpKind::ACos>,
+    VariantUnary<T, OpKind::Tan>,
+    VariantUnary<T, OpKind::ATan>,
+    VariantUnary<T, OpKind::Sinh>,
+    VariantUnary<T, OpKind::ASinh>,
+    VariantUnary<T, OpKind::Cosh>,
+    VariantUnary<T, OpKind::ACosh>,
+    VariantUnary<T, OpKind::Tanh>,
+    VariantUnary<T, OpKind::ATanh>,
+    VariantBinary<T, OpKind::Pow>,
+    VariantBinary<T, OpKind::Mul>,
+    VariantBinary<T, OpKind::Div>,
+    VariantBinary<T, OpKind::Add>,
+    VariantBinary<T, OpKind::Sub>,
+    VariantSum<T>
+    >;
+
+/* Node categories, for use in the generic lambdas passed to std::visit */
+template<typename N> struct is_variant_leaf : std::false_type { };
+template<typename T, OpKind K> struct is_variant_leaf<VariantLeaf<T, K>> : std::true_type { };
+template<typename N> struct is_variant_unary : std::false_type { };
+template<typename T, OpKind K> struct is_variant_unary<VariantUnary<T, K>> : std::true_type { };
+template<typename N> struct is_variant_binary : std::false_type { };
+template<typename T, OpKind K> struct is_variant_binary<VariantBinary<T, K>> : std::true_type { };
+
+template<typename T>
+struct VariantNode
+{
+    VariantOp<T> op;
+
+    /* Whether the node has more than one parent */
+    bool shared = false;
+
+    /* Whether the node is an operation that is constant (see MathOp::is_constant()), and if so,
+     * its value */
+    bool constant = false;
+    T value = T();
+
+    ~VariantNode()
+    {
+        std::visit([](auto& n)
+        {
+            using N = std::decay_t<decltype(n)>;
+
+            if constexpr (std::is_same_v<N, VariantContainer<T>>) release(n.inner);
+            else if constexpr (std::is_same_v<N, VariantSum<T>>)
+            {
+                for (auto& term: n.terms)
+                {
+                    release(term.op);
+                }
+            }
+            else if constexpr (is_variant_unary<N>::value)        release(n.x);
+            else if constexpr (is_variant_binary<N>::value)
+            {
+                release(n.lhs);
+                release(n.rhs);
+            }
+        }, op);
+    }
+
+private:
+    /* Destroying the last reference to a tree would recurse once per level, so the outermost
+     * destructor destroys the nodes below it from a loop instead, as MathOp does */
+    static void release(VariantPtr<T>& node)
+    {
+        static thread_local std::vector<VariantPtr<T>> pending;
+        static thread_local bool releasing = false;
+
+        if (node.use_count() != 1)
+        {
+            node.reset();
+            return;
+        }
+
+        pending.push_back(std::move(node));
+        if (releasing)
+        {
+            return;
+        }
+
+        releasing = true;
+        while (!pending.empty())
+        {
+            auto next = std::move(pending.back());
+            pending.pop_back();
+        }
+        releasing = false;
+    }
+};
+
+/* What a traversal found for the shared nodes it has walked */
+template<typename T, typename R>
+using VariantMemo = std::unordered_map<const VariantNode<T>*, R>;
+
+/* f() for a node that isn't shared, or the first time a shared node is walked */
+template<typename T, typename R, typename F>
+R memoised(const VariantNode<T>& node, VariantMemo<T, R>& memo, F f)
+{
+    if (!node.shared)
+    {
+        return f();
+    }
+
+    auto it = memo.find(&node);
+    if (it != memo.end())
+    {
+        return it->second;
+    }
+
+    R result = f();
+    memo.emplace(&node, result);
+
+    return result;
+}
+
+/* Nesting depth of the recursive traversals. Below it, the rest of the tree is walked from a loop
+ * instead. */
+constexpr unsigned max_variant_depth = 256;
+
+/* f() for every operand of a node, in order */
+template<typename T, typename F>
+void for_each_operand(const VariantNode<T>& node, F f)
+{
+    std::visit([&](const auto& n)
+    {
+        using N = std::decay_t<decltype(n)>;
+
+        if constexpr (std::is_same_v<N, VariantContainer<T>>) f(*n.inner);
+        else if constexpr (std::is_same_v<N, VariantSum<T>>)
+        {
+            for (auto& term: n.terms)
+            {
+                f(*term.op);
+            }
+        }
+        else if constexpr (is_variant_unary<N>::value)        f(*n.x);
+        else if constexpr (is_variant_binary<N>::value)
+        {
+            f(*n.lhs);
+            f(*n.rhs);
+        }
+    }, node.op);
+}
+
+/* Iterative post-order walk over root and the nodes below it. compute(node, get) is given each
+ * node after its operands, and returns what's found for it from what get(operand) found for its
+ * operands. Shared nodes are looked up in, and added to, the memo of the recursive walk. Constant
+ * nodes are only walked into if skip_constants is false. */
+template<typename T, typename R, typename F>
+R walked_below(const VariantNode<T>& root, VariantMemo<T, R>& memo, bool skip_constants, F compute)
+{
+    VariantMemo<T, R> found;
+    auto get = [&](const VariantNode<T>& node) -> const R&
+    {
+        auto it = found.find(&node);
+        return it != found.end() ? it->second : memo.at(&node);
+    };
+
+    std::vector<std::pair<const VariantNode<T>*, bool>> stack { { &root, false } };
+    while (!stack.empty())
+    {
+        auto [node, ready] = stack.back();
+
+        if (found.count(node) || (node->shared && memo.count(node)))
+        {
+            stack.pop_back();
+            continue;
+        }
+
+        if (!ready && !(skip_constants && node->constant))
+        {
+            stack.back().second = true;
+            for_each_operand(*node, [&](const VariantNode<T>& operand) { stack.emplace_back(&operand, false); });
+            continue;
+        }
+
+        stack.pop_back();
+        R result = compute(*node, get);
+        (node->shared ? memo : found).emplace(node, std::move(result));
+    }
+
+    return get(root);
+}
+
+/* Function name or infix symbol of an operation, as printed by DefaultFormatter */
+inline const char* op_symbol(OpKind kind)
+{
+    switch (kind)
+    {
+        case OpKind::Negate: return "-";
+        case OpKind::Sqrt:   return "sqrt";
+        case OpKind::Log:    return "log";
+        case OpKind::Log10:  return "log10";
+        case OpKind::Sin:    return "sin";
+        case OpKind::ASin:   return "asin";
+        case OpKind::Cos:    return "cos";
+        case OpKind::ACos:   return "acos";
+        case OpKind::Tan:    return "tan";
+        case OpKind::ATan:   return "atan";
+        case OpKind::Sinh:   return "sinh";
+        case OpKind::ASinh:  return "asinh";
+        case OpKind::Cosh:   return "cosh";
+        case OpKind::ACosh:  return "acosh";
+        case OpKind::Tanh:   return "tanh";
+        case OpKind::ATanh:  return "atanh";
+        case OpKind::Pow:    return " ^ ";
+        case OpKind::Mul:    return " * ";
+        case OpKind::Div:    return " / ";
+        case OpKind::Add:    return " + ";
+        case OpKind::Sub:    return " - ";
+        default:             return "";
+    }
+}
+
+/* Same as MathOp::precedence(), is_commutative() and right_associative() */
+template<typename T>
+Bodmas precedence(const VariantNode<T>& node)
+{
+    switch ((OpKind) node.op.index())
+    {
+        case OpKind::Container: return precedence(*std::get<VariantContainer<T>>(node.op).inner);
+        case OpKind::Negate:    return Bodmas::AdditionSubtraction;
+        case OpKind::Pow:       return Bodmas::Exponents;
+        case OpKind::Mul:
+        case OpKind::Div:       return Bodmas::MultiplicationDivision;
+        case OpKind::Add:
+        case OpKind::Sub:
+        case OpKind::Sum:       return Bodmas::AdditionSubtraction;
+        default:                return Bodmas::Parentheses;
+    }
+}
+
+template<typename T>
+bool is_commutative(const VariantNode<T>& node)
+{
+    switch ((OpKind) node.op.index())
+    {
+        case OpKind::Container: return is_commutative(*std::get<VariantContainer<T>>(node.op).inner);
+        case OpKind::Negate:
+        case OpKind::Pow:
+        case OpKind::Div:
+        case OpKind::Sub:       return false;
+        default:                return true;
+    }
+}
+
+template<typename T>
+bool right_associative(const VariantNode<T>& node)
+{
+    switch ((OpKind) node.op.index())
+    {
+        case OpKind::Container: return right_associative(*std::get<VariantContainer<T>>(node.op).inner);
+        case OpKind::Pow:       return true;
+        default:                return false;
+    }
+}
+
+/* The alternatives are declared in OpKind order, so a node's index is its kind */
+static_assert(std::is_same_v<std::variant_alternative_t<(size_t) OpKind::Container, VariantOp<double>>,
+                             VariantContainer<double>>, "VariantOp must be in OpKind order");
+static_assert(std::is_same_v<std::variant_alternative_t<(size_t) OpKind::Sub, VariantOp<double>>,
+                             VariantBinary<double, OpKind::Sub>>, "VariantOp must be in OpKind order");
+static_assert(std::is_same_v<std::variant_alternative_t<(size_t) OpKind::Sum, VariantOp<double>>,
+                             VariantSum<double>>, "VariantOp must be in OpKind order");
+
+/* Converts a MathOp tree. Shared subtrees are converted once and stay shared, and are marked as
+ * shared. Operations that are constant are given their value, which evaluate() then takes as it
+ * is, just like MathOp caches it. Nodes are made non-const (see make()) so they can be marked
+ * after they're built. */
+template<typename T>
+struct VariantBuilder : public Visitor<T, VariantPtr<T>>
+{
+    /* Operations are converted in post-order, from a loop, so the stack usage doesn't depend on
+     * the depth of the tree. Each one is visited once its operands have been converted, and every
+     * time an operation is reached again, it's marked as shared. */
+    VariantPtr<T> build(std::shared_ptr<MathOp<T>> root)
+    {
+        std::vector<std::pair<MathOp<T>*, bool>> stack { { root.get(), false } };
+        while (!stack.empty())
+        {
+            auto [op, ready] = stack.back();
+
+            auto it = built.find(op);
+            if (it != built.end())
+            {
+                std::const_pointer_cast<VariantNode<T>>(it->second)->shared = true;
+                stack.pop_back();
+                continue;
+            }
+
+            if (!ready)
+            {
+                stack.back().second = true;
+                for (size_t i = op->arity(); i-- > 0; )
+                {
+                    stack.push_back({ op->operand(i), false });
+                }
+
+                continue;
+            }
+
+            stack.pop_back();
+
+            auto node = this->apply(*op);
+            if (op->arity() && op->is_constant())
+            {
+                auto folded = std::const_pointer_cast<VariantNode<T>>(node);
+                folded->constant = true;
+                folded->value = op->result();
+            }
+
+            built[op] = node;
+        }
+
+        return built[root.get()];
+    }
+
+    VariantPtr<T> visit(std::shared_ptr<ConstantSymbol<T>> op) override { return leaf<OpKind::ConstantSymbol>(op); }
+    VariantPtr<T> visit(std::shared_ptr<Variable<T>> op) override { return leaf<OpKind::Variable>(op); }
+    VariantPtr<T> visit(std::shared_ptr<ValueVariable<T>> op) override { return leaf<OpKind::ValueVariable>(op); }
+    VariantPtr<T> visit(std::shared_ptr<NamedConstant<T>> op) override { return leaf<OpKind::NamedConstant>(op); }
+    VariantPtr<T> visit(std::shared_ptr<MutableValue<T>> op) override { return leaf<OpKind::MutableValue>(op); }
+    VariantPtr<T> visit(std::shared_ptr<ConstantValue<T>> op) override { return make(VariantConstant<T> { op->result() }); }
+
+    VariantPtr<T> visit(std::shared_ptr<Container<T>> op) override
+    {
+        return make(VariantContainer<T> { op, converted(op->get_inner()) });
+    }
+
+    VariantPtr<T> visit(std::shared_ptr<Negate<T>> op) override { return unary<OpKind::Negate>(op); }
+    VariantPtr<T> visit(std::shared_ptr<Sqrt<T>> op) override { return unary<OpKind::Sqrt>(op); }
+    VariantPtr<T> visit(std::shared_ptr<Log<T>> op) override { return unary<OpKind::Log>(op); }
+    VariantPtr<T> visit(std::shared_ptr<Log10<T>> op) override { return unary<OpKind::Log10>(op); }
+    VariantPtr<T> visit(std::shared_ptr<Sin<T>> op) override { return unary<OpKind::Sin>(op); }
+    VariantPtr<T> visit(std::shared_ptr<ASin<T>> op) override { return unary<OpKind::ASin>(op); }
+    VariantPtr<T> visit(std::shared_ptr<Cos<T>> op) override { return unary<OpKind::Cos>(op); }
+    VariantPtr<T> visit(std::shared_ptr<ACos<T>> op) override { return unary<OpKind::ACos>(op); }
+    VariantPtr<T> visit(std::shared_ptr<Tan<T>> op) override { return unary<OpKind::Tan>(op); }
+    VariantPtr<T> visit(std::shared_ptr<ATan<T>> op) override { return unary<OpKind::ATan>(op); }
+    VariantPtr<T> visit(std::shared_ptr<Sinh<T>> op) override { return unary<OpKind::Sinh>(op); }
+    VariantPtr<T> visit(std::shared_ptr<ASinh<T>> op) override { return unary<OpKind::ASinh>(op); }
+    VariantPtr<T> visit(std::shared_ptr<Cosh<T>> op) override { return unary<OpKind::Cosh>(op); }
+    VariantPtr<T> visit(std::shared_ptr<ACosh<T>> op) override { return unary<OpKind::ACosh>(op); }
+    VariantPtr<T> visit(std::shared_ptr<Tanh<T>> op) override { return unary<OpKind::Tanh>(op); }
+    VariantPtr<T> visit(std::shared_ptr<ATanh<T>> op) override { return unary<OpKind::ATanh>(op); }
+
+    VariantPtr<T> visit(std::shared_ptr<Pow<T>> op) override { return binary<OpKind::Pow>(op); }
+    VariantPtr<T> visit(std::shared_ptr<Mul<T>> op) override { return binary<OpKind::Mul>(op); }
+    VariantPtr<T> visit(std::shared_ptr<Div<T>> op) override { return binary<OpKind::Div>(op); }
+    VariantPtr<T> visit(std::shared_ptr<Add<T>> op) override { return binary<OpKind::Add>(op); }
+    VariantPtr<T> visit(std::shared_ptr<Sub<T>> op) override { return binary<OpKind::Sub>(op); }
+
+    VariantPtr<T> visit(std::shared_ptr<Sum<T>> op) override
+    {
+        VariantSum<T> sum;
+        for (auto& term: op->get_terms())
+        {
+            sum.terms.push_back({ converted(term.op), term.inverted });
+        }
+
+        return make(std::move(sum));
+    }
+
+    VariantPtr<T> visit(std::shared_ptr<Product<T>> op) override { return nary<OpKind::Mul, OpKind::Div>(op); }
+
+private:
+    std::unordered_map<const MathOp<T>*, VariantPtr<T>> built;
+
+    /* An operand, which build() converts before its users */
+    const VariantPtr<T>& converted(const std::shared_ptr<MathOp<T>>& op) const { return built.at(op.get()); }
+
+    template<typename N>
+    static VariantPtr<T> make(N node)
+    {
+        auto made = std::make_shared<VariantNode<T>>();
+        made->op = std::move(node);
+
+        return made;
+    }
+
+    template<OpKind K>
+    VariantPtr<T> leaf(std::shared_ptr<Value<T>> op) { return make(VariantLeaf<T, K> { op }); }
+
+    template<OpKind K>
+    VariantPtr<T> unary(std::shared_ptr<MathUnaryOp<T>> op) { return make(VariantUnary<T, K> { converted(op->get_x()) }); }
+
+    template<OpKind K>
+    VariantPtr<T> binary(std::shared_ptr<MathBinaryOp<T>> op)
+    {
+        auto lhs = converted(op->get_lhs());
+        auto rhs = converted(op->get_rhs());
+
+        return make(VariantBinary<T, K> { lhs, rhs });
+    }
+
+    /* Products are converted to the chain of binary operations they stand for */
+    template<OpKind K, OpKind Inverted>
+    VariantPtr<T> nary(std::shared_ptr<MathNaryOp<T>> op)
+    {
+        auto& terms = op->get_terms();
+
+        VariantPtr<T> result = converted(terms[0].op);
+        if (terms[0].inverted)
+        {
+            if constexpr (K == OpKind::Add)
+            {
+                result = make(VariantUnary<T, OpKind::Negate> { result });
+            }
+            else
+            {
+                result = make(VariantBinary<T, OpKind::Div> { make(VariantConstant<T> { 1 }), result });
+            }
+        }
+
+        for (size_t i = 1; i < terms.size(); i++)
+        {
+            auto& rhs = converted(terms[i].op);
+            result = terms[i].inverted ? make(VariantBinary<T, Inverted> { result, rhs }) : make(VariantBinary<T, K> { result, rhs });
+        }
+
+        return result;
+    }
+};
+
+template<typename T>
+VariantPtr<T> to_variant(std::shared_ptr<MathOp<T>> op)
+{
+    return VariantBuilder<T>().build(op);
+}
+
+/* The MathOp a node stands for, given those of its operands */
+template<typename T, typename Get>
+std::shared_ptr<MathOp<T>> rebuilt(const VariantNode<T>& node, Get get)
+{
+    return std::visit([&](const auto& n) -> std::shared_ptr<MathOp<T>>
+    {
+        using N = std::decay_t<decltype(n)>;
+
+        if constexpr (std::is_same_v<N, VariantConstant<T>>)       return ConstantValue<T>::create(n.value);
+        else if constexpr (std::is_same_v<N, VariantContainer<T>>) return n.container;
+        else if constexpr (is_variant_leaf<N>::value)              return n.value;
+        else if constexpr (std::is_same_v<N, VariantSum<T>>)
+        {
+            std::vector<typename MathNaryOp<T>::Term> terms;
+            for (auto& term: n.terms)
+            {
+                terms.push_back({ get(*term.op), term.inverted });
+            }
+
+            return Sum<T>::create(std::move(terms));
+        }
+        else if constexpr (is_variant_unary<N>::value)             return create_op<T>(N::kind, get(*n.x));
+        else return create_op<T>(N::kind, get(*n.lhs), get(*n.rhs));
+    }, node.op);
+}
+
+template<typename T>
+[[gnu::noinline]] std::shared_ptr<MathOp<T>> to_math_op_below(const VariantNode<T>& node, VariantMemo<T, std::shared_ptr<MathOp<T>>>& memo)
+{
+    return walked_below(node, memo, false, [](const VariantNode<T>& n, auto get) { return rebuilt(n, get); });
+}
+
+/* Shared nodes are rebuilt once, and stay shared */
+template<typename T>
+std::shared_ptr<MathOp<T>> to_math_op(const VariantNode<T>& node, VariantMemo<T, std::shared_ptr<MathOp<T>>>& memo, unsigned depth)
+{
+    if (depth >= max_variant_depth)
+    {
+        return to_math_op_below(node, memo);
+    }
+
+    return memoised(node, memo, [&] { return rebuilt(node, [&](const VariantNode<T>& operand) { return to_math_op(operand, memo, depth + 1); }); });
+}
+
+template<typename T>
+std::shared_ptr<MathOp<T>> to_math_op(const VariantNode<T>& node)
+{
+    VariantMemo<T, std::shared_ptr<MathOp<T>>> memo;
+
+    return to_math_op(node, memo, 0);
+}
+
+/* The value of a node, given those of its operands */
+template<typename T, typename Get>
+T evaluated(const VariantNode<T>& node, Get get)
+{
+    if (node.constant)
+    {
+        return node.value;
+    }
+
+    return std::visit([&](const auto& n) -> T
+    {
+        using N = std::decay_t<decltype(n)>;
+
+        if constexpr (std::is_same_v<N, VariantConstant<T>>)       return n.value;
+        else if constexpr (std::is_same_v<N, VariantContainer<T>>) return get(*n.inner);
+        else if constexpr (is_variant_leaf<N>::value)              return n.value->result();
+        else if constexpr (std::is_same_v<N, VariantSum<T>>)
+        {
+            auto term = [&](const typename VariantSum<T>::Term& term) { return term.inverted ? -get(*term.op) : get(*term.op); };
+
+            CompensatedSum<T> total(term(n.terms[0]));
+            for (size_t i = 1; i < n.terms.size(); i++)
+            {
+                total.add(term(n.terms[i]));
+            }
+
+            return total.result();
+        }
+        else if constexpr (is_variant_unary<N>::value)             return apply_op<N::kind>(get(*n.x));
+        else return apply_op<N::kind>(get(*n.lhs), get(*n.rhs));
+    }, node.op);
+}
+
+template<typename T>
+[[gnu::noinline]] T evaluate_below(const VariantNode<T>& node, VariantMemo<T, T>& memo)
+{
+    return walked_below(node, memo, true, [](const VariantNode<T>& n, auto get) { return evaluated(n, get); });
+}
+
+template<typename T>
+T evaluate(const VariantNode<T>& node, VariantMemo<T, T>& memo, unsigned depth = 0)
+{
+    if (node.constant)
+    {
+        return node.value;
+    }
+
+    if (depth >= max_variant_depth)
+    {
+        return evaluate_below(node, memo);
+    }
+
+    return memoised(node, memo, [&] { return evaluated(node, [&](const VariantNode<T>& operand) { return evaluate(operand, memo, depth + 1); }); });
+}
+
+template<typename T>
+T evaluate(const VariantNode<T>& node)
+{
+    VariantMemo<T, T> memo;
+
+    return evaluate(node, memo);
+}
+
+/* The number of references to target in a node, given those in its operands */
+template<typename T, typename Get>
+int found(const VariantNode<T>& node, const std::shared_ptr<MathOp<T>>& target, Get get)
+{
+    return std::visit([&](const auto& n) -> int
+    {
+        using N = std::decay_t<decltype(n)>;
+
+        if constexpr (std::is_same_v<N, VariantConstant<T>>)       return 0;
+        else if constexpr (std::is_same_v<N, VariantContainer<T>>) return (n.container == target ? 1 : 0) + get(*n.inner);
+        else if constexpr (is_variant_leaf<N>::value)              return n.value == target ? 1 : 0;
+        else if constexpr (std::is_same_v<N, VariantSum<T>>)
+        {
+            int count = 0;
+            for (auto& term: n.terms)
+            {
+                count += get(*term.op);
+            }
+
+            return count;
+        }
+        else if constexpr (is_variant_unary<N>::value)             return get(*n.x);
+        else return get(*n.lhs) + get(*n.rhs);
+    }, node.op);
+}
+
+template<typename T>
+[[gnu::noinline]] int find_below(const VariantNode<T>& node, const std::shared_ptr<MathOp<T>>& target, VariantMemo<T, int>& memo)
+{
+    return walked_below(node, memo, false, [&](const VariantNode<T>& n, auto get) { return found(n, target, get); });
+}
+
+/* Number of references to the given value or container (see Finder) */
+template<typename T>
+int find(const VariantNode<T>& node, const std::shared_ptr<MathOp<T>>& target, VariantMemo<T, int>& memo, unsigned depth = 0)
+{
+    if (depth >= max_variant_depth)
+    {
+        return find_below(node, target, memo);
+    }
+
+    return memoised(node, memo, [&] { return std::visit([&](const auto& n) -> int
+    {
+        using N = std::decay_t<decltype(n)>;
+
+        if constexpr (std::is_same_v<N, VariantConstant<T>>)       return 0;
+        else if constexpr (std::is_same_v<N, VariantContainer<T>>) return (n.container == target ? 1 : 0) + find(*n.inner, target, memo, depth + 1);
+        else if constexpr (is_variant_leaf<N>::value)              return n.value == target ? 1 : 0;
+        else if constexpr (std::is_same_v<N, VariantSum<T>>)
+        {
+            int count = 0;
+            for (auto& term: n.terms)
+            {
+                count += find(*term.op, target, memo, depth + 1);
+            }
+
+            return count;
+        }
+        else if constexpr (is_variant_unary<N>::value)             return find(*n.x, target, memo, depth + 1);
+        else return find(*n.lhs, target, memo, depth + 1) + find(*n.rhs, target, memo, depth + 1);
+    }, node.op); });
+}
+
+template<typename T>
+int find(const VariantNode<T>& node, std::shared_ptr<MathOp<T>> target)
+{
+    VariantMemo<T, int> memo;
+
+    return find(node, target, memo);
+}
+
+/* The values a shared node added to the results, as where they start and end */
+typedef std::pair<size_t, size_t> VariantRange;
+
+/* Walks root and the nodes below it in pre-order, from a loop. A shared node is walked the first
+ * time it's reached, after which an entry that's left on the stack records the values it added. */
+template<typename T>
+[[gnu::noinline]] void named_values_below(const VariantNode<T>& root, const std::string& name,
+                                          std::vector<std::shared_ptr<Value<T>>>& results, VariantMemo<T, VariantRange>& memo)
+{
+    struct Pending
+    {
+        const VariantNode<T>* node;
+        bool walked;
+        size_t begin;
+    };
+
+    std::vector<Pending> stack { { &root, false, 0 } };
+    while (!stack.empty())
+    {
+        Pending next = stack.back();
+        stack.pop_back();
+
+        const VariantNode<T>& node = *next.node;
+        if (next.walked)
+        {
+            memo.emplace(&node, VariantRange(next.begin, results.size()));
+            continue;
+        }
+
+        if (node.shared)
+        {
+            auto it = memo.find(&node);
+            if (it != memo.end())
+            {
+                /* Copied from the results by index, as they may move while they grow */
+                for (size_t i = it->second.first; i < it->second.second; i++)
+                {
+                    results.push_back(results[i]);
+                }
+
+                continue;
+            }
+
+            stack.push_back({ &node, true, results.size() });
+        }
+
+        /* Operands are pushed right to left, so they're walked left to right */
+        auto push = [&](const VariantPtr<T>& operand) { stack.push_back({ operand.get(), false, 0 }); };
+
+        std::visit([&](const auto& n)
+        {
+            using N = std::decay_t<decltype(n)>;
+
+            if constexpr (std::is_same_v<N, VariantLeaf<T, OpKind::Variable>> ||
+                          std::is_same_v<N, VariantLeaf<T, OpKind::ValueVariable>> ||
+                          std::is_same_v<N, VariantLeaf<T, OpKind::NamedConstant>>)
+            {
+                if (name.empty() || n.value->get_name() == name)
+                {
+                    results.push_back(n.value);
+                }
+            }
+            else if constexpr (std::is_same_v<N, VariantContainer<T>>) push(n.inner);
+            else if constexpr (std::is_same_v<N, VariantSum<T>>)
+            {
+                for (size_t i = n.terms.size(); i-- > 0; )
+                {
+                    push(n.terms[i].op);
+                }
+            }
+            else if constexpr (is_variant_unary<N>::value)             push(n.x);
+            else if constexpr (is_variant_binary<N>::value)
+            {
+                push(n.rhs);
+                push(n.lhs);
+            }
+        }, node.op);
+    }
+}
+
+template<typename T>
+void named_values(const VariantNode<T>& node, const std::string& name, std::vector<std::shared_ptr<Value<T>>>& results,
+                  VariantMemo<T, VariantRange>& memo, unsigned depth = 0)
+{
+    if (depth >= max_variant_depth)
+    {
+        named_values_below(node, name, results, memo);
+        return;
+    }
+
+    if (node.shared)
+    {
+        auto it = memo.find(&node);
+        if (it != memo.end())
+        {
+            /* Copied from the results by index, as they may move while they grow */
+            for (size_t i = it->second.first; i < it->second.second; i++)
+            {
+                results.push_back(results[i]);
+            }
+
+            return;
+        }
+    }
+
+    size_t begin = results.size();
+
+    std::visit([&](const auto& n)
+    {
+        using N = std::decay_t<decltype(n)>;
+
+        if constexpr (std::is_same_v<N, VariantLeaf<T, OpKind::Variable>> ||
+                      std::is_same_v<N, VariantLeaf<T, OpKind::ValueVariable>> ||
+                      std::is_same_v<N, VariantLeaf<T, OpKind::NamedConstant>>)
+        {
+            if (name.empty() || n.value->get_name() == name)
+            {
+                results.push_back(n.value);
+            }
+        }
+        else if constexpr (std::is_same_v<N, VariantContainer<T>>) named_values(*n.inner, name, results, memo, depth + 1);
+        else if constexpr (std::is_same_v<N, VariantSum<T>>)
+        {
+            for (auto& term: n.terms)
+            {
+                named_values(*term.op, name, results, memo, depth + 1);
+            }
+        }
+        else if constexpr (is_variant_unary<N>::value)             named_values(*n.x, name, results, memo, depth + 1);
+        else if constexpr (is_variant_binary<N>::value)
+        {
+            named_values(*n.lhs, name, results, memo, depth + 1);
+            named_values(*n.rhs, name, results, memo, depth + 1);
+        }
+    }, node.op);
+
+    if (node.shared)
+    {
+        memo.emplace(&node, VariantRange(begin, results.size()));
+    }
+}
+
+/* Variables, value variables and named constants with the given name, or with any name if the
+ * given name is empty, in tree order (see NamedValueCounter). A value is listed once for every
+ * path to it, so the results of a tree with many shared nodes can be long, even though each node
+ * is only walked once. */
+template<typename T>
+void named_values(const VariantNode<T>& node, const std::string& name, std::vector<std::shared_ptr<Value<T>>>& results)
+{
+    VariantMemo<T, VariantRange> memo;
+
+    named_values(node, name, results, memo);
+}
+
+/* Formats a tree exactly like DefaultFormatter, and like it, from a loop: each node queues the
+ * pieces it's made of, which are written out in turn */
+template<typename T>
+struct VariantFormatter
+{
+    VariantFormatter(int precision) : precision(precision) { }
+
+    std::string format(const VariantNode<T>& node, bool parenthesize = false) const
+    {
+        std::stringstream ss;
+
+        std::vector<Piece> pending { { &node, nullptr, parenthesize } };
+        while (!pending.empty())
+        {
+            Piece next = pending.back();
+            pending.pop_back();
+
+            if (!next.node)
+            {
+                ss << next.text;
+                continue;
+            }
+
+            to_stream(ss, *next.node, next.parenthesize, pending);
+        }
+
+        return ss.str();
+    }
+
+private:
+    const int precision;
+
+    /* A piece of the output that's yet to be written: either a node to format, or text */
+    struct Piece
+    {
+        const VariantNode<T>* node;
+        const char* text;
+        bool parenthesize;
+    };
+
+    static Piece text(const char* text) { return Piece { nullptr, text, false }; }
+
+    /* Queues pieces to be written in the given order */
+    static void queue(std::vector<Piece>& pending, std::initializer_list<Piece> pieces)
+    {
+        pending.insert(pending.end(), std::make_reverse_iterator(pieces.end()), std::make_reverse_iterator(pieces.begin()));
+    }
+
+    void value_to_stream(std::stringstream& ss, const T& x) const
+    {
+        auto old_precision = ss.precision(precision);
+        ss << x;
+        ss.precision(old_precision);
+    }
+
+    void to_stream(std::stringstream& ss, const VariantNode<T>& node, bool parenthesize, std::vector<Piece>& pending) const
+    {
+        std::visit([&](const auto& n)
+        {
+            using N = std::decay_t<decltype(n)>;
+
+            if constexpr (std::is_same_v<N, VariantConstant<T>>) value_to_stream(ss, n.value);
+            else if constexpr (std::is_same_v<N, VariantContainer<T>>) ss << n.container->get_name();
+            else if constexpr (std::is_same_v<N, VariantLeaf<T, OpKind::ValueVariable>> ||
+                               std::is_same_v<N, VariantLeaf<T, OpKind::MutableValue>>)
+            {
+                value_to_stream(ss, n.value->result());
+            }
+            else if constexpr (is_variant_leaf<N>::value) ss << n.value->get_name();
+            else if constexpr (N::kind == OpKind::Negate)
+            {
+                queue(pending, { text(parenthesize ? "(-" : "-"), side_piece(node, *n.x, true), text(parenthesize ? ")" : "") });
+            }
+            else if constexpr (is_variant_unary<N>::value)
+            {
+                queue(pending, { text(op_symbol(N::kind)), text("("), Piece { n.x.get(), nullptr, parenthesize }, text(")") });
+            }
+            else if constexpr (std::is_same_v<N, VariantSum<T>>)
+            {
+                /* An inverted operand is parenthesized like the right hand side of a subtraction.
+                 * Terms are queued last to first. */
+                pending.push_back(text(parenthesize ? ")" : ""));
+                for (size_t i = n.terms.size(); i-- > 0; )
+                {
+                    auto& term = n.terms[i];
+                    pending.push_back(Piece { term.op.get(), nullptr, term.inverted
+                        ? Bodmas::AdditionSubtraction <= precedence(*term.op)
+                        : Bodmas::AdditionSubtraction < precedence(*term.op) });
+                    pending.push_back(text(term.inverted ? (i ? " - " : "-") : (i ? " + " : "")));
+                }
+                pending.push_back(text(parenthesize ? "(" : ""));
+            }
+            else
+            {
+                bool right_assoc = right_associative(node);
+
+                queue(pending, { text(parenthesize ? "(" : ""),
+                                 side_piece(node, *n.lhs, right_assoc),
+                                 text(op_symbol(N::kind)),
+                                 side_piece(node, *n.rhs, !right_assoc),
+                                 text(parenthesize ? ")" : "") });
+            }
+        }, node.op);
+    }
+
+    static Piece side_piece(const VariantNode<T>& op, const VariantNode<T>& side, bool use_commutation)
+    {
+        Bodmas parent_precedence = precedence(op);
+        bool use_parens = !use_commutation || is_commutative(op)
+            ? parent_precedence < precedence(side)
+            : parent_precedence <= precedence(side);
+
+        return Piece { &side, nullptr, use_parens };
+    }
+};
+
+} /* namespace MathOps */
+
+#endif /* VARIANTOP_H */
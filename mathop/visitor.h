@@ -3,7 +3,6 @@
 
 #include <string>
 #include <memory>
-#include <variant>
 #include <vector>
 
 namespace MathOps
@@ -40,49 +39,222 @@ template<typename T> struct Mul;
 template<typename T> struct Div;
 template<typename T> struct Add;
 template<typename T> struct Sub;
+template<typename T> struct Sum;
+template<typename T> struct Product;
 
-template <typename T>
-using VisitorResult = std::variant<
-    int,
-    std::string,
-    std::shared_ptr<MathOp<T>>,
-    std::vector<std::shared_ptr<MathOp<T>>>
-    >;
+/* Untyped visitor interface, through which MathOp::accept() dispatches on the node type */
+template<typename T>
+struct VisitorBase
+{
+    virtual void dispatch(std::shared_ptr<ConstantSymbol<T>> op) = 0;
+    virtual void dispatch(std::shared_ptr<Variable<T>> op) = 0;
+    virtual void dispatch(std::shared_ptr<ValueVariable<T>> op) = 0;
+    virtual void dispatch(std::shared_ptr<NamedConstant<T>> op) = 0;
+    virtual void dispatch(std::shared_ptr<MutableValue<T>> op) = 0;
+    virtual void dispatch(std::shared_ptr<ConstantValue<T>> op) = 0;
+
+    virtual void dispatch(std::shared_ptr<Container<T>> op) = 0;
+
+    virtual void dispatch(std::shared_ptr<Negate<T>> op) = 0;
+    virtual void dispatch(std::shared_ptr<Sqrt<T>> op) = 0;
+    virtual void dispatch(std::shared_ptr<Log<T>> op) = 0;
+    virtual void dispatch(std::shared_ptr<Log10<T>> op) = 0;
+    virtual void dispatch(std::shared_ptr<Sin<T>> op) = 0;
+    virtual void dispatch(std::shared_ptr<ASin<T>> op) = 0;
+    virtual void dispatch(std::shared_ptr<Cos<T>> op) = 0;
+    virtual void dispatch(std::shared_ptr<ACos<T>> op) = 0;
+    virtual void dispatch(std::shared_ptr<Tan<T>> op) = 0;
+    virtual void dispatch(std::shared_ptr<ATan<T>> op) = 0;
+    virtual void dispatch(std::shared_ptr<Sinh<T>> op) = 0;
+    virtual void dispatch(std::shared_ptr<ASinh<T>> op) = 0;
+    virtual void dispatch(std::shared_ptr<Cosh<T>> op) = 0;
+    virtual void dispatch(std::shared_ptr<ACosh<T>> op) = 0;
+    virtual void dispatch(std::shared_ptr<Tanh<T>> op) = 0;
+    virtual void dispatch(std::shared_ptr<ATanh<T>> op) = 0;
+    virtual void dispatch(std::shared_ptr<Pow<T>> op) = 0;
+    virtual void dispatch(std::shared_ptr<Mul<T>> op) = 0;
+    virtual void dispatch(std::shared_ptr<Div<T>> op) = 0;
+    virtual void dispatch(std::shared_ptr<Add<T>> op) = 0;
+    virtual void dispatch(std::shared_ptr<Sub<T>> op) = 0;
+    virtual void dispatch(std::shared_ptr<Sum<T>> op) = 0;
+    virtual void dispatch(std::shared_ptr<Product<T>> op) = 0;
+
+    virtual ~VisitorBase() {}
+};
+
+/* A visitor whose visit() functions return R. The result of each visit is handed back through a
+ * member rather than through the (untyped) dispatch, so it is never wrapped or type checked. */
+template<typename T, typename R>
+struct Visitor : public VisitorBase<T>
+{
+    virtual R visit(std::shared_ptr<ConstantSymbol<T>> op) = 0;
+    virtual R visit(std::shared_ptr<Variable<T>> op) = 0;
+    virtual R visit(std::shared_ptr<ValueVariable<T>> op) = 0;
+    virtual R visit(std::shared_ptr<NamedConstant<T>> op) = 0;
+    virtual R visit(std::shared_ptr<MutableValue<T>> op) = 0;
+    virtual R visit(std::shared_ptr<ConstantValue<T>> op) = 0;
+
+    virtual R visit(std::shared_ptr<Container<T>> op) = 0;
+
+    virtual R visit(std::shared_ptr<Negate<T>> op) = 0;
+    virtual R visit(std::shared_ptr<Sqrt<T>> op) = 0;
+    virtual R visit(std::shared_ptr<Log<T>> op) = 0;
+    virtual R visit(std::shared_ptr<Log10<T>> op) = 0;
+    virtual R visit(std::shared_ptr<Sin<T>> op) = 0;
+    virtual R visit(std::shared_ptr<ASin<T>> op) = 0;
+    virtual R visit(std::shared_ptr<Cos<T>> op) = 0;
+    virtual R visit(std::shared_ptr<ACos<T>> op) = 0;
+    virtual R visit(std::shared_ptr<Tan<T>> op) = 0;
+    virtual R visit(std::shared_ptr<ATan<T>> op) = 0;
+    virtual R visit(std::shared_ptr<Sinh<T>> op) = 0;
+    virtual R visit(std::shared_ptr<ASinh<T>> op) = 0;
+    virtual R visit(std::shared_ptr<Cosh<T>> op) = 0;
+    virtual R visit(std::shared_ptr<ACosh<T>> op) = 0;
+    virtual R visit(std::shared_ptr<Tanh<T>> op) = 0;
+    virtual R visit(std::shared_ptr<ATanh<T>> op) = 0;
+    virtual R visit(std::shared_ptr<Pow<T>> op) = 0;
+    virtual R visit(std::shared_ptr<Mul<T>> op) = 0;
+    virtual R visit(std::shared_ptr<Div<T>> op) = 0;
+    virtual R visit(std::shared_ptr<Add<T>> op) = 0;
+    virtual R visit(std::shared_ptr<Sub<T>> op) = 0;
+    virtual R visit(std::shared_ptr<Sum<T>> op) = 0;
+    virtual R visit(std::shared_ptr<Product<T>> op) = 0;
+
+    /* Visit op and return the result */
+    R apply(MathOp<T>& op)
+    {
+        op.accept(*this);
+        return take();
+    }
+
+    R apply(const std::shared_ptr<MathOp<T>>& op) { return apply(*op); }
+
+private:
+    friend struct MathOp<T>;
+
+    R result;
+
+    R take() { return std::move(result); }
+
+    void dispatch(std::shared_ptr<ConstantSymbol<T>> op) final { result = visit(op); }
+    void dispatch(std::shared_ptr<Variable<T>> op) final { result = visit(op); }
+    void dispatch(std::shared_ptr<ValueVariable<T>> op) final { result = visit(op); }
+    void dispatch(std::shared_ptr<NamedConstant<T>> op) final { result = visit(op); }
+    void dispatch(std::shared_ptr<MutableValue<T>> op) final { result = visit(op); }
+    void dispatch(std::shared_ptr<ConstantValue<T>> op) final { result = visit(op); }
+
+    void dispatch(std::shared_ptr<Container<T>> op) final { result = visit(op); }
+
+    void dispatch(std::shared_ptr<Negate<T>> op) final { result = visit(op); }
+    void dispatch(std::shared_ptr<Sqrt<T>> op) final { result = visit(op); }
+    void dispatch(std::shared_ptr<Log<T>> op) final { result = visit(op); }
+    void dispatch(std::shared_ptr<Log10<T>> op) final { result = visit(op); }
+    void dispatch(std::shared_ptr<Sin<T>> op) final { result = visit(op); }
+    void dispatch(std::shared_ptr<ASin<T>> op) final { result = visit(op); }
+    void dispatch(std::shared_ptr<Cos<T>> op) final { result = visit(op); }
+    void dispatch(std::shared_ptr<ACos<T>> op) final { result = visit(op); }
+    void dispatch(std::shared_ptr<Tan<T>> op) final { result = visit(op); }
+    void dispatch(std::shared_ptr<ATan<T>> op) final { result = visit(op); }
+    void dispatch(std::shared_ptr<Sinh<T>> op) final { result = visit(op); }
+    void dispatch(std::shared_ptr<ASinh<T>> op) final { result = visit(op); }
+    void dispatch(std::shared_ptr<Cosh<T>> op) final { result = visit(op); }
+    void dispatch(std::shared_ptr<ACosh<T>> op) final { result = visit(op); }
+    void dispatch(std::shared_ptr<Tanh<T>> op) final { result = visit(op); }
+    void dispatch(std::shared_ptr<ATanh<T>> op) final { result = visit(op); }
+    void dispatch(std::shared_ptr<Pow<T>> op) final { result = visit(op); }
+    void dispatch(std::shared_ptr<Mul<T>> op) final { result = visit(op); }
+    void dispatch(std::shared_ptr<Div<T>> op) final { result = visit(op); }
+    void dispatch(std::shared_ptr<Add<T>> op) final { result = visit(op); }
+    void dispatch(std::shared_ptr<Sub<T>> op) final { result = visit(op); }
+    void dispatch(std::shared_ptr<Sum<T>> op) final { result = visit(op); }
+    void dispatch(std::shared_ptr<Product<T>> op) final { result = visit(op); }
+};
+
+/* A visitor that returns nothing, e.g. a formatter that appends to an output buffer */
+template<typename T>
+struct Visitor<T, void> : public VisitorBase<T>
+{
+    virtual void visit(std::shared_ptr<ConstantSymbol<T>> op) = 0;
+    virtual void visit(std::shared_ptr<Variable<T>> op) = 0;
+    virtual void visit(std::shared_ptr<ValueVariable<T>> op) = 0;
+    virtual void visit(std::shared_ptr<NamedConstant<T>> op) = 0;
+    virtual void visit(std::shared_ptr<MutableValue<T>> op) = 0;
+    virtual void visit(std::shared_ptr<ConstantValue<T>> op) = 0;
+
+    virtual void visit(std::shared_ptr<Container<T>> op) = 0;
+
+    virtual void visit(std::shared_ptr<Negate<T>> op) = 0;
+    virtual void visit(std::shared_ptr<Sqrt<T>> op) = 0;
+    virtual void visit(std::shared_ptr<Log<T>> op) = 0;
+    virtual void visit(std::shared_ptr<Log10<T>> op) = 0;
+    virtual void visit(std::shared_ptr<Sin<T>> op) = 0;
+    virtual void visit(std::shared_ptr<ASin<T>> op) = 0;
+    virtual void visit(std::shared_ptr<Cos<T>> op) = 0;
+    virtual void visit(std::shared_ptr<ACos<T>> op) = 0;
+    virtual void visit(std::shared_ptr<Tan<T>> op) = 0;
+    virtual void visit(std::shared_ptr<ATan<T>> op) = 0;
+    virtual void visit(std::shared_ptr<Sinh<T>> op) = 0;
+    virtual void visit(std::shared_ptr<ASinh<T>> op) = 0;
+    virtual void visit(std::shared_ptr<Cosh<T>> op) = 0;
+    virtual void visit(std::shared_ptr<ACosh<T>> op) = 0;
+    virtual void visit(std::shared_ptr<Tanh<T>> op) = 0;
+    virtual void visit(std::shared_ptr<ATanh<T>> op) = 0;
+    virtual void visit(std::shared_ptr<Pow<T>> op) = 0;
+    virtual void visit(std::shared_ptr<Mul<T>> op) = 0;
+    virtual void visit(std::shared_ptr<Div<T>> op) = 0;
+    virtual void visit(std::shared_ptr<Add<T>> op) = 0;
+    virtual void visit(std::shared_ptr<Sub<T>> op) = 0;
+    virtual void visit(std::shared_ptr<Sum<T>> op) = 0;
+    virtual void visit(std::shared_ptr<Product<T>> op) = 0;
+
+    void apply(MathOp<T>& op) { op.accept(*this); }
+    void apply(const std::shared_ptr<MathOp<T>>& op) { op->accept(*this); }
+
+private:
+    void dispatch(std::shared_ptr<ConstantSymbol<T>> op) final { visit(op); }
+    void dispatch(std::shared_ptr<Variable<T>> op) final { visit(op); }
+    void dispatch(std::shared_ptr<ValueVariable<T>> op) final { visit(op); }
+    void dispatch(std::shared_ptr<NamedConstant<T>> op) final { visit(op); }
+    void dispatch(std::shared_ptr<MutableValue<T>> op) final { visit(op); }
+    void dispatch(std::shared_ptr<ConstantValue<T>> op) final { visit(op); }
+
+    void dispatch(std::shared_ptr<Container<T>> op) final { visit(op); }
+
+    void dispatch(std::shared_ptr<Negate<T>> op) final { visit(op); }
+    void dispatch(std::shared_ptr<Sqrt<T>> op) final { visit(op); }
+    void dispatch(std::shared_ptr<Log<T>> op) final { visit(op); }
+    void dispatch(std::shared_ptr<Log10<T>> op) final { visit(op); }
+    void dispatch(std::shared_ptr<Sin<T>> op) final { visit(op); }
+    void dispatch(std::shared_ptr<ASin<T>> op) final { visit(op); }
+    void dispatch(std::shared_ptr<Cos<T>> op) final { visit(op); }
+    void dispatch(std::shared_ptr<ACos<T>> op) final { visit(op); }
+    void dispatch(std::shared_ptr<Tan<T>> op) final { visit(op); }
+    void dispatch(std::shared_ptr<ATan<T>> op) final { visit(op); }
+    void dispatch(std::shared_ptr<Sinh<T>> op) final { visit(op); }
+    void dispatch(std::shared_ptr<ASinh<T>> op) final { visit(op); }
+    void dispatch(std::shared_ptr<Cosh<T>> op) final { visit(op); }
+    void dispatch(std::shared_ptr<ACosh<T>> op) final { visit(op); }
+    void dispatch(std::shared_ptr<Tanh<T>> op) final { visit(op); }
+    void dispatch(std::shared_ptr<ATanh<T>> op) final { visit(op); }
+    void dispatch(std::shared_ptr<Pow<T>> op) final { visit(op); }
+    void dispatch(std::shared_ptr<Mul<T>> op) final { visit(op); }
+    void dispatch(std::shared_ptr<Div<T>> op) final { visit(op); }
+    void dispatch(std::shared_ptr<Add<T>> op) final { visit(op); }
+    void dispatch(std::shared_ptr<Sub<T>> op) final { visit(op); }
+    void dispatch(std::shared_ptr<Sum<T>> op) final { visit(op); }
+    void dispatch(std::shared_ptr<Product<T>> op) final { visit(op); }
+};
+
+/* The visitor types used by MathOp::count(), transform(), multi_transform() and format() */
+template<typename T> using CountVisitor = Visitor<T, int>;
+template<typename T> using TransformVisitor = Visitor<T, std::shared_ptr<MathOp<T>>>;
+template<typename T> using MultiTransformVisitor = Visitor<T, std::vector<std::shared_ptr<MathOp<T>>>>;
 
+/* Formatters append their output to 'out' */
 template<typename T>
-struct Visitor
+struct FormatVisitor : public Visitor<T, void>
 {
-    virtual VisitorResult<T> visit(std::shared_ptr<ConstantSymbol<T>> op) = 0;
-    virtual VisitorResult<T> visit(std::shared_ptr<Variable<T>> op) = 0;
-    virtual VisitorResult<T> visit(std::shared_ptr<ValueVariable<T>> op) = 0;
-    virtual VisitorResult<T> visit(std::shared_ptr<NamedConstant<T>> op) = 0;
-    virtual VisitorResult<T> visit(std::shared_ptr<MutableValue<T>> op) = 0;
-    virtual VisitorResult<T> visit(std::shared_ptr<ConstantValue<T>> op) = 0;
-
-    virtual VisitorResult<T> visit(std::shared_ptr<Container<T>> op) = 0;
-
-    virtual VisitorResult<T> visit(std::shared_ptr<Negate<T>> op) = 0;
-    virtual VisitorResult<T> visit(std::shared_ptr<Sqrt<T>> op) = 0;
-    virtual VisitorResult<T> visit(std::shared_ptr<Log<T>> op) = 0;
-    virtual VisitorResult<T> visit(std::shared_ptr<Log10<T>> op) = 0;
-    virtual VisitorResult<T> visit(std::shared_ptr<Sin<T>> op) = 0;
-    virtual VisitorResult<T> visit(std::shared_ptr<ASin<T>> op) = 0;
-    virtual VisitorResult<T> visit(std::shared_ptr<Cos<T>> op) = 0;
-    virtual VisitorResult<T> visit(std::shared_ptr<ACos<T>> op) = 0;
-    virtual VisitorResult<T> visit(std::shared_ptr<Tan<T>> op) = 0;
-    virtual VisitorResult<T> visit(std::shared_ptr<ATan<T>> op) = 0;
-    virtual VisitorResult<T> visit(std::shared_ptr<Sinh<T>> op) = 0;
-    virtual VisitorResult<T> visit(std::shared_ptr<ASinh<T>> op) = 0;
-    virtual VisitorResult<T> visit(std::shared_ptr<Cosh<T>> op) = 0;
-    virtual VisitorResult<T> visit(std::shared_ptr<ACosh<T>> op) = 0;
-    virtual VisitorResult<T> visit(std::shared_ptr<Tanh<T>> op) = 0;
-    virtual VisitorResult<T> visit(std::shared_ptr<ATanh<T>> op) = 0;
-    virtual VisitorResult<T> visit(std::shared_ptr<Pow<T>> op) = 0;
-    virtual VisitorResult<T> visit(std::shared_ptr<Mul<T>> op) = 0;
-    virtual VisitorResult<T> visit(std::shared_ptr<Div<T>> op) = 0;
-    virtual VisitorResult<T> visit(std::shared_ptr<Add<T>> op) = 0;
-    virtual VisitorResult<T> visit(std::shared_ptr<Sub<T>> op) = 0;
-    virtual ~Visitor() {}
+    std::string out;
 };
 
 } /* MathOps */
@@ -0,0 +1,189 @@
+#ifndef WALKER_H
+#define WALKER_H
+
+#include "algeblah.h"
+
+#include <unordered_map>
+#include <vector>
+
+namespace MathOps
+{
+
+/* Base class of count visitors that visit every operation in a tree. Operands are queued by
+ * descend() rather than visited recursively, and the outermost call visits the queue, in
+ * pre-order, from a loop. The stack usage doesn't depend on the depth of the tree. */
+template<typename T>
+struct CountWalker : public CountVisitor<T>
+{
+protected:
+    /* Visit the operands of op. Returns their count if this is the outermost call, or 0 if the
+     * operands were queued for the outermost call to count. */
+    int descend(MathOp<T>& op)
+    {
+        for (size_t i = op.arity(); i-- > 0; )
+        {
+            pending.push_back(op.operand(i));
+        }
+
+        if (walking)
+        {
+            return 0;
+        }
+
+        walking = true;
+
+        int n = 0;
+        while (!pending.empty() && !done())
+        {
+            MathOp<T>* next = pending.back();
+            pending.pop_back();
+            n += this->apply(*next);
+        }
+
+        pending.clear();
+        walking = false;
+
+        return n;
+    }
+
+    /* Stop visiting early */
+    virtual bool done() const { return false; }
+
+private:
+    std::vector<MathOp<T>*> pending;
+    bool walking = false;
+};
+
+/* Base class of transformers that rebuild a tree from its transformed operands. Operands are
+ * visited recursively up to a depth of max_depth. Below that, the rest of the subtree is
+ * transformed bottom up, from a loop, and each operation's operands are looked up rather than
+ * visited.
+ *
+ * rewrite() transforms a single operation, given the transforms of its operands (or taking its
+ * operands to be transformed already). This only makes sense for transformers that rewrite every
+ * operation from its transformed operands alone, which are the ones that can be a stage of a
+ * TransformPipeline. */
+template<typename T>
+struct TransformWalker : public TransformVisitor<T>
+{
+    std::shared_ptr<MathOp<T>> rewrite(const std::shared_ptr<MathOp<T>>& op, const std::shared_ptr<MathOp<T>>* operands = nullptr)
+    {
+        auto saved = local;
+        local = Local { op.get(), operands };
+        auto result = this->apply(op);
+        local = saved;
+
+        return result;
+    }
+
+protected:
+    std::shared_ptr<MathOp<T>> transformed(const std::shared_ptr<MathOp<T>>& op)
+    {
+        if (local.op)
+        {
+            for (size_t i = 0; local.operands && i < local.op->arity(); i++)
+            {
+                if (local.op->operand(i) == op.get())
+                {
+                    return local.operands[i];
+                }
+            }
+
+            return op;
+        }
+
+        if (!bottom_up.empty())
+        {
+            auto it = bottom_up.find(op.get());
+            if (it != bottom_up.end())
+            {
+                return it->second;
+            }
+        }
+
+        if (depth >= max_depth)
+        {
+            return transform_bottom_up(*op);
+        }
+
+        depth++;
+        auto result = this->apply(op);
+        depth--;
+
+        return result;
+    }
+
+    /* The same as transformed(op.operand(i)), but without looking the operand up when rewriting
+     * op, which matters for operations with many operands */
+    std::shared_ptr<MathOp<T>> transformed_operand(MathOp<T>& op, size_t i)
+    {
+        if (local.op == &op)
+        {
+            return local.operands ? local.operands[i] : op.operand(i)->shared_from_this();
+        }
+
+        return transformed(op.operand(i)->shared_from_this());
+    }
+
+    /* Whether containers are transformed through their inner expression */
+    virtual bool walks_into_containers() const { return false; }
+
+private:
+    static constexpr unsigned max_depth = 256;
+
+    /* The operation being rewritten, if any, and the transforms of its operands */
+    struct Local
+    {
+        MathOp<T>* op;
+        const std::shared_ptr<MathOp<T>>* operands;
+    };
+
+    unsigned depth = 0;
+    Local local { nullptr, nullptr };
+    std::unordered_map<const MathOp<T>*, std::shared_ptr<MathOp<T>>> bottom_up;
+
+    /* Containers are only walked into by transformers that expand them */
+    bool is_opaque(MathOp<T>* op) const
+    {
+        return op->arity() == 1 && !walks_into_containers() && dynamic_cast<Container<T>*>(op);
+    }
+
+    std::shared_ptr<MathOp<T>> transform_bottom_up(MathOp<T>& root)
+    {
+        auto saved = std::move(bottom_up);
+        unsigned saved_depth = depth;
+        bottom_up.clear();
+        depth = 0;
+
+        std::vector<std::pair<MathOp<T>*, size_t>> stack { { &root, 0 } };
+        while (!stack.empty())
+        {
+            MathOp<T>* op = stack.back().first;
+            size_t i = stack.back().second++;
+
+            if (i < op->arity() && (i || !is_opaque(op)))
+            {
+                MathOp<T>* next = op->operand(i);
+                if (!bottom_up.count(next))
+                {
+                    stack.emplace_back(next, 0);
+                }
+
+                continue;
+            }
+
+            stack.pop_back();
+            bottom_up.emplace(op, this->apply(*op));
+        }
+
+        auto result = bottom_up[&root];
+        bottom_up = std::move(saved);
+        depth = saved_depth;
+
+        return result;
+    }
+};
+
+} /* namespace MathOps */
+
+#endif /* WALKER_H */
@@ -24,10 +24,12 @@ options::options(int argc, char **argv)
                 {"version", 0, 0, 'v'},
                 {"tex", 0, 0, 't'},
                 {"external", 1, 0, 'e'},
+                {"jit", 0, 0, 'j'},
+                {"threads", 1, 0, 'T'},
                 {0, 0, 0, 0}};
         int option_index = 0;
 
-        c = getopt_long(argc, argv, "aqm:d:p:hvte:",
+        c = getopt_long(argc, argv, "aqm:d:p:hvte:jT:",
                         long_options, &option_index);
 
         if (c == -1)
@@ -78,6 +80,24 @@ options::options(int argc, char **argv)
             external = optarg;
             break;
 
+        case 'j':
+#ifdef ARBIT_PREC
+            std::cerr << "Native code compilation is not supported with arbitrary precision\n";
+            exit(1);
+#else
+            use_jit = true;
+            break;
+#endif
+
+        case 'T':
+            threads = parse_int(optarg);
+            if (threads < 1)
+            {
+                std::cerr << "Number of threads should be at least 1\n";
+                exit(1);
+            }
+            break;
+
         case 'v':
             print_version();
             exit(0);
@@ -125,7 +145,11 @@ void options::print_help(std::string name, bool error)
         << "  -p, --precision [n] : Set the number of internal significant digits (default: 50)\n"
         << "  -q, --quiet         : Suppress disclaimer\n"
         << "  -t, --tex           : Use tex formatter\n"
+        << "  -T, --threads   [n] : Set the number of threads used for solving (default: 1)\n"
         << "  -e, --external      : Pass result string to external program\n"
+#ifndef ARBIT_PREC
+        << "  -j, --jit           : Compile plotted expressions to native code\n"
+#endif
         << "  -v, --version       : This help screen\n";
 }
 
@@ -15,11 +15,13 @@ struct options
     bool quiet = false;
     bool answer_only = false;
     int max_precision = -1;
+    int threads = 1;
     std::vector<std::string> filenames;
 
     options(int argc, char** argv);
 
     bool use_tex = false;
+    bool use_jit = false;
     std::string external;
 
 private:
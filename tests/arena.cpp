@@ -0,0 +1,102 @@
+/* Checks that an arena evaluates random trees exactly like the trees themselves, both before and
+ * after their variables change, and that the trees it rebuilds do as well. Each root is also
+ * evaluated into a buffer of its own, from several threads at once, which only works if it
+ * evaluates every node it reaches (and none of the other trees' nodes are needed). A chain that
+ * is too deep to build or rebuild recursively is checked as well. */
+
+#include "test.h"
+#include "randomtree.h"
+
+#include "../mathop/arena.h"
+
+#include <thread>
+
+using namespace MathOps;
+
+int main()
+{
+    RandomTree<number> random(2);
+
+    /* Every tree goes in the same arena, after the ones before it */
+    Arena<number> arena;
+    std::vector<std::pair<std::shared_ptr<MathOp<number>>, uint32_t>> roots;
+
+    for (auto& tree: random.trees(500))
+    {
+        roots.emplace_back(tree, arena.add(tree));
+    }
+
+    random.for_values(3, [&]
+    {
+        for (auto& root: roots)
+        {
+            CHECK(same(arena.result(root.second), root.first->result()));
+            CHECK(same(arena.to_math_op(root.second)->result(), root.first->result()));
+        }
+
+        /* The trees themselves are only evaluated on this thread */
+        std::vector<number> expected;
+        for (auto& root: roots)
+        {
+            expected.push_back(root.first->result());
+        }
+
+        std::vector<std::thread> threads;
+        std::vector<int> mismatches(4);
+        for (size_t i = 0; i < mismatches.size(); i++)
+        {
+            threads.emplace_back([&, i]
+            {
+                for (size_t j = i; j < roots.size(); j += mismatches.size())
+                {
+                    std::vector<number> results;
+                    mismatches[i] += !same(arena.result(roots[j].second, results), expected[j]);
+                }
+            });
+        }
+
+        for (auto& thread: threads)
+        {
+            thread.join();
+        }
+
+        CHECK(std::count(mismatches.begin(), mismatches.end(), 0) == (int) mismatches.size());
+    });
+
+    /* Shared subtrees are appended once, so t = t * t + t, 22 times over, takes 45 nodes rather
+     * than millions */
+    auto x = Variable<number>::create("x", -0.5);
+    std::shared_ptr<MathOp<number>> t = x;
+    for (int i = 0; i < 22; i++)
+    {
+        t = t * t + t;
+    }
+
+    Arena<number> shared;
+    uint32_t root = shared.add(t);
+    CHECK(shared.size() == 45);
+    CHECK(same(shared.result(root), t->result()));
+
+    x->set(-0.25);
+    CHECK(same(shared.result(root), t->result()));
+    CHECK(same(shared.to_math_op(root)->result(), t->result()));
+
+    /* A chain far deeper than the stack would allow if the arena were built, or the tree rebuilt,
+     * recursively */
+    const size_t n = 200000;
+    std::shared_ptr<MathOp<number>> chain = x;
+    for (size_t i = 1; i < n; i++)
+    {
+        chain = i % 2 ? sin(chain) * x : chain + x;
+    }
+
+    Arena<number> deep;
+    uint32_t deep_root = deep.add(chain);
+    CHECK(same(deep.result(deep_root), chain->result()));
+
+    x->set(0.75);
+    CHECK(same(deep.result(deep_root), chain->result()));
+    CHECK(same(deep.to_math_op(deep_root)->result(), chain->result()));
+
+    return test_result();
+}
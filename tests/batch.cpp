@@ -0,0 +1,55 @@
+/* Checks that batched evaluation gives, row for row, what evaluating the tree for that row's
+ * values gives, over several chunks and a partial one */
+
+#include "test.h"
+#include "randomtree.h"
+
+#include "../mathop/program.h"
+
+using namespace MathOps;
+
+typedef std::shared_ptr<MathOp<number>> Op;
+
+int main()
+{
+    const size_t rows = 600;
+
+    RandomTree<number> random(4);
+
+    std::vector<Op> trees = random.trees(100);
+
+    /* x and y come from columns, z keeps its value */
+    std::vector<number> xs(rows), ys(rows);
+    for (size_t k = 0; k < rows; k++)
+    {
+        xs[k] = number(int(k % 41) - 20) / 8;
+        ys[k] = number(int(k % 23) - 11) / 4;
+    }
+
+    Program<number> together(trees);
+    std::vector<std::vector<number>> outs(trees.size(), std::vector<number>(rows));
+    std::vector<number*> out_pointers;
+    for (auto& out: outs)
+    {
+        out_pointers.push_back(out.data());
+    }
+
+    together.results({ random.x, random.y }, { xs.data(), ys.data() }, out_pointers, rows);
+
+    for (size_t i = 0; i < trees.size(); i++)
+    {
+        std::vector<number> out(rows);
+        Program<number>(trees[i]).results({ random.x, random.y }, { xs.data(), ys.data() }, out.data(), rows);
+
+        for (size_t k = 0; k < rows; k++)
+        {
+            random.x->set(xs[k]);
+            random.y->set(ys[k]);
+
+            CHECK(same(out[k], trees[i]->result()));
+            CHECK(same(outs[i][k], trees[i]->result()));
+        }
+    }
+
+    return test_result();
+}
@@ -0,0 +1,9 @@
+#!/bin/sh
+# Feeds <test>.in to algeblah, and compares what it prints with <test>.out
+#
+# Usage: cli.sh <path to algeblah> <path to test, without extension>
+
+ALGEBLAH=$1
+TEST=$2
+
+"$ALGEBLAH" -q < "$TEST.in" 2>&1 | diff -u "$TEST.out" -
@@ -0,0 +1,63 @@
+/* Creates and destroys operations that share an operand from several threads at once, and checks
+ * that the operand still knows all of its parents afterwards, so they're invalidated when it
+ * changes */
+
+#include "test.h"
+
+#include "../mathop/algeblah.h"
+
+#include <thread>
+#include <vector>
+
+using namespace MathOps;
+
+int main()
+{
+    const size_t threads = 4;
+    const size_t kept_per_thread = 100;
+    const size_t rounds = 20000;
+
+    auto x = Variable<number>::create("x", 1);
+    std::vector<std::vector<std::shared_ptr<MathOp<number>>>> kept(threads);
+
+    {
+        MathOp<number>::Concurrent concurrent;
+
+        std::vector<std::thread> workers;
+        for (size_t t = 0; t < threads; t++)
+        {
+            workers.emplace_back([&, t]
+            {
+                auto one = ConstantValue<number>::create(1);
+                for (size_t i = 0; i < rounds; i++)
+                {
+                    /* Parents of x come and go, moving the slots of the ones that stay */
+                    auto temporary = x * x + x;
+                    if (i % (rounds / kept_per_thread) == 0)
+                    {
+                        kept[t].push_back(x + one);
+                    }
+
+                    CHECK(temporary->result() == 2);
+                }
+            });
+        }
+
+        for (auto& worker: workers)
+        {
+            worker.join();
+        }
+    }
+
+    x->set(2);
+    for (auto& ops: kept)
+    {
+        CHECK(ops.size() == kept_per_thread);
+        for (auto& op: ops)
+        {
+            CHECK(op->result() == 3);
+        }
+    }
+
+    return test_result();
+}
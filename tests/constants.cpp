@@ -0,0 +1,49 @@
+/* Checks that constants are told apart by sign as well as value, that NaN is found again, and
+ * that constant symbols are told apart by value as well as name */
+
+#include "test.h"
+
+#include "../mathop/algeblah.h"
+#include "../mathop/constants.h"
+#include "../mathop/interner.h"
+#include "../mathop/program.h"
+
+#include <cmath>
+#include <limits>
+
+using namespace MathOps;
+
+typedef std::shared_ptr<MathOp<number>> Op;
+
+static Op constant(number value) { return ConstantValue<number>::create(value); }
+
+int main()
+{
+    const number nan = std::numeric_limits<number>::quiet_NaN();
+
+    Interner<number> interner;
+    CHECK(interner.intern(constant(0)) == interner.intern(constant(0)));
+    CHECK(interner.intern(constant(0)) != interner.intern(constant(-number(0))));
+    CHECK(interner.intern(constant(nan)) == interner.intern(constant(-nan)));
+    CHECK(interner.size() == 3);
+
+    /* %pi made at a lower precision (as it would be before the precision is raised) is another
+     * constant */
+    Op pi = Constants::pi<number>();
+    Op low_pi = ConstantSymbol<number>::create("%pi", number((float) pi->result()));
+    CHECK(interner.intern(pi) == interner.intern(Constants::pi<number>()));
+    CHECK(interner.intern(low_pi) != interner.intern(pi));
+    CHECK(interner.intern(low_pi)->result() == low_pi->result());
+
+    /* 1 / -0 is -inf, so -0 can't share the register of the 0 before it */
+    Op zeros = constant(0) + constant(1) / constant(-number(0));
+    CHECK(Program<number>(zeros).result() == -INFINITY);
+    CHECK(zeros->result() == -INFINITY);
+
+    /* Both NaNs share one register */
+    Op nans = constant(nan) + constant(nan);
+    number result = Program<number>(nans).result();
+    CHECK(result != result);
+
+    return test_result();
+}
@@ -0,0 +1,58 @@
+/* Checks that programs compute structurally identical subtrees once, whether they're separate
+ * copies or shared, within one tree or across trees, and that the interner lets go of nodes
+ * nothing else uses */
+
+#include "test.h"
+
+#include "../mathop/algeblah.h"
+#include "../mathop/interner.h"
+#include "../mathop/program.h"
+
+using namespace MathOps;
+
+typedef std::shared_ptr<MathOp<number>> Op;
+
+int main()
+{
+    Op x = Variable<number>::create("x", 0.5);
+    Op y = Variable<number>::create("y", 2);
+    auto three = [] { return ConstantValue<number>::create(3); };
+
+    /* A new copy every time */
+    auto copy = [&]() -> Op { return sin(x) * log(y + three()) - cos(x); };
+
+    Program<number> copies(std::vector<Op> { copy() + copy() + copy(), copy() * copy() });
+
+    Op shared = copy();
+    Program<number> sharing(std::vector<Op> { shared + shared + shared, shared * shared });
+
+    /* sin, +, log, *, cos and - once, then two additions and a multiplication */
+    CHECK(copies.get_code().size() == 9);
+    CHECK(sharing.get_code().size() == 9);
+    CHECK(copies.result(0) == 3 * shared->result());
+    CHECK(copies.result(1) == shared->result() * shared->result());
+
+    /* Operands of commutative operations are ordered */
+    Program<number> commuted(x * y - y * x + (x + y) / (y + x));
+    CHECK(commuted.get_code().size() == 5);
+    CHECK(commuted.result() == 1);
+
+    /* ...but those of other operations aren't */
+    CHECK(Program<number>(x / y - y / x).get_code().size() == 3);
+
+    Interner<number> interner;
+    {
+        Op kept = interner.intern(copy());
+        interner.intern(copy() + x * y);
+
+        size_t all = interner.size();
+        interner.collect();
+        CHECK(interner.size() < all);
+        CHECK(interner.intern(copy()) == kept);
+    }
+
+    interner.collect();
+    CHECK(interner.size() == 0);
+
+    return test_result();
+}
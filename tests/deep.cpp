@@ -0,0 +1,86 @@
+/* Evaluates, counts, transforms, formats, compiles and destroys a chain of additions, and formats
+ * a chain of sines, that are far deeper than the stack would allow if any of them walked the tree
+ * recursively */
+
+#include "test.h"
+
+#include "../mathop/algeblah.h"
+#include "../mathop/constantfoldtransformer.h"
+#include "../mathop/dummytransformer.h"
+#include "../mathop/finder.h"
+#include "../mathop/namedvaluecounter.h"
+#include "../mathop/defaultformatter.h"
+#include "../mathop/texformatter.h"
+#include "../mathop/program.h"
+
+using namespace MathOps;
+
+int main()
+{
+    const size_t n = 1000000;
+
+    auto a = Variable<number>::create("a", 1);
+    std::shared_ptr<MathOp<number>> chain = a;
+    for (size_t i = 1; i < n; i++)
+    {
+        chain = chain + a;
+    }
+
+    CHECK(chain->result() == n);
+    CHECK(chain->count(Finder<number>(a)) == (int) n);
+    CHECK(chain->count(NamedValueCounter<number>("a")) == (int) n);
+
+    /* Nothing changes, so the whole tree is reused */
+    CHECK(chain->transform(DummyTransformer<number>()) == chain);
+    CHECK(chain->transform(ConstantFoldTransformer<number>()) == chain);
+
+    /* Every addition folds into one constant */
+    std::shared_ptr<MathOp<number>> constants = ConstantValue<number>::create(1);
+    for (size_t i = 1; i < n; i++)
+    {
+        constants = constants + ConstantValue<number>::create(1);
+    }
+
+    auto folded = constants->transform(ConstantFoldTransformer<number>());
+    CHECK(dynamic_cast<ConstantValue<number>*>(folded.get()) != nullptr);
+    CHECK(folded->result() == n);
+
+    std::string formatted = chain->format(DefaultFormatter<number>(5));
+    CHECK(formatted.size() == n * 4 - 3);
+    CHECK(formatted.compare(0, 9, "a + a + a") == 0);
+
+    auto negated = -(a - chain);
+    CHECK(negated->format(DefaultFormatter<number>(5)).compare(0, 12, "-(a - (a + a") == 0);
+
+    CHECK(chain->format(TexFormatter<number>(5)) == formatted);
+
+    std::shared_ptr<MathOp<number>> nested = a;
+    for (size_t i = 1; i < n; i++)
+    {
+        nested = sin(nested) * a;
+    }
+
+    std::string tex = nested->format(TexFormatter<number>(5));
+    CHECK(tex.compare(0, 12, "sin(sin(sin(") == 0);
+    CHECK(tex.compare(tex.size() - 8, 8, " \\cdot a") == 0);
+
+    Program<number> program(chain);
+    CHECK(program.result() == n);
+
+    a->set(2);
+    CHECK(program.result() == 2 * n);
+    CHECK(chain->result() == 2 * n);
+
+    /* Destroying the chain releases every reference to a, without recursing */
+    auto uses = a.use_count();
+    {
+        std::shared_ptr<MathOp<number>> other = a;
+        for (size_t i = 1; i < n; i++)
+        {
+            other = other * a;
+        }
+    }
+    CHECK(a.use_count() == uses);
+
+    return test_result();
+}
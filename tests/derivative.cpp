@@ -0,0 +1,108 @@
+/* Checks the derivatives of random trees against central differences, wherever the differences
+ * settle on a value as their step is made smaller, and that Newton's method doesn't make up a
+ * root where there is none */
+
+#include "test.h"
+#include "randomtree.h"
+
+#include "../mathop/derivativetransformer.h"
+#include "../mathop/newtonsolver.h"
+
+#include <limits>
+
+using namespace MathOps;
+
+typedef std::shared_ptr<MathOp<number>> Op;
+
+/* (f(x + h) - f(x - h)) / 2h, leaving x as it was */
+static number difference(const Op& f, const std::shared_ptr<Variable<number>>& x, number h)
+{
+    number x0 = x->result();
+
+    x->set(x0 + h);
+    number above = f->result();
+    x->set(x0 - h);
+    number below = f->result();
+    x->set(x0);
+
+    return (above - below) / (2 * h);
+}
+
+static bool finite(number x) { return x == x && x - x == 0; }
+
+static bool near(number a, number b, number tolerance) { return MathOps::abs(a - b) <= tolerance * std::max(number(1), MathOps::abs(a)); }
+
+/* Whether the derivative of f agrees with its central differences at the current values. Returns
+ * false only where the differences settle, and the derivative is elsewhere. */
+static bool agrees(const Op& f, const Op& df, const std::shared_ptr<Variable<number>>& x, size_t& compared)
+{
+    number h = sqrt(std::numeric_limits<number>::epsilon()) * std::max(number(1), MathOps::abs(x->result()));
+    number coarse = difference(f, x, h);
+    number fine = difference(f, x, h / 2);
+
+    if (!finite(f->result()) || !finite(coarse) || !finite(fine) || !near(coarse, fine, number(1e-5)))
+    {
+        return true;
+    }
+
+    compared++;
+
+    return near(df->result(), fine, number(1e-4));
+}
+
+int main()
+{
+    RandomTree<number> random(7);
+    size_t compared = 0;
+
+    for (auto& tree: random.trees(2000))
+    {
+        /* A tree can be finite, and even constant, where its derivative is NaN, e.g. a ^ (x / x)
+         * for a < 0, as that is taken from log(a). Such derivatives are left out. */
+        auto df = tree->transform(DerivativeTransformer<number>(random.x));
+        random.for_values(5, [&] { CHECK(df->result() != df->result() || agrees(tree, df, random.x, compared)); });
+    }
+
+    /* Enough of the trees are smooth where they're compared */
+    CHECK(compared > 1000);
+
+    Op x = random.x;
+    Op y = random.y;
+    Op three = ConstantValue<number>::create(3);
+    typedef MathNaryOp<number>::Term Term;
+
+    std::vector<Op> trees = {
+        /* Exponents and bases that don't depend on x */
+        pow(x, three), pow(three, x), pow(x, x), pow(y, three) * x, pow(sin(x), y),
+        /* Inverted terms and factors, and factors whose derivative is one */
+        create_nary_op<number>(OpKind::Sum, { Term { sin(x), true }, Term { x * y, false }, Term { y, true } }),
+        create_nary_op<number>(OpKind::Product, { Term { x, false }, Term { cos(x) + three, true } }),
+        create_nary_op<number>(OpKind::Product, { Term { x + three, true }, Term { y, false } }),
+        create_nary_op<number>(OpKind::Product, { Term { x, true }, Term { x, true }, Term { sin(x), false } }),
+    };
+
+    for (auto& tree: trees)
+    {
+        size_t before = compared;
+        auto df = tree->transform(DerivativeTransformer<number>(x));
+        random.for_values(20, [&] { CHECK(agrees(tree, df, random.x, compared)); });
+        CHECK(compared > before);
+    }
+
+    /* Terms that don't depend on x are left out */
+    CHECK(pow(y, three)->transform(DerivativeTransformer<number>(x))->result() == 0);
+
+    /* x * x + 1 has no root, and x is left as it was */
+    random.x->set(5);
+    NewtonSolver<number> no_root(x * x + ConstantValue<number>::create(1), random.x);
+    CHECK(no_root.solve(number(1)) != no_root.solve(number(1)));
+    CHECK(no_root.solve(std::vector<number> { -2, 0.5, 3 }).empty());
+    CHECK(x->result() == 5);
+
+    NewtonSolver<number> root(x * x - ConstantValue<number>::create(2), random.x);
+    CHECK(close(root.solve(number(1)), sqrt(number(2))));
+    CHECK(root.solve(std::vector<number> { -3, 1, 2 }).size() == 2);
+    CHECK(x->result() == 5);
+
+    return test_result();
+}
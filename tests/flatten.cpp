@@ -0,0 +1,87 @@
+/* Checks that flattened random trees evaluate like the originals: exactly where there's no sum,
+ * as products keep the order of their factors, and up to rounding where there is one, as sums
+ * are compensated (unless the tree is so ill-conditioned that rounding is all it shows) */
+
+#include "test.h"
+#include "randomtree.h"
+
+#include "../mathop/counter.h"
+#include "../mathop/flattentransformer.h"
+
+#include <limits>
+#include <vector>
+
+using namespace MathOps;
+
+/* Counts the additions, subtractions and sums in a tree */
+template<typename T>
+struct SumCounter : public Counter<T, MathOp<T>>
+{
+    int visit(std::shared_ptr<Add<T>> op) override { return 1 + Counter<T, MathOp<T>>::visit(op); }
+    int visit(std::shared_ptr<Sub<T>> op) override { return 1 + Counter<T, MathOp<T>>::visit(op); }
+    int visit(std::shared_ptr<Sum<T>> op) override { return 1 + Counter<T, MathOp<T>>::visit(op); }
+};
+
+/* Whether moving x, y and z by a few units in the last place moves the tree by more than rounding,
+ * as in sin(x / sin(pi)). The rounding of a compensated sum in such a tree moves it as much. */
+static bool ill_conditioned(RandomTree<number>& random, const std::shared_ptr<MathOp<number>>& tree)
+{
+    number before = tree->result();
+
+    number scale = 1 + 16 * std::numeric_limits<number>::epsilon();
+    for (auto& value: { random.x, random.y, random.z })
+    {
+        value->set(value->result() * scale);
+    }
+
+    return !close(tree->result(), before);
+}
+
+int main()
+{
+    RandomTree<number> random(6);
+
+    for (auto& tree: random.trees(2000))
+    {
+        auto flat = FlattenTransformer<number>().flatten(tree);
+        bool exact = tree->count(SumCounter<number>()) == 0;
+
+        random.for_values(3, [&]
+        {
+            CHECK(exact ? same(flat->result(), tree->result())
+                        : close(flat->result(), tree->result()) || ill_conditioned(random, tree));
+        });
+    }
+
+    /* A long chain becomes a single sum */
+    std::shared_ptr<MathOp<number>> chain = random.x;
+    for (int i = 0; i < 1000; i++)
+    {
+        chain = i % 2 ? chain + random.y : chain - random.z;
+    }
+
+    auto flat = FlattenTransformer<number>().flatten(chain);
+    CHECK(dynamic_cast<Sum<number>*>(flat.get()) != nullptr);
+    CHECK(flat->arity() == 1001);
+
+    /* A subsum on the right hand side is added on its own, so it overflows (or doesn't) and turns
+     * into NaN (or doesn't) just like it would in the original tree */
+    auto a = Variable<number>::create("a", 0);
+    auto b = Variable<number>::create("b", 0);
+    auto c = Variable<number>::create("c", 0);
+    std::shared_ptr<MathOp<number>> nested = a + (b + c) - (b - c);
+    auto flat_nested = FlattenTransformer<number>().flatten(nested);
+    CHECK(flat_nested->arity() == 3);
+
+    number max = std::numeric_limits<number>::max();
+    number inf = std::numeric_limits<number>::infinity();
+    for (auto& values: { std::vector<number> { max, max, -max }, std::vector<number> { inf, -max, -max } })
+    {
+        a->set(values[0]);
+        b->set(values[1]);
+        c->set(values[2]);
+        CHECK(same(flat_nested->result(), nested->result()));
+    }
+
+    return test_result();
+}
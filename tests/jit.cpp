@@ -0,0 +1,179 @@
+/* Checks that the native code cache only loads objects that were built from the same source by
+ * the same compiler, and only from a private directory of our own */
+
+#include "test.h"
+
+#include "../mathop/algeblah.h"
+#include "../mathop/jit.h"
+
+#include <cstdio>
+#include <string>
+#include <vector>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+using namespace MathOps;
+
+typedef double D;
+
+/* The objects in dir */
+static std::vector<std::string> objects_in(const std::string& dir)
+{
+    std::vector<std::string> objects;
+
+    DIR* d = opendir(dir.c_str());
+    while (dirent* entry = d ? readdir(d) : nullptr)
+    {
+        std::string name = entry->d_name;
+        if (name.size() > 3 && name.compare(name.size() - 3, 3, ".so") == 0)
+        {
+            objects.push_back(dir + "/" + name);
+        }
+    }
+
+    if (d)
+    {
+        closedir(d);
+    }
+
+    return objects;
+}
+
+static std::string key_of(const std::string& object)
+{
+    return object.substr(0, object.size() - 3) + ".key";
+}
+
+static void clear(const std::string& dir)
+{
+    DIR* d = opendir(dir.c_str());
+    while (dirent* entry = d ? readdir(d) : nullptr)
+    {
+        std::string name = entry->d_name;
+        if (name != "." && name != "..")
+        {
+            remove((dir + "/" + name).c_str());
+        }
+    }
+
+    if (d)
+    {
+        closedir(d);
+    }
+
+    rmdir(dir.c_str());
+}
+
+int main()
+{
+    char root_template[] = "/tmp/algeblah-test-XXXXXX";
+    std::string root = mkdtemp(root_template);
+    std::string cache = root + "/algeblah";
+    setenv("XDG_CACHE_HOME", root.c_str(), 1);
+
+    auto x = Variable<D>::create("x", 3);
+    std::shared_ptr<MathOp<D>> square = x * x;
+    std::shared_ptr<MathOp<D>> cube = x * x * x;
+
+    /* Without a compiler nothing can be checked */
+    Jit<D> first(square);
+    if (!first.is_compiled())
+    {
+        std::cerr << "no C compiler, skipping\n";
+        clear(cache);
+        rmdir(root.c_str());
+        return test_result();
+    }
+
+    CHECK(first.result() == 9);
+
+    struct stat status;
+    CHECK(stat(cache.c_str(), &status) == 0 && (status.st_mode & 0777) == 0700);
+
+    /* A cached object is loaded again */
+    CHECK(objects_in(cache).size() == 1);
+    CHECK(Jit<D>(square).result() == 9);
+
+    /* A key without its object, as left by a build that was cut short, gets its object rebuilt.
+     * (Not square's object, which dlopen() would hand back by name while first has it loaded.) */
+    std::string first_object = objects_in(cache).at(0);
+    std::shared_ptr<MathOp<D>> doubled = x + x;
+    CHECK(Jit<D>(doubled).result() == 6);
+    for (auto& object: objects_in(cache))
+    {
+        if (object != first_object)
+        {
+            CHECK(remove(object.c_str()) == 0);
+        }
+    }
+
+    Jit<D> unfinished(doubled);
+    CHECK(unfinished.is_compiled());
+    CHECK(unfinished.result() == 6);
+    CHECK(objects_in(cache).size() == 2);
+
+    /* Shared subtrees are computed once, into temporaries, so t = t * t + t, 22 times over, makes
+     * a short source rather than one that's millions of terms long */
+    auto y = Variable<D>::create("y", -0.5);
+    std::shared_ptr<MathOp<D>> t = y;
+    for (int i = 0; i < 22; i++)
+    {
+        t = t * t + t;
+    }
+
+    Jit<D> shared(t);
+    CHECK(shared.is_compiled());
+    CHECK(shared.result() == t->result());
+
+    /* An object whose key is for another source (as if the two hashed the same) isn't loaded, and
+     * the source gets a slot of its own */
+    std::string cube_object = root + "/cube.so";
+    std::string cube_key = root + "/cube.key";
+    clear(cache);
+    CHECK(Jit<D>(cube).result() == 27);
+    CHECK(objects_in(cache).size() == 1);
+    CHECK(rename(key_of(objects_in(cache)[0]).c_str(), cube_key.c_str()) == 0);
+    CHECK(rename(objects_in(cache)[0].c_str(), cube_object.c_str()) == 0);
+
+    clear(cache);
+    CHECK(Jit<D>(square).result() == 9);
+    std::string square_object = objects_in(cache).at(0);
+    CHECK(rename(cube_object.c_str(), square_object.c_str()) == 0);
+    CHECK(rename(cube_key.c_str(), key_of(square_object).c_str()) == 0);
+
+    Jit<D> rebuilt(square);
+    CHECK(rebuilt.is_compiled());
+    CHECK(rebuilt.result() == 9);
+    CHECK(objects_in(cache).size() == 2);
+    CHECK(Jit<D>(cube).result() == 27);
+
+    /* The compiler is part of the key, so another compiler gets an object of its own */
+    setenv("CC", "cc -DALGEBLAH_TEST", 1);
+    Jit<D> other_compiler(square);
+    CHECK(other_compiler.result() == 9);
+    CHECK(objects_in(cache).size() == 4);
+    unsetenv("CC");
+
+    /* A directory that's open to others is made private */
+    CHECK(chmod(cache.c_str(), 0777) == 0);
+    CHECK(Jit<D>(square).is_compiled());
+    CHECK(stat(cache.c_str(), &status) == 0 && (status.st_mode & 0777) == 0700);
+
+    /* A link to somewhere else isn't followed */
+    clear(cache);
+    std::string elsewhere = root + "/elsewhere";
+    CHECK(mkdir(elsewhere.c_str(), 0700) == 0);
+    CHECK(symlink(elsewhere.c_str(), cache.c_str()) == 0);
+
+    Jit<D> linked(square);
+    CHECK(!linked.is_compiled());
+    CHECK(linked.result() == 9);
+    CHECK(objects_in(elsewhere).empty());
+
+    remove(cache.c_str());
+    clear(elsewhere);
+    rmdir(root.c_str());
+
+    return test_result();
+}
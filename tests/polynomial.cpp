@@ -0,0 +1,68 @@
+/* Checks that in strict mode, random trees with their polynomials in Horner form evaluate like the
+ * originals up to rounding, even where a term overflows, and that polynomials in atoms that can be
+ * infinite are left alone */
+
+#include "test.h"
+#include "randomtree.h"
+
+#include "../mathop/defaultformatter.h"
+#include "../mathop/polynomialtransformer.h"
+
+#include <limits>
+
+using namespace MathOps;
+
+typedef std::shared_ptr<MathOp<number>> Op;
+
+static std::string canonical(Op op, bool strict = true)
+{
+    return PolynomialTransformer<number>(strict).canonicalize(op)->format(DefaultFormatter<number>(5));
+}
+
+int main()
+{
+    RandomTree<number> random(9);
+    size_t changed = 0;
+
+    const number huge = std::numeric_limits<number>::max() / 4;
+    const number inf = std::numeric_limits<number>::infinity();
+
+    for (auto& tree: random.trees(2000))
+    {
+        auto strict = PolynomialTransformer<number>().canonicalize(tree);
+        changed += strict != tree;
+
+        random.for_values(5, [&] { CHECK(close(strict->result(), tree->result())); });
+
+        for (number value: { huge, -huge, inf, -inf })
+        {
+            random.x->set(value);
+            CHECK(close(strict->result(), tree->result()));
+        }
+    }
+
+    /* Enough of the trees have a polynomial in bounded atoms */
+    CHECK(changed > 100);
+
+    Op x = random.x;
+    Op s = sin(x);
+    Op two = ConstantValue<number>::create(2);
+    Op three = ConstantValue<number>::create(3);
+
+    /* x * x overflows for a large x, where the Horner form doesn't */
+    CHECK(canonical(x * x - x * x + x) == "x * x - x * x + x");
+    CHECK(canonical(x * x - x * x + x, false) == "x");
+    CHECK(canonical(three * x * x + two * x * x * x + x + two) == "3 * x * x + 2 * x * x * x + x + 2");
+
+    /* ...but sin(x) doesn't, even where x is infinite */
+    CHECK(canonical(s * s - s * s + s) == "sin(x)");
+    CHECK(canonical(three * s * s + two * s * s * s + s + two) == "((2 * sin(x) + 3) * sin(x) + 1) * sin(x) + 2");
+
+    /* log(x) is infinite at 0 */
+    Op l = log(x);
+    CHECK(canonical(l * l - l * l + l) == "log(x) * log(x) - log(x) * log(x) + log(x)");
+    random.x->set(0);
+    CHECK(MathOps::isnan((l * l - l * l + l)->result()));
+
+    return test_result();
+}
@@ -0,0 +1,63 @@
+/* Checks that compiled programs evaluate random trees exactly like the trees themselves, whether
+ * all of their values change or only some of them, and whether their results are read through
+ * result() or through output() after evaluate() */
+
+#include "test.h"
+#include "randomtree.h"
+
+#include "../mathop/program.h"
+
+#include <limits>
+
+using namespace MathOps;
+
+typedef std::shared_ptr<MathOp<number>> Op;
+
+int main()
+{
+    RandomTree<number> random(3);
+
+    std::vector<Op> trees = random.trees(300);
+    std::vector<Program<number>> programs(trees.begin(), trees.end());
+
+    /* One program for every tree, and one for all of them together */
+    Program<number> together(trees);
+
+    auto agrees = [&]
+    {
+        together.evaluate();
+        for (size_t i = 0; i < trees.size(); i++)
+        {
+            CHECK(same(together.output(i), trees[i]->result()));
+        }
+
+        for (size_t i = 0; i < trees.size(); i++)
+        {
+            CHECK(same(programs[i].result(), trees[i]->result()));
+            CHECK(same(together.result(i), trees[i]->result()));
+        }
+    };
+
+    random.for_values(3, agrees);
+
+    /* Instructions that don't depend on the value that changed are skipped, and keep their
+     * results, including past a NaN, and from 0 to -0 */
+    number nan = std::numeric_limits<number>::quiet_NaN();
+    for (number value: { number(1.5), number(-2), nan, number(0.25), number(0), number(-0.0), number(3) })
+    {
+        for (auto& variable: { random.x, random.y, random.z })
+        {
+            variable->set(value);
+            agrees();
+        }
+    }
+
+    /* Setting a value back and forth between evaluations */
+    random.x->set(1);
+    agrees();
+    random.x->set(2);
+    random.x->set(1);
+    agrees();
+
+    return test_result();
+}
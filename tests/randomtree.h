@@ -0,0 +1,137 @@
+#ifndef RANDOMTREE_H
+#define RANDOMTREE_H
+
+#include "../mathop/algeblah.h"
+
+#include <random>
+#include <vector>
+
+/* Builds random trees over the variables x, y and z, for checking one way of evaluating (or
+ * walking) a tree against another. Trees use every operation, constants that are often 0 or
+ * negative (so some results are NaN or infinite), named constants, containers, n-ary sums and
+ * products, and (unless share is false) subtrees that are shared. The same seed always gives the
+ * same trees. */
+template<typename T>
+struct RandomTree
+{
+    typedef std::shared_ptr<MathOps::MathOp<T>> Op;
+
+    RandomTree(unsigned seed = 1, bool share = true)
+        : x(MathOps::Variable<T>::create("x", 1)),
+          y(MathOps::Variable<T>::create("y", 2)),
+          z(MathOps::Variable<T>::create("z", 3)),
+          pi(MathOps::NamedConstant<T>::create("pi", MathOps::get_constant_pi<T>())),
+          random(seed), share(share)
+    { }
+
+    std::shared_ptr<MathOps::Variable<T>> x;
+    std::shared_ptr<MathOps::Variable<T>> y;
+    std::shared_ptr<MathOps::Variable<T>> z;
+    std::shared_ptr<MathOps::NamedConstant<T>> pi;
+
+    /* A tree that's at most depth operations deep */
+    Op operator()(int depth)
+    {
+        shared.clear();
+
+        return tree(depth);
+    }
+
+    /* n trees, with depths from 1 to 8 in turn */
+    std::vector<Op> trees(int n)
+    {
+        std::vector<Op> result;
+        for (int i = 0; i < n; i++)
+        {
+            result.push_back((*this)(1 + i % 8));
+        }
+
+        return result;
+    }
+
+    /* Gives x, y and z new values between -4 and 4 */
+    void set_values()
+    {
+        x->set(value());
+        y->set(value());
+        z->set(value());
+    }
+
+    /* Gives x, y and z new values n times over, and calls check() after each time */
+    template<typename F>
+    void for_values(int n, F check)
+    {
+        for (int i = 0; i < n; i++)
+        {
+            set_values();
+            check();
+        }
+    }
+
+private:
+    std::mt19937 random;
+    bool share;
+    std::vector<Op> shared;
+
+    int pick(int n) { return std::uniform_int_distribution<int>(0, n - 1)(random); }
+
+    T value() { return T(pick(161) - 80) / 20; }
+
+    Op tree(int depth)
+    {
+        if (share && !shared.empty() && pick(8) == 0)
+        {
+            return shared[pick(shared.size())];
+        }
+
+        Op op = depth <= 0 || pick(8) == 0 ? leaf() : operation(depth - 1);
+        shared.push_back(op);
+
+        return op;
+    }
+
+    Op leaf()
+    {
+        switch (pick(6))
+        {
+            case 0:  return x;
+            case 1:  return y;
+            case 2:  return z;
+            case 3:  return pi;
+            default: return MathOps::ConstantValue<T>::create(pick(4) == 0 ? T(0) : value());
+        }
+    }
+
+    Op operation(int depth)
+    {
+        using MathOps::OpKind;
+
+        int choice = pick(20);
+        if (choice == 0)
+        {
+            return MathOps::Container<T>::create(tree(depth), "f");
+        }
+
+        if (choice <= 2)
+        {
+            std::vector<typename MathOps::MathNaryOp<T>::Term> terms;
+            for (int i = 2 + pick(4); i > 0; i--)
+            {
+                terms.push_back({ tree(depth), pick(3) == 0 });
+            }
+
+            return MathOps::create_nary_op<T>(choice == 1 ? OpKind::Sum : OpKind::Product, std::move(terms));
+        }
+
+        if (choice <= 10)
+        {
+            OpKind kind = (OpKind) ((int) OpKind::Negate + pick((int) OpKind::ATanh - (int) OpKind::Negate + 1));
+            return MathOps::create_op<T>(kind, tree(depth));
+        }
+
+        OpKind kind = (OpKind) ((int) OpKind::Pow + pick((int) OpKind::Sub - (int) OpKind::Pow + 1));
+        return MathOps::create_op<T>(kind, tree(depth), tree(depth));
+    }
+};
+
+#endif /* RANDOMTREE_H */
@@ -0,0 +1,75 @@
+/* Checks that rearranging on a thread pool, forking every branch it can, finds the same solutions
+ * in the same order as rearranging on a single thread, and that waiting on a pool whose tasks are
+ * all taken by its workers returns */
+
+#include "test.h"
+
+#include "../mathop/algeblah.h"
+#include "../mathop/defaultformatter.h"
+#include "../mathop/rearrangemultitransformer.h"
+
+#include <chrono>
+#include <thread>
+
+using namespace MathOps;
+
+typedef std::shared_ptr<MathOp<number>> Op;
+
+static std::vector<std::string> formatted(const std::vector<Op>& solutions)
+{
+    std::vector<std::string> result;
+    for (auto& solution: solutions)
+    {
+        result.push_back(solution->format(DefaultFormatter<number>(5)));
+    }
+
+    return result;
+}
+
+int main()
+{
+    auto x = Variable<number>::create("x", 0.5);
+    auto c = [](number value) { return ConstantValue<number>::create(value); };
+
+    /* Every level doubles the number of branches */
+    Op equation = x;
+    for (int i = 0; i < 3; i++)
+    {
+        equation = sin(cos(equation * equation + c(i)) * c(3)) * c(5) - c(1) / (equation * equation + c(2));
+    }
+
+    auto from = c(0.25);
+    auto sequential = formatted(equation->multi_transform(RearrangeMultiTransformer<number>(x, from)));
+    CHECK(!sequential.empty());
+
+    for (unsigned workers: { 0, 1, 3 })
+    {
+        ThreadPool pool(workers);
+        for (int i = 0; i < 5; i++)
+        {
+            CHECK(formatted(equation->multi_transform(RearrangeMultiTransformer<number>(x, from, &pool, false, 1))) == sequential);
+        }
+    }
+
+    /* A pool whose tasks are all run by other threads, so waiting for them has to sleep */
+    ThreadPool pool(2);
+    std::vector<std::future<int>> futures;
+    for (int i = 0; i < 8; i++)
+    {
+        futures.push_back(pool.submit([i]
+        {
+            std::this_thread::sleep_for(std::chrono::milliseconds(5));
+            return i;
+        }));
+    }
+
+    int sum = 0;
+    for (auto& future: futures)
+    {
+        sum += pool.wait(future);
+    }
+
+    CHECK(sum == 28);
+
+    return test_result();
+}
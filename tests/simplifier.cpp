@@ -0,0 +1,120 @@
+/* Checks that simplified random trees are NaN where, and only where, the originals are, and equal
+ * to them up to rounding elsewhere, and that the simplifier doesn't remove an overflow or a
+ * saturation of the original tree */
+
+#include "test.h"
+#include "randomtree.h"
+
+#include "../mathop/algeblah.h"
+#include "../mathop/defaultformatter.h"
+#include "../mathop/simplifier.h"
+
+#include <limits>
+
+using namespace MathOps;
+
+typedef std::shared_ptr<MathOp<number>> Op;
+
+static std::string simplified(Op op) { return Simplifier<number>().simplify(op)->format(DefaultFormatter<number>(5)); }
+
+int main()
+{
+    RandomTree<number> random(5);
+    size_t changed = 0;
+
+    for (auto& tree: random.trees(2000))
+    {
+        Simplifier<number> simplifier;
+        auto simple = simplifier.simplify(tree);
+        changed += simplifier.rewrites() != 0;
+
+        random.for_values(5, [&] { CHECK(close(simple->result(), tree->result())); });
+    }
+
+    /* Enough of the trees have something to simplify */
+    CHECK(changed > 100);
+
+    Op x = Variable<number>::create("x", 1);
+    Op s = sin(x);
+    Op three = ConstantValue<number>::create(3);
+    Op half = ConstantValue<number>::create(0.5);
+
+    /* Only where tanh() can't round to +-1, sinh() can't overflow, and atan() isn't too close to
+     * +-pi / 2 */
+    CHECK(simplified(atanh(tanh(x))) == "atanh(tanh(x))");
+    CHECK(simplified(atanh(tanh(s))) == "sin(x)");
+    CHECK(simplified(asinh(sinh(x))) == "asinh(sinh(x))");
+    CHECK(simplified(asinh(sinh(s * three))) == "sin(x) * 3");
+    CHECK(simplified(tan(atan(x))) == "tan(atan(x))");
+    CHECK(simplified(tan(atan(s))) == "sin(x)");
+
+    /* Only where the product or quotient can't overflow */
+    CHECK(simplified(x * three / three) == "x * 3 / 3");
+    CHECK(simplified(s * three / three) == "sin(x)");
+    CHECK(simplified(x * half / half) == "x");
+    CHECK(simplified(x / three * three) == "x");
+    CHECK(simplified(x / half * half) == "x / 0.5 * 0.5");
+    CHECK(simplified(three * (s / three)) == "sin(x)");
+
+    /* Only where the inverse function can't overflow on the way back */
+    Op largest = ConstantValue<number>::create(std::numeric_limits<number>::max());
+    Op ten = ConstantValue<number>::create(10);
+    for (auto& op: { pow(Constants::e<number>(), log(largest)), pow(ten, log10(largest)), sinh(asinh(largest)),
+                     cosh(acosh(largest)) })
+    {
+        CHECK(same(Simplifier<number>().simplify(op)->result(), op->result()));
+    }
+    CHECK(simplified(pow(ten, log10(three))) == "3");
+    CHECK(simplified(sinh(asinh(s))) == "sin(x)");
+
+    /* Only where what's cancelled out can't be NaN */
+    Op two = ConstantValue<number>::create(2);
+    Op as = asin(x);
+    Op ac = acos(x) + two;
+    Op at = atan(x) + two;
+    CHECK(simplified(as - as) == "asin(x) - asin(x)");
+    CHECK(simplified(ac / ac) == "(acos(x) + 2) / (acos(x) + 2)");
+    CHECK(simplified(three / ac * ac) == "3 / (acos(x) + 2) * (acos(x) + 2)");
+    CHECK(simplified(ac * (three / ac)) == "(acos(x) + 2) * 3 / (acos(x) + 2)");
+    CHECK(simplified(three * ac / ac) == "3 * (acos(x) + 2) / (acos(x) + 2)");
+    CHECK(simplified(ac * three / ac) == "(acos(x) + 2) * 3 / (acos(x) + 2)");
+    CHECK(simplified(s - s) == "sin(x) - sin(x)");
+    CHECK(simplified(at - at) == "0");
+    CHECK(simplified(at / at) == "1");
+    CHECK(simplified(three / at * at) == "3");
+    CHECK(simplified(at * three / at) == "3");
+
+    /* Both NaN at x = 2 */
+    std::static_pointer_cast<Variable<number>>(x)->set(2);
+    for (auto& op: { as - as, ac / ac, three / ac * ac, ac * three / ac })
+    {
+        CHECK(same(Simplifier<number>().simplify(op)->result(), op->result()));
+    }
+
+    /* Only where the inner power can't overflow or underflow, and the product of the exponents is
+     * finite and can't be NaN (sin(x) is NaN for an infinite x) */
+    auto e = Constants::e<number>();
+    CHECK(simplified(log(pow(e, x))) == "log(%e ^ x)");
+    CHECK(simplified(log(pow(e, s))) == "sin(x)");
+    CHECK(simplified(pow(pow(x, three), three)) == "(x ^ 3) ^ 3");
+    CHECK(simplified(pow(pow(three, atan(x)), at)) == "3 ^ (atan(x) * (atan(x) + 2))");
+    CHECK(simplified(pow(pow(three, s), at)) == "(3 ^ sin(x)) ^ (atan(x) + 2)");
+    CHECK(simplified(pow(pow(three, s), x)) == "(3 ^ sin(x)) ^ x");
+
+    /* (e ^ 0) ^ inf is 1, but e ^ (0 * inf) is NaN */
+    Op y = Variable<number>::create("y", std::numeric_limits<number>::infinity());
+    auto pi = Constants::pi<number>();
+    Op zero_power = pow(pow(e, pi - pi), y);
+    CHECK(zero_power->result() == 1);
+    CHECK(same(Simplifier<number>().simplify(zero_power)->result(), zero_power->result()));
+
+    /* -(x - z) is -0 at x = z = 2, where z - x is 0, so 1 / -(x - z) is -inf rather than inf */
+    Op z = Variable<number>::create("z", 2);
+    Op five = ConstantValue<number>::create(5);
+    Op inverse = ConstantValue<number>::create(1) / -(x - z);
+    CHECK(simplified(inverse) == "1 / (-(x - z))");
+    CHECK(same(Simplifier<number>().simplify(inverse)->result(), inverse->result()));
+    CHECK(simplified(-(at - five)) == "5 - (atan(x) + 2)");
+
+    return test_result();
+}
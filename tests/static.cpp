@@ -0,0 +1,56 @@
+/* Checks that expression templates evaluate like the MathOp trees they convert to, and that the
+ * arithmetic ones are evaluated at compile time */
+
+#include "test.h"
+
+#include "../mathop/algeblah.h"
+#include "../mathop/defaultformatter.h"
+#include "../mathop/staticop.h"
+
+using namespace MathOps;
+
+typedef std::shared_ptr<MathOp<number>> Op;
+
+constexpr auto x = static_arg<0>;
+constexpr auto y = static_arg<1>;
+
+constexpr auto polynomial = x * x + 2 * y - x / 4 - -y;
+static_assert(polynomial(3.0, 4.0) == 20.25, "constexpr evaluation");
+static_assert(decltype(polynomial)::arity == 2, "arity");
+static_assert((x / y)(3, 4) == 0.75, "integer arguments are evaluated as double");
+
+/* Evaluates e and the tree it converts to over a grid of values, which include points where
+ * some of the functions aren't defined */
+template<typename E>
+static void check_equivalent(const StaticOp<E>& e, const std::string& formatted)
+{
+    auto a = Variable<number>::create("a");
+    auto b = Variable<number>::create("b");
+    Op tree = to_math_op<number>(e, { a, b });
+
+    CHECK(tree->format(DefaultFormatter<number>(5)) == formatted);
+
+    for (int i = -8; i <= 8; i++)
+    {
+        for (int j = -8; j <= 8; j++)
+        {
+            a->set(number(i) / 4);
+            b->set(number(j) / 3);
+            CHECK(same(e(number(i) / 4, number(j) / 3), tree->result()));
+        }
+    }
+}
+
+int main()
+{
+    CHECK(sqrt(x)(2) == std::sqrt(2.0));
+
+    check_equivalent(polynomial, "a * a + 2 * b - a / 4 - (-b)");
+    check_equivalent(pow(x, 2) + sin(y) * x / 3, "a ^ 2 + sin(b) * a / 3");
+    check_equivalent(sqrt(x) + log(y) - log10(x * y), "sqrt(a) + log(b) - log10(a * b)");
+    check_equivalent(asin(x) * acos(y) / atan(tan(x)) + cos(y), "asin(a) * acos(b) / atan(tan(a)) + cos(b)");
+    check_equivalent(sinh(x) - asinh(y) * cosh(x) + acosh(y) - tanh(x) / atanh(y),
+        "sinh(a) - asinh(b) * cosh(a) + acosh(b) - tanh(a) / atanh(b)");
+
+    return test_result();
+}
@@ -0,0 +1,111 @@
+/* Checks that every backend compensates sums like Sum::result() does, so 1 + 100000 * 1e-16 in
+ * double precision comes out as 1.00000000001 everywhere, rather than 1 */
+
+#include "test.h"
+
+#include "../mathop/algeblah.h"
+#include "../mathop/arena.h"
+#include "../mathop/defaultformatter.h"
+#include "../mathop/jit.h"
+#include "../mathop/program.h"
+#include "../mathop/variantop.h"
+
+#include <cmath>
+#include <cstdio>
+#include <string>
+#include <dirent.h>
+#include <unistd.h>
+
+using namespace MathOps;
+
+typedef double D;
+typedef std::vector<MathNaryOp<D>::Term> Terms;
+
+static bool close_to(D x, D expected) { return std::abs(x - expected) < 1e-15; }
+
+static void clear(const std::string& dir)
+{
+    DIR* d = opendir(dir.c_str());
+    while (dirent* entry = d ? readdir(d) : nullptr)
+    {
+        std::string name = entry->d_name;
+        if (name != "." && name != "..")
+        {
+            remove((dir + "/" + name).c_str());
+        }
+    }
+
+    if (d)
+    {
+        closedir(d);
+    }
+
+    rmdir(dir.c_str());
+}
+
+int main()
+{
+    /* The JIT compiles into a cache of our own rather than the user's */
+    char root_template[] = "/tmp/algeblah-test-XXXXXX";
+    std::string cache_root = mkdtemp(root_template);
+    setenv("XDG_CACHE_HOME", cache_root.c_str(), 1);
+
+    const D expected = 1.00000000001;
+
+    auto x = Variable<D>::create("x", 1e-16);
+    auto y = Variable<D>::create("y", 0);
+
+    Terms terms { { ConstantValue<D>::create(1), false } };
+    for (int i = 0; i < 100000; i++)
+    {
+        terms.push_back({ x, false });
+    }
+
+    /* An inverted term that cancels out */
+    terms.push_back({ y, true });
+    terms.push_back({ y, false });
+
+    std::shared_ptr<MathOp<D>> sum = Sum<D>::create(terms);
+    CHECK(close_to(sum->result(), expected));
+
+    Program<D> program(sum);
+    CHECK(close_to(program.result(), expected));
+
+    std::vector<D> xs { 1e-16, 2e-16, -1e-16 };
+    std::vector<D> ys { 1, 2, 3 };
+    std::vector<D> out(xs.size());
+    program.results({ x, y }, { xs.data(), ys.data() }, out.data(), xs.size());
+    CHECK(close_to(out[0], 1.00000000001));
+    CHECK(close_to(out[1], 1.00000000002));
+    CHECK(close_to(out[2], 0.99999999999));
+
+    Arena<D> arena;
+    uint32_t root = arena.add(sum);
+    CHECK(close_to(arena.result(root), expected));
+    CHECK(close_to(arena.to_math_op(root)->result(), expected));
+
+    auto variant = to_variant(sum);
+    CHECK(close_to(evaluate(*variant), expected));
+    CHECK(close_to(to_math_op(*variant)->result(), expected));
+    CHECK(find<D>(*variant, x) == 100000);
+
+    /* A shorter sum keeps the C compiler quick; 1 + 1000 * 1e-16 still rounds to 1 in a chain */
+    Terms jit_terms(terms.begin(), terms.begin() + 1001);
+    Jit<D> jit(Sum<D>::create(jit_terms));
+    CHECK(close_to(jit.result(), 1.0000000000001));
+
+    /* Sums are formatted the same by both formatters */
+    std::shared_ptr<MathOp<D>> small = Sum<D>::create(Terms { { x, true }, { x - y, true }, { y * x, false } });
+    CHECK(small->format(DefaultFormatter<D>(5)) == "-x - (x - y) + y * x");
+    CHECK(VariantFormatter<D>(5).format(*to_variant(small)) == small->format(DefaultFormatter<D>(5)));
+
+    /* The compensation is left out once the sum isn't finite */
+    std::shared_ptr<MathOp<D>> infinite = Sum<D>::create(Terms { { x, false }, { ConstantValue<D>::create(INFINITY), false } });
+    CHECK(Program<D>(infinite).result() == INFINITY);
+    CHECK(Jit<D>(infinite).result() == INFINITY);
+
+    clear(cache_root + "/algeblah");
+    rmdir(cache_root.c_str());
+
+    return test_result();
+}
@@ -0,0 +1,44 @@
+#ifndef TEST_H
+#define TEST_H
+
+#include "../config.h"
+#include "../defaulthelper.h"
+
+#include <algorithm>
+#include <iostream>
+#include <cstdlib>
+
+/* Tests report every failed check, and exit with a non-zero status if there were any */
+static int failures = 0;
+
+#define CHECK(condition) check((condition), #condition, __FILE__, __LINE__)
+
+static inline void check(bool passed, const char* condition, const char* file, int line)
+{
+    if (!passed)
+    {
+        std::cerr << file << ':' << line << ": check failed: " << condition << '\n';
+        failures++;
+    }
+}
+
+/* Equal, or both NaN */
+static inline bool same(number a, number b) { return a == b || (a != a && b != b); }
+
+/* Both NaN, the same infinity, or within rounding of each other */
+static inline bool close(number a, number b)
+{
+    if (a != a || b != b || a - a != 0 || b - b != 0)
+    {
+        return same(a, b);
+    }
+
+    return MathOps::abs(a - b) <= number(1e-9) * std::max(number(1), MathOps::abs(a));
+}
+
+static inline int test_result()
+{
+    return failures ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
+#endif /* TEST_H */
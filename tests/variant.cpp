@@ -0,0 +1,97 @@
+/* Checks the std::variant representation against the MathOp tree it was built from, on random
+ * trees, on a tree with many paths to each of its nodes, and on a chain that's far deeper than the
+ * stack would allow if it were walked recursively: every ported traversal has to give exactly
+ * what the original visitor gives */
+
+#include "test.h"
+#include "randomtree.h"
+
+#include "../mathop/defaultformatter.h"
+#include "../mathop/finder.h"
+#include "../mathop/namedvaluecounter.h"
+#include "../mathop/variantop.h"
+
+using namespace MathOps;
+
+int main()
+{
+    RandomTree<number> random;
+
+    for (auto& tree: random.trees(2000))
+    {
+        auto variant = to_variant(tree);
+
+        random.for_values(3, [&] { CHECK(same(evaluate(*variant), tree->result())); });
+
+        CHECK(same(to_math_op(*variant)->result(), tree->result()));
+
+        CHECK(VariantFormatter<number>(5).format(*variant) == tree->format(DefaultFormatter<number>(5)));
+
+        for (auto value: { std::shared_ptr<MathOp<number>>(random.x), std::shared_ptr<MathOp<number>>(random.pi) })
+        {
+            CHECK(find(*variant, value) == tree->count(Finder<number>(value)));
+        }
+
+        for (std::string name: { "", "y" })
+        {
+            std::vector<std::shared_ptr<Value<number>>> found;
+            named_values(*variant, name, found);
+
+            NamedValueCounter<number> counter(name);
+            tree->count(counter);
+            CHECK(found == counter.get_results());
+        }
+    }
+
+    /* x doubled 64 times over, with each sum using the one before it twice. That's 2^64 paths, so
+     * the shared sums can only be walked once. */
+    std::vector<std::shared_ptr<MathOp<number>>> doubled { random.x };
+    for (int i = 0; i < 64; i++)
+    {
+        doubled.push_back(doubled.back() + doubled.back());
+    }
+
+    random.x->set(3);
+    CHECK(same(evaluate(*to_variant(doubled[64])), doubled[64]->result()));
+
+    /* Few enough paths for the original visitors */
+    auto variant = to_variant(doubled[16]);
+    CHECK(find<number>(*variant, random.x) == 1 << 16);
+    CHECK(find<number>(*variant, random.x) == doubled[16]->count(Finder<number>(random.x)));
+
+    std::vector<std::shared_ptr<Value<number>>> found;
+    named_values(*variant, "", found);
+
+    NamedValueCounter<number> counter("");
+    doubled[16]->count(counter);
+    CHECK(found == counter.get_results());
+
+    /* The deep chain shares x and a subtree of its own, below the depth at which traversals
+     * switch to loops */
+    const size_t n = 200000;
+    std::shared_ptr<MathOp<number>> x = random.x;
+    auto shared = sin(x) + x;
+    auto chain = shared;
+    for (size_t i = 1; i < n; i++)
+    {
+        chain = i % 3 == 0 ? chain - shared : i % 3 == 1 ? sin(chain) * x : chain + x;
+    }
+
+    random.x->set(0.5);
+    {
+        auto deep = to_variant(chain);
+        CHECK(same(evaluate(*deep), chain->result()));
+        CHECK(same(to_math_op(*deep)->result(), chain->result()));
+        CHECK(VariantFormatter<number>(5).format(*deep) == chain->format(DefaultFormatter<number>(5)));
+        CHECK(find(*deep, x) == chain->count(Finder<number>(x)));
+
+        std::vector<std::shared_ptr<Value<number>>> deep_found;
+        named_values(*deep, "x", deep_found);
+
+        NamedValueCounter<number> deep_counter("x");
+        chain->count(deep_counter);
+        CHECK(deep_found == deep_counter.get_results());
+    }
+
+    return test_result();
+}
@@ -4,12 +4,9 @@
 #include "defaulthelper.h"
 #include "mathop/algeblah.h"
 #include "mathop/defaultformatter.h"
-#include "mathop/replacetransformer.h"
-#include "mathop/removenooptransformer.h"
+#include "mathop/substitutetransformer.h"
 #include "mathop/rearrangemultitransformer.h"
 
-#include <cassert>
-
 template <typename T>
 struct Fraction
 {
@@ -83,9 +80,17 @@ Fraction<T> solver(std::shared_ptr<MathOps::MathOp<T>> y, std::shared_ptr<MathOp
 {
     auto result = MathOps::ConstantValue<T>::create(value);
 
-    auto solved = y->multi_transform(MathOps::RearrangeMultiTransformer<T>(numerator, result));
-    assert(solved.size() == 1);
-    auto fraction = Fraction<T>::find(solved[0]->result(), max_error, iters);
+    /* Only the first solution is needed. There's none if it's out of domain (e.g. the square of
+     * a negative value). */
+    std::shared_ptr<MathOps::MathOp<T>> solved;
+    y->multi_transform(MathOps::RearrangeMultiTransformer<T>(numerator, result,
+        [&](auto& solution) { solved = solution; return false; }));
+    if (!solved)
+    {
+        return Fraction<T>::quiet_NaN();
+    }
+
+    auto fraction = Fraction<T>::find(solved->result(), max_error, iters);
 
     return fraction;
 }
@@ -118,9 +123,9 @@ std::shared_ptr<MathOps::MathOp<T>> find_fraction(std::vector<std::shared_ptr<Ma
         return nullptr;
     }
 
-    return best_y->transform(MathOps::ReplaceTransformer<T>(best_numerator, MathOps::ConstantValue<T>::create(best_fraction.numerator)))
-        ->transform(MathOps::ReplaceTransformer<T>(best_denominator, MathOps::ConstantValue<T>::create(best_fraction.denominator)))
-        ->transform(MathOps::MathOpRemoveNoOpTransformer<T>());
+    return best_y->transform(MathOps::SubstituteTransformer<T>({
+        { best_numerator, MathOps::ConstantValue<T>::create(best_fraction.numerator) },
+        { best_denominator, MathOps::ConstantValue<T>::create(best_fraction.denominator) } }, true));
 }
 
 template<typename T>